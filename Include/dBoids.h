@@ -0,0 +1,318 @@
+// dBoids.h - Headless 3D flocking simulation with uniform grid neighbor search
+
+#ifndef DBOIDS_HDR
+#define DBOIDS_HDR
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "VecMat.h"
+#include "dRandom.h"
+#include "dThreadPool.h"
+#include "dSimd.h"
+
+using std::vector;
+
+/* Flock steps boids in the [-1, 1] cube, which wraps on every axis:
+ - Boids steer by alignment and cohesion with neighbors of their own mesh and separation from all
+   neighbors within perception, then move at a fixed speed and are pushed off the top / bottom walls
+ - Distances are taken across the wrap (the nearest copy of the other boid), so boids on opposite
+   faces of the cube see each other the same way as boids anywhere else
+ - step() is double buffered: every boid reads the flock as it was at the start of the step and
+   writes its own slot of the back buffer, so the result doesn't depend on update order and blocks
+   of boids can run on a ThreadPool, giving the same flock for any number of threads
+ - The previous state is kept after the swap, interpolated() blends between the two for drawing
+   at a different rate than the simulation ticks
+ - BoidGrid buckets boids into cells at least perception wide, rebuilt every step with a counting
+   sort so each cell's boids are contiguous, a query visits the 27 cells around a boid (wrapping
+   at the faces)
+ - The scalar path (useSimd = false) sorts neighbors by index before steering, so it gives exactly
+   the brute force result (useGrid = false), sums run in the same order. It's the reference
+ - The default SIMD path gathers the flock into structure-of-arrays in grid order, then runs one
+   fused pass of all three rules per boid over each nearby cell's contiguous candidates, 4 lanes at
+   a time, with mesh masks instead of neighbor lists and rsqrt for separation. Sums run in another
+   order, so it matches the reference to float rounding rather than bit for bit, but still gives the
+   same flock for any number of threads
+*/
+
+struct Boid {
+	vec3 p, v; // position and velocity
+	int mesh = 0;
+};
+
+struct BoidSettings {
+	float speed = 0.005f;
+	float perception = 0.3f;
+	float wallRange = 0.2f;
+	float alignment = 1.0f, cohesion = 1.0f, separation = 1.0f;
+};
+
+// Shortest offset between two points in the wrapped [-1, 1] cube
+inline float wrapOffset(float d) { return d > 1.0f ? d - 2.0f : d < -1.0f ? d + 2.0f : d; }
+inline vec3 wrapOffset(vec3 d) { return vec3(wrapOffset(d.x), wrapOffset(d.y), wrapOffset(d.z)); }
+
+struct BoidGrid {
+	int n = 0; // cells per axis
+	float cellSize = 2.0f;
+	vector<int> cellStart; // boids of cell c are cellBoids[cellStart[c], cellStart[c + 1])
+	vector<int> cellBoids;
+	int cellCoord(float x) const {
+		int c = (int)floorf((x + 1.0f) / cellSize);
+		return c < 0 ? 0 : c >= n ? n - 1 : c;
+	}
+	int cellOf(vec3 p) const { return (cellCoord(p.z) * n + cellCoord(p.y)) * n + cellCoord(p.x); }
+	void build(const vector<Boid>& boids, float minCellSize) {
+		// Cells no smaller than minCellSize, but no more than about 2 per boid (at least 8^3): a small
+		// perception radius would otherwise ask for n^3 mostly empty cells to clear every build
+		int limit = std::max(8, (int)cbrtf(2.0f * boids.size()));
+		float fit = minCellSize > 0.0f ? 2.0f / minCellSize : (float)limit;
+		n = std::max(1, (int)floorf(std::min(fit, (float)limit)));
+		cellSize = 2.0f / n;
+		int cells = n * n * n;
+		cellStart.assign(cells + 1, 0);
+		boidCells.resize(boids.size());
+		for (size_t i = 0; i < boids.size(); i++) {
+			boidCells[i] = cellOf(boids[i].p);
+			cellStart[boidCells[i] + 1]++;
+		}
+		for (int c = 0; c < cells; c++) cellStart[c + 1] += cellStart[c];
+		// Scatter in index order, so each cell lists its boids by index
+		cellBoids.resize(boids.size());
+		fill.assign(cellStart.begin(), cellStart.end() - 1);
+		for (size_t i = 0; i < boids.size(); i++) cellBoids[fill[boidCells[i]]++] = (int)i;
+	}
+	// Calls fn(begin, end) for the cellBoids range of each of the 27 cells around p, each boid once
+	template <typename Fn>
+	void forNearbyCells(vec3 p, Fn fn) const {
+		if (n < 3) {
+			// Neighboring cells would repeat, every cell is near anyway
+			fn(0, (int)cellBoids.size());
+			return;
+		}
+		int cx = cellCoord(p.x), cy = cellCoord(p.y), cz = cellCoord(p.z);
+		for (int dz = -1; dz <= 1; dz++) {
+			int z = (cz + dz + n) % n;
+			for (int dy = -1; dy <= 1; dy++) {
+				int y = (cy + dy + n) % n;
+				for (int dx = -1; dx <= 1; dx++) {
+					int c = (z * n + y) * n + (cx + dx + n) % n;
+					if (cellStart[c] < cellStart[c + 1]) fn(cellStart[c], cellStart[c + 1]);
+				}
+			}
+		}
+	}
+	// Calls fn(j) for every boid in the 27 cells around p, each boid once
+	template <typename Fn>
+	void forNearby(vec3 p, Fn fn) const {
+		forNearbyCells(p, [&](int begin, int end) {
+			for (int k = begin; k < end; k++) fn(cellBoids[k]);
+		});
+	}
+private:
+	vector<int> boidCells, fill;
+};
+
+struct Flock {
+	static const int BLOCK = 1024; // boids per parallelFor chunk
+	BoidSettings settings;
+	vector<Boid> boids; // current state
+	BoidGrid grid;
+	bool useGrid = true;
+	bool useSimd = true; // fused SIMD kernel over the grid, useSimd = false (or no grid) is the scalar reference
+	size_t pairsTested = 0; // distance tests in the last step
+	// count boids at random positions and headings, meshes in [0, meshTypes)
+	void randomize(int count, int meshTypes, uint64_t seed) {
+		pcg32 rng(seed);
+		boids.resize(count);
+		for (Boid& b : boids) {
+			b.p = rng.range(vec3(-1.0f), vec3(1.0f));
+			b.v = settings.speed * rng.range(vec3(-1.0f), vec3(1.0f));
+			b.mesh = (int)rng.below((uint32_t)std::max(1, meshTypes));
+		}
+		previous = boids;
+	}
+	// Steps every boid from boids into the back buffer, then swaps, spread over pool if given
+	void step(ThreadPool* pool = nullptr) {
+		if (useGrid) grid.build(boids, settings.perception);
+		int slots = pool ? pool->size() : 1;
+		if ((int)scratch.size() < slots) scratch.resize(slots);
+		for (Scratch& s : scratch) s.tests = 0;
+		previous.resize(boids.size());
+		bool simd = useGrid && useSimd;
+		auto run = [&](int begin, int end, int slot) {
+			Scratch& s = scratch[slot];
+			for (int i = begin; i < end; i++) {
+				if (simd)
+					previous[i] = steerSimd(i, s.tests);
+				else {
+					s.tests += findNeighbors(i, s.neighbors);
+					previous[i] = steer(boids[i], s.neighbors);
+				}
+			}
+		};
+		auto spread = [&](const std::function<void(int, int, int)>& fn) {
+			if (pool) pool->parallelFor((int)boids.size(), fn, BLOCK);
+			else fn(0, (int)boids.size(), 0);
+		};
+		if (simd) {
+			gathered.resize(boids.size() + 3);
+			spread([&](int begin, int end, int) { gather(begin, end); });
+		}
+		spread(run);
+		boids.swap(previous);
+		pairsTested = 0;
+		for (Scratch& s : scratch) pairsTested += s.tests;
+	}
+	// Boids within perception of boid i, by index, returns the number of distance tests
+	size_t findNeighbors(int i, vector<int>& out) const {
+		out.clear();
+		vec3 p = boids[i].p;
+		float r2 = settings.perception * settings.perception;
+		size_t tests = 0;
+		auto test = [&](int j) {
+			vec3 d = wrapOffset(boids[j].p - p);
+			float d2 = dot(d, d);
+			tests++;
+			if (j != i && d2 < r2 && d2 > 0.0f) out.push_back(j);
+		};
+		if (useGrid) {
+			grid.forNearby(p, test);
+			std::sort(out.begin(), out.end());
+		} else
+			for (size_t j = 0; j < boids.size(); j++) test((int)j);
+		return tests;
+	}
+	// FNV-1a over every boid's raw bits, equal only if the flocks are bit for bit the same
+	uint64_t checksum() const {
+		uint64_t h = 0xcbf29ce484222325ull;
+		for (const Boid& b : boids) {
+			float f[6] = { b.p.x, b.p.y, b.p.z, b.v.x, b.v.y, b.v.z };
+			uint32_t words[7];
+			memcpy(words, f, sizeof(f));
+			words[6] = (uint32_t)b.mesh;
+			for (uint32_t w : words)
+				for (int k = 0; k < 4; k++) h = (h ^ ((w >> (8 * k)) & 0xff)) * 0x100000001b3ull;
+		}
+		return h;
+	}
+	// Boid i's position t of the way from the previous step to the current one, across the wrap
+	vec3 interpolated(int i, float t) const {
+		vec3 p0 = previous[i].p;
+		return p0 + t * wrapOffset(boids[i].p - p0);
+	}
+private:
+	struct Scratch {
+		vector<int> neighbors;
+		size_t tests = 0;
+	};
+	vector<Boid> previous; // back buffer during step(), the last state after it
+	vector<Scratch> scratch; // per pool slot
+	static vec3 safeNormalize(vec3 v) {
+		float l = length(v);
+		return l > 0.0f ? v / l : vec3(0.0f);
+	}
+	// Applies the three rules over neighbors (by index) in one pass, returns b moved
+	Boid steer(Boid b, const vector<int>& neighbors) const {
+		vec3 align(0.0f), center(0.0f), separateSame(0.0f), separateOther(0.0f);
+		int same = 0;
+		for (int j : neighbors) {
+			const Boid& n = boids[j];
+			vec3 d = wrapOffset(b.p - n.p);
+			if (n.mesh == b.mesh) {
+				align += n.v;
+				center -= d;
+				separateSame += d / dot(d, d);
+				same++;
+			} else
+				separateOther += d / dot(d, d);
+		}
+		return finish(b, align, center, separateSame + separateOther, same, (int)neighbors.size());
+	}
+	// Boids in grid order as structure of arrays (padded by 3), so each cell's candidates are contiguous
+	struct Gathered {
+		vector<float> x, y, z, vx, vy, vz, mesh;
+		void resize(size_t n) {
+			for (vector<float>* a : { &x, &y, &z, &vx, &vy, &vz, &mesh }) a->resize(n);
+		}
+	} gathered;
+	void gather(int begin, int end) {
+		Gathered& g = gathered;
+		for (int k = begin; k < end; k++) {
+			const Boid& b = boids[grid.cellBoids[k]];
+			g.x[k] = b.p.x; g.y[k] = b.p.y; g.z[k] = b.p.z;
+			g.vx[k] = b.v.x; g.vy[k] = b.v.y; g.vz[k] = b.v.z;
+			g.mesh[k] = (float)b.mesh;
+		}
+	}
+	static float4 wrapOffset4(float4 d) {
+		float4 two = splat4(2.0f);
+		d = d - bitsAnd(greaterThan(d, splat4(1.0f)), two);
+		return d + bitsAnd(lessThan(d, splat4(-1.0f)), two);
+	}
+	static float sum4(float4 a) {
+		float f[4];
+		store4(f, a);
+		return (f[0] + f[1]) + (f[2] + f[3]);
+	}
+	// steer() fused over 4 candidates at a time straight from the gathered cells, lanes outside
+	// perception, past the cell or on b itself are masked out, mesh masks pick the same mesh lanes
+	Boid steerSimd(int i, size_t& tests) const {
+		static const float laneOffsets[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+		const Gathered& g = gathered;
+		Boid b = boids[i];
+		float4 px = splat4(b.p.x), py = splat4(b.p.y), pz = splat4(b.p.z), mesh = splat4((float)b.mesh);
+		float4 r2 = splat4(settings.perception * settings.perception), zero = splat4(0.0f), one = splat4(1.0f);
+		float4 half = splat4(0.5f), threeHalves = splat4(1.5f), lanes = load4(laneOffsets);
+		float4 ax = zero, ay = zero, az = zero, cx = zero, cy = zero, cz = zero;
+		float4 sx = zero, sy = zero, sz = zero, same = zero, all = zero;
+		grid.forNearbyCells(b.p, [&](int begin, int end) {
+			float4 last = splat4((float)end);
+			tests += end - begin;
+			for (int k = begin; k < end; k += 4) {
+				float4 dx = wrapOffset4(load4(&g.x[k]) - px);
+				float4 dy = wrapOffset4(load4(&g.y[k]) - py);
+				float4 dz = wrapOffset4(load4(&g.z[k]) - pz);
+				float4 d2 = dx * dx + dy * dy + dz * dz;
+				float4 near = bitsAnd(bitsAnd(lessThan(d2, r2), greaterThan(d2, zero)), lessThan(splat4((float)k) + lanes, last));
+				if (!moveMask(near)) continue;
+				float4 match = bitsAnd(near, equalTo(load4(&g.mesh[k]), mesh));
+				// 1 / d2 as rsqrt squared, one Newton step takes the estimate to ~23 bits
+				float4 r = rsqrt4(d2);
+				r = r * (threeHalves - half * d2 * r * r);
+				float4 inv = bitsAnd(near, r * r);
+				sx -= dx * inv; sy -= dy * inv; sz -= dz * inv;
+				ax += bitsAnd(match, load4(&g.vx[k])); ay += bitsAnd(match, load4(&g.vy[k])); az += bitsAnd(match, load4(&g.vz[k]));
+				cx += bitsAnd(match, dx); cy += bitsAnd(match, dy); cz += bitsAnd(match, dz);
+				same += bitsAnd(match, one);
+				all += bitsAnd(near, one);
+			}
+		});
+		vec3 align(sum4(ax), sum4(ay), sum4(az)), center(sum4(cx), sum4(cy), sum4(cz)), separate(sum4(sx), sum4(sy), sum4(sz));
+		return finish(b, align, center, separate, (int)sum4(same), (int)sum4(all));
+	}
+	// Turns the rule sums over same mesh / all neighbors into b's new velocity, moves b
+	Boid finish(Boid b, vec3 align, vec3 center, vec3 separate, int same, int count) const {
+		vec3 a = same ? safeNormalize(align / (float)same) : vec3(0.0f);
+		vec3 c = same ? safeNormalize(center / (float)same) : vec3(0.0f);
+		vec3 s = count ? safeNormalize(separate / (float)count) : vec3(0.0f);
+		vec3 w = move(b);
+		b.v += a * settings.alignment + c * settings.cohesion + s * settings.separation + w;
+		b.v = safeNormalize(b.v) * settings.speed;
+		return b;
+	}
+	// Moves b by its velocity, wraps it, returns the push away from the top / bottom walls
+	vec3 move(Boid& b) const {
+		b.p += b.v;
+		for (float* x : { &b.p.x, &b.p.y, &b.p.z }) {
+			if (*x > 1.0f) *x = -1.0f;
+			if (*x < -1.0f) *x = 1.0f;
+		}
+		if (b.p.y > 1 - settings.wallRange) return vec3(0.0f, 1 / (-1 - b.p.y), 0.0f);
+		if (b.p.y < -1 + settings.wallRange) return vec3(0.0f, 1 / (1 - b.p.y), 0.0f);
+		return vec3(0.0f);
+	}
+};
+
+#endif
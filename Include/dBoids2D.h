@@ -0,0 +1,168 @@
+// dBoids2D.h - Headless 2D flocking over a uniform grid, single pass per boid
+
+#ifndef DBOIDS2D_HDR
+#define DBOIDS2D_HDR
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cstdint>
+#include "VecMat.h"
+#include "dRandom.h"
+#include "dThreadPool.h"
+
+using std::vector;
+
+/* Flock2D is boids.cpp's flock as structure-of-arrays, in a [-extent, extent] square that wraps:
+ - Each boid has a position and a heading r (length speed), and moves along r turned a quarter turn,
+   which is what the old Move() did by rotating (0, speed) by atan2(r)
+ - Every step buckets boids into a grid of perception wide cells (counting sort, the grid clamps
+   at the edges since distances don't wrap) and copies them into cell order, then walks boids in
+   that order so a boid and its 3x3 cells of candidates are all close together in memory. Boids
+   are written back in that order too, so the flock stays sorted by cell and the next step's sort
+   barely moves anything (indices aren't stable between steps, colors move with their boids)
+ - One pass over the candidates tests squared distance once and gathers all three rules, direct
+   vector math, no dist() / pow() / atan2()
+ - Double buffered, so blocks of boids can run on a ThreadPool with the same result on any number
+   of threads
+ - pack() writes what the renderer needs per boid, to fill a mapped instance buffer from workers
+*/
+
+struct Boid2DInstance {
+	float x, y, rx, ry; // position and heading
+	uint32_t color;
+};
+
+struct Flock2D {
+	static const int BLOCK = 4096; // boids per parallelFor chunk
+	float extent = 400.0f;
+	float speed = 2.0f;
+	float perception = 75.0f;
+	float alignment = 1.0f, cohesion = 1.0f, separation = 1.5f;
+	vector<float> x, y, rx, ry;
+	vector<uint32_t> color;
+	size_t pairsTested = 0; // distance tests in the last step
+	int size() const { return (int)x.size(); }
+	void add(vec2 p, vec2 r, uint32_t c) {
+		float l = length(r);
+		if (l > 0.0f) r = r * (speed / l);
+		x.push_back(p.x); y.push_back(p.y);
+		rx.push_back(r.x); ry.push_back(r.y);
+		color.push_back(c);
+	}
+	// count boids at random positions, headings and colors
+	void randomize(int count, uint64_t seed) {
+		pcg32 rng(seed);
+		for (int i = 0; i < count; i++) {
+			vec2 p(rng.range(-extent, extent), rng.range(-extent, extent));
+			float a = rng.range(0.0f, 2.0f * (float)M_PI);
+			uint32_t c = 0xff000000u;
+			for (int k = 0; k < 3; k++) c |= (uint32_t)(rng.range(0.25f, 1.0f) * 255.0f) << (8 * k);
+			add(p, vec2(cosf(a), sinf(a)), c);
+		}
+	}
+	void step(ThreadPool* pool = nullptr) {
+		int count = size();
+		buildGrid();
+		nx.resize(count); ny.resize(count); nrx.resize(count); nry.resize(count);
+		ncolor.resize(count);
+		for (int k = 0; k < count; k++) ncolor[k] = color[order[k]];
+		int slots = pool ? pool->size() : 1;
+		tests.assign(slots, 0);
+		auto run = [&](int begin, int end, int slot) {
+			for (int k = begin; k < end; k++) steer(k, tests[slot]);
+		};
+		if (pool) pool->parallelFor(count, run, BLOCK);
+		else run(0, count, 0);
+		x.swap(nx); y.swap(ny); rx.swap(nrx); ry.swap(nry);
+		color.swap(ncolor);
+		pairsTested = 0;
+		for (size_t t : tests) pairsTested += t;
+	}
+	void pack(Boid2DInstance* out, int begin, int end) const {
+		for (int i = begin; i < end; i++) out[i] = { x[i], y[i], rx[i], ry[i], color[i] };
+	}
+private:
+	int n = 0; // cells per axis
+	float cellSize = 1.0f;
+	vector<int> cellStart, cellOf, nextSlot, order; // order[k] is the boid at sorted position k
+	vector<float> sx, sy, srx, sry; // boids in cell order
+	vector<float> nx, ny, nrx, nry;
+	vector<uint32_t> ncolor;
+	vector<size_t> tests;
+	int cellCoord(float v) const {
+		int c = (int)floorf((v + extent) / cellSize);
+		return c < 0 ? 0 : c >= n ? n - 1 : c;
+	}
+	void buildGrid() {
+		int count = size();
+		n = std::max(1, (int)floorf(2.0f * extent / perception));
+		cellSize = 2.0f * extent / n;
+		cellStart.assign(n * n + 1, 0);
+		cellOf.resize(count);
+		for (int i = 0; i < count; i++) {
+			cellOf[i] = cellCoord(y[i]) * n + cellCoord(x[i]);
+			cellStart[cellOf[i] + 1]++;
+		}
+		for (int c = 0; c < n * n; c++) cellStart[c + 1] += cellStart[c];
+		order.resize(count);
+		nextSlot.assign(cellStart.begin(), cellStart.end() - 1);
+		for (int i = 0; i < count; i++) order[nextSlot[cellOf[i]]++] = i;
+		sx.resize(count); sy.resize(count); srx.resize(count); sry.resize(count);
+		for (int k = 0; k < count; k++) {
+			int i = order[k];
+			sx[k] = x[i]; sy[k] = y[i]; srx[k] = rx[i]; sry[k] = ry[i];
+		}
+	}
+	// Steps the boid at sorted position k into the back buffer, at k
+	void steer(int k, size_t& tested) {
+		float px = sx[k], py = sy[k], r2 = perception * perception;
+		float ax = 0, ay = 0, cx = 0, cy = 0, sepx = 0, sepy = 0;
+		int near = 0, apart = 0;
+		int cellX = cellCoord(px), cellY = cellCoord(py);
+		for (int yy = std::max(0, cellY - 1); yy <= std::min(n - 1, cellY + 1); yy++) {
+			int rowStart = cellStart[yy * n + std::max(0, cellX - 1)], rowEnd = cellStart[yy * n + std::min(n - 1, cellX + 1) + 1];
+			tested += rowEnd - rowStart;
+			for (int j = rowStart; j < rowEnd; j++) {
+				float dx = sx[j] - px, dy = sy[j] - py, d2 = dx * dx + dy * dy;
+				if (d2 >= r2 || j == k) continue;
+				ax += srx[j]; ay += sry[j];
+				cx += dx; cy += dy;
+				near++;
+				if (d2 > 0.0f) {
+					sepx -= dx / d2; sepy -= dy / d2;
+					apart++;
+				}
+			}
+		}
+		float vx = srx[k], vy = sry[k];
+		auto steerBy = [&](float fx, float fy, float weight) {
+			float l2 = fx * fx + fy * fy;
+			if (l2 > 0.0f) {
+				float s = weight / sqrtf(l2);
+				vx += fx * s; vy += fy * s;
+			}
+		};
+		// Averages only change the length, which normalizing drops
+		if (near) {
+			steerBy(ax, ay, alignment);
+			steerBy(cx, cy, cohesion);
+		}
+		if (apart) steerBy(sepx, sepy, separation);
+		float l2 = vx * vx + vy * vy;
+		if (l2 > 0.0f) {
+			float s = speed / sqrtf(l2);
+			vx *= s; vy *= s;
+		}
+		// Moves along the heading turned a quarter turn, wrapping at the edges
+		float mx = px - vy, my = py + vx;
+		if (mx > extent) mx = -extent;
+		if (mx < -extent) mx = extent;
+		if (my > extent) my = -extent;
+		if (my < -extent) my = extent;
+		nx[k] = mx; ny[k] = my; nrx[k] = vx; nry[k] = vy;
+	}
+};
+
+#endif
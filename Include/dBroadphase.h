@@ -0,0 +1,471 @@
+// dBroadphase.h - Broadphase pair finding for AABB proxies, incremental sweep-and-prune and dynamic AABB trees
+
+#ifndef DBROADPHASE_HDR
+#define DBROADPHASE_HDR
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include "VecMat.h"
+
+using std::vector;
+using std::runtime_error;
+
+/* A broadphase keeps world space bounds of proxies (whatever the caller collides: trees, a car,
+   rocks, each created with a user value to find it again) and lists the pairs that may touch:
+ - create() / move() / destroy() only record changes, update() brings pairs up to date. pairs is
+   sorted by (a, b) with a < b, so it is the same list whatever order proxies were changed in, and
+   added / removed hold what changed in the last update() (for contact begin / end)
+ - Dynamic proxies keep fat bounds, their bounds grown by margin on every side, and only count as
+   moved when their bounds leave them. Static proxies aren't fattened and are never paired with
+   each other (trees don't collide with trees). A pair means the fat bounds overlap, callers test
+   their own shapes (the narrowphase) to tell real contacts
+ - Freed ids aren't handed out again until the update() that reports their pairs removed
+ - Pairs of proxies that didn't move are carried over as they were, only proxies that did look for
+   new pairs, in one of two ways:
+ - SweepAndPrune keeps the 2 endpoints of each proxy along one axis sorted, re-sorted by insertion
+   sort since proxies barely move between updates, and sweeps them. The axis is the one proxy
+   centers vary most along, chosen again whenever most endpoints are new (the first update, say).
+   Proxies it is passing through are kept in 4 lists, static or dynamic and moved or not, so a proxy
+   is only tested against the lists it can have a new pair with
+ - TreeBroadphase keeps static and dynamic proxies in two AABBTrees and queries them with every
+   proxy that moved
+*/
+
+struct Bounds {
+	vec3 lo, hi;
+	Bounds() { }
+	Bounds(vec3 lo, vec3 hi) : lo(lo), hi(hi) { }
+	static Bounds sphere(vec3 center, float radius) { return Bounds(center - vec3(radius), center + vec3(radius)); }
+	bool overlaps(const Bounds& b) const {
+		return lo.x <= b.hi.x && b.lo.x <= hi.x && lo.y <= b.hi.y && b.lo.y <= hi.y && lo.z <= b.hi.z && b.lo.z <= hi.z;
+	}
+	bool contains(const Bounds& b) const {
+		return lo.x <= b.lo.x && lo.y <= b.lo.y && lo.z <= b.lo.z && b.hi.x <= hi.x && b.hi.y <= hi.y && b.hi.z <= hi.z;
+	}
+	Bounds merged(const Bounds& b) const {
+		return Bounds(vec3(std::min(lo.x, b.lo.x), std::min(lo.y, b.lo.y), std::min(lo.z, b.lo.z)),
+			vec3(std::max(hi.x, b.hi.x), std::max(hi.y, b.hi.y), std::max(hi.z, b.hi.z)));
+	}
+	Bounds grown(float margin) const { return Bounds(lo - vec3(margin), hi + vec3(margin)); }
+	float area() const {
+		vec3 d = hi - lo;
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+};
+
+struct BroadphasePair {
+	int a, b; // proxy ids, a < b
+	bool operator<(const BroadphasePair& o) const { return a == o.a ? b < o.b : a < o.a; }
+	bool operator==(const BroadphasePair& o) const { return a == o.a && b == o.b; }
+};
+
+struct Proxy {
+	Bounds bounds, fat;
+	int user = 0;
+	bool isStatic = false, alive = false, touched = false;
+};
+
+// Proxy bookkeeping shared by both broadphases
+struct ProxySet {
+	float margin = 0.1f;
+	vector<BroadphasePair> pairs, added, removed;
+	int moved = 0; // proxies created, moved or destroyed for the last update()
+	int create(const Bounds& bounds, int user = 0, bool isStatic = false) {
+		int id;
+		if (freeIds.empty()) {
+			id = (int)proxies.size();
+			proxies.emplace_back();
+		}
+		else {
+			id = freeIds.back();
+			freeIds.pop_back();
+		}
+		Proxy& p = proxies[id];
+		p.bounds = bounds;
+		p.fat = isStatic ? bounds : bounds.grown(margin);
+		p.user = user;
+		p.isStatic = isStatic;
+		p.alive = true;
+		live++;
+		touch(id);
+		return id;
+	}
+	// Returns true if bounds left the proxy's fat bounds (its pairs will be looked for again)
+	bool move(int id, const Bounds& bounds) {
+		Proxy& p = at(id);
+		p.bounds = bounds;
+		if (p.fat.contains(bounds)) return false;
+		p.fat = p.isStatic ? bounds : bounds.grown(margin);
+		touch(id);
+		return true;
+	}
+	void destroy(int id) {
+		at(id).alive = false;
+		live--;
+		freedIds.push_back(id);
+		touch(id);
+	}
+	const Proxy& proxy(int id) const { return proxies[id]; }
+	int count() const { return live; }
+	int capacity() const { return (int)proxies.size(); }
+protected:
+	vector<Proxy> proxies;
+	vector<int> touchedIds;
+	vector<BroadphasePair> next;
+	Proxy& at(int id) {
+		if (id < 0 || id >= (int)proxies.size() || !proxies[id].alive)
+			throw runtime_error("Broadphase proxy " + std::to_string(id) + " doesn't exist");
+		return proxies[id];
+	}
+	// Pairs of proxies that didn't move, to be kept
+	void keepUntouched() {
+		next.clear();
+		for (const BroadphasePair& pair : pairs)
+			if (!proxies[pair.a].touched && !proxies[pair.b].touched) next.push_back(pair);
+	}
+	void touch(int id) {
+		if (proxies[id].touched) return;
+		proxies[id].touched = true;
+		touchedIds.push_back(id);
+	}
+	void addPair(int a, int b) {
+		next.push_back(a < b ? BroadphasePair{ a, b } : BroadphasePair{ b, a });
+	}
+	// next holds kept pairs (sorted) followed by new ones, makes it the pair list
+	void commit(size_t kept) {
+		std::sort(next.begin() + kept, next.end());
+		std::inplace_merge(next.begin(), next.begin() + kept, next.end());
+		added.clear();
+		removed.clear();
+		std::set_difference(next.begin(), next.end(), pairs.begin(), pairs.end(), std::back_inserter(added));
+		std::set_difference(pairs.begin(), pairs.end(), next.begin(), next.end(), std::back_inserter(removed));
+		pairs.swap(next);
+		settle();
+	}
+	// Clears change records once an update() has seen them
+	void settle() {
+		moved = (int)touchedIds.size();
+		for (int id : touchedIds) proxies[id].touched = false;
+		touchedIds.clear();
+		freeIds.insert(freeIds.end(), freedIds.begin(), freedIds.end());
+		freedIds.clear();
+	}
+private:
+	vector<int> freeIds, freedIds;
+	int live = 0;
+};
+
+struct SweepAndPrune : ProxySet {
+	int axis = 0; // x until the first update(), then the axis proxy centers vary most along
+	void update() {
+		added.clear();
+		removed.clear();
+		if (touchedIds.empty()) {
+			settle();
+			return;
+		}
+		// Refresh endpoint values, dropping dead proxies' endpoints and appending new ones'
+		swept.resize(proxies.size(), false);
+		size_t n = 0;
+		for (size_t i = 0; i < endpoints.size(); i++) {
+			Endpoint e = endpoints[i];
+			const Proxy& p = proxies[e.key >> 1];
+			if (!p.alive) {
+				swept[e.key >> 1] = false;
+				continue;
+			}
+			e.value = e.key & 1 ? p.fat.hi[axis] : p.fat.lo[axis];
+			endpoints[n++] = e;
+		}
+		endpoints.resize(n);
+		for (int id : touchedIds) {
+			const Proxy& p = proxies[id];
+			if (!p.alive || swept[id]) continue;
+			endpoints.push_back({ p.fat.lo[axis], (uint32_t)id << 1 });
+			endpoints.push_back({ p.fat.hi[axis], (uint32_t)id << 1 | 1 });
+			swept[id] = true;
+		}
+		if (endpoints.size() - n > n) {
+			// Mostly new endpoints is a rebuild, pick the axis again and sort from scratch
+			axis = widestAxis();
+			for (Endpoint& e : endpoints) {
+				const Proxy& p = proxies[e.key >> 1];
+				e.value = e.key & 1 ? p.fat.hi[axis] : p.fat.lo[axis];
+			}
+			std::sort(endpoints.begin(), endpoints.end(), before);
+		}
+		else {
+			// Old endpoints are nearly sorted already, new ones get sorted on their own and merged in
+			for (size_t i = 1; i < n; i++) {
+				Endpoint e = endpoints[i];
+				size_t j = i;
+				for (; j > 0 && before(e, endpoints[j - 1]); j--)
+					endpoints[j] = endpoints[j - 1];
+				endpoints[j] = e;
+			}
+			std::sort(endpoints.begin() + n, endpoints.end(), before);
+			std::inplace_merge(endpoints.begin(), endpoints.begin() + n, endpoints.end(), before);
+		}
+		keepUntouched();
+		size_t kept = next.size();
+		sweep();
+		commit(kept);
+	}
+private:
+	struct Endpoint {
+		float value;
+		uint32_t key; // id << 1 | 1 for the max endpoint
+	};
+	struct Active {
+		Bounds fat;
+		int id;
+	};
+	vector<Endpoint> endpoints;
+	vector<bool> swept; // proxy has endpoints
+	vector<Active> active[4]; // by isStatic * 2 + touched
+	vector<int> activeSlot;
+	// Min endpoints go before max endpoints at the same value, so touching bounds overlap
+	static bool before(const Endpoint& a, const Endpoint& b) {
+		return a.value < b.value || (a.value == b.value && (a.key & 1) < (b.key & 1));
+	}
+	// The axis with the greatest variance of live proxy centers, fewest proxies overlap along it
+	int widestAxis() const {
+		double sum[3] = { 0, 0, 0 }, sum2[3] = { 0, 0, 0 };
+		int count = 0;
+		for (const Proxy& p : proxies) {
+			if (!p.alive) continue;
+			for (int k = 0; k < 3; k++) {
+				double c = 0.5 * ((double)p.fat.lo[k] + p.fat.hi[k]);
+				sum[k] += c;
+				sum2[k] += c * c;
+			}
+			count++;
+		}
+		int best = axis;
+		double bestVariance = -1.0;
+		for (int k = 0; count && k < 3; k++) {
+			double variance = sum2[k] / count - (sum[k] / count) * (sum[k] / count);
+			if (variance > bestVariance) {
+				best = k;
+				bestVariance = variance;
+			}
+		}
+		return best;
+	}
+	void sweep() {
+		for (vector<Active>& list : active) list.clear();
+		activeSlot.resize(proxies.size());
+		int u = (axis + 1) % 3, v = (axis + 2) % 3;
+		for (const Endpoint& e : endpoints) {
+			int id = e.key >> 1;
+			const Proxy& p = proxies[id];
+			vector<Active>& list = active[p.isStatic * 2 + p.touched];
+			if (e.key & 1) {
+				int slot = activeSlot[id];
+				list[slot] = list.back();
+				activeSlot[list[slot].id] = slot;
+				list.pop_back();
+				continue;
+			}
+			// Everything active overlaps p along the axis
+			float ulo = p.fat.lo[u], uhi = p.fat.hi[u], vlo = p.fat.lo[v], vhi = p.fat.hi[v];
+			for (int l = 0; l < 4; l++) {
+				if ((l >> 1 && p.isStatic) || !(l & 1 || p.touched)) continue;
+				for (const Active& a : active[l])
+					if (a.fat.lo[u] <= uhi && ulo <= a.fat.hi[u] && a.fat.lo[v] <= vhi && vlo <= a.fat.hi[v])
+						addPair(id, a.id);
+			}
+			activeSlot[id] = (int)list.size();
+			list.push_back({ p.fat, id });
+		}
+	}
+};
+
+/* AABBTree is a binary tree of bounds with proxies at the leaves, every internal node bounding its
+   two children. Leaves are inserted next to the sibling that grows the tree's surface area least
+   (a greedy descent on surface area cost), and nodes whose children's heights differ by more than 1
+   are rotated on the way back up, so the tree stays balanced however leaves come and go.
+*/
+
+struct AABBTree {
+	struct Node {
+		Bounds box;
+		int parent = -1, child[2] = { -1, -1 };
+		int proxy = -1;
+		int height = 0; // leaves are 0
+		bool leaf() const { return child[0] < 0; }
+	};
+	vector<Node> nodes;
+	int root = -1;
+	int insert(const Bounds& box, int proxy) {
+		int leaf = allocate();
+		nodes[leaf].box = box;
+		nodes[leaf].proxy = proxy;
+		if (root < 0) {
+			root = leaf;
+			return leaf;
+		}
+		int sibling = bestSibling(box);
+		int oldParent = nodes[sibling].parent, parent = allocate();
+		Node& p = nodes[parent];
+		p.parent = oldParent;
+		p.box = box.merged(nodes[sibling].box);
+		p.height = nodes[sibling].height + 1;
+		p.child[0] = sibling;
+		p.child[1] = leaf;
+		if (oldParent < 0) root = parent;
+		else nodes[oldParent].child[nodes[oldParent].child[1] == sibling] = parent;
+		nodes[sibling].parent = nodes[leaf].parent = parent;
+		refit(nodes[leaf].parent);
+		return leaf;
+	}
+	void remove(int leaf) {
+		int parent = nodes[leaf].parent;
+		release(leaf);
+		if (parent < 0) {
+			root = -1;
+			return;
+		}
+		int grandParent = nodes[parent].parent;
+		int sibling = nodes[parent].child[nodes[parent].child[0] == leaf];
+		nodes[sibling].parent = grandParent;
+		if (grandParent < 0) root = sibling;
+		else nodes[grandParent].child[nodes[grandParent].child[1] == parent] = sibling;
+		release(parent);
+		refit(grandParent);
+	}
+	// Calls fn(proxy) for every leaf overlapping box
+	template <typename Fn>
+	void query(const Bounds& box, Fn fn) {
+		if (root < 0 || !nodes[root].box.overlaps(box)) return;
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty()) {
+			const Node& n = nodes[stack.back()];
+			stack.pop_back();
+			if (n.leaf()) {
+				fn(n.proxy);
+				continue;
+			}
+			for (int c : n.child)
+				if (nodes[c].box.overlaps(box)) stack.push_back(c);
+		}
+	}
+	int height() const { return root < 0 ? 0 : nodes[root].height; }
+	int leaves() const { return root < 0 ? 0 : ((int)(nodes.size() - freeNodes.size()) + 1) / 2; }
+private:
+	vector<int> freeNodes, stack;
+	int allocate() {
+		int i;
+		if (freeNodes.empty()) {
+			i = (int)nodes.size();
+			nodes.emplace_back();
+		}
+		else {
+			i = freeNodes.back();
+			freeNodes.pop_back();
+			nodes[i] = Node();
+		}
+		return i;
+	}
+	void release(int i) {
+		nodes[i].height = -1;
+		freeNodes.push_back(i);
+	}
+	// Descends while pairing with a child costs less than pairing here, counting the growth of
+	// every ancestor the new leaf would enlarge
+	int bestSibling(const Bounds& box) const {
+		int i = root;
+		while (!nodes[i].leaf()) {
+			const Node& n = nodes[i];
+			float area = n.box.area(), combined = n.box.merged(box).area();
+			float here = 2.0f * combined, inherited = 2.0f * (combined - area);
+			float cost[2];
+			for (int c = 0; c < 2; c++) {
+				const Node& child = nodes[n.child[c]];
+				float grown = box.merged(child.box).area();
+				cost[c] = inherited + (child.leaf() ? grown : grown - child.box.area());
+			}
+			if (here < cost[0] && here < cost[1]) break;
+			i = n.child[cost[1] < cost[0]];
+		}
+		return i;
+	}
+	// Rebalances and refits from node i to the root
+	void refit(int i) {
+		while (i >= 0) {
+			i = balance(i);
+			Node& n = nodes[i];
+			const Node& c0 = nodes[n.child[0]], & c1 = nodes[n.child[1]];
+			n.height = 1 + std::max(c0.height, c1.height);
+			n.box = c0.box.merged(c1.box);
+			i = n.parent;
+		}
+	}
+	// Rotates the taller child of a up if its children's heights differ by more than 1, returns
+	// the node now in a's place
+	int balance(int a) {
+		Node& A = nodes[a];
+		if (A.leaf() || A.height < 2) return a;
+		int diff = nodes[A.child[1]].height - nodes[A.child[0]].height;
+		if (diff >= -1 && diff <= 1) return a;
+		int tall = diff > 1 ? 1 : 0, b = A.child[tall], c = A.child[1 - tall];
+		Node& B = nodes[b];
+		// B takes a's place, a keeps c and B's shorter child, B keeps a and its taller child
+		B.parent = A.parent;
+		A.parent = b;
+		if (B.parent < 0) root = b;
+		else nodes[B.parent].child[nodes[B.parent].child[1] == a] = b;
+		int f = B.child[0], g = B.child[1];
+		if (nodes[f].height > nodes[g].height) std::swap(f, g);
+		B.child[0] = a;
+		B.child[1] = g;
+		A.child[tall] = f;
+		nodes[f].parent = a;
+		A.box = nodes[c].box.merged(nodes[f].box);
+		A.height = 1 + std::max(nodes[c].height, nodes[f].height);
+		B.box = A.box.merged(nodes[g].box);
+		B.height = 1 + std::max(A.height, nodes[g].height);
+		return b;
+	}
+};
+
+struct TreeBroadphase : ProxySet {
+	AABBTree dynamicTree, staticTree;
+	void update() {
+		added.clear();
+		removed.clear();
+		if (touchedIds.empty()) {
+			settle();
+			return;
+		}
+		leaves.resize(proxies.size(), -1);
+		for (int id : touchedIds) {
+			const Proxy& p = proxies[id];
+			AABBTree& tree = p.isStatic ? staticTree : dynamicTree;
+			if (leaves[id] >= 0) tree.remove(leaves[id]);
+			leaves[id] = p.alive ? tree.insert(p.fat, id) : -1;
+		}
+		keepUntouched();
+		size_t kept = next.size();
+		for (int id : touchedIds) {
+			const Proxy& p = proxies[id];
+			if (!p.alive) continue;
+			// Two moved proxies find each other, one of them adds the pair
+			auto found = [&](int other) {
+				if (other != id && !(proxies[other].touched && other < id)) addPair(id, other);
+			};
+			dynamicTree.query(p.fat, found);
+			if (!p.isStatic) staticTree.query(p.fat, found);
+		}
+		commit(kept);
+	}
+private:
+	vector<int> leaves; // tree node of each proxy
+};
+
+#endif
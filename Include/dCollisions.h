@@ -140,6 +140,14 @@ struct Frustum {
             && nearFace.onOrBehindPlane(point) 
             && farFace.onOrBehindPlane(point);
     }
+    bool inFrustum(vec3 center, float radius) {
+        return topFace.onOrBehindPlane(center, radius) 
+            && bottomFace.onOrBehindPlane(center, radius) 
+            && leftFace.onOrBehindPlane(center, radius) 
+            && rightFace.onOrBehindPlane(center, radius) 
+            && nearFace.onOrBehindPlane(center, radius) 
+            && farFace.onOrBehindPlane(center, radius);
+    }
     bool inFrustum(mat4 transform, Sphere* collider) {
         vec3 tf_center (transform * vec4(collider->center, 1));
         return topFace.onOrBehindPlane(tf_center, collider->radius) 
@@ -0,0 +1,224 @@
+// dCommandList.h - Plain-data draw commands, recorded on any thread and replayed on the GL thread
+
+#ifndef DCOMMANDLIST_HDR
+#define DCOMMANDLIST_HDR
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include "glad.h"
+#include "VecMat.h"
+#include "dThreadPool.h"
+
+using std::vector;
+
+/* CommandList records what a pass wants to draw without making any GL calls:
+ - Commands are fixed-size plain data, anything variable sized (uniform values, uniform
+   blocks, packed instance data) is copied into the list's own byte arena
+ - Recording is safe on worker threads as long as each thread records its own list
+ - replay() walks a list in order on a backend, GLBackend issues the real GL calls while
+   any other type with the same member functions (e.g. CommandStats) can stand in for it,
+   which lets recording code run and be checked without a GL context
+
+Uniform locations have to be resolved before recording (see RenderPass::location()), since
+looking them up by name would need the GL thread.
+*/
+
+enum class CmdType : uint8_t {
+    UseProgram, BindVertexArray, BindTexture, BindFramebuffer, Viewport, Clear, CullFace,
+    Uniform, UniformBlock, BufferData, DrawElements, DrawElementsInstanced, DrawArrays, BlitDepth
+};
+
+enum class UniformType : uint8_t { Int, UInt, Float, Vec2, Vec3, Vec4, Mat4 };
+
+struct Command {
+    CmdType type;
+    UniformType utype = UniformType::Int;
+    uint32_t a = 0, b = 0, c = 0, d = 0; // meaning depends on type, see CommandList recorders
+    uint32_t offset = 0, size = 0; // byte range of payload in CommandList::data
+};
+
+struct CommandList {
+    vector<Command> commands;
+    vector<uint8_t> data;
+    void clear() {
+        commands.clear();
+        data.clear();
+    }
+    bool empty() const { return commands.empty(); }
+    void useProgram(GLuint program) { push(CmdType::UseProgram, program); }
+    void bindVertexArray(GLuint vao) { push(CmdType::BindVertexArray, vao); }
+    void bindTexture(GLuint unit, GLenum target, GLuint texture) { push(CmdType::BindTexture, unit, target, texture); }
+    void bindFramebuffer(GLuint fbo) { push(CmdType::BindFramebuffer, fbo); }
+    void viewport(GLint x, GLint y, GLsizei w, GLsizei h) { push(CmdType::Viewport, (uint32_t)x, (uint32_t)y, (uint32_t)w, (uint32_t)h); }
+    void clear(GLbitfield mask) { push(CmdType::Clear, mask); }
+    void cullFace(GLenum face) { push(CmdType::CullFace, face); }
+    void uniform(GLint loc, GLint v) { pushUniform(loc, UniformType::Int, &v, sizeof(v)); }
+    void uniform(GLint loc, GLuint v) { pushUniform(loc, UniformType::UInt, &v, sizeof(v)); }
+    void uniform(GLint loc, GLfloat v) { pushUniform(loc, UniformType::Float, &v, sizeof(v)); }
+    void uniform(GLint loc, vec2 v) { pushUniform(loc, UniformType::Vec2, &v.x, 2 * sizeof(float)); }
+    void uniform(GLint loc, vec3 v) { pushUniform(loc, UniformType::Vec3, &v.x, 3 * sizeof(float)); }
+    void uniform(GLint loc, vec4 v) { pushUniform(loc, UniformType::Vec4, &v.x, 4 * sizeof(float)); }
+    void uniform(GLint loc, const mat4& m) { pushUniform(loc, UniformType::Mat4, &m.row[0].x, 16 * sizeof(float)); }
+    // Copies block into a uniform buffer and binds it to the given binding point
+    void uniformBlock(GLuint binding, GLuint buffer, const void* block, size_t bytes) {
+        Command& cmd = push(CmdType::UniformBlock, binding, buffer);
+        append(cmd, block, bytes);
+    }
+    // Orphans buffer and fills it with bytes, used for instance data packed on the recording thread
+    void bufferData(GLenum target, GLuint buffer, const void* bytes, size_t size) {
+        Command& cmd = push(CmdType::BufferData, target, buffer);
+        append(cmd, bytes, size);
+    }
+    // Reserves size bytes for the buffer upload and returns where to write them (valid until the next
+    // command is recorded), avoids packing into a temporary first
+    uint8_t* bufferData(GLenum target, GLuint buffer, size_t size) {
+        Command& cmd = push(CmdType::BufferData, target, buffer);
+        append(cmd, nullptr, size);
+        return data.data() + cmd.offset;
+    }
+    void drawElements(GLenum mode, GLsizei count, size_t indexOffset = 0) { push(CmdType::DrawElements, mode, (uint32_t)count, (uint32_t)indexOffset); }
+    void drawElementsInstanced(GLenum mode, GLsizei count, GLsizei instances, size_t indexOffset = 0) { push(CmdType::DrawElementsInstanced, mode, (uint32_t)count, (uint32_t)indexOffset, (uint32_t)instances); }
+    void drawArrays(GLenum mode, GLint first, GLsizei count) { push(CmdType::DrawArrays, mode, (uint32_t)first, (uint32_t)count); }
+    // Copies a w x h depth buffer between framebuffers, leaves to bound
+    void blitDepth(GLuint from, GLuint to, GLsizei w, GLsizei h) { push(CmdType::BlitDepth, from, to, (uint32_t)w, (uint32_t)h); }
+private:
+    Command& push(CmdType type, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0, uint32_t d = 0) {
+        Command cmd;
+        cmd.type = type;
+        cmd.a = a; cmd.b = b; cmd.c = c; cmd.d = d;
+        commands.push_back(cmd);
+        return commands.back();
+    }
+    void pushUniform(GLint loc, UniformType utype, const void* v, size_t bytes) {
+        if (loc < 0) return;
+        Command& cmd = push(CmdType::Uniform, (uint32_t)loc);
+        cmd.utype = utype;
+        append(cmd, v, bytes);
+    }
+    void append(Command& cmd, const void* bytes, size_t size) {
+        // Keep payloads 16-byte aligned so they can be read back as floats / matrices
+        size_t offset = (data.size() + 15) & ~(size_t)15;
+        data.resize(offset + size);
+        if (bytes) memcpy(data.data() + offset, bytes, size);
+        cmd.offset = (uint32_t)offset;
+        cmd.size = (uint32_t)size;
+    }
+};
+
+// Issues recorded commands as GL calls, skipping redundant program / VAO binds across lists
+struct GLBackend {
+    GLuint program = 0, vao = 0;
+    void useProgram(GLuint p) { if (p != program) glUseProgram(program = p); }
+    void bindVertexArray(GLuint v) { if (v != vao) glBindVertexArray(vao = v); }
+    void bindTexture(GLuint unit, GLenum target, GLuint texture) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, texture);
+    }
+    void bindFramebuffer(GLuint fbo) { glBindFramebuffer(GL_FRAMEBUFFER, fbo); }
+    void viewport(GLint x, GLint y, GLsizei w, GLsizei h) { glViewport(x, y, w, h); }
+    void clear(GLbitfield mask) { glClear(mask); }
+    void cullFace(GLenum face) { glCullFace(face); }
+    void uniform(GLint loc, UniformType type, const void* v) {
+        const float* f = (const float*)v;
+        switch (type) {
+            case UniformType::Int: glUniform1i(loc, *(const GLint*)v); break;
+            case UniformType::UInt: glUniform1ui(loc, *(const GLuint*)v); break;
+            case UniformType::Float: glUniform1f(loc, f[0]); break;
+            case UniformType::Vec2: glUniform2f(loc, f[0], f[1]); break;
+            case UniformType::Vec3: glUniform3f(loc, f[0], f[1], f[2]); break;
+            case UniformType::Vec4: glUniform4f(loc, f[0], f[1], f[2], f[3]); break;
+            case UniformType::Mat4: glUniformMatrix4fv(loc, 1, true, f); break;
+        }
+    }
+    void uniformBlock(GLuint binding, GLuint buffer, const void* block, size_t size) {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, size, block, GL_STREAM_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+    }
+    void bufferData(GLenum target, GLuint buffer, const void* bytes, size_t size) {
+        glBindBuffer(target, buffer);
+        glBufferData(target, size, bytes, GL_STREAM_DRAW);
+        glBindBuffer(target, 0);
+    }
+    void drawElements(GLenum mode, GLsizei count, size_t indexOffset) { glDrawElements(mode, count, GL_UNSIGNED_INT, (GLvoid*)indexOffset); }
+    void drawElementsInstanced(GLenum mode, GLsizei count, GLsizei instances, size_t indexOffset) { glDrawElementsInstanced(mode, count, GL_UNSIGNED_INT, (GLvoid*)indexOffset, instances); }
+    void drawArrays(GLenum mode, GLint first, GLsizei count) { glDrawArrays(mode, first, count); }
+    void blitDepth(GLuint from, GLuint to, GLsizei w, GLsizei h) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, from);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, to);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, to);
+    }
+    // Leaves GL in the unbound state the rest of the code expects
+    void finish() {
+        glBindVertexArray(vao = 0);
+        program = 0;
+    }
+};
+
+// Backend that only counts, for the performance readout or for checking lists without GL
+struct CommandStats {
+    int commands = 0, draws = 0, instances = 0, stateChanges = 0, uniforms = 0;
+    size_t uploadBytes = 0, blitBytes = 0;
+    void useProgram(GLuint) { commands++; stateChanges++; }
+    void bindVertexArray(GLuint) { commands++; stateChanges++; }
+    void bindTexture(GLuint, GLenum, GLuint) { commands++; stateChanges++; }
+    void bindFramebuffer(GLuint) { commands++; stateChanges++; }
+    void viewport(GLint, GLint, GLsizei, GLsizei) { commands++; }
+    void clear(GLbitfield) { commands++; }
+    void cullFace(GLenum) { commands++; stateChanges++; }
+    void uniform(GLint, UniformType, const void*) { commands++; uniforms++; }
+    void uniformBlock(GLuint, GLuint, const void*, size_t size) { commands++; uniforms++; uploadBytes += size; }
+    void bufferData(GLenum, GLuint, const void*, size_t size) { commands++; uploadBytes += size; }
+    void drawElements(GLenum, GLsizei, size_t) { commands++; draws++; instances++; }
+    void drawElementsInstanced(GLenum, GLsizei, GLsizei n, size_t) { commands++; draws++; instances += n; }
+    void drawArrays(GLenum, GLint, GLsizei) { commands++; draws++; instances++; }
+    void blitDepth(GLuint, GLuint, GLsizei w, GLsizei h) { commands++; stateChanges++; blitBytes += (size_t)w * h * 2; }
+    void finish() { }
+};
+
+template <typename Backend>
+void replay(const CommandList& list, Backend& backend) {
+    const uint8_t* data = list.data.data();
+    for (const Command& cmd : list.commands) {
+        switch (cmd.type) {
+            case CmdType::UseProgram: backend.useProgram(cmd.a); break;
+            case CmdType::BindVertexArray: backend.bindVertexArray(cmd.a); break;
+            case CmdType::BindTexture: backend.bindTexture(cmd.a, cmd.b, cmd.c); break;
+            case CmdType::BindFramebuffer: backend.bindFramebuffer(cmd.a); break;
+            case CmdType::Viewport: backend.viewport((GLint)cmd.a, (GLint)cmd.b, (GLsizei)cmd.c, (GLsizei)cmd.d); break;
+            case CmdType::Clear: backend.clear(cmd.a); break;
+            case CmdType::CullFace: backend.cullFace(cmd.a); break;
+            case CmdType::Uniform: backend.uniform((GLint)cmd.a, cmd.utype, data + cmd.offset); break;
+            case CmdType::UniformBlock: backend.uniformBlock(cmd.a, cmd.b, data + cmd.offset, cmd.size); break;
+            case CmdType::BufferData: backend.bufferData(cmd.a, cmd.b, data + cmd.offset, cmd.size); break;
+            case CmdType::DrawElements: backend.drawElements(cmd.a, (GLsizei)cmd.b, cmd.c); break;
+            case CmdType::DrawElementsInstanced: backend.drawElementsInstanced(cmd.a, (GLsizei)cmd.b, (GLsizei)cmd.d, cmd.c); break;
+            case CmdType::DrawArrays: backend.drawArrays(cmd.a, (GLint)cmd.b, (GLsizei)cmd.c); break;
+            case CmdType::BlitDepth: backend.blitDepth(cmd.a, cmd.b, (GLsizei)cmd.c, (GLsizei)cmd.d); break;
+        }
+    }
+}
+
+// Replays lists in the order given, regardless of the order they finished recording in
+template <typename Backend>
+void replay(const vector<CommandList>& lists, Backend& backend) {
+    for (const CommandList& list : lists)
+        replay(list, backend);
+    backend.finish();
+}
+
+// Runs one recorder per list on the pool, lists[i] is only ever touched by recorders[i]
+inline void recordParallel(ThreadPool& pool, vector<CommandList>& lists, const vector<std::function<void(CommandList&)>>& recorders) {
+    lists.resize(recorders.size());
+    pool.parallelFor((int)recorders.size(), [&](int begin, int end, int) {
+        for (int i = begin; i < end; i++) {
+            lists[i].clear();
+            recorders[i](lists[i]);
+        }
+    });
+}
+
+#endif
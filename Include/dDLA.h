@@ -0,0 +1,323 @@
+// dDLA.h - Headless off-lattice diffusion-limited aggregation with hashed stick tests
+
+#ifndef DDLA_HDR
+#define DDLA_HDR
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <atomic>
+#include "VecMat.h"
+#include "dRandom.h"
+
+using std::vector;
+
+/* DLASim is dlaFractal's simulation without the window:
+ - Walkers spawn one per step anywhere in the [-1, 1] cube (at most maxWalkers alive or queued),
+   take speedSteps substeps of length speed in a random direction each step, wrapping at the walls,
+   and stick once within range of an aggregate particle. Stuck particles join the aggregate at
+   once, so later walkers in the same step already see them
+ - Spawning stops when the aggregate comes within range of a wall, the run ends when the last
+   walker has stuck
+ - Stick tests go through AggregateHash: a hashed grid of range wide cells, each cell a linked list
+   of its aggregate particles, appended to as particles stick. Sticking also adds the 26 cells
+   around the particle, so a walker whose own cell isn't in the table is out of range after one
+   lookup, otherwise it checks the 27 cells around it. Cost depends on the local density, not the
+   aggregate size
+ - useHash = false tests every aggregate particle instead, the brute force reference. Both use the
+   same d^2 <= range^2 test and the same random stream, so they grow the same aggregate
+ - An OccupancyPyramid (finest cells about 2 * range wide, each level up twice as wide) bounds how
+   far a walker is from the aggregate. A walker with more clearance than a step's travel jumps
+   instead: it moves its clearance less range in a direction uniform on the sphere, where a walk
+   started at the center of that (aggregate free) ball first leaves it. The aggregate only sees
+   where walkers end up, so this grows statistically the same clusters in far fewer steps.
+   useJumps = false keeps the small step walk as the reference; jumps don't replay the same random
+   stream, compare statistics
+ - massDimension() and gyrationRadius() give those statistics for a grown aggregate
+ - snapshot() copies everything a run needs to continue into a DLASnapshot, restore() picks it up
+   again exactly where it was (the spatial structures are rebuilt from the aggregate). Since the
+   aggregate only grows, a snapshot refilled from the same run only copies what stuck since
+*/
+
+// Settings, random state, walkers and aggregate of a DLASim (colors follow from the order)
+struct DLASnapshot {
+	float particleSize = 0.05f, speed = 0.01f;
+	int speedSteps = 5, maxWalkers = 200, budget = 0;
+	bool useHash = true, useJumps = true, spawning = true;
+	uint64_t rngState = 0, rngInc = 0;
+	vector<vec3> walkers, aggregate;
+	uint64_t run = 0; // the run aggregate was copied from, not saved
+};
+
+struct AggregateHash {
+	float cellSize = 1.0f;
+	vector<int> next; // next[i] is the particle after i in its cell, -1 at the end
+	void reset(float size) {
+		cellSize = size;
+		next.clear();
+		keys.assign(1024, EMPTY);
+		heads.assign(1024, -1);
+		cells = 0;
+	}
+	// Adds particle index (which must be next.size()) at p
+	void insert(vec3 p, int index) {
+		int cx = cellCoord(p.x), cy = cellCoord(p.y), cz = cellCoord(p.z);
+		// Also flags the 26 cells around it (with empty lists), see anyNear()
+		for (int z = cz - 1; z <= cz + 1; z++)
+			for (int y = cy - 1; y <= cy + 1; y++)
+				for (int x = cx - 1; x <= cx + 1; x++)
+					slotFor(key(x, y, z));
+		size_t slot = slotFor(key(cx, cy, cz));
+		next.push_back(heads[slot]);
+		heads[slot] = index;
+	}
+	// True once fn(i) is true for a particle i in the 27 cells around p
+	template <typename Fn>
+	bool anyNear(vec3 p, Fn fn) const {
+		int cx = cellCoord(p.x), cy = cellCoord(p.y), cz = cellCoord(p.z);
+		// A cell is in the table only if a particle is in it or next to it, so walkers away from the
+		// aggregate get by on one lookup
+		if (keys[find(key(cx, cy, cz))] == EMPTY) return false;
+		for (int z = cz - 1; z <= cz + 1; z++)
+			for (int y = cy - 1; y <= cy + 1; y++)
+				for (int x = cx - 1; x <= cx + 1; x++) {
+					size_t slot = find(key(x, y, z));
+					if (keys[slot] == EMPTY) continue;
+					for (int i = heads[slot]; i >= 0; i = next[i])
+						if (fn(i)) return true;
+				}
+		return false;
+	}
+	size_t cellCount() const { return cells; } // cells in the table, occupied or next to one
+private:
+	static constexpr uint64_t EMPTY = ~0ull;
+	vector<uint64_t> keys; // open addressing, linear probing, size a power of 2
+	vector<int> heads;
+	size_t cells = 0;
+	int cellCoord(float v) const { return (int)floorf(v / cellSize); }
+	static uint64_t key(int x, int y, int z) {
+		const uint64_t bias = 1 << 20, mask = (1 << 21) - 1;
+		return ((x + bias) & mask) << 42 | ((y + bias) & mask) << 21 | ((z + bias) & mask);
+	}
+	size_t find(uint64_t k) const {
+		size_t mask = keys.size() - 1, slot = (size_t)(mix64(k) & mask);
+		while (keys[slot] != EMPTY && keys[slot] != k) slot = (slot + 1) & mask;
+		return slot;
+	}
+	// Slot of key k, added (with an empty list) if missing
+	size_t slotFor(uint64_t k) {
+		size_t slot = find(k);
+		if (keys[slot] != EMPTY) return slot;
+		if (2 * (cells + 1) > keys.size()) {
+			grow();
+			slot = find(k);
+		}
+		keys[slot] = k;
+		cells++;
+		return slot;
+	}
+	void grow() {
+		vector<uint64_t> oldKeys;
+		vector<int> oldHeads;
+		oldKeys.swap(keys);
+		oldHeads.swap(heads);
+		keys.assign(oldKeys.size() * 2, EMPTY);
+		heads.assign(oldKeys.size() * 2, -1);
+		for (size_t s = 0; s < oldKeys.size(); s++) {
+			if (oldKeys[s] == EMPTY) continue;
+			size_t slot = find(oldKeys[s]);
+			keys[slot] = oldKeys[s];
+			heads[slot] = oldHeads[s];
+		}
+	}
+};
+
+// Occupancy pyramid over the [-1, 1] cube: level 0 has n^3 cells, each level above halves n, down
+// to 4. A cell is set once a point lands in it, on every level
+struct OccupancyPyramid {
+	int n = 0;
+	vector<vector<uint8_t>> levels;
+	void reset(int finest) {
+		n = 4;
+		while (2 * n <= finest) n *= 2;
+		levels.clear();
+		for (int m = n; m >= 4; m /= 2) levels.emplace_back((size_t)m * m * m, 0);
+	}
+	void occupy(vec3 p) {
+		for (int l = 0, m = n; l < (int)levels.size(); l++, m /= 2)
+			levels[l][index(m, coord(m, p.x), coord(m, p.y), coord(m, p.z))] = 1;
+	}
+	// Lower bound on the distance from p to any occupied point, across the wrap: the width of the
+	// largest cell whose 3x3x3 block around p is empty (p is at least one cell from the block's faces)
+	float clearance(vec3 p) const {
+		float clear = 0.0f;
+		for (int l = 0, m = n; l < (int)levels.size(); l++, m /= 2) {
+			int cx = coord(m, p.x), cy = coord(m, p.y), cz = coord(m, p.z);
+			for (int z = cz - 1; z <= cz + 1; z++)
+				for (int y = cy - 1; y <= cy + 1; y++)
+					for (int x = cx - 1; x <= cx + 1; x++)
+						if (levels[l][index(m, wrap(m, x), wrap(m, y), wrap(m, z))]) return clear;
+			clear = 2.0f / m; // empty on a finer level means empty above it too, so go up
+		}
+		return clear;
+	}
+private:
+	static int coord(int m, float v) {
+		int c = (int)floorf((v + 1.0f) * 0.5f * m);
+		return c < 0 ? 0 : c >= m ? m - 1 : c;
+	}
+	static int wrap(int m, int c) { return c < 0 ? c + m : c >= m ? c - m : c; }
+	static size_t index(int m, int x, int y, int z) { return ((size_t)z * m + y) * m + x; }
+};
+
+// Rainbow by particle count, as dlaFractal's getCol()
+inline vec3 dlaColor(float n) {
+	n *= 2.0f * 3.14159265f;
+	float third = 2.0f * 3.14159265f / 3.0f;
+	return vec3(0.5f * sinf(n) + 0.5f, 0.5f * sinf(n - third) + 0.5f, 0.5f * sinf(n - 2.0f * third) + 0.5f);
+}
+
+struct DLASim {
+	float particleSize = 0.05f;
+	float speed = 0.01f;
+	int speedSteps = 5;
+	int maxWalkers = 200;
+	bool useHash = true;
+	bool useJumps = true;
+	vector<vec3> walkers;
+	vector<vec3> aggregate, aggregateColor;
+	bool spawning = true; // false once the aggregate reaches a wall
+	size_t stickTests = 0; // distance tests in the last step
+	size_t jumps = 0; // walkers that jumped in the last step
+	float range() const { return 1.5f * particleSize; }
+	// Clears everything down to the seed particle at the origin
+	void reset(uint64_t seed) {
+		rng = pcg32(seed);
+		start();
+		budget = maxWalkers;
+		stick(vec3(0.0f));
+	}
+	bool finished() const { return !spawning && walkers.empty(); }
+	void snapshot(DLASnapshot& s) const {
+		s.particleSize = particleSize; s.speed = speed;
+		s.speedSteps = speedSteps; s.maxWalkers = maxWalkers; s.budget = budget;
+		s.useHash = useHash; s.useJumps = useJumps; s.spawning = spawning;
+		s.rngState = rng.state; s.rngInc = rng.inc;
+		s.walkers = walkers;
+		if (s.run == run && s.aggregate.size() <= aggregate.size())
+			s.aggregate.insert(s.aggregate.end(), aggregate.begin() + s.aggregate.size(), aggregate.end());
+		else
+			s.aggregate = aggregate;
+		s.run = run;
+	}
+	void restore(const DLASnapshot& s) {
+		particleSize = s.particleSize; speed = s.speed;
+		speedSteps = s.speedSteps; maxWalkers = s.maxWalkers;
+		useHash = s.useHash; useJumps = s.useJumps;
+		rng.state = s.rngState; rng.inc = s.rngInc;
+		start();
+		for (vec3 p : s.aggregate) stick(p);
+		walkers = s.walkers;
+		spawning = s.spawning;
+		budget = s.budget;
+	}
+	void step() {
+		if (spawning && budget > 0) {
+			walkers.push_back(rng.range(vec3(-1.0f), vec3(1.0f)));
+			budget--;
+		}
+		stickTests = 0;
+		jumps = 0;
+		for (size_t i = 0; i < walkers.size(); i++) {
+			if (!walk(walkers[i])) continue;
+			stick(walkers[i]);
+			budget++;
+			walkers.erase(walkers.begin() + i);
+			i--;
+		}
+	}
+	// True if a particle at p would stick
+	bool touches(vec3 p) {
+		float r2 = range() * range();
+		auto near = [&](int j) {
+			stickTests++;
+			vec3 d = aggregate[j] - p;
+			return dot(d, d) <= r2;
+		};
+		if (useHash) return hash.anyNear(p, near);
+		for (int j = 0; j < (int)aggregate.size(); j++)
+			if (near(j)) return true;
+		return false;
+	}
+private:
+	pcg32 rng;
+	AggregateHash hash;
+	OccupancyPyramid field;
+	int budget = 0; // walkers left to spawn
+	uint64_t run = 0; // new for every reset() or restore(), see snapshot()
+	void start() {
+		static std::atomic<uint64_t> runs{ 0 };
+		run = ++runs;
+		walkers.clear();
+		aggregate.clear();
+		aggregateColor.clear();
+		hash.reset(range());
+		field.reset(std::min(128, (int)(1.0f / range())));
+		spawning = true;
+	}
+	static float wrap(float v) { return v < -1.0f ? 1.0f : v > 1.0f ? -1.0f : v; }
+	// One step of a walker, true if it stuck
+	bool walk(vec3& p) {
+		float clear = useJumps ? field.clearance(p) - range() : 0.0f;
+		if (clear > speed * speedSteps) {
+			// Jumps wrap all the way around, a plain step only ever crosses a wall by a little
+			p += rng.direction() * clear;
+			for (float* x : {&p.x, &p.y, &p.z}) *x -= 2.0f * floorf((*x + 1.0f) / 2.0f);
+			jumps++;
+			return touches(p);
+		}
+		vec3 v = rng.direction() * speed;
+		for (int s = 0; s < speedSteps; s++) {
+			p += v;
+			p = vec3(wrap(p.x), wrap(p.y), wrap(p.z));
+			if (touches(p)) return true;
+		}
+		return false;
+	}
+	void stick(vec3 p) {
+		hash.insert(p, (int)aggregate.size());
+		aggregate.push_back(p);
+		field.occupy(p);
+		aggregateColor.push_back(dlaColor((float)(aggregate.size() - 1) / 1000.0f));
+		float edge = 1.0f - range();
+		if (fabsf(p.x) > edge || fabsf(p.y) > edge || fabsf(p.z) > edge) spawning = false;
+	}
+};
+
+// Mass-radius fractal dimension around the seed: slope of log(particles within r) against log(r),
+// least squares over radii spaced evenly in log from rMin to rMax
+inline float massDimension(const vector<vec3>& points, float rMin, float rMax, int samples = 16) {
+	vector<float> d2;
+	for (const vec3& p : points) d2.push_back(dot(p - points[0], p - points[0]));
+	std::sort(d2.begin(), d2.end());
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	for (int s = 0; s < samples; s++) {
+		float r = rMin * powf(rMax / rMin, (float)s / (samples - 1));
+		double x = log(r), y = log((double)(std::upper_bound(d2.begin(), d2.end(), r * r) - d2.begin()));
+		sx += x; sy += y; sxx += x * x; sxy += x * y;
+	}
+	return (float)((samples * sxy - sx * sy) / (samples * sxx - sx * sx));
+}
+
+// Root mean square distance from the centroid
+inline float gyrationRadius(const vector<vec3>& points) {
+	vec3 c(0.0f);
+	for (const vec3& p : points) c += p;
+	c = c / (float)points.size();
+	double sum = 0.0;
+	for (const vec3& p : points) sum += dot(p - c, p - c);
+	return (float)sqrt(sum / points.size());
+}
+
+#endif
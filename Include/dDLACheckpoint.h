@@ -0,0 +1,279 @@
+// dDLACheckpoint.h - DLASim checkpoint files written off-thread, restart, streaming PLY / XYZ export
+
+#ifndef DDLACHECKPOINT_HDR
+#define DDLACHECKPOINT_HDR
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <stdexcept>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "VecMat.h"
+#include "dDLA.h"
+
+using std::vector;
+using std::string;
+using std::runtime_error;
+using std::ifstream;
+using std::ofstream;
+
+/* Long DLA runs survive exits and crashes through checkpoints:
+ - A checkpoint file is a DLACheckpointHeader then the walkers and the aggregate as raw vec3s.
+   writeCheckpoint() writes to path + ".tmp" and renames it over path once complete, so a crash
+   mid-write leaves the previous checkpoint intact (on Windows, where rename() won't replace a
+   file, the old one is removed first, and a crash between the two leaves just the .tmp).
+   readCheckpoint() validates sizes before reading
+ - CheckpointWriter saves without pausing the simulation: submit() copies the sim into one of two
+   DLASnapshots (only the tail of the aggregate, see DLASim::snapshot()) and a background thread
+   writes it, while the next submit() can fill the other. With both buffers busy submit() skips
+   that checkpoint rather than wait. Each write leaves a CheckpointReport (copy and write time,
+   bytes) for poll()
+ - exportXYZ() / exportPLY() stream points through a small buffer, for offline analysis of
+   aggregates much bigger than a formatted string should be
+*/
+
+static const char DLA_CHECKPOINT_MAGIC[4] = { 'D', 'L', 'A', 'C' };
+static const uint32_t DLA_CHECKPOINT_VERSION = 1;
+
+struct DLACheckpointHeader {
+	char magic[4];
+	uint32_t version;
+	float particleSize, speed;
+	int32_t speedSteps, maxWalkers, budget;
+	uint8_t useHash, useJumps, spawning, pad;
+	uint64_t rngState, rngInc;
+	uint64_t numWalkers, numAggregate;
+};
+
+// Returns the bytes written
+inline size_t writeCheckpoint(string path, const DLASnapshot& s) {
+	DLACheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DLA_CHECKPOINT_MAGIC, 4);
+	header.version = DLA_CHECKPOINT_VERSION;
+	header.particleSize = s.particleSize; header.speed = s.speed;
+	header.speedSteps = s.speedSteps; header.maxWalkers = s.maxWalkers; header.budget = s.budget;
+	header.useHash = s.useHash; header.useJumps = s.useJumps; header.spawning = s.spawning;
+	header.rngState = s.rngState; header.rngInc = s.rngInc;
+	header.numWalkers = s.walkers.size(); header.numAggregate = s.aggregate.size();
+	string temp = path + ".tmp";
+	{
+		ofstream file(temp, std::ios::binary);
+		if (!file.is_open())
+			throw runtime_error("Failed to write checkpoint '" + temp + "'");
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)s.walkers.data(), s.walkers.size() * sizeof(vec3));
+		file.write((const char*)s.aggregate.data(), s.aggregate.size() * sizeof(vec3));
+		if (!file)
+			throw runtime_error("Failed to write checkpoint '" + temp + "'");
+	}
+#ifdef _WIN32
+	std::remove(path.c_str()); // rename() won't replace a file here, elsewhere it replaces atomically
+#endif
+	if (std::rename(temp.c_str(), path.c_str()) != 0)
+		throw runtime_error("Failed to rename checkpoint '" + temp + "' to '" + path + "'");
+	return sizeof(header) + (s.walkers.size() + s.aggregate.size()) * sizeof(vec3);
+}
+
+inline void readCheckpoint(string path, DLASnapshot& s) {
+	ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		throw runtime_error("Failed to open checkpoint '" + path + "'");
+	uint64_t size = (uint64_t)file.tellg();
+	file.seekg(0);
+	DLACheckpointHeader header;
+	if (size < sizeof(header) || !file.read((char*)&header, sizeof(header)))
+		throw runtime_error("Truncated checkpoint '" + path + "'");
+	if (memcmp(header.magic, DLA_CHECKPOINT_MAGIC, 4) != 0 || header.version != DLA_CHECKPOINT_VERSION)
+		throw runtime_error("Unsupported checkpoint '" + path + "'");
+	uint64_t points = (size - sizeof(header)) / sizeof(vec3);
+	if (header.numWalkers > points || header.numAggregate > points - header.numWalkers || header.numAggregate == 0)
+		throw runtime_error("Truncated checkpoint '" + path + "'");
+	s.particleSize = header.particleSize; s.speed = header.speed;
+	s.speedSteps = header.speedSteps; s.maxWalkers = header.maxWalkers; s.budget = header.budget;
+	s.useHash = header.useHash != 0; s.useJumps = header.useJumps != 0; s.spawning = header.spawning != 0;
+	s.rngState = header.rngState; s.rngInc = header.rngInc;
+	s.walkers.resize((size_t)header.numWalkers);
+	s.aggregate.resize((size_t)header.numAggregate);
+	s.run = 0;
+	file.read((char*)s.walkers.data(), s.walkers.size() * sizeof(vec3));
+	file.read((char*)s.aggregate.data(), s.aggregate.size() * sizeof(vec3));
+	if (!file)
+		throw runtime_error("Failed to read checkpoint '" + path + "'");
+}
+
+struct CheckpointReport {
+	int index = 0; // submit() calls that were written, from 1
+	size_t particles = 0, walkers = 0, bytes = 0;
+	float copyMs = 0.0f; // on the simulation thread, in submit()
+	float writeMs = 0.0f; // on the writer thread
+	string error; // empty if written
+};
+
+struct CheckpointWriter {
+	int skipped = 0; // submit() calls that found both buffers busy
+	CheckpointWriter() : thread([this] { writeLoop(); }) { }
+	~CheckpointWriter() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		thread.join();
+	}
+	CheckpointWriter(const CheckpointWriter&) = delete;
+	CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+	// Snapshots sim for the writer thread to save at path, false if skipped
+	bool submit(const DLASim& sim, string path) {
+		Buffer* b = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (Buffer& buffer : buffers)
+				if (buffer.state == FREE) b = &buffer;
+		}
+		if (!b) {
+			skipped++;
+			return false;
+		}
+		// Free buffers are only touched from this thread
+		auto start = std::chrono::steady_clock::now();
+		sim.snapshot(b->snapshot);
+		b->path = path;
+		b->report = CheckpointReport();
+		b->report.index = ++submitted;
+		b->report.copyMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			b->state = QUEUED;
+			queue.push_back(b);
+		}
+		wake.notify_all();
+		return true;
+	}
+	// Waits until everything submitted is written
+	void flush() {
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this] { return queue.empty() && !writing; });
+	}
+	// Next finished checkpoint's report, false if there is none yet
+	bool poll(CheckpointReport& r) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (reports.empty()) return false;
+		r = reports.front();
+		reports.pop_front();
+		return true;
+	}
+private:
+	enum State { FREE, QUEUED, WRITING };
+	struct Buffer {
+		State state = FREE;
+		DLASnapshot snapshot;
+		string path;
+		CheckpointReport report;
+	};
+	Buffer buffers[2];
+	std::deque<Buffer*> queue;
+	std::deque<CheckpointReport> reports;
+	int submitted = 0;
+	bool writing = false, stopping = false;
+	std::mutex mutex;
+	std::condition_variable wake, idle;
+	std::thread thread; // last, so it starts after everything above
+	void writeLoop() {
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;) {
+			wake.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (queue.empty()) return; // stopping, and nothing left to write
+			Buffer* b = queue.front();
+			queue.pop_front();
+			b->state = WRITING;
+			writing = true;
+			lock.unlock();
+			auto start = std::chrono::steady_clock::now();
+			try {
+				b->report.bytes = writeCheckpoint(b->path, b->snapshot);
+			}
+			catch (runtime_error& e) {
+				b->report.error = e.what();
+			}
+			b->report.writeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			b->report.particles = b->snapshot.aggregate.size();
+			b->report.walkers = b->snapshot.walkers.size();
+			lock.lock();
+			reports.push_back(b->report);
+			b->state = FREE;
+			writing = false;
+			idle.notify_all();
+		}
+	}
+};
+
+// Streams text or binary through a fixed buffer
+struct StreamOut {
+	ofstream file;
+	string path;
+	vector<char> buffer;
+	size_t used = 0;
+	StreamOut(string path) : file(path, std::ios::binary), path(path), buffer(1 << 16) {
+		if (!file.is_open())
+			throw runtime_error("Failed to write '" + path + "'");
+	}
+	void write(const void* data, size_t bytes) {
+		if (used + bytes > buffer.size()) drain();
+		memcpy(buffer.data() + used, data, bytes);
+		used += bytes;
+	}
+	template <typename... Args>
+	void print(const char* format, Args... args) {
+		if (used + 256 > buffer.size()) drain();
+		int n = snprintf(buffer.data() + used, 256, format, args...);
+		used += n > 0 ? std::min(n, 255) : 0;
+	}
+	void finish() {
+		drain();
+		file.flush();
+		if (!file)
+			throw runtime_error("Failed to write '" + path + "'");
+	}
+private:
+	void drain() {
+		file.write(buffer.data(), used);
+		used = 0;
+	}
+};
+
+// One "x y z" line per point
+inline void exportXYZ(string path, const vector<vec3>& points) {
+	StreamOut out(path);
+	for (const vec3& p : points) out.print("%.6g %.6g %.6g\n", p.x, p.y, p.z);
+	out.finish();
+}
+
+// Binary little endian PLY vertices, float x y z and uchar red green blue (if colors isn't empty)
+inline void exportPLY(string path, const vector<vec3>& points, const vector<vec3>& colors) {
+	StreamOut out(path);
+	bool colored = colors.size() == points.size() && !points.empty();
+	out.print("ply\nformat binary_little_endian 1.0\nelement vertex %llu\n", (unsigned long long)points.size());
+	out.print("property float x\nproperty float y\nproperty float z\n");
+	if (colored) out.print("property uchar red\nproperty uchar green\nproperty uchar blue\n");
+	out.print("end_header\n");
+	for (size_t i = 0; i < points.size(); i++) {
+		out.write(&points[i].x, 3 * sizeof(float));
+		if (colored) {
+			uint8_t rgb[3];
+			const float* c = &colors[i].x;
+			for (int k = 0; k < 3; k++) rgb[k] = (uint8_t)(std::min(std::max(c[k], 0.0f), 1.0f) * 255.0f + 0.5f);
+			out.write(rgb, 3);
+		}
+	}
+	out.finish();
+}
+
+#endif
@@ -0,0 +1,194 @@
+// dFluidGrid.h - Voxel water as a cellular automaton over a flat, padded, double-buffered grid
+
+#ifndef DFLUIDGRID_HDR
+#define DFLUIDGRID_HDR
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include "dSimd.h"
+#include "dThreadPool.h"
+
+using std::vector;
+
+/* FluidGrid holds a water level per cell of a width x height x depth grid (y is up):
+ - Levels are one flat float array, x fastest, padded by a ring of blocks on every side and rows
+   padded to a multiple of 4 (plus the x + 1 overread) for float4. Blocks are stored as level -1,
+   so there is no separate cell type array: a cell is open if its level is >= 0
+ - A step is two double-buffered passes, each reading one buffer and writing the other:
+   verticalFlow() pairs each cell with the one above (even pairs on even steps, odd on odd steps,
+   so every cell is in one pair per step) and shares the pair's water the way it settles: the lower
+   cell up to full, then slightly compressed (MAX_COMPRESS per cell of water above), so a column
+   pushes water back up when squeezed. That is the downward and upward flow in one
+   sidewaysFlow() moves FLOW * (neighbor - cell) across each open x and z face whose levels differ
+   by more than MIN_FLOW. Both passes move water between pairs of cells by amounts computed the
+   same way from either side, so water is only ever moved, never made or lost (up to rounding)
+ - Both passes run over x-rows with float4, and over z-slabs on a ThreadPool
+ - A row is active if it or one of its 8 neighbor rows in y and z changed in either of the last two
+   steps (the vertical pairs alternate, so one quiet step isn't proof of rest). Changes below
+   MIN_FLOW / EPSILON aren't made at all, so settled water ends bit-for-bit unchanged and its rows
+   drop out: inactive rows are skipped, their two buffers already agree
+*/
+
+struct FluidGrid {
+	static constexpr float MAX_COMPRESS = 0.02f; // extra water a full cell holds per full cell above it
+	static constexpr float FLOW = 0.2f; // fraction of a level difference crossing a side face per step, < 1/4
+	static constexpr float MIN_FLOW = 0.005f; // side differences below this don't flow
+	static constexpr float EPSILON = 1e-4f; // vertical changes below this aren't made
+	static constexpr float BLOCK = -1.0f;
+	int width = 0, height = 0, depth = 0;
+	bool useActive = true; // false runs every row, for comparing
+	size_t rowsUpdated = 0; // rows run in the last step
+	void resize(int w, int h, int d) {
+		width = w; height = h; depth = d;
+		stride = (w + 5 + 3) & ~3; // pads at x = 0 and past w, room to read x + 1 of the last float4
+		rowsPerSlab = h + 2;
+		rows = (size_t)rowsPerSlab * (d + 2);
+		for (vector<float>& l : levels) l.assign(rows * stride, BLOCK);
+		for (int z = 1; z <= d; z++)
+			for (int y = 1; y <= h; y++)
+				for (vector<float>& l : levels) std::fill(l.begin() + index(1, y, z), l.begin() + index(w + 1, y, z), 0.0f);
+		// Only interior rows start changed, the padding rows around them are never aged
+		history.assign(rows, 0);
+		for (int z = 1; z <= d; z++)
+			for (int y = 1; y <= h; y++) history[row(y, z)] = 3;
+		active.assign(rows, 1);
+		current = 0;
+		steps = 0;
+	}
+	size_t rowCount() const { return (size_t)width > 0 ? (size_t)height * depth : 0; }
+	size_t memoryBytes() const { return 2 * levels[0].size() * sizeof(float) + history.size() + active.size(); }
+	// Cells are 0-based here, the padding is internal
+	bool inside(int x, int y, int z) const { return x >= 0 && x < width && y >= 0 && y < height && z >= 0 && z < depth; }
+	bool block(int x, int y, int z) const { return levels[current][index(x + 1, y + 1, z + 1)] < 0.0f; }
+	float level(int x, int y, int z) const { return std::max(0.0f, levels[current][index(x + 1, y + 1, z + 1)]); }
+	void setBlock(int x, int y, int z, bool solid) {
+		if (!inside(x, y, z)) return;
+		setCell(x, y, z, solid ? BLOCK : 0.0f);
+	}
+	// Adds to an open cell (a negative amount takes water away, down to empty)
+	void addWater(int x, int y, int z, float amount) {
+		if (!inside(x, y, z) || block(x, y, z)) return;
+		setCell(x, y, z, std::max(0.0f, level(x, y, z) + amount));
+	}
+	double totalWater() const {
+		double total = 0.0;
+		for (float l : levels[current]) if (l > 0.0f) total += l;
+		return total;
+	}
+	// Current levels, padded: cell (x, y, z) is at data()[((z + 1) * (height + 2) + y + 1) * rowStride() + x + 1]
+	const float* data() const { return levels[current].data(); }
+	int rowStride() const { return stride; }
+	void step(ThreadPool* pool = nullptr) {
+		int slots = pool ? pool->size() : 1;
+		updated.assign(slots, 0);
+		auto run = [&](int begin, int end, const std::function<void(int, int)>& pass) {
+			auto slab = [&](int b, int e, int slot) { for (int z = b; z < e; z++) pass(z + 1, slot); };
+			if (pool) pool->parallelFor(end - begin, [&](int b, int e, int slot) { slab(begin + b, begin + e, slot); }, 2);
+			else slab(begin, end, 0);
+		};
+		run(0, depth, [&](int z, int) { findActive(z); });
+		int from = current, to = 1 - current;
+		run(0, depth, [&](int z, int slot) { verticalFlow(z, levels[from], levels[to], updated[slot]); });
+		run(0, depth, [&](int z, int) { sidewaysFlow(z, levels[to], levels[from]); });
+		// Both passes done, so the result is back in levels[current]
+		rowsUpdated = 0;
+		for (size_t u : updated) rowsUpdated += u;
+		steps++;
+	}
+private:
+	vector<float> levels[2];
+	vector<uint8_t> history; // per row, bit 0 set if it changed in the last step, bit 1 the step before
+	vector<uint8_t> active;
+	vector<size_t> updated;
+	int current = 0;
+	int stride = 0, rowsPerSlab = 0;
+	size_t rows = 0;
+	uint64_t steps = 0;
+	size_t row(int y, int z) const { return (size_t)z * rowsPerSlab + y; }
+	size_t index(int x, int y, int z) const { return row(y, z) * stride + x; }
+	void setCell(int x, int y, int z, float value) {
+		for (vector<float>& l : levels) l[index(x + 1, y + 1, z + 1)] = value;
+		history[row(y + 1, z + 1)] = 3;
+	}
+	void findActive(int z) {
+		for (int y = 1; y <= height; y++) {
+			uint8_t a = !useActive;
+			for (int zz = z - 1; zz <= z + 1 && !a; zz++)
+				for (int yy = y - 1; yy <= y + 1; yy++) a |= history[row(yy, zz)];
+			active[row(y, z)] = a != 0;
+		}
+	}
+	// Downward and upward flow: pairs (y, y + 1) starting at y = 1 on even steps, y = 2 on odd ones
+	void verticalFlow(int z, const vector<float>& in, vector<float>& out, size_t& count) {
+		for (int y = 1; y <= height; y++) history[row(y, z)] = (uint8_t)(history[row(y, z)] << 1 & 2);
+		const float4 zero = splat4(0.0f), one = splat4(1.0f), compress = splat4(MAX_COMPRESS);
+		const float4 squeezed = splat4(2.0f + MAX_COMPRESS), epsilon = splat4(EPSILON), half = splat4(0.5f);
+		const float4 keep = splat4(1.0f / (1.0f + MAX_COMPRESS)), absMask = splatBits4(0x7fffffffu);
+		int y = 1 + (int)(steps & 1);
+		if (y == 2) copyRow(1, z, in, out);
+		for (; y <= height; y += 2) {
+			if (y == height) {
+				copyRow(y, z, in, out);
+				break;
+			}
+			size_t lowerRow = row(y, z), upperRow = row(y + 1, z);
+			if (!active[lowerRow] && !active[upperRow]) continue;
+			count += 2;
+			const float* l = &in[lowerRow * stride];
+			const float* u = &in[upperRow * stride];
+			float* lo = &out[lowerRow * stride];
+			float* uo = &out[upperRow * stride];
+			float4 moved = zero;
+			for (int x = 0; x < stride; x += 4) {
+				float4 lv = load4(l + x), uv = load4(u + x), total = lv + uv;
+				float4 open = bitsAnd(greaterThan(lv, splat4(-0.5f)), greaterThan(uv, splat4(-0.5f)));
+				// What the lower cell holds once the pair has settled: all of it up to full, then full
+				// plus its share of the compression, then half of everything once both are full
+				float4 settled = select(greaterThan(total, squeezed), (total + compress) * half, (one + total * compress) * keep);
+				float4 lower = min4(total, select(greaterThan(total, one), settled, one));
+				float4 move = bitsAnd(open, greaterThan(bitsAnd(lower - lv, absMask), epsilon));
+				store4(lo + x, select(move, lower, lv));
+				store4(uo + x, select(move, total - lower, uv));
+				moved = bitsOr(moved, move);
+			}
+			if (moveMask(moved)) {
+				history[lowerRow] |= 1;
+				history[upperRow] |= 1;
+			}
+		}
+	}
+	void copyRow(int y, int z, const vector<float>& in, vector<float>& out) {
+		size_t r = row(y, z);
+		if (active[r]) std::copy(in.begin() + r * stride, in.begin() + (r + 1) * stride, out.begin() + r * stride);
+	}
+	// Flow across the 4 side faces, out of each cell by what its neighbors gain
+	void sidewaysFlow(int z, const vector<float>& in, vector<float>& out) {
+		const float4 zero = splat4(0.0f), flow = splat4(FLOW), minFlow = splat4(MIN_FLOW), absMask = splatBits4(0x7fffffffu);
+		const float4 solid = splat4(-0.5f);
+		size_t slab = (size_t)rowsPerSlab * stride;
+		for (int y = 1; y <= height; y++) {
+			size_t r = row(y, z);
+			if (!active[r]) continue;
+			const float* c = &in[r * stride];
+			float* o = &out[r * stride];
+			float4 moved = zero;
+			// x = 0 and the lanes past width are padding, blocks never flow
+			for (int x = 0; x < stride - 4; x += 4) {
+				float4 a = load4(c + x), sum = zero;
+				float4 open = greaterThan(a, solid);
+				for (const float* n : {c + x - 1, c + x + 1, c + x - slab, c + x + slab}) {
+					float4 nv = load4(n), d = nv - a;
+					float4 ok = bitsAnd(bitsAnd(open, greaterThan(nv, solid)), greaterThan(bitsAnd(d, absMask), minFlow));
+					sum += select(ok, flow * d, zero);
+					moved = bitsOr(moved, ok);
+				}
+				store4(o + x, a + sum);
+			}
+			if (moveMask(moved)) history[r] |= 1;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,255 @@
+// dFluidMesh.h - Surface meshes for a SparseFluidGrid: greedy block faces, water isosurface, remeshed per dirty brick
+
+#ifndef DFLUIDMESH_HDR
+#define DFLUIDMESH_HDR
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "VecMat.h"
+#include "dThreadPool.h"
+#include "dSparseFluid.h"
+
+using std::vector;
+
+/* FluidMesher turns a SparseFluidGrid into triangles, one chunk per 8^3 brick:
+ - Blocks get a greedy mesher: per axis, direction and slice of a chunk, the faces of blocks with an
+   open neighbor are merged into the largest rectangles that cover them, two triangles each
+ - Water gets an isosurface of its level (capped at 1, blocks and outside the grid count as 0) at
+   isoLevel, sampled at cell centers. Each cube of 8 samples is split into 6 tetrahedra around its
+   main diagonal, the same way in every cube, so the surface is closed across cubes and chunks, and
+   each tetrahedron needs at most 2 triangles, no case table. Normals come from the level's gradient
+ - update() remeshes only the chunks around bricks whose change stamp (SparseFluidGrid::brickChanged())
+   is past the last update, a chunk reads a 2 cell margin past its brick so it depends on its 26
+   neighbors. The dirty chunks are meshed over a ThreadPool, each into its own ChunkMesh
+ - Chunks are drawn in regions of REGION^3 bricks: update() lists the regions that changed, and
+   regionMesh() gathers a region's chunks into one buffer of block and one of water triangles, for
+   a renderer to upload and draw with a couple of calls per region
+*/
+
+struct MeshVertex {
+	vec3 point, normal;
+};
+
+struct ChunkMesh {
+	vector<MeshVertex> blocks, water; // triangles
+};
+
+struct FluidMesher {
+	static const int REGION = 4; // bricks per side of a region
+	vec3 offset = vec3(0, 0, 0); // a vertex is at offset + scale * (its grid position), cell i spans [i, i + 1]
+	float scale = 1.0f;
+	float isoLevel = 0.5f;
+	size_t bricksMeshed = 0; // in the last update()
+	// Remeshes what changed since the last call, returns the regions to upload again
+	const vector<int>& update(const SparseFluidGrid& grid, ThreadPool* pool = nullptr) {
+		if (grid.bricksX() != bw || grid.bricksY() != bh || grid.bricksZ() != bd) {
+			bw = grid.bricksX(); bh = grid.bricksY(); bd = grid.bricksZ();
+			rw = (bw + REGION - 1) / REGION; rh = (bh + REGION - 1) / REGION; rd = (bd + REGION - 1) / REGION;
+			chunks.assign((size_t)bw * bh * bd, ChunkMesh());
+			dirty.assign(chunks.size(), 0);
+			seen = 0;
+		}
+		dirtyBricks.clear();
+		for (int z = 0; z < bd; z++)
+			for (int y = 0; y < bh; y++)
+				for (int x = 0; x < bw; x++) {
+					if (grid.brickChanged(x, y, z) <= seen) continue;
+					for (int zz = std::max(0, z - 1); zz <= std::min(bd - 1, z + 1); zz++)
+						for (int yy = std::max(0, y - 1); yy <= std::min(bh - 1, y + 1); yy++)
+							for (int xx = std::max(0, x - 1); xx <= std::min(bw - 1, x + 1); xx++) {
+								int b = brickIndex(xx, yy, zz);
+								if (!dirty[b]) dirtyBricks.push_back(b);
+								dirty[b] = 1;
+							}
+				}
+		auto mesh = [&](int begin, int end, int) { for (int i = begin; i < end; i++) meshBrick(grid, dirtyBricks[i]); };
+		if (pool) pool->parallelFor((int)dirtyBricks.size(), mesh, 4);
+		else mesh(0, (int)dirtyBricks.size(), 0);
+		dirtyRegions.clear();
+		vector<uint8_t> listed((size_t)rw * rh * rd, 0);
+		for (int b : dirtyBricks) {
+			dirty[b] = 0;
+			int r = regionOf(b);
+			if (!listed[r]) dirtyRegions.push_back(r);
+			listed[r] = 1;
+		}
+		bricksMeshed = dirtyBricks.size();
+		seen = grid.changeStamp();
+		return dirtyRegions;
+	}
+	int regionCount() const { return rw * rh * rd; }
+	void regionMesh(int region, vector<MeshVertex>& blocks, vector<MeshVertex>& water) const {
+		blocks.clear();
+		water.clear();
+		int rx = region % rw, ry = region / rw % rh, rz = region / (rw * rh);
+		for (int z = rz * REGION; z < std::min(bd, (rz + 1) * REGION); z++)
+			for (int y = ry * REGION; y < std::min(bh, (ry + 1) * REGION); y++)
+				for (int x = rx * REGION; x < std::min(bw, (rx + 1) * REGION); x++) {
+					const ChunkMesh& c = chunks[brickIndex(x, y, z)];
+					blocks.insert(blocks.end(), c.blocks.begin(), c.blocks.end());
+					water.insert(water.end(), c.water.begin(), c.water.end());
+				}
+	}
+	const ChunkMesh& chunk(int bx, int by, int bz) const { return chunks[brickIndex(bx, by, bz)]; }
+private:
+	static const int S = 12; // samples per side of a chunk, its 8 cells and 2 either side
+	int bw = -1, bh = -1, bd = -1, rw = 0, rh = 0, rd = 0;
+	vector<ChunkMesh> chunks;
+	vector<uint8_t> dirty;
+	vector<int> dirtyBricks, dirtyRegions;
+	uint64_t seen = 0;
+	int brickIndex(int bx, int by, int bz) const { return (bz * bh + by) * bw + bx; }
+	int regionOf(int b) const {
+		int bx = b % bw, by = b / bw % bh, bz = b / (bw * bh);
+		return (bz / REGION * rh + by / REGION) * rw + bx / REGION;
+	}
+	static int sample(int x, int y, int z) { return (z * S + y) * S + x; }
+	vec3 world(vec3 g) const { return offset + scale * g; }
+	void meshBrick(const SparseFluidGrid& grid, int b) {
+		int bx = b % bw, by = b / bw % bh, bz = b / (bw * bh);
+		int ox = bx * 8 - 2, oy = by * 8 - 2, oz = bz * 8 - 2; // grid cell of sample (0, 0, 0)
+		ChunkMesh& mesh = chunks[b];
+		mesh.blocks.clear();
+		mesh.water.clear();
+		bool empty = true;
+		for (int z = std::max(0, bz - 1); z <= std::min(bd - 1, bz + 1) && empty; z++)
+			for (int y = std::max(0, by - 1); y <= std::min(bh - 1, by + 1) && empty; y++)
+				for (int x = std::max(0, bx - 1); x <= std::min(bw - 1, bx + 1) && empty; x++) empty = grid.brickEmpty(x, y, z);
+		if (empty) return;
+		float field[S * S * S];
+		uint8_t solid[S * S * S];
+		grid.gather(ox, oy, oz, S, field, solid);
+		for (float& f : field) f = std::min(1.0f, f);
+		bool blocks = false, wet = false, dry = false; // in the brick, and in the corners of its cubes
+		for (int z = 2; z <= 9; z++)
+			for (int y = 2; y <= 9; y++)
+				for (int x = 2; x <= 9; x++) blocks |= solid[sample(x, y, z)] != 0;
+		for (int z = 1; z <= 10; z++)
+			for (int y = 1; y <= 10; y++)
+				for (int x = 1; x <= 10; x++) {
+					bool in = field[sample(x, y, z)] > isoLevel;
+					wet |= in;
+					dry |= !in;
+				}
+		if (blocks) meshBlocks(solid, vec3((float)ox, (float)oy, (float)oz), mesh.blocks);
+		if (!wet || !dry) return;
+		// Cubes from each sample in the brick to the next along every axis. The first brick on an
+		// axis also takes the cubes from the cell outside the grid, to close the surface there
+		int lo[3] = { bx ? 2 : 1, by ? 2 : 1, bz ? 2 : 1 };
+		for (int z = lo[2]; z <= 9; z++)
+			for (int y = lo[1]; y <= 9; y++)
+				for (int x = lo[0]; x <= 9; x++) meshCube(field, x, y, z, vec3(ox + 0.5f, oy + 0.5f, oz + 0.5f), mesh.water);
+	}
+	// Greedy faces of the blocks in the brick (samples 2..9), against the samples around them
+	void meshBlocks(const uint8_t* solid, vec3 origin, vector<MeshVertex>& out) const {
+		for (int a = 0; a < 3; a++) {
+			int u = (a + 1) % 3, v = (a + 2) % 3;
+			for (int dir = -1; dir <= 1; dir += 2)
+				for (int k = 2; k <= 9; k++) {
+					bool mask[8][8];
+					for (int j = 0; j < 8; j++)
+						for (int i = 0; i < 8; i++) {
+							int c[3], n[3];
+							c[a] = k; c[u] = i + 2; c[v] = j + 2;
+							n[a] = k + dir; n[u] = c[u]; n[v] = c[v];
+							mask[j][i] = solid[sample(c[0], c[1], c[2])] && !solid[sample(n[0], n[1], n[2])];
+						}
+					for (int j = 0; j < 8; j++)
+						for (int i = 0; i < 8; ) {
+							if (!mask[j][i]) {
+								i++;
+								continue;
+							}
+							int w = 1, h = 1;
+							while (i + w < 8 && mask[j][i + w]) w++;
+							for (bool grow = true; grow && j + h < 8; ) {
+								for (int t = 0; t < w && grow; t++) grow = mask[j + h][i + t];
+								if (grow) h++;
+							}
+							for (int jj = j; jj < j + h; jj++)
+								for (int ii = i; ii < i + w; ii++) mask[jj][ii] = false;
+							// The face lies on the far side of the slice for +dir. u x v = +a, so corners
+							// in u, v order wind counterclockwise seen from +a
+							vec3 corner[4], normal(0, 0, 0);
+							float plane = (float)(k + (dir > 0 ? 1 : 0));
+							float us[4] = { (float)(i + 2), (float)(i + 2 + w), (float)(i + 2 + w), (float)(i + 2) };
+							float vs[4] = { (float)(j + 2), (float)(j + 2), (float)(j + 2 + h), (float)(j + 2 + h) };
+							for (int q = 0; q < 4; q++) {
+								corner[q][a] = plane; corner[q][u] = us[q]; corner[q][v] = vs[q];
+								corner[q] = world(origin + corner[q]);
+							}
+							normal[a] = (float)dir;
+							int order[6] = { 0, 1, 2, 0, 2, 3 };
+							for (int q = 0; q < 6; q++) out.push_back({ corner[dir > 0 ? order[q] : order[5 - q]], normal });
+							i += w;
+						}
+				}
+		}
+	}
+	vec3 gradient(const float* field, int x, int y, int z) const {
+		return vec3(field[sample(x + 1, y, z)] - field[sample(x - 1, y, z)], field[sample(x, y + 1, z)] - field[sample(x, y - 1, z)],
+			field[sample(x, y, z + 1)] - field[sample(x, y, z - 1)]);
+	}
+	// Isosurface in the cube from sample (x, y, z) to (x + 1, y + 1, z + 1), origin is sample (0, 0, 0)'s grid position
+	void meshCube(const float* field, int x, int y, int z, vec3 origin, vector<MeshVertex>& out) const {
+		float v[8];
+		int inside = 0;
+		for (int c = 0; c < 8; c++) {
+			v[c] = field[sample(x + (c & 1), y + (c >> 1 & 1), z + (c >> 2))];
+			inside += v[c] > isoLevel;
+		}
+		if (inside == 0 || inside == 8) return;
+		vec3 p[8], g[8];
+		for (int c = 0; c < 8; c++) {
+			int cx = x + (c & 1), cy = y + (c >> 1 & 1), cz = z + (c >> 2);
+			p[c] = origin + vec3((float)cx, (float)cy, (float)cz);
+			g[c] = gradient(field, cx, cy, cz);
+		}
+		// The 6 paths from corner 0 to corner 7 along x, y and z in every order
+		static const int tets[6][4] = { {0, 1, 3, 7}, {0, 1, 5, 7}, {0, 2, 3, 7}, {0, 2, 6, 7}, {0, 4, 5, 7}, {0, 4, 6, 7} };
+		for (const int* t : tets) {
+			int in[4], ni = 0, outs[4], no = 0;
+			for (int k = 0; k < 4; k++) {
+				if (v[t[k]] > isoLevel) in[ni++] = t[k];
+				else outs[no++] = t[k];
+			}
+			if (ni == 0 || ni == 4) continue;
+			auto edge = [&](int a, int b) {
+				float s = (isoLevel - v[a]) / (v[b] - v[a]);
+				vec3 n = g[a] + s * (g[b] - g[a]);
+				float l = length(n);
+				return MeshVertex{ world(p[a] + s * (p[b] - p[a])), l > 1e-6f ? -n / l : vec3(0, 0, 0) };
+			};
+			vec3 inMean(0, 0, 0), outMean(0, 0, 0);
+			for (int k = 0; k < ni; k++) inMean += p[in[k]] / (float)ni;
+			for (int k = 0; k < no; k++) outMean += p[outs[k]] / (float)no;
+			vec3 away = outMean - inMean; // from the water out
+			if (ni == 1) triangle(edge(in[0], outs[0]), edge(in[0], outs[1]), edge(in[0], outs[2]), away, out);
+			else if (ni == 3) triangle(edge(in[0], outs[0]), edge(in[1], outs[0]), edge(in[2], outs[0]), away, out);
+			else {
+				// A quad through the 4 edges from the 2 inside corners to the 2 outside, in order around it
+				MeshVertex a = edge(in[0], outs[0]), b = edge(in[0], outs[1]), c = edge(in[1], outs[1]), d = edge(in[1], outs[0]);
+				triangle(a, b, c, away, out);
+				triangle(a, c, d, away, out);
+			}
+		}
+	}
+	// Appends a b c wound counterclockwise seen from away, giving any vertex without a gradient the face's normal
+	void triangle(MeshVertex a, MeshVertex b, MeshVertex c, vec3 away, vector<MeshVertex>& out) const {
+		vec3 n = cross(b.point - a.point, c.point - a.point);
+		if (dot(n, away) < 0.0f) {
+			std::swap(b, c);
+			n = -n;
+		}
+		float l = length(n);
+		if (l < 1e-12f) return;
+		for (MeshVertex* m : { &a, &b, &c })
+			if (m->normal.x == 0.0f && m->normal.y == 0.0f && m->normal.z == 0.0f) m->normal = n / l;
+		out.push_back(a);
+		out.push_back(b);
+		out.push_back(c);
+	}
+};
+
+#endif
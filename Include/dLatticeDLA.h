@@ -0,0 +1,255 @@
+// dLatticeDLA.h - On-lattice diffusion-limited aggregation on a bit-packed grid, walkers on a ThreadPool
+
+#ifndef DLATTICEDLA_HDR
+#define DLATTICEDLA_HDR
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <fstream>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "VecMat.h"
+#include "dRandom.h"
+#include "dThreadPool.h"
+
+using std::vector;
+using std::string;
+using std::runtime_error;
+using std::ofstream;
+
+/* LatticeDLA grows an aggregate on a side^3 lattice (side a power of 2, at most 1024), for sizes
+   DLASim's particle list can't reach:
+ - Occupancy is one bit per site in a BitLattice, indexed by the site's Morton code. The low 9 bits
+   of the code are the site within its 8^3 brick, so every brick is 512 contiguous bits (8 words,
+   one cache line) and bricks themselves lie in Morton order, neighbors in space stay close in
+   memory. 1024^3 is 128 MB
+ - The seed is the center site. Walkers start on a sphere just outside the aggregate's radius and
+   step to one of their 6 neighbors, a step onto an occupied site is refused. A walker next to an
+   occupied site sticks with an atomic test-and-set of its own bit: if another thread got that
+   site first the walker just keeps walking, so no stick is ever lost or doubled
+ - Walkers outside the aggregate's radius jump to a uniform point on the sphere of their distance
+   to it (less a margin). Inside that, a pyramid of blocks (4^3 sites, 8^3 bricks, 16^3..) finds
+   the largest empty 3x3x3 blocks around a walker, it jumps that block's side less 2 sites.
+   Walkers that wander past the kill radius restart on the launch sphere
+ - grow() runs walkersPerThread walkers per ThreadPool slot, advanced in turn. With threads the
+   aggregate depends on timing, on one thread it is the same for the same seed
+ - points() lists the aggregate as Morton codes in ascending order (4 bytes per site, already
+   sorted for locality), writePoints() saves them, decode() gives back the coordinates
+*/
+
+struct BitLattice {
+	int side = 0;
+	void reset(int sideLength) {
+		if (sideLength < 8 || sideLength > 1024 || (sideLength & (sideLength - 1)))
+			throw runtime_error("Lattice side must be a power of 2 from 8 to 1024");
+		side = sideLength;
+		words = (size_t)side * side * side / 64;
+		bits.reset(new std::atomic<uint64_t>[words]);
+		for (size_t w = 0; w < words; w++) bits[w].store(0, std::memory_order_relaxed);
+		used.clear();
+		for (int l = 1; blockSide(l) <= side / 4; l++) {
+			size_t blocks = words >> 3 * l;
+			used.emplace_back(new std::atomic<uint8_t>[blocks]);
+			for (size_t b = 0; b < blocks; b++) used.back()[b].store(0, std::memory_order_relaxed);
+		}
+	}
+	bool inside(int x, int y, int z) const { return (unsigned)x < (unsigned)side && (unsigned)y < (unsigned)side && (unsigned)z < (unsigned)side; }
+	bool test(int x, int y, int z) const {
+		uint32_t m = morton(x, y, z);
+		return bits[m >> 6].load(std::memory_order_relaxed) >> (m & 63) & 1;
+	}
+	// Sets the site's bit, true if this call set it (false if it was already set)
+	bool testAndSet(int x, int y, int z) {
+		uint32_t m = morton(x, y, z);
+		uint64_t bit = 1ull << (m & 63);
+		if (bits[m >> 6].fetch_or(bit, std::memory_order_acq_rel) & bit) return false;
+		for (int l = 1; l < levels(); l++) {
+			std::atomic<uint8_t>& u = used[l - 1][m >> (6 + 3 * l)];
+			if (!u.load(std::memory_order_relaxed)) u.store(1, std::memory_order_relaxed);
+		}
+		return true;
+	}
+	// Blocks of level l are blockSide(l)^3 sites: 4^3 (one word), 8^3 (bricks), 16^3.. up to a quarter
+	// of side. Level 0 reads the words themselves, the rest keep a flag per block
+	int levels() const { return (int)used.size() + 1; }
+	static int blockSide(int level) { return 4 << level; }
+	// True if block (bx, by, bz) (in level's block coordinates) has no set site, or is off the lattice
+	bool blockEmpty(int level, int bx, int by, int bz) const {
+		unsigned n = (unsigned)(side / blockSide(level));
+		if ((unsigned)bx >= n || (unsigned)by >= n || (unsigned)bz >= n) return true;
+		uint32_t b = morton(bx, by, bz);
+		return level ? !used[level - 1][b].load(std::memory_order_relaxed) : !bits[b].load(std::memory_order_relaxed);
+	}
+	// Calls fn(code) for every set site, in ascending Morton order, skipping empty bricks
+	template <typename Fn>
+	void forEachSet(Fn fn) const {
+		for (size_t b = 0; b < words / 8; b++) {
+			if (levels() > 1 && !used[0][b].load(std::memory_order_relaxed)) continue;
+			for (size_t w = 8 * b; w < 8 * b + 8; w++)
+				for (uint64_t v = bits[w].load(std::memory_order_relaxed); v; v &= v - 1)
+					fn((uint32_t)(64 * w + ctz(v)));
+		}
+	}
+	static uint32_t morton(int x, int y, int z) { return spread(x) | spread(y) << 1 | spread(z) << 2; }
+	static void decode(uint32_t code, int& x, int& y, int& z) {
+		x = (int)compact(code);
+		y = (int)compact(code >> 1);
+		z = (int)compact(code >> 2);
+	}
+private:
+	size_t words = 0;
+	std::unique_ptr<std::atomic<uint64_t>[]> bits;
+	vector<std::unique_ptr<std::atomic<uint8_t>[]>> used; // per level and block, set once any of its sites is
+	// 10 bits to every third bit of 30
+	static uint32_t spread(uint32_t v) {
+		v &= 0x3ff;
+		v = (v | v << 16) & 0x030000ff;
+		v = (v | v << 8) & 0x0300f00f;
+		v = (v | v << 4) & 0x030c30c3;
+		v = (v | v << 2) & 0x09249249;
+		return v;
+	}
+	static uint32_t compact(uint32_t v) {
+		v &= 0x09249249;
+		v = (v | v >> 2) & 0x030c30c3;
+		v = (v | v >> 4) & 0x0300f00f;
+		v = (v | v >> 8) & 0x030000ff;
+		v = (v | v >> 16) & 0x3ff;
+		return v;
+	}
+	static int ctz(uint64_t v) {
+		int n = 0;
+		while (!(v & 1)) { v >>= 1; n++; }
+		return n;
+	}
+};
+
+struct LatticeDLA {
+	int walkersPerThread = 1;
+	BitLattice lattice;
+	int side() const { return lattice.side; }
+	int stuck() const { return count.load(); }
+	int radius() const { return maxRadius.load(); } // of the aggregate around the center, rounded up
+	// A full aggregate leaves too little room to launch walkers inside the margin kept from the faces
+	bool full() const { return radius() + 4 >= side() / 2 - MARGIN; }
+	void reset(int sideLength, uint64_t seed) {
+		lattice.reset(sideLength);
+		this->seed = seed;
+		round = 0;
+		int c = side() / 2;
+		lattice.testAndSet(c, c, c);
+		count = 1;
+		maxRadius = 1;
+	}
+	// Grows until target sites are stuck (or full()), returns how many are
+	int grow(int target, ThreadPool* pool = nullptr) {
+		int slots = pool ? pool->size() : 1;
+		auto run = [&](int, int, int slot) { walk(target, keyedRng(seed, round, slot)); };
+		if (pool) pool->parallelFor(slots, run);
+		else run(0, 1, 0);
+		round++;
+		return stuck();
+	}
+	vector<uint32_t> points() const {
+		vector<uint32_t> codes;
+		codes.reserve(stuck());
+		lattice.forEachSet([&](uint32_t code) { codes.push_back(code); });
+		return codes;
+	}
+	// "LDLA", side and count as uint32, then the Morton codes
+	void writePoints(string path) const {
+		vector<uint32_t> codes = points();
+		uint32_t header[2] = { (uint32_t)side(), (uint32_t)codes.size() };
+		ofstream file(path, std::ios::binary);
+		if (!file.is_open())
+			throw runtime_error("Failed to write lattice points '" + path + "'");
+		file.write("LDLA", 4);
+		file.write((const char*)header, sizeof(header));
+		file.write((const char*)codes.data(), codes.size() * sizeof(uint32_t));
+		if (!file)
+			throw runtime_error("Failed to write lattice points '" + path + "'");
+	}
+	static void decode(uint32_t code, int& x, int& y, int& z) { BitLattice::decode(code, x, y, z); }
+private:
+	static constexpr int MARGIN = 16; // sites kept free at the faces
+	struct Walker { int x, y, z; };
+	uint64_t seed = 0;
+	uint64_t round = 0; // grow() calls so far, keys each call's random streams
+	std::atomic<int> count{ 0 }, maxRadius{ 0 };
+	void launch(Walker& w, pcg32& rng) const {
+		int c = side() / 2;
+		vec3 d = rng.direction() * (float)(radius() + 2);
+		w = { c + (int)lroundf(d.x), c + (int)lroundf(d.y), c + (int)lroundf(d.z) };
+	}
+	bool nextToAggregate(int x, int y, int z) const {
+		return lattice.test(x - 1, y, z) || lattice.test(x + 1, y, z) || lattice.test(x, y - 1, z) ||
+			lattice.test(x, y + 1, z) || lattice.test(x, y, z - 1) || lattice.test(x, y, z + 1);
+	}
+	// Side of the largest block whose 3x3x3 blocks around w are all empty, 0 if none is
+	int clearance(const Walker& w) const {
+		int clear = 0;
+		for (int l = 0; l < lattice.levels(); l++) {
+			int shift = 2 + l, bx = w.x >> shift, by = w.y >> shift, bz = w.z >> shift;
+			for (int z = bz - 1; z <= bz + 1; z++)
+				for (int y = by - 1; y <= by + 1; y++)
+					for (int x = bx - 1; x <= bx + 1; x++)
+						if (!lattice.blockEmpty(l, x, y, z)) return clear;
+			clear = BitLattice::blockSide(l);
+		}
+		return clear;
+	}
+	void jump(Walker& w, float distance, pcg32& rng) const {
+		vec3 d = rng.direction() * distance;
+		w.x += (int)lroundf(d.x); w.y += (int)lroundf(d.y); w.z += (int)lroundf(d.z);
+	}
+	void walk(int target, pcg32 rng) {
+		vector<Walker> walkers(std::max(1, walkersPerThread));
+		for (Walker& w : walkers) launch(w, rng);
+		int c = side() / 2;
+		while (count.load(std::memory_order_relaxed) < target && !full())
+			for (Walker& w : walkers) {
+				float r = (float)radius(), dx = (float)(w.x - c), dy = (float)(w.y - c), dz = (float)(w.z - c);
+				float d = sqrtf(dx * dx + dy * dy + dz * dz);
+				if (d > std::min(2.0f * r + 32.0f, (float)(c - MARGIN))) {
+					launch(w, rng);
+					continue;
+				}
+				// Rounding moves a jump by under a site, the margins cover it
+				if (d > r + 4.0f) {
+					jump(w, d - r - 2.0f, rng);
+					continue;
+				}
+				if (int clear = clearance(w)) {
+					jump(w, clear - 2.0f, rng);
+					continue;
+				}
+				Walker n = w;
+				switch (rng.below(6)) {
+					case 0: n.x--; break;
+					case 1: n.x++; break;
+					case 2: n.y--; break;
+					case 3: n.y++; break;
+					case 4: n.z--; break;
+					default: n.z++; break;
+				}
+				if (lattice.test(n.x, n.y, n.z)) continue;
+				w = n;
+				if (!nextToAggregate(w.x, w.y, w.z)) continue;
+				// Radius first, so other walkers never jump by a radius that misses this site (a lost
+				// test-and-set leaves it a site too large, which only shortens jumps)
+				int reach = (int)ceilf(sqrtf((float)((w.x - c) * (w.x - c) + (w.y - c) * (w.y - c) + (w.z - c) * (w.z - c))));
+				int old = maxRadius.load();
+				while (reach > old && !maxRadius.compare_exchange_weak(old, reach)) { }
+				if (!lattice.testAndSet(w.x, w.y, w.z)) continue;
+				count.fetch_add(1, std::memory_order_relaxed);
+				launch(w, rng);
+			}
+	}
+};
+
+#endif
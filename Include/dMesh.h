@@ -9,6 +9,7 @@
 #include "VecMat.h"
 #include "dCollisions.h"
 #include "dMisc.h"
+#include "dCommandList.h"
 
 using std::vector;
 using std::runtime_error;
@@ -58,6 +59,13 @@ struct Mesh {
         model = modelTransform;
         allocate();
     }
+    // From data already read (and normalized) off the GL thread, see SceneGraph::loadAssets()
+    Mesh(const ObjData& data, const Image& image, mat4 modelTransform=mat4()) {
+        objData = data;
+        texture = loadTexture(image);
+        model = modelTransform;
+        allocate();
+    }
     void allocate() {
         glGenVertexArrays(1, &VAO);
         glBindVertexArray(VAO);
@@ -91,11 +99,12 @@ struct Mesh {
         if (transform_VBO) glDeleteBuffers(1, &transform_VBO);
         if (collider) delete collider;
     }
+    GLsizei indexCount() const { return (GLsizei)(objData.indices.size() * 3); }
     void render() {
         glBindVertexArray(VAO);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, texture);
-        glDrawElements(GL_TRIANGLES, (GLsizei)(objData.indices.size() * sizeof(int3)), GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, indexCount(), GL_UNSIGNED_INT, 0);
         glBindVertexArray(0);
         glBindTexture(GL_TEXTURE_2D, 0);
     }
@@ -115,15 +124,35 @@ struct Mesh {
         }
         glBindVertexArray(0);
     }
-    void loadInstances(vector<mat4>& transforms) {
+    void loadInstances(const mat4* transforms, GLsizei count) {
         // Update num instances
-        num_instances = (GLsizei)transforms.size();
-        // Copy transforms to VBO
+        num_instances = count;
+        // Pack transposed transforms and copy them to VBO in one upload
+        vector<mat4> packed(transforms, transforms + count);
+        for (mat4& t : packed) t = Transpose(t);
         glBindBuffer(GL_ARRAY_BUFFER, transform_VBO);
-        for (size_t i = 0; i < transforms.size(); i++) {
-            mat4 t = Transpose(transforms[i]);
-            glBufferSubData(GL_ARRAY_BUFFER, i * sizeof(mat4), sizeof(mat4), &t);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(max(count, max_instances) * sizeof(mat4)), NULL, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr)(count * sizeof(mat4)), packed.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    void loadInstances(const vector<mat4>& transforms) { loadInstances(transforms.data(), (GLsizei)transforms.size()); }
+    // Streams count transforms without a staging copy: write them Transpose()d into the returned buffer
+    // (previous contents are discarded), then unmapInstances() before rendering. Null if count is 0
+    uint8_t* mapInstances(GLsizei count) {
+        num_instances = count;
+        if (!transform_VBO || !count) return nullptr;
+        glBindBuffer(GL_ARRAY_BUFFER, transform_VBO);
+        if (count > max_instances) {
+            max_instances = count;
+            glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(max_instances * sizeof(mat4)), NULL, GL_DYNAMIC_DRAW);
         }
+        void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, (GLsizeiptr)(count * sizeof(mat4)), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return (uint8_t*)mapped;
+    }
+    void unmapInstances() {
+        glBindBuffer(GL_ARRAY_BUFFER, transform_VBO);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
     void renderInstanced() {
@@ -131,10 +160,34 @@ struct Mesh {
         glBindVertexArray(VAO);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, texture);
-        glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)(objData.indices.size() * sizeof(int3)), GL_UNSIGNED_INT, 0, num_instances);
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount(), GL_UNSIGNED_INT, 0, num_instances);
         glBindVertexArray(0);
         glBindTexture(GL_TEXTURE_2D, 0);
     }
+    // Command list versions of render() / renderInstanced(), safe off the GL thread
+    void record(CommandList& cmds) const {
+        cmds.bindVertexArray(VAO);
+        cmds.bindTexture(0, GL_TEXTURE_2D, texture);
+        cmds.drawElements(GL_TRIANGLES, indexCount());
+    }
+    void recordInstanced(CommandList& cmds) const {
+        if (!transform_VBO || !num_instances) return;
+        cmds.bindVertexArray(VAO);
+        cmds.bindTexture(0, GL_TEXTURE_2D, texture);
+        cmds.drawElementsInstanced(GL_TRIANGLES, indexCount(), num_instances);
+    }
+    // Uploads transforms and draws them, leaves num_instances alone so several lists can be recorded at once
+    void recordInstanced(CommandList& cmds, const vector<mat4>& transforms) const {
+        if (!transform_VBO || transforms.empty()) return;
+        uint8_t* packed = cmds.bufferData(GL_ARRAY_BUFFER, transform_VBO, transforms.size() * sizeof(mat4));
+        for (size_t i = 0; i < transforms.size(); i++) {
+            mat4 t = Transpose(transforms[i]);
+            memcpy(packed + i * sizeof(mat4), &t, sizeof(mat4));
+        }
+        cmds.bindVertexArray(VAO);
+        cmds.bindTexture(0, GL_TEXTURE_2D, texture);
+        cmds.drawElementsInstanced(GL_TRIANGLES, indexCount(), (GLsizei)transforms.size());
+    }
     template <typename T>
     void createCollider() { collider = new T(objData.points); }
 };
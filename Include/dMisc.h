@@ -10,6 +10,13 @@
 #include <map>
 #include <algorithm>
 #include <float.h>
+#include <cstdint>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "stb_image.h"
 #include "glad.h"
 #include "VecMat.h"
@@ -60,28 +67,43 @@ struct ObjData {
 // ---------------------
 
 
-inline GLuint loadTexture(string filename, bool mipmap = true, GLint min_filter = GL_LINEAR, GLint mag_filter = GL_NEAREST) {
+// Decoded RGBA image, readImage() makes no GL calls so it can run on loader threads
+struct Image {
+	int width = 0, height = 0;
+	vector<uint8_t> pixels;
+};
+
+inline Image readImage(string filename) {
 	// Load image from file, force RGBA
 	int w, h;
-	stbi_set_flip_vertically_on_load(true);
+	stbi_set_flip_vertically_on_load_thread(true);
 	stbi_uc* data = stbi_load(filename.c_str(), &w, &h, 0, STBI_rgb_alpha);
 	if (!data) 
 		throw runtime_error("Failed to read '" + filename + "' : " + string(stbi_failure_reason()));
+	Image image;
+	image.width = w;
+	image.height = h;
+	image.pixels.assign(data, data + (size_t)w * h * 4);
+	stbi_image_free(data);
+	return image;
+}
+
+inline GLuint loadTexture(const Image& image, bool mipmap = true, GLint min_filter = GL_LINEAR, GLint mag_filter = GL_NEAREST) {
 	// Create GL texture, copy image data
 	GLuint texture;
 	glGenTextures(1, &texture);
 	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels.data());
 	// Generate mipmap and set min / mag filters
 	if (mipmap) glGenerateMipmap(GL_TEXTURE_2D);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
-	// Free image data and return texture
-	stbi_image_free(data);
 	return texture;
 }
 
-
+inline GLuint loadTexture(string filename, bool mipmap = true, GLint min_filter = GL_LINEAR, GLint mag_filter = GL_NEAREST) {
+	return loadTexture(readImage(filename), mipmap, min_filter, mag_filter);
+}
 
 // Reads simple ASCII obj files - does not handle:
 // - binary obj files
@@ -202,6 +224,51 @@ inline void normalizePoints(vector<vec3>& points, float scale) {
     }
 }
 
+// Read-only view of a whole file, memory mapped where available so large binary assets
+// (e.g. .scgb scenes) load without an intermediate copy
+struct MappedFile {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    MappedFile(string filename) {
+#ifdef _WIN32
+        ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+            throw runtime_error("Failed to open '" + filename + "'");
+        buffer.resize((size_t)file.tellg());
+        file.seekg(0);
+        file.read((char*)buffer.data(), buffer.size());
+        data = buffer.data();
+        size = buffer.size();
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw runtime_error("Failed to open '" + filename + "'");
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            throw runtime_error("Failed to read '" + filename + "'");
+        }
+        size = (size_t)st.st_size;
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED)
+            throw runtime_error("Failed to map '" + filename + "'");
+        data = (const uint8_t*)mapped;
+#endif
+    }
+    ~MappedFile() {
+#ifndef _WIN32
+        if (data) munmap((void*)data, size);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+private:
+#ifdef _WIN32
+    vector<uint8_t> buffer;
+#endif
+};
+
 // Adding comparison operator for GLFWvidmode for comparing against current video mode
 bool operator==(const GLFWvidmode& a, const GLFWvidmode& b) {
     return a.width == b.width && a.height == b.height && a.refreshRate == b.refreshRate && a.redBits == b.redBits && a.greenBits == b.greenBits && a.blueBits == b.blueBits;
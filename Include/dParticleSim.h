@@ -0,0 +1,286 @@
+// dParticleSim.h - Structure-of-arrays particle simulation, no GL so it can run headless
+
+#ifndef DPARTICLESIM_HDR
+#define DPARTICLESIM_HDR
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "VecMat.h"
+#include "dSimd.h"
+#include "dRandom.h"
+#include "dThreadPool.h"
+
+using std::vector;
+
+/* ParticleSim keeps each particle attribute in its own array (px, py, pz, vx, vy, vz, life, color)
+so update() can integrate 4 particles per instruction with float4:
+ - Live particles are kept dense in [0, live), a particle that dies is swap-removed (the last live
+   particle moves into its slot), so spawning and killing are O(1) and loops only touch live particles
+ - Arrays are padded to a multiple of 4 with dead slots so the kernel never needs a scalar tail
+ - When the pool is full, spawn() follows the overflow policy: Drop the new particle, StealOldest
+   (reuse the slot of the oldest live particle) or Grow the pool, dropped / stolen / grown count
+   what happened. Spawn order is tracked in a ring of slots with tombstones for particles that died
+   out of order, the ring is twice the capacity and compacted when full, so it stays O(1) amortized
+ - pack() copies live particles into ParticleInstance records for a renderer to upload in one go,
+   depthKeys() + packOrdered() do the same back to front for alpha blending (see RadixSort)
+ - emit() queues a particle with a random velocity in [velMin, velMax], queued particles are spawned
+   at the start of the next step and their velocities drawn per BLOCK of emissions from
+   keyedRng(seed, emitter, frame, block), so a seed always gives the same particles
+ - A step runs in phases over fixed BLOCKs of particles: beginStep() spawns the queue, emitBlock()
+   fills velocities, integrateBlock() integrates and lists dead particles, endStep() swap-removes them
+   (highest slot first, so the particle moved into a dead slot is always alive). Blocks only touch
+   their own slots, so updateParticles() can run them as jobs on a ThreadPool with the same result
+   as update() on one thread
+Colors are packed RGBA8 since that's all the renderer needs per instance.
+*/
+
+struct ParticleInstance {
+	float x, y, z, size;
+	uint32_t color;
+};
+
+inline uint32_t packColor(vec4 c) {
+	auto byte = [](float f) { return (uint32_t)(std::max(0.0f, std::min(1.0f, f)) * 255.0f + 0.5f); };
+	return byte(c.x) | byte(c.y) << 8 | byte(c.z) << 16 | byte(c.w) << 24;
+}
+
+enum class ParticleOverflow { Drop, StealOldest, Grow };
+
+struct ParticleEmission {
+	vec3 pos;
+	vec4 color;
+};
+
+struct ParticleSim {
+	vec3 gravity = vec3(0, -0.01f, 0);
+	float life_dt = 0.05f; // life lost per unit of dt, particles start with 1
+	float floorY = 0.0f; // particles don't fall through this height
+	ParticleOverflow overflow = ParticleOverflow::StealOldest;
+	int maxCapacity = 1 << 24; // Grow stops here and drops instead
+	vector<float> px, py, pz, vx, vy, vz, life;
+	vector<uint32_t> color;
+	int live = 0; // particles [0, live) are alive
+	int dropped = 0, stolen = 0, grown = 0; // spawns that found the pool full
+	static const int BLOCK = 4096; // particles per job, fixed so results don't depend on thread count
+	uint64_t seed = 1;
+	uint32_t emitter = 0; // tells apart systems sharing a seed
+	uint64_t frame = 0; // steps so far
+	vec3 velMin = vec3(-0.03f, 0.05f, -0.03f), velMax = vec3(0.03f, 0.1f, 0.03f);
+	vector<ParticleEmission> pending;
+	bool fade = false; // scale alpha by remaining life when packing
+	int capacity() const { return cap; }
+	void resize(int maxParticles) {
+		cap = std::max(0, maxParticles);
+		size_t n = (size_t)(cap + 3) / 4 * 4;
+		for (vector<float>* a : { &px, &py, &pz, &vx, &vy, &vz, &life }) a->assign(n, 0.0f);
+		color.assign(n, 0);
+		orderPos.assign(n, 0);
+		order.assign((size_t)cap * 2, -1);
+		head = tail = 0;
+		live = 0;
+	}
+	// Queues a particle for the next step
+	void emit(vec3 pos, vec4 col) { pending.push_back({ pos, col }); }
+	// Spawns a particle right away, returns its slot or -1 if it was dropped (not during a step)
+	int spawn(vec3 pos, vec3 vel, vec4 col) {
+		int slot = live;
+		if (live == cap) {
+			if (overflow == ParticleOverflow::Grow && cap < maxCapacity) {
+				grow(std::min(maxCapacity, std::max(4, cap * 2)));
+				grown++;
+			} else if (overflow == ParticleOverflow::StealOldest && live) {
+				slot = oldest();
+				order[orderPos[slot]] = -1;
+				stolen++;
+			} else {
+				dropped++;
+				return -1;
+			}
+		}
+		if (slot == live) live++;
+		px[slot] = pos.x, py[slot] = pos.y, pz[slot] = pos.z;
+		vx[slot] = vel.x, vy[slot] = vel.y, vz[slot] = vel.z;
+		life[slot] = 1.0f;
+		color[slot] = packColor(col);
+		pushOrder(slot);
+		return slot;
+	}
+	// Swap-removes a live particle, the last live particle takes its slot
+	void kill(int slot) {
+		int last = --live;
+		order[orderPos[slot]] = -1;
+		if (slot != last) {
+			px[slot] = px[last], py[slot] = py[last], pz[slot] = pz[last];
+			vx[slot] = vx[last], vy[slot] = vy[last], vz[slot] = vz[last];
+			life[slot] = life[last];
+			color[slot] = color[last];
+			orderPos[slot] = orderPos[last];
+			order[orderPos[slot]] = slot;
+		}
+		life[last] = 0.0f;
+	}
+	void update(float dt) {
+		int emitBlocks = beginStep();
+		for (int b = 0; b < emitBlocks; b++) emitBlock(b);
+		for (int b = 0; b < blocks(); b++) integrateBlock(b, dt);
+		endStep();
+	}
+	// Spawns pending emissions, returns how many blocks of them need velocities from emitBlock()
+	int beginStep() {
+		// With StealOldest anything past capacity would steal a particle emitted this same step
+		size_t skip = 0;
+		if (overflow == ParticleOverflow::StealOldest && pending.size() > (size_t)cap) {
+			skip = pending.size() - cap;
+			dropped += (int)skip;
+		}
+		emitted.assign(pending.size(), -1);
+		for (size_t i = skip; i < pending.size(); i++)
+			emitted[i] = spawn(pending[i].pos, vec3(0.0f), pending[i].color);
+		deadLists.resize(blocks());
+		return (int)(emitted.size() + BLOCK - 1) / BLOCK;
+	}
+	void emitBlock(int b) {
+		pcg32 rng = keyedRng(seed, emitter, frame, (uint64_t)b);
+		int end = std::min((int)emitted.size(), (b + 1) * BLOCK);
+		for (int i = b * BLOCK; i < end; i++) {
+			// Drawn for dropped particles too, so one drop doesn't change every later velocity
+			vec3 v = rng.range(velMin, velMax);
+			int slot = emitted[i];
+			if (slot >= 0) vx[slot] = v.x, vy[slot] = v.y, vz[slot] = v.z;
+		}
+	}
+	// Blocks of live particles, fixed from beginStep() until endStep()
+	int blocks() const { return (live + BLOCK - 1) / BLOCK; }
+	void integrateBlock(int b, float dt) {
+		int begin = b * BLOCK, end = std::min((b + 1) * BLOCK, live);
+		deadLists[b].clear();
+		integrate(begin, (end + 3) / 4 * 4, dt, deadLists[b]);
+	}
+	void endStep() {
+		for (int b = (int)deadLists.size() - 1; b >= 0; b--)
+			for (int d = (int)deadLists[b].size() - 1; d >= 0; d--) kill(deadLists[b][d]);
+		pending.clear();
+		frame++;
+	}
+	// Integrates slots [begin, end), both multiples of 4, dead slots in range are left untouched.
+	// Slots that die are appended to dead from the same pass, a second scan over life costs as much again
+	void integrate(int begin, int end, float dt, vector<int>& dead) {
+		float4 zero = splat4(0.0f), dt4 = splat4(dt), decay = splat4(dt * life_dt), floor4 = splat4(floorY);
+		float4 gx = splat4(dt * gravity.x), gy = splat4(dt * gravity.y), gz = splat4(dt * gravity.z);
+		for (int i = begin; i < end; i += 4) {
+			float4 l = load4(&life[i]);
+			float4 active = greaterThan(l, zero);
+			float4 x = load4(&px[i]), y = load4(&py[i]), z = load4(&pz[i]);
+			float4 u = load4(&vx[i]), v = load4(&vy[i]), w = load4(&vz[i]);
+			store4(&life[i], select(active, l - decay, l));
+			// l - decay <= 0 exactly when l <= decay
+			int died = moveMask(bitsXor(active, bitsAnd(active, greaterThan(l, decay))));
+			if (died)
+				for (int k = 0; k < 4; k++)
+					if (died >> k & 1) dead.push_back(i + k);
+			store4(&px[i], select(active, x + dt4 * u, x));
+			store4(&py[i], select(active, max4(y + dt4 * v, floor4), y));
+			store4(&pz[i], select(active, z + dt4 * w, z));
+			store4(&vx[i], select(active, u + gx, u));
+			store4(&vy[i], select(active, v + gy, v));
+			store4(&vz[i], select(active, w + gz, w));
+		}
+	}
+	// Writes live particles [begin, end) to out[begin, end), returns how many were written
+	int pack(ParticleInstance* out, float size, int begin = 0, int end = -1) const {
+		if (end < 0 || end > live) end = live;
+		for (int i = begin; i < end; i++) out[i] = instance(i, size);
+		return std::max(0, end - begin);
+	}
+	// Same, but out[k] is particle order[k]
+	void packOrdered(ParticleInstance* out, float size, const uint32_t* order, int begin, int end) const {
+		for (int k = begin; k < end; k++) out[k] = instance((int)order[k], size);
+	}
+	// Back to front sort keys for slots [begin, end): the farther from eye the smaller the key, values = slots
+	void depthKeys(vec3 eye, uint32_t* keys, uint32_t* values, int begin, int end) const {
+		// Squared distances are never negative so their bits already sort, flipping them reverses the order
+		float4 ex = splat4(eye.x), ey = splat4(eye.y), ez = splat4(eye.z), flip = splatBits4(0xffffffffu);
+		int i = begin;
+		for (; i + 4 <= end; i += 4) {
+			float4 dx = load4(&px[i]) - ex, dy = load4(&py[i]) - ey, dz = load4(&pz[i]) - ez;
+			storeBits4(&keys[i], bitsXor(dx * dx + dy * dy + dz * dz, flip));
+		}
+		for (; i < end; i++) {
+			float dx = px[i] - eye.x, dy = py[i] - eye.y, dz = pz[i] - eye.z;
+			float d2 = dx * dx + dy * dy + dz * dz;
+			uint32_t bits;
+			memcpy(&bits, &d2, sizeof(bits));
+			keys[i] = ~bits;
+		}
+		for (i = begin; i < end; i++) values[i] = (uint32_t)i;
+	}
+private:
+	int cap = 0;
+	ParticleInstance instance(int i, float size) const {
+		uint32_t c = color[i];
+		if (fade) c = (c & 0x00ffffffu) | (uint32_t)((c >> 24) * std::max(0.0f, std::min(1.0f, life[i]))) << 24;
+		return { px[i], py[i], pz[i], size, c };
+	}
+	// Ring of slots in spawn order, -1 where the particle died, orderPos[slot] = index in ring
+	vector<int> order, orderPos;
+	vector<int> emitted; // slot per pending emission this step, -1 if dropped
+	vector<vector<int>> deadLists; // per block, filled by integrateBlock()
+	size_t head = 0, tail = 0;
+	int oldest() {
+		while (order[head % order.size()] < 0) head++;
+		return order[head % order.size()];
+	}
+	void pushOrder(int slot) {
+		if (tail - head == order.size()) compactOrder(order.size());
+		orderPos[slot] = (int)(tail % order.size());
+		order[orderPos[slot]] = slot;
+		tail++;
+	}
+	// Drops tombstones and lays the ring out from 0 in a ring of the given size
+	void compactOrder(size_t size) {
+		vector<int> compacted;
+		compacted.reserve(size);
+		for (size_t i = head; i < tail; i++) {
+			int slot = order[i % order.size()];
+			if (slot >= 0) compacted.push_back(slot);
+		}
+		head = 0;
+		tail = compacted.size();
+		compacted.resize(size, -1);
+		order.swap(compacted);
+		for (size_t i = 0; i < tail; i++) orderPos[order[i]] = (int)i;
+	}
+	void grow(int newCap) {
+		size_t n = (size_t)(newCap + 3) / 4 * 4;
+		for (vector<float>* a : { &px, &py, &pz, &vx, &vy, &vz, &life }) a->resize(n, 0.0f);
+		color.resize(n, 0);
+		orderPos.resize(n, 0);
+		compactOrder((size_t)newCap * 2);
+		cap = newCap;
+	}
+};
+
+// Steps several systems together, every (system, block) is its own job so small systems share the pool
+inline void updateParticles(ThreadPool& pool, const vector<ParticleSim*>& sims, float dt) {
+	vector<std::pair<ParticleSim*, int>> jobs;
+	for (ParticleSim* sim : sims) {
+		int emitBlocks = sim->beginStep();
+		for (int b = 0; b < emitBlocks; b++) jobs.push_back({ sim, b });
+	}
+	pool.parallelFor((int)jobs.size(), [&](int begin, int end, int) {
+		for (int j = begin; j < end; j++) jobs[j].first->emitBlock(jobs[j].second);
+	});
+	jobs.clear();
+	for (ParticleSim* sim : sims)
+		for (int b = 0; b < sim->blocks(); b++) jobs.push_back({ sim, b });
+	pool.parallelFor((int)jobs.size(), [&](int begin, int end, int) {
+		for (int j = begin; j < end; j++) jobs[j].first->integrateBlock(jobs[j].second, dt);
+	});
+	for (ParticleSim* sim : sims) sim->endStep();
+}
+
+inline void updateParticles(ThreadPool& pool, ParticleSim& sim, float dt) { updateParticles(pool, vector<ParticleSim*>{ &sim }, dt); }
+
+#endif
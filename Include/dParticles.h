@@ -6,9 +6,17 @@
 #include <glad.h>
 #include <vector>
 #include <stdexcept>
+#include <cstddef>
+#include <cstring>
+#include <future>
+#include <chrono>
+#include <functional>
 #include "VecMat.h"
 #include "GLXtras.h"
 #include "GeomUtils.h"
+#include "dParticleSim.h"
+#include "dThreadPool.h"
+#include "dRadixSort.h"
 
 using std::vector;
 using std::runtime_error;
@@ -16,7 +24,6 @@ using std::runtime_error;
 namespace {
 
 GLuint particleShader = 0;
-GLuint particleVArray = 0;
 GLuint particleVBuffer = 0;
 GLuint particleIBuffer = 0;
 
@@ -38,136 +45,245 @@ vector<int3> particleTriangles{
     {20, 21, 22}, {22, 23, 20}  // bottom
 };
 
+// One cube per instance, instance = center + size, shade is a per particle hash that changes with seed
 const char* particleVert = R"(
     #version 410 core
-    in vec3 point;
-    uniform mat4 mvp;
+    layout(location = 0) in vec3 point;
+    layout(location = 1) in vec4 instance;
+    layout(location = 2) in vec4 instanceColor;
+    uniform mat4 vp;
+    uniform float xzrange = 1;
+    uniform uint seed = 0u;
+    out vec4 color;
+    out vec2 uv;
+    out float shade;
     void main() {
-        gl_Position = mvp * vec4(point, 1);
+        gl_Position = vp * vec4(instance.xyz + instance.w * point, 1);
+        color = instanceColor;
+        uv = instance.xz / (2 * xzrange) + 0.5;
+        uint h = uint(gl_InstanceID) * 747796405u + seed * 2891336453u;
+        h = (h ^ (h >> 16)) * 2246822519u;
+        h ^= h >> 13;
+        shade = float(h & 0xffffu) / 65535.0 * 0.2 - 0.1;
     }
 )";
 
 const char* particleFrag = R"(
     #version 410 core
-    uniform vec4 color;
-    uniform vec2 uv;
+    in vec4 color;
+    in vec2 uv;
+    in float shade;
     uniform int useTexture = 0;
     uniform sampler2D colorTexture;
     out vec4 fragColor;
     void main() {
         if (useTexture == 0) {
             fragColor = color;
-        } else { 
-            fragColor = 1.2 * texture(colorTexture, uv) + color;
+        } else {
+            fragColor = vec4(1.2 * texture(colorTexture, uv).rgb + shade, color.a);
         }
     }
 )";
 
 }
 
-struct dParticle {
-    vec3 pos, vel;
-    vec4 color;
-    float life = 0.0f;
-};
+/* dParticles draws a ParticleSim as cubes:
+ - createParticle() queues a particle (velocity drawn from the sim's seeded streams), update() /
+   updateAsync() step the simulation and draw() only renders, so they can be called separately
+ - updateAsync() waits for the step it started last frame, then starts the next one on the pool, the
+   step packs its instances into the back staging buffer so draw() renders the last finished step
+   while the next is simulated, overlapping it with this frame's GL submission (a frame of latency)
+ - With sortByDepth particles fade out with their life and are drawn back to front from eye (as of the
+   step, so a frame behind with updateAsync()): the step builds distance keys with SIMD, radix sorts
+   them (on the pool when there are enough) and packs instances in sorted order, then draw() blends
+   them without depth writes. simMs / sortMs / packMs time each CPU stage of the last finished step
+ - When the pool is full new particles follow sim.overflow (steals the oldest by default), drawn,
+   dropped and stolen are taken from the last finished step since sim is busy during a step
+ - draw() copies the finished step into the instance buffer (mapped with invalidate, so the driver
+   hands back fresh storage instead of waiting on last frame's draw) and draws them all in one
+   glDrawElementsInstanced, uniform locations are looked up once in setup()
+*/
 
 struct dParticles {
-    int lastUsed = 0;
     int max_particles = 500;
     float particle_size = 0.015f;
     float life_dt = 0.05f;
     vec2 y_variance = vec2(0.05f, 0.1f);
     vec2 xz_variance = vec2(-0.03f, 0.03f);
     vec3 gravity = vec3(0, -0.01f, 0);
+    ParticleSim sim;
+    GLuint vArray = 0;
+    GLuint instanceBuffer = 0;
+    int drawn = 0, dropped = 0, stolen = 0;
+    bool sortByDepth = true;
+    vec3 eye; // camera position the next step sorts for
+    float simMs = 0.0f, sortMs = 0.0f, packMs = 0.0f;
     dParticles() { };
-    vector<dParticle> particles;
+    ~dParticles() { wait(); }
     void setup() {
         if (!particleShader)
             particleShader = LinkProgramViaCode(&particleVert, &particleFrag);
-        if (!particleVArray) {
-            glGenVertexArrays(1, &particleVArray);
-            glBindVertexArray(particleVArray);
+        if (!particleShader)
+            throw runtime_error("Failed to link particle shader!");
+        if (!particleVBuffer) {
             glGenBuffers(1, &particleVBuffer);
             glBindBuffer(GL_ARRAY_BUFFER, particleVBuffer);
             glBufferData(GL_ARRAY_BUFFER, particlePoints.size() * sizeof(vec3), particlePoints.data(), GL_STATIC_DRAW);
             glGenBuffers(1, &particleIBuffer);
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, particleIBuffer);
             glBufferData(GL_ELEMENT_ARRAY_BUFFER, particleTriangles.size() * sizeof(int3), particleTriangles.data(), GL_STATIC_DRAW);
-            VertexAttribPointer(particleShader, "point", 3, 0, 0);
-            glBindVertexArray(0);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
         }
-        // Initialize particles
-        for (int i = 0; i < max_particles; i++)
-            particles.push_back(dParticle());
+        wait();
+        sim.resize(max_particles);
+        // VAO shares the cube buffers, instance buffer is this system's own
+        if (!vArray) glGenVertexArrays(1, &vArray);
+        glBindVertexArray(vArray);
+        glBindBuffer(GL_ARRAY_BUFFER, particleVBuffer);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, particleIBuffer);
+        if (!instanceBuffer) glGenBuffers(1, &instanceBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        instanceCapacity = sim.capacity();
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(ParticleInstance), NULL, GL_STREAM_DRAW);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), 0);
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ParticleInstance), (GLvoid*)offsetof(ParticleInstance, color));
+        glVertexAttribDivisor(2, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        vpLoc = glGetUniformLocation(particleShader, "vp");
+        xzrangeLoc = glGetUniformLocation(particleShader, "xzrange");
+        seedLoc = glGetUniformLocation(particleShader, "seed");
+        useTextureLoc = glGetUniformLocation(particleShader, "useTexture");
+        colorTextureLoc = glGetUniformLocation(particleShader, "colorTexture");
     }
     void cleanup() {
-        if (particleVArray) {
-            glDeleteVertexArrays(1, &particleVArray);
-            glDeleteBuffers(1, &particleVBuffer);
-        }
+        wait();
+        if (vArray) glDeleteVertexArrays(1, &vArray);
+        if (instanceBuffer) glDeleteBuffers(1, &instanceBuffer);
+        vArray = instanceBuffer = 0;
     }
-    int findDead() {
-        // Search for dead particle starting from last used particle
-        for (int i = lastUsed; i < max_particles; i++) {
-            if (particles[i].life <= 0.0f) {
-                lastUsed = i;
-                return i;
-            }
-        }
-        // Search linearly through rest of particles
-        for (int i = 0; i < lastUsed; i++) {
-            if (particles[i].life <= 0.0f) {
-                lastUsed = i;
-                return i;
-            }
-        }
-        // If no dead particles exist, simply take the first particle
-        lastUsed = 0;
-        return 0;
+    void createParticle(vec3 pos, vec3 color) { requests.push_back({ pos, vec4(color, 1) }); }
+    // Steps on the calling thread, the result is drawn right away
+    void update(float dt) {
+        wait();
+        beginStep();
+        step(nullptr, dt, front, eye);
+        finishStep(front);
     }
-    void createParticle(vec3 pos, vec3 color) {
-        int p = findDead();
-        particles[p].pos = pos;
-        particles[p].color = color;
-        particles[p].life = 1.0f;
-        particles[p].vel = vec3(
-            rand_float(xz_variance.x, xz_variance.y),
-            rand_float(y_variance.x, y_variance.y),
-            rand_float(xz_variance.x, xz_variance.y)
-        );
+    // Takes the step started last call and starts the next one on pool, see above
+    void updateAsync(ThreadPool& pool, float dt) {
+        wait();
+        beginStep();
+        int back = 1 - front;
+        vec3 from = eye;
+        stepping = pool.submit([this, &pool, dt, back, from] { step(&pool, dt, back, from); });
+        steppingInto = back;
     }
-    void draw(float dt, mat4 vp, GLuint texture = 0, float xzrange = 0) {
+    // Blocks until the step in flight is done and makes it the one drawn
+    void wait() {
+        if (!stepping.valid()) return;
+        stepping.get();
+        finishStep(steppingInto);
+    }
+    void draw(mat4 vp, GLuint texture = 0, float xzrange = 0) {
+        const vector<ParticleInstance>& instances = staged[front];
+        if (instances.empty() || !instanceBuffer) return;
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        // Pool may have grown since setup
+        if ((int)instances.size() > instanceCapacity) {
+            instanceCapacity = (int)instances.size();
+            glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(ParticleInstance), NULL, GL_STREAM_DRAW);
+        }
+        GLsizeiptr size = (GLsizeiptr)(instances.size() * sizeof(ParticleInstance));
+        void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!mapped) return;
+        memcpy(mapped, instances.data(), size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
         glUseProgram(particleShader);
-        glBindVertexArray(particleVArray);
-        for (int i = 0; i < max_particles; i++) {
-            if (particles[i].life > 0.0f) {
-                // Run particle
-                particles[i].life -= dt * life_dt;
-                particles[i].pos += dt * particles[i].vel;
-                particles[i].vel += dt * gravity;
-                if (particles[i].pos.y < 0.0f) particles[i].pos.y = 0.0f;
-                // Draw particle
-                SetUniform(particleShader, "mvp", vp * Translate(particles[i].pos) * Scale(particle_size));
-                if (texture > 0) {
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, texture);
-                    vec2 uv = vec2(particles[i].pos.x / (xzrange * 2.0f) + 0.5, particles[i].pos.z / (xzrange * 2.0f) + 0.5);
-                    float value = rand_float(-0.1f, 0.1f);
-                    vec4 color = vec4(value, value, value, 1.0f);
-                    SetUniform(particleShader, "useTexture", 1);
-                    SetUniform(particleShader, "uv", uv);
-                    SetUniform(particleShader, "colorTexture", 0);
-                    SetUniform(particleShader, "color", color);
-                } else {
-                    SetUniform(particleShader, "useTexture", 0);
-                    SetUniform(particleShader, "color", particles[i].color);
-                }
-                glDrawElements(GL_TRIANGLES, (GLsizei)(particleTriangles.size() * sizeof(int3)), GL_UNSIGNED_INT, 0);
-            }
+        glUniformMatrix4fv(vpLoc, 1, GL_TRUE, &vp.row[0].x);
+        glUniform1ui(seedLoc, frame++);
+        if (texture > 0) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glUniform1i(useTextureLoc, 1);
+            glUniform1i(colorTextureLoc, 0);
+            glUniform1f(xzrangeLoc, xzrange);
+        } else glUniform1i(useTextureLoc, 0);
+        GLboolean blending = glIsEnabled(GL_BLEND);
+        if (sortByDepth) {
+            glEnable(GL_BLEND);
+            glDepthMask(GL_FALSE);
         }
+        glBindVertexArray(vArray);
+        glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)(particleTriangles.size() * 3), GL_UNSIGNED_INT, 0, (GLsizei)instances.size());
         glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        if (!blending) glDisable(GL_BLEND);
+    }
+private:
+    GLint vpLoc = -1, xzrangeLoc = -1, seedLoc = -1, useTextureLoc = -1, colorTextureLoc = -1;
+    GLuint frame = 0;
+    int instanceCapacity = 0;
+    vector<ParticleEmission> requests; // queued on the calling thread while a step may be running
+    vector<ParticleInstance> staged[2];
+    int front = 0, steppingInto = 0;
+    std::future<void> stepping;
+    RadixSort sorter;
+    float stepTimes[3] = { 0.0f }; // sim, sort, pack ms, written by step()
+    // Simulates, sorts and packs into staged[staging], pool is only used for CPU jobs
+    void step(ThreadPool* pool, float dt, int staging, vec3 from) {
+        using clock = std::chrono::steady_clock;
+        auto ms = [](clock::time_point a, clock::time_point b) { return std::chrono::duration<float, std::milli>(b - a).count(); };
+        clock::time_point start = clock::now();
+        if (pool) updateParticles(*pool, sim, dt);
+        else sim.update(dt);
+        clock::time_point simulated = clock::now();
+        int n = sim.live;
+        vector<ParticleInstance>& out = staged[staging];
+        out.resize(n);
+        // Blocks of BLOCK particles keep SIMD groups aligned
+        auto blocks = [&](const std::function<void(int, int, int)>& fn) {
+            if (pool) pool->parallelFor(n, fn, ParticleSim::BLOCK);
+            else fn(0, n, 0);
+        };
+        float size = particle_size;
+        sim.fade = sortByDepth;
+        if (sortByDepth) {
+            sorter.keys.resize(n);
+            sorter.values.resize(n);
+            blocks([&](int begin, int end, int) { sim.depthKeys(from, sorter.keys.data(), sorter.values.data(), begin, end); });
+            sorter.sort(n, pool);
+        }
+        clock::time_point sorted = clock::now();
+        if (sortByDepth) blocks([&](int begin, int end, int) { sim.packOrdered(out.data(), size, sorter.values.data(), begin, end); });
+        else blocks([&](int begin, int end, int) { sim.pack(out.data(), size, begin, end); });
+        stepTimes[0] = ms(start, simulated);
+        stepTimes[1] = ms(simulated, sorted);
+        stepTimes[2] = ms(sorted, clock::now());
+    }
+    // Settings and queued particles go to sim while no step is running
+    void beginStep() {
+        sim.gravity = gravity;
+        sim.life_dt = life_dt;
+        sim.velMin = vec3(xz_variance.x, y_variance.x, xz_variance.x);
+        sim.velMax = vec3(xz_variance.y, y_variance.y, xz_variance.y);
+        sim.pending.insert(sim.pending.end(), requests.begin(), requests.end());
+        requests.clear();
+    }
+    void finishStep(int staging) {
+        front = staging;
+        drawn = (int)staged[front].size();
+        dropped = sim.dropped;
+        stolen = sim.stolen;
+        simMs = stepTimes[0];
+        sortMs = stepTimes[1];
+        packMs = stepTimes[2];
     }
 };
 
@@ -0,0 +1,82 @@
+// dProfiler.h - GPU timer queries for timing sections of a frame
+
+#ifndef DPROFILER_HDR
+#define DPROFILER_HDR
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "glad.h"
+
+using std::vector;
+using std::string;
+using std::runtime_error;
+
+/* GPUProfiler times named sections of the frame on the GPU with GL_TIME_ELAPSED queries:
+ - begin() / end() bracket a section on the GL thread, sections can't nest (one elapsed query at a time)
+ - Every section cycles through LATENCY queries, a result is only read back when its query comes up
+   for reuse LATENCY frames later, so reading never waits on the GPU
+ - ms() is the latest result, avgMs() an exponential average that's easier to read in a UI
+*/
+
+struct GPUProfiler {
+	static const int LATENCY = 3;
+	struct Section {
+		string name;
+		GLuint queries[LATENCY] = { 0 };
+		bool issued[LATENCY] = { false };
+		float ms = 0.0f, avgMs = 0.0f;
+	};
+	vector<Section> sections;
+	int frame = 0;
+	void begin(const char* name) {
+		if (active >= 0)
+			throw runtime_error("GPU profiler sections can't nest!");
+		active = find(name);
+		Section& s = sections[active];
+		int slot = frame % LATENCY;
+		if (!s.queries[slot]) glGenQueries(1, &s.queries[slot]);
+		// Collect the result this query held LATENCY frames ago
+		if (s.issued[slot]) {
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(s.queries[slot], GL_QUERY_RESULT, &ns);
+			s.ms = ns / 1e6f;
+			s.avgMs += (s.ms - s.avgMs) * 0.1f;
+		}
+		glBeginQuery(GL_TIME_ELAPSED, s.queries[slot]);
+		s.issued[slot] = true;
+	}
+	void end() {
+		if (active < 0) return;
+		glEndQuery(GL_TIME_ELAPSED);
+		active = -1;
+	}
+	void nextFrame() { frame++; }
+	float ms(const char* name) const {
+		for (const Section& s : sections)
+			if (s.name == name) return s.ms;
+		return 0.0f;
+	}
+	float avgMs(const char* name) const {
+		for (const Section& s : sections)
+			if (s.name == name) return s.avgMs;
+		return 0.0f;
+	}
+	void cleanup() {
+		for (Section& s : sections)
+			for (GLuint& q : s.queries)
+				if (q) glDeleteQueries(1, &q);
+		sections.clear();
+	}
+private:
+	int active = -1;
+	int find(const char* name) {
+		for (size_t i = 0; i < sections.size(); i++)
+			if (sections[i].name == name) return (int)i;
+		sections.push_back(Section());
+		sections.back().name = name;
+		return (int)sections.size() - 1;
+	}
+};
+
+#endif
@@ -0,0 +1,95 @@
+// dRadixSort.h - LSD radix sort of 32 bit keys with 32 bit payloads, optionally spread over a ThreadPool
+
+#ifndef DRADIXSORT_HDR
+#define DRADIXSORT_HDR
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include "dThreadPool.h"
+
+using std::vector;
+
+/* RadixSort sorts keys[0, n) ascending and applies the same permutation to values, usually indices:
+ - Four passes over 8 bit digits, least significant first, each pass is a stable counting sort
+ - A pass is skipped when every key has the same digit there (e.g. the top byte of nearby depths)
+ - With a pool and at least parallelMin keys, each pass splits the keys into BLOCKs: blocks count
+   their digits in parallel, offsets are laid out digit by digit then block by block, and blocks
+   scatter in parallel into their own ranges, so the result is identical to the serial sort
+ - Scratch buffers are kept between calls, sorting every frame doesn't allocate once they've grown
+floatKey() maps a float to a key with the same order (negative floats included).
+*/
+
+inline uint32_t floatKey(float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits ^ ((uint32_t)((int32_t)bits >> 31) | 0x80000000u);
+}
+
+struct RadixSort {
+	static const int BLOCK = 1 << 16;
+	int parallelMin = 1 << 17;
+	vector<uint32_t> keys, values;
+	int passes = 0; // passes run by the last sort(), out of 4
+	// Sorts the first n keys / values (both must hold at least n)
+	void sort(int n, ThreadPool* pool = nullptr) {
+		passes = 0;
+		if (n <= 1) return;
+		tmpKeys.resize(std::max(tmpKeys.size(), (size_t)n));
+		tmpValues.resize(std::max(tmpValues.size(), (size_t)n));
+		bool parallel = pool && pool->size() > 1 && n >= parallelMin;
+		int blocks = parallel ? (n + BLOCK - 1) / BLOCK : 1;
+		int blockSize = parallel ? BLOCK : n;
+		counts.resize(blocks);
+		uint32_t *srcK = keys.data(), *srcV = values.data(), *dstK = tmpKeys.data(), *dstV = tmpValues.data();
+		for (int shift = 0; shift < 32; shift += 8) {
+			auto count = [&](int b) {
+				std::array<uint32_t, 256>& c = counts[b];
+				c.fill(0);
+				int end = std::min(n, (b + 1) * blockSize);
+				for (int i = b * blockSize; i < end; i++) c[(srcK[i] >> shift) & 0xff]++;
+			};
+			if (parallel) pool->parallelFor(blocks, [&](int begin, int end, int) { for (int b = begin; b < end; b++) count(b); });
+			else count(0);
+			// Offsets digit-major so equal digits keep their block order, skip the pass if one digit has them all
+			uint32_t sum = 0;
+			bool trivial = false;
+			for (int d = 0; d < 256 && !trivial; d++) {
+				uint32_t digitStart = sum;
+				for (int b = 0; b < blocks; b++) {
+					uint32_t c = counts[b][d];
+					counts[b][d] = sum;
+					sum += c;
+				}
+				trivial = sum - digitStart == (uint32_t)n;
+			}
+			if (trivial) continue;
+			auto scatter = [&](int b) {
+				std::array<uint32_t, 256>& offset = counts[b];
+				int end = std::min(n, (b + 1) * blockSize);
+				for (int i = b * blockSize; i < end; i++) {
+					uint32_t o = offset[(srcK[i] >> shift) & 0xff]++;
+					dstK[o] = srcK[i];
+					dstV[o] = srcV[i];
+				}
+			};
+			if (parallel) pool->parallelFor(blocks, [&](int begin, int end, int) { for (int b = begin; b < end; b++) scatter(b); });
+			else scatter(0);
+			std::swap(srcK, dstK);
+			std::swap(srcV, dstV);
+			passes++;
+		}
+		// Odd number of passes leaves the result in the scratch buffers
+		if (srcK != keys.data()) {
+			memcpy(keys.data(), srcK, n * sizeof(uint32_t));
+			memcpy(values.data(), srcV, n * sizeof(uint32_t));
+		}
+	}
+private:
+	vector<uint32_t> tmpKeys, tmpValues;
+	vector<std::array<uint32_t, 256>> counts;
+};
+
+#endif
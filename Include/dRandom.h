@@ -0,0 +1,68 @@
+// dRandom.h - Small, seedable random number streams (PCG32) for deterministic parallel work
+
+#ifndef DRANDOM_HDR
+#define DRANDOM_HDR
+
+#include <cstdint>
+#include <cmath>
+#include "VecMat.h"
+
+/* pcg32 is O'Neill's PCG-XSH-RR generator: 8 bytes of state, a 32 bit output per step and 2^63
+selectable streams. Unlike rand() it has no hidden global state, so every job can own one:
+ - keyedRng(seed, a, b, c) derives a generator from a seed and up to three keys
+   (e.g. emitter, frame, block), the same keys give the same sequence on any thread
+*/
+
+struct pcg32 {
+	uint64_t state = 0x853c49e6748fea9bull, inc = 0xda3e39cb94b95bdbull;
+	pcg32() { }
+	pcg32(uint64_t seed, uint64_t stream = 0) {
+		state = 0;
+		inc = (stream << 1) | 1;
+		next();
+		state += seed;
+		next();
+	}
+	uint32_t next() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ull + inc;
+		uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+		uint32_t rot = (uint32_t)(old >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+	}
+	// [0, 1) with 24 bits of precision
+	float uniform() { return (next() >> 8) * (1.0f / 16777216.0f); }
+	float range(float min, float max) { return min + (max - min) * uniform(); }
+	vec3 range(vec3 min, vec3 max) {
+		float x = range(min.x, max.x), y = range(min.y, max.y), z = range(min.z, max.z);
+		return vec3(x, y, z);
+	}
+	// Unit vector uniform on the sphere, like GeomUtils' rand_dir()
+	vec3 direction() {
+		float theta = range(0.0f, 2.0f * 3.14159265f), z = range(-1.0f, 1.0f), r = sqrtf(1.0f - z * z);
+		return vec3(r * cosf(theta), r * sinf(theta), z);
+	}
+	// [0, bound) without modulo bias
+	uint32_t below(uint32_t bound) {
+		uint32_t threshold = (0u - bound) % bound;
+		for (;;) {
+			uint32_t r = next();
+			if (r >= threshold) return r % bound;
+		}
+	}
+};
+
+// SplitMix64 finalizer, spreads nearby keys over the whole 64 bit range
+inline uint64_t mix64(uint64_t x) {
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+inline pcg32 keyedRng(uint64_t seed, uint64_t a = 0, uint64_t b = 0, uint64_t c = 0) {
+	uint64_t h = mix64(mix64(mix64(mix64(seed) ^ a) ^ b) ^ c);
+	return pcg32(h, mix64(h));
+}
+
+#endif
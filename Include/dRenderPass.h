@@ -68,7 +68,16 @@ struct RenderPass {
 			GLchar name[32]{ '\0' };
 			glGetActiveUniform(program, (GLuint)i, 32, &nameLen, &size, &type, name);
 			string nameStr(name);
-			uniform_ids[nameStr] = i;
+			// Active uniform index isn't necessarily its location
+			uniform_ids[nameStr] = glGetUniformLocation(program, name);
+			// Arrays are listed once as "name[0]", register every element
+			if (size > 1 && nameStr.size() > 3 && nameStr.compare(nameStr.size() - 3, 3, "[0]") == 0) {
+				string base = nameStr.substr(0, nameStr.size() - 3);
+				for (int e = 1; e < size; e++) {
+					string element = base + "[" + std::to_string(e) + "]";
+					uniform_ids[element] = glGetUniformLocation(program, element.c_str());
+				}
+			}
 		}
 	}
 	void checkCompileStatus(GLuint shader, const char* shaderType) {
@@ -103,6 +112,11 @@ struct RenderPass {
 			throw runtime_error("Error linking program");
 		}
 	}
+	// Location lookup without touching GL, for recording command lists off the GL thread
+	GLint location(const char* key) const {
+		map<string, GLint>::const_iterator it = uniform_ids.find(string(key));
+		return it == uniform_ids.end() ? -1 : it->second;
+	}
 	template<typename T>
 	void set(const char* key, T val) {
 		if (GLint id = getId(key); id >= 0) uniform(id, reinterpret_cast<T*>(&val));
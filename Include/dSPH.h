@@ -0,0 +1,245 @@
+// dSPH.h - Weakly compressible SPH fluid in a box, cell-sorted neighbor grid, passes on a ThreadPool
+
+#ifndef DSPH_HDR
+#define DSPH_HDR
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <cstdint>
+#include "VecMat.h"
+#include "dThreadPool.h"
+#include "dRadixSort.h"
+
+using std::vector;
+
+/* SPHFluid is a weakly compressible SPH (WCSPH) fluid inside the box [boxMin, boxMax], the walls of
+   the container it is drawn in:
+ - Particles are structure-of-arrays (px, py, pz, vx, vy, vz, density, pressure). Every substep they
+   are sorted by the cell of a grid of support-radius cells (RadixSort on cell indices) and all the
+   arrays permuted to match, so the particles of a cell are contiguous and the 3 cells along x of
+   each neighbor row are one contiguous range: a neighbor search is 9 ranges, read in order
+ - Density is summed with a cubic spline kernel (h = 1.2 spacing, support 2h), pressure follows
+   Tait's equation p = B ((density / restDensity)^7 - 1), clamped at 0 so free surfaces don't clump,
+   with B set so the speed of sound is 10x the fastest flow a fluid height allows (density errors
+   stay around 1%). Forces are the symmetric pressure gradient plus Monaghan's artificial viscosity
+ - advance() runs fixed substeps (dt from the CFL condition on the speed of sound and from gravity)
+   for the time it is given, carrying the remainder to the next call, at most maxSubsteps per call.
+   Density and force passes read the sorted arrays and write only their own particle, so they run
+   over a ThreadPool with results independent of the thread count
+ - Walls clamp particles half a spacing inside the box and reflect their velocity into it, scaled by
+   wallRestitution
+ - The particle mass is calibrated on reset() so a particle inside the initial lattice has exactly
+   restDensity
+*/
+
+struct SPHFluid {
+	vec3 boxMin = vec3(-1, -1, -1), boxMax = vec3(1, 1, 1);
+	vec3 gravity = vec3(0, -9.81f, 0);
+	float spacing = 0.02f; // between particles at rest
+	float restDensity = 1000.0f;
+	float viscosity = 0.1f; // Monaghan's alpha
+	float wallRestitution = 0.2f;
+	int maxSubsteps = 100; // per advance(), time past that is dropped
+	vector<float> px, py, pz, vx, vy, vz, density, pressure;
+	float time = 0.0f; // simulated seconds
+	int substeps = 0; // run so far
+	int count() const { return (int)px.size(); }
+	float smoothing() const { return h; }
+	float timestep() const { return dt; }
+	float particleMass() const { return mass; }
+	// Clears the particles and sets the kernel and grid for spacing and the box
+	void reset() {
+		for (vector<float>* a : { &px, &py, &pz, &vx, &vy, &vz, &density, &pressure }) a->clear();
+		time = 0.0f;
+		substeps = 0;
+		carry = 0.0f;
+		h = 1.2f * spacing;
+		support = 2.0f * h;
+		sigma = 1.0f / (3.14159265f * h * h * h);
+		vec3 extent = boxMax - boxMin;
+		for (int a = 0; a < 3; a++) cells[a] = std::max(1, (int)ceilf(extent[a] / support));
+		cellStart.assign((size_t)cells[0] * cells[1] * cells[2] + 1, 0);
+		// Mass so a particle with a full lattice of neighbors has restDensity
+		float sum = 0.0f;
+		int reach = (int)ceilf(support / spacing);
+		for (int z = -reach; z <= reach; z++)
+			for (int y = -reach; y <= reach; y++)
+				for (int x = -reach; x <= reach; x++) sum += kernel(spacing * sqrtf((float)(x * x + y * y + z * z)));
+		mass = restDensity / sum;
+		setSoundSpeed(extent.y);
+	}
+	// Fills [lo, hi] (clipped to the box) with particles on a lattice at spacing, at rest
+	void addBlock(vec3 lo, vec3 hi) {
+		lo = vec3(std::max(lo.x, boxMin.x), std::max(lo.y, boxMin.y), std::max(lo.z, boxMin.z));
+		hi = vec3(std::min(hi.x, boxMax.x), std::min(hi.y, boxMax.y), std::min(hi.z, boxMax.z));
+		for (float z = lo.z + 0.5f * spacing; z < hi.z; z += spacing)
+			for (float y = lo.y + 0.5f * spacing; y < hi.y; y += spacing)
+				for (float x = lo.x + 0.5f * spacing; x < hi.x; x += spacing) {
+					px.push_back(x); py.push_back(y); pz.push_back(z);
+					vx.push_back(0.0f); vy.push_back(0.0f); vz.push_back(0.0f);
+					density.push_back(restDensity); pressure.push_back(0.0f);
+				}
+	}
+	// Stiffness from the tallest fluid column, fluidHeight: flow is at most sqrt(2 g H), sound 10x that
+	void setSoundSpeed(float fluidHeight) {
+		float g = length(gravity);
+		soundSpeed = 10.0f * sqrtf(2.0f * std::max(g, 1e-3f) * std::max(fluidHeight, spacing));
+		stiffness = restDensity * soundSpeed * soundSpeed / 7.0f;
+		dt = std::min(0.4f * h / (soundSpeed * (1.0f + 0.6f * viscosity)), 0.25f * sqrtf(h / std::max(g, 1e-3f)));
+	}
+	// Runs the substeps that fit in seconds plus what was left over last time, returns how many ran
+	int advance(float seconds, ThreadPool* pool = nullptr) {
+		carry += seconds;
+		int n = 0;
+		for (; carry >= dt && n < maxSubsteps; n++) {
+			substep(pool);
+			carry -= dt;
+		}
+		if (n == maxSubsteps) carry = 0.0f;
+		return n;
+	}
+	void substep(ThreadPool* pool = nullptr) {
+		int n = count();
+		if (!n) return;
+		sortByCell(pool);
+		run(n, pool, [&](int i) { computeDensity(i); });
+		run(n, pool, [&](int i) { computeForce(i); });
+		run(n, pool, [&](int i) { integrate(i); });
+		time += dt;
+		substeps++;
+	}
+private:
+	float h = 0.0f, support = 0.0f, sigma = 0.0f, mass = 0.0f;
+	float soundSpeed = 0.0f, stiffness = 0.0f, dt = 1e-3f, carry = 0.0f;
+	int cells[3] = { 1, 1, 1 };
+	vector<uint32_t> cellStart; // particles of cell c are [cellStart[c], cellStart[c + 1])
+	vector<uint32_t> cellOf; // per sorted particle
+	vector<float> ax, ay, az, scratch;
+	vector<uint32_t> neighbors; // MAX_NEIGHBORS per particle, found by the density pass for the force pass
+	vector<int> neighborCount; // MAX_NEIGHBORS + 1 if they didn't fit, the force pass searches again
+	RadixSort sorter;
+	static const int GRAIN = 512;
+	static const int MAX_NEIGHBORS = 80; // about 58 at rest
+	void run(int n, ThreadPool* pool, const std::function<void(int)>& fn) {
+		auto range = [&](int begin, int end, int) { for (int i = begin; i < end; i++) fn(i); };
+		if (pool) pool->parallelFor(n, range, GRAIN);
+		else range(0, n, 0);
+	}
+	float kernel(float r) const {
+		float q = r / h;
+		if (q >= 2.0f) return 0.0f;
+		if (q >= 1.0f) return sigma * 0.25f * (2.0f - q) * (2.0f - q) * (2.0f - q);
+		return sigma * (1.0f - 1.5f * q * q + 0.75f * q * q * q);
+	}
+	// dW/dr divided by r, so the gradient is this times the offset
+	float gradientOverR(float r) const {
+		float q = r / h;
+		if (q >= 2.0f || r <= 0.0f) return 0.0f;
+		float dw = q >= 1.0f ? -0.75f * (2.0f - q) * (2.0f - q) : -3.0f * q + 2.25f * q * q;
+		return sigma * dw / (h * r);
+	}
+	int cellCoord(float p, int axis) const {
+		int c = (int)((p - boxMin[axis]) / support);
+		return std::min(std::max(c, 0), cells[axis] - 1);
+	}
+	void sortByCell(ThreadPool* pool) {
+		int n = count();
+		sorter.keys.resize(n);
+		sorter.values.resize(n);
+		for (int i = 0; i < n; i++) {
+			sorter.keys[i] = (uint32_t)((cellCoord(pz[i], 2) * cells[1] + cellCoord(py[i], 1)) * cells[0] + cellCoord(px[i], 0));
+			sorter.values[i] = (uint32_t)i;
+		}
+		sorter.sort(n, pool);
+		scratch.resize(n);
+		for (vector<float>* a : { &px, &py, &pz, &vx, &vy, &vz }) {
+			const uint32_t* order = sorter.values.data();
+			for (int i = 0; i < n; i++) scratch[i] = (*a)[order[i]];
+			a->swap(scratch);
+		}
+		cellOf.assign(sorter.keys.begin(), sorter.keys.begin() + n);
+		for (vector<float>* a : { &density, &pressure, &ax, &ay, &az }) a->resize(n);
+		neighbors.resize((size_t)n * MAX_NEIGHBORS);
+		neighborCount.resize(n);
+		// cellStart[c] = first sorted particle in a cell >= c
+		std::fill(cellStart.begin(), cellStart.end(), 0);
+		for (int i = 0; i < n; i++) cellStart[cellOf[i] + 1]++;
+		for (size_t c = 1; c < cellStart.size(); c++) cellStart[c] += cellStart[c - 1];
+	}
+	// Calls fn(j) for every particle in the 27 cells around particle i, as 9 contiguous runs along x
+	template <typename Fn>
+	void forNeighbors(int i, Fn fn) const {
+		int cx = cellCoord(px[i], 0), cy = cellCoord(py[i], 1), cz = cellCoord(pz[i], 2);
+		int x0 = std::max(cx - 1, 0), x1 = std::min(cx + 1, cells[0] - 1);
+		for (int z = std::max(cz - 1, 0); z <= std::min(cz + 1, cells[2] - 1); z++)
+			for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, cells[1] - 1); y++) {
+				size_t row = ((size_t)z * cells[1] + y) * cells[0];
+				for (uint32_t j = cellStart[row + x0], end = cellStart[row + x1 + 1]; j < end; j++) fn((int)j);
+			}
+	}
+	void computeDensity(int i) {
+		float sum = 0.0f, xi = px[i], yi = py[i], zi = pz[i], r2max = support * support;
+		uint32_t* list = &neighbors[(size_t)i * MAX_NEIGHBORS];
+		int found = 0;
+		forNeighbors(i, [&](int j) {
+			float dx = xi - px[j], dy = yi - py[j], dz = zi - pz[j], r2 = dx * dx + dy * dy + dz * dz;
+			if (r2 >= r2max) return;
+			sum += kernel(sqrtf(r2));
+			if (j != i && found < MAX_NEIGHBORS) list[found] = (uint32_t)j;
+			found += j != i;
+		});
+		neighborCount[i] = std::min(found, MAX_NEIGHBORS + 1);
+		density[i] = mass * sum;
+		float ratio = density[i] / restDensity, r7 = ratio * ratio * ratio;
+		r7 = r7 * r7 * ratio;
+		pressure[i] = std::max(0.0f, stiffness * (r7 - 1.0f));
+	}
+	void computeForce(int i) {
+		float xi = px[i], yi = py[i], zi = pz[i], r2max = support * support;
+		float pi = pressure[i] / (density[i] * density[i]);
+		float fx = 0.0f, fy = 0.0f, fz = 0.0f;
+		auto pair = [&](int j) {
+			float dx = xi - px[j], dy = yi - py[j], dz = zi - pz[j], r2 = dx * dx + dy * dy + dz * dz;
+			if (r2 >= r2max || j == i) return;
+			float r = sqrtf(r2), term = pi + pressure[j] / (density[j] * density[j]);
+			// Artificial viscosity only between particles closing in on each other
+			float vr = (vx[i] - vx[j]) * dx + (vy[i] - vy[j]) * dy + (vz[i] - vz[j]) * dz;
+			if (vr < 0.0f) {
+				float mu = h * vr / (r2 + 0.01f * h * h);
+				term -= viscosity * soundSpeed * mu / (0.5f * (density[i] + density[j]));
+			}
+			float g = -mass * term * gradientOverR(r);
+			fx += g * dx; fy += g * dy; fz += g * dz;
+		};
+		if (neighborCount[i] <= MAX_NEIGHBORS) {
+			const uint32_t* list = &neighbors[(size_t)i * MAX_NEIGHBORS];
+			for (int k = 0; k < neighborCount[i]; k++) pair((int)list[k]);
+		}
+		else forNeighbors(i, pair);
+		ax[i] = fx + gravity.x;
+		ay[i] = fy + gravity.y;
+		az[i] = fz + gravity.z;
+	}
+	// Semi-implicit Euler, then the walls
+	void integrate(int i) {
+		vx[i] += dt * ax[i]; vy[i] += dt * ay[i]; vz[i] += dt * az[i];
+		px[i] += dt * vx[i]; py[i] += dt * vy[i]; pz[i] += dt * vz[i];
+		float* p[3] = { &px[i], &py[i], &pz[i] };
+		float* v[3] = { &vx[i], &vy[i], &vz[i] };
+		float inset = 0.5f * spacing;
+		for (int a = 0; a < 3; a++) {
+			if (*p[a] < boxMin[a] + inset) {
+				*p[a] = boxMin[a] + inset;
+				if (*v[a] < 0.0f) *v[a] *= -wallRestitution;
+			}
+			if (*p[a] > boxMax[a] - inset) {
+				*p[a] = boxMax[a] - inset;
+				if (*v[a] > 0.0f) *v[a] *= -wallRestitution;
+			}
+		}
+	}
+};
+
+#endif
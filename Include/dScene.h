@@ -4,123 +4,455 @@
 #define DSCENE_HDR
 
 #include <vector>
+#include <string>
 #include <stdexcept>
 #include <fstream>
-#include <map>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+#include <cstring>
 #include "VecMat.h"
 #include "dCamera.h"
+#include "dCollisions.h"
 #include "dMesh.h"
 #include "dRenderPass.h"
+#include "dCommandList.h"
 #include "dMisc.h"
 
 using std::vector;
-using std::map;
+using std::string;
 using std::runtime_error;
 using std::ifstream;
+using std::ofstream;
+using std::istringstream;
 using std::getline;
 
+/* SceneGraph keeps scene data and GPU resources apart:
+ - data / instances describe the scene and are all that gets serialized, every mesh's instances
+   are a contiguous range [firstInstance, firstInstance + numInstances) of one instances array
+ - upload() creates a Mesh for every entry that doesn't have one yet, so scenes can be loaded
+   and converted without a GL context
+ - frustumCull() culls each 'F' mesh's instances into a per-mesh buffer and uploads them, cull()
+   does the same off the GL thread and record() uploads them with the draw in a command list
+ - render() / record() issue one draw per mesh, so every instance of a mesh is a single draw
+ - recordCasters() draws instances by some other test (e.g. a shadow cascade) independent of culling
+
+Text scenes (.scg), one mesh per block:
+	m <collider: N/S/A/O/C> <culling: N/F> '<obj path>' '<texture path>'
+	mdl	<model matrix rows, separated by |>
+	!	<instance matrix rows, separated by |> (repeated)
+	e
+Lines starting with '#' are comments. A mesh with a single instance bakes it into its model matrix.
+
+Binary scenes (.scgb) are the same data laid out to be read straight from one mapping, see
+SceneFileHeader. Matrices are stored as row-major floats in native (little) endian.
+*/
+
 struct MeshDetails {
 	bool instanced = false;
 	char culling = 'N'; // N = None, F = Frustum
 };
 
+struct SceneMeshData {
+	string obj;
+	string tex;
+	char collider = 'N'; // N = None, S = Sphere, A = AABB, O = OBB, C = ConvexHull
+	MeshDetails details;
+	mat4 model;
+	uint32_t firstInstance = 0;
+	uint32_t numInstances = 0;
+};
+
+// .scgb layout: header, mesh records, instance matrices, then the string table for paths
+struct SceneFileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t numMeshes;
+	uint32_t numInstances;
+	uint32_t stringBytes;
+};
+
+struct SceneFileMesh {
+	uint32_t objOffset, objLength;
+	uint32_t texOffset, texLength;
+	char collider, culling;
+	uint8_t instanced, pad;
+	float model[16];
+	uint32_t firstInstance, numInstances;
+};
+
+const char SCENE_MAGIC[4] = { 'S', 'C', 'G', 'B' };
+const uint32_t SCENE_VERSION = 1;
+
 struct SceneGraph {
+	vector<SceneMeshData> data;
+	vector<mat4> instances;
+	// GPU side, parallel to data once uploaded
 	vector<Mesh> meshes;
-	vector<vector<mat4>> transforms;
-	vector<string> objs;
-	vector<string> texs;
-	vector<MeshDetails> details;
+	vector<vector<mat4>> culled;
+	vector<char> visible;
+	// Decoded by loadAssets() for upload(), indexed like data
+	vector<ObjData> assetObjs;
+	vector<Image> assetImages;
 	SceneGraph() { };
-	SceneGraph(string scgPath) {
-		deserialize(scgPath);
+	SceneGraph(string path, bool uploadMeshes = true) {
+		deserialize(path);
+		if (uploadMeshes) upload();
+	}
+	static bool isBinary(const string& path) {
+		return path.size() >= 5 && path.compare(path.size() - 5, 5, ".scgb") == 0;
 	}
 	void serialize(string path) {
-
+		if (isBinary(path)) serializeBinary(path);
+		else serializeText(path);
 	}
 	void deserialize(string path) {
+		if (isBinary(path)) deserializeBinary(path);
+		else deserializeText(path);
+	}
+	void serializeText(string path) {
+		ofstream file(path);
+		if (!file.is_open())
+			throw runtime_error("Failed to write scene graph file '" + path + "'");
+		file << std::setprecision(9);
+		for (const SceneMeshData& d : data) {
+			file << "m " << d.collider << ' ' << d.details.culling << ' ' << std::quoted(d.obj, '\'') << ' ' << std::quoted(d.tex, '\'') << '\n';
+			file << "mdl\t";
+			writeMatrix(file, d.model);
+			for (uint32_t i = 0; i < d.numInstances; i++) {
+				file << "!\t";
+				writeMatrix(file, instances[d.firstInstance + i]);
+			}
+			file << "e\n";
+		}
+	}
+	void deserializeText(string path) {
 		// Open scg file
 		ifstream file(path);
 		if (!file.is_open())
 			throw runtime_error("Failed to read scene graph file '" + path + "'");
+		clear();
 		// Read file
 		string line;
-		int cur_mesh = -1;
-		vector<mat4> instance_transforms;
-		MeshDetails meshDetails;
+		int lineNum = 0;
+		bool inMesh = false;
+		SceneMeshData cur;
+		vector<mat4> curInstances;
 		while (getline(file, line)) {
-			if (line[0] == 'm') {
-				instance_transforms.clear();
-				char colliderType;
-				char objPath[128]{ '\0' };
-				char texPath[128]{ '\0' };
-				if (sscanf(line.c_str(), "m %c %c '%s' '%s'", &colliderType, &meshDetails.culling, objPath, texPath) < 3)
-					throw runtime_error("Error reading mesh details!");
-				string objStr(objPath), texStr(texPath);
-				Mesh m = Mesh(objStr, texStr, mat4());
-				switch (colliderType) {
-					case 'S':
-						m.createCollider<Sphere>();
-						break;
-					case 'A':
-						m.createCollider<AABB>();
-						break;
-					case 'O':
-						m.createCollider<OBB>();
-						break;
-					case 'C':
-						m.createCollider<ConvexHull>();
-						break;
-				}
-				cur_mesh = meshes.size();
-				meshes.push_back(m);
-			} else if (strncmp(line.c_str(), "mdl", 3) == 0) {
-				if (cur_mesh == -1)
-					throw runtime_error("Received model matrix before mesh specifier!");
+			lineNum++;
+			istringstream in(line);
+			string tag;
+			if (!(in >> tag) || tag[0] == '#') continue;
+			string where = "' (" + path + ":" + std::to_string(lineNum) + ")";
+			if (tag == "m") {
+				if (inMesh)
+					throw runtime_error("Mesh specifier before end of previous mesh" + where.substr(1));
+				cur = SceneMeshData();
+				curInstances.clear();
+				if (!(in >> cur.collider >> cur.details.culling >> std::quoted(cur.obj, '\'') >> std::quoted(cur.tex, '\'')))
+					throw runtime_error("Error reading mesh details '" + line + where);
+				inMesh = true;
+			} else if (tag == "mdl") {
+				if (!inMesh)
+					throw runtime_error("Received model matrix before mesh specifier" + where.substr(1));
+				if (!readMatrix(in, cur.model))
+					throw runtime_error("Error reading model matrix '" + line + where);
+			} else if (tag == "!") {
+				if (!inMesh)
+					throw runtime_error("Received instance matrix before mesh specifier" + where.substr(1));
 				mat4 m;
-				if (sscanf(line.c_str(), "mdl\t%f %f %f %f | %f %f %f %f | %f %f %f %f | %f %f %f %f", &m[0][0], &m[0][1], &m[0][2], &m[0][3], &m[1][0], &m[1][1], &m[1][2], &m[1][3], &m[2][0], &m[2][1], &m[2][2], &m[2][3], &m[3][0], &m[3][1], &m[3][2], &m[3][3]) < 16)
-					throw runtime_error("Error reading model matrix!");
-				meshes[cur_mesh].model = m;
-			} else if (line[0] == '!') {
-				if (cur_mesh == -1)
-					throw runtime_error("Received instance matrix before mesh specified!");
-				mat4 m;
-				if (sscanf(line.c_str(), "!\t%f %f %f %f | %f %f %f %f | %f %f %f %f | %f %f %f %f", &m[0][0], &m[0][1], &m[0][2], &m[0][3], &m[1][0], &m[1][1], &m[1][2], &m[1][3], &m[2][0], &m[2][1], &m[2][2], &m[2][3], &m[3][0], &m[3][1], &m[3][2], &m[3][3]) < 16)
-					throw runtime_error("Error reading instance matrix!");
-				instance_transforms.push_back(m);
-			} else if (line[0] == 'e') {
-				if (instance_transforms.size() <= 1) {
-					if (instance_transforms.size() == 1)
-						meshes[cur_mesh].model = instance_transforms[0] * meshes[cur_mesh].model;
-				} else {
-					meshDetails.instanced = true;
-					meshes[cur_mesh].setupInstanceBuffer((GLsizei)instance_transforms.size());
-					meshes[cur_mesh].loadInstances(instance_transforms);
-					transforms.resize(meshes.size());
-					transforms[cur_mesh] = instance_transforms;
+				if (!readMatrix(in, m))
+					throw runtime_error("Error reading instance matrix '" + line + where);
+				curInstances.push_back(m);
+			} else if (tag == "e") {
+				if (!inMesh)
+					throw runtime_error("Received mesh end before mesh specifier" + where.substr(1));
+				if (curInstances.size() == 1) {
+					cur.model = curInstances[0] * cur.model;
+					curInstances.clear();
 				}
-				details.push_back(meshDetails);
-				meshDetails = MeshDetails();
-				cur_mesh = -1;
-			} 
+				addMesh(cur.obj, cur.tex, cur.model, curInstances, cur.collider, cur.details.culling);
+				inMesh = false;
+			} else throw runtime_error("Unknown scene graph line '" + line + where);
 		}
+		if (inMesh)
+			throw runtime_error("Missing end of last mesh in '" + path + "'");
 	}
-	void addMesh() {
-
+	void serializeBinary(string path) {
+		// Build string table and mesh records
+		string strings;
+		vector<SceneFileMesh> records(data.size());
+		for (size_t i = 0; i < data.size(); i++) {
+			const SceneMeshData& d = data[i];
+			SceneFileMesh& r = records[i];
+			memset(&r, 0, sizeof(r));
+			r.objOffset = (uint32_t)strings.size();
+			r.objLength = (uint32_t)d.obj.size();
+			strings += d.obj;
+			r.texOffset = (uint32_t)strings.size();
+			r.texLength = (uint32_t)d.tex.size();
+			strings += d.tex;
+			r.collider = d.collider;
+			r.culling = d.details.culling;
+			r.instanced = d.details.instanced;
+			memcpy(r.model, &d.model.row[0].x, sizeof(r.model));
+			r.firstInstance = d.firstInstance;
+			r.numInstances = d.numInstances;
+		}
+		SceneFileHeader header;
+		memcpy(header.magic, SCENE_MAGIC, 4);
+		header.version = SCENE_VERSION;
+		header.numMeshes = (uint32_t)records.size();
+		header.numInstances = (uint32_t)instances.size();
+		header.stringBytes = (uint32_t)strings.size();
+		ofstream file(path, std::ios::binary);
+		if (!file.is_open())
+			throw runtime_error("Failed to write scene graph file '" + path + "'");
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)records.data(), records.size() * sizeof(SceneFileMesh));
+		for (const mat4& m : instances)
+			file.write((const char*)&m.row[0].x, 16 * sizeof(float));
+		file.write(strings.data(), strings.size());
+		if (!file)
+			throw runtime_error("Failed to write scene graph file '" + path + "'");
 	}
-	void addMesh() {
-
+	void deserializeBinary(string path) {
+		MappedFile file(path);
+		const uint8_t* p = file.data;
+		// Validate sizes up front, then read every section in place
+		SceneFileHeader header;
+		if (file.size < sizeof(header))
+			throw runtime_error("Truncated scene graph file '" + path + "'");
+		memcpy(&header, p, sizeof(header));
+		if (memcmp(header.magic, SCENE_MAGIC, 4) != 0 || header.version != SCENE_VERSION)
+			throw runtime_error("Unsupported scene graph file '" + path + "'");
+		size_t recordsOffset = sizeof(header);
+		size_t instancesOffset = recordsOffset + (size_t)header.numMeshes * sizeof(SceneFileMesh);
+		size_t stringsOffset = instancesOffset + (size_t)header.numInstances * 16 * sizeof(float);
+		if (file.size < stringsOffset + header.stringBytes)
+			throw runtime_error("Truncated scene graph file '" + path + "'");
+		clear();
+		const char* strings = (const char*)p + stringsOffset;
+		data.resize(header.numMeshes);
+		for (uint32_t i = 0; i < header.numMeshes; i++) {
+			SceneFileMesh r;
+			memcpy(&r, p + recordsOffset + i * sizeof(SceneFileMesh), sizeof(r));
+			if ((size_t)r.objOffset + r.objLength > header.stringBytes || (size_t)r.texOffset + r.texLength > header.stringBytes
+				|| (size_t)r.firstInstance + r.numInstances > header.numInstances)
+				throw runtime_error("Corrupt mesh record in scene graph file '" + path + "'");
+			SceneMeshData& d = data[i];
+			d.obj.assign(strings + r.objOffset, r.objLength);
+			d.tex.assign(strings + r.texOffset, r.texLength);
+			d.collider = r.collider;
+			d.details.culling = r.culling;
+			d.details.instanced = r.instanced != 0;
+			memcpy(&d.model.row[0].x, r.model, sizeof(r.model));
+			d.firstInstance = r.firstInstance;
+			d.numInstances = r.numInstances;
+		}
+		instances.resize(header.numInstances);
+		if (header.numInstances)
+			memcpy((void*)&instances[0].row[0].x, p + instancesOffset, (size_t)header.numInstances * sizeof(mat4));
 	}
-	void render(RenderPass pass) {
-
+	// Appends a mesh and its instances, meshes with more than one instance are drawn instanced
+	int addMesh(string obj, string tex, mat4 model, const vector<mat4>& meshInstances, char collider = 'N', char culling = 'N') {
+		SceneMeshData d;
+		d.obj = obj;
+		d.tex = tex;
+		d.model = model;
+		d.collider = collider;
+		d.details.culling = culling;
+		d.details.instanced = meshInstances.size() > 1;
+		d.firstInstance = (uint32_t)instances.size();
+		d.numInstances = (uint32_t)meshInstances.size();
+		instances.insert(instances.end(), meshInstances.begin(), meshInstances.end());
+		data.push_back(d);
+		return (int)data.size() - 1;
+	}
+	// Reads and decodes obj / texture files of entries not uploaded yet, safe off the GL thread
+	void loadAssets() {
+		assetObjs.resize(data.size());
+		assetImages.resize(data.size());
+		for (size_t i = meshes.size(); i < data.size(); i++) {
+			assetObjs[i] = readObj(data[i].obj);
+			normalizePoints(assetObjs[i].points, 1.0f);
+			assetImages[i] = readImage(data[i].tex);
+		}
 	}
-	void frustumCull(Camera cam) {
+	// Estimated memory of uploaded meshes (vertices, indices, textures with mips, instances)
+	size_t bytes() const {
+		size_t total = instances.size() * sizeof(mat4);
+		for (size_t i = 0; i < data.size(); i++) {
+			const ObjData* obj = i < meshes.size() ? &meshes[i].objData : i < assetObjs.size() ? &assetObjs[i] : nullptr;
+			if (obj) total += obj->points.size() * sizeof(vec3) * 2 + obj->uvs.size() * sizeof(vec2) + obj->indices.size() * sizeof(int3);
+			if (i < assetImages.size()) total += assetImages[i].pixels.size() * 4 / 3;
+		}
+		return total + textureBytes;
+	}
+	// Creates GPU meshes for entries added since the last upload, needs the GL thread
+	void upload() {
+		for (size_t i = meshes.size(); i < data.size(); i++) {
+			const SceneMeshData& d = data[i];
+			bool preloaded = i < assetObjs.size() && !assetObjs[i].points.empty();
+			Mesh m = preloaded ? Mesh(assetObjs[i], assetImages[i], d.model) : Mesh(d.obj, d.tex, d.model);
+			if (preloaded) textureBytes += assetImages[i].pixels.size() * 4 / 3;
+			switch (d.collider) {
+				case 'S': m.createCollider<Sphere>(); break;
+				case 'A': m.createCollider<AABB>(); break;
+				case 'O': m.createCollider<OBB>(); break;
+				case 'C': m.createCollider<ConvexHull>(); break;
+			}
+			if (d.details.instanced) {
+				m.setupInstanceBuffer((GLsizei)d.numInstances);
+				m.loadInstances(instanceData(i), (GLsizei)d.numInstances);
+			}
+			meshes.push_back(m);
+		}
+		// Until culled everything is in view
+		culled.resize(meshes.size());
+		visible.resize(meshes.size(), true);
+		for (size_t i = 0; i < meshes.size(); i++)
+			if (culled[i].empty()) culled[i].assign(instanceData(i), instanceData(i) + data[i].numInstances);
+		assetObjs.clear();
+		assetImages.clear();
+	}
+	size_t size() const { return data.size(); }
+	const mat4* instanceData(size_t i) const { return instances.data() + data[i].firstInstance; }
+	bool culls(size_t i) const { return data[i].details.culling == 'F' && meshes[i].collider && meshes[i].collider->type == ColliderType::Sphere; }
+	// World space bounding sphere of mesh i placed by instance transform tf
+	void bounds(size_t i, const mat4& tf, vec3& center, float& radius) const {
+		const Sphere* sphere = (const Sphere*)meshes[i].collider;
+		mat4 m = tf * meshes[i].model;
+		center = vec3(m * vec4(sphere->center, 1));
+		float scale = std::max({ length(vec3(m[0][0], m[1][0], m[2][0])), length(vec3(m[0][1], m[1][1], m[2][1])), length(vec3(m[0][2], m[1][2], m[2][2])) });
+		radius = sphere->radius * scale;
+	}
+	// Appends mesh i's instances whose bounds pass inside(center, radius) to out
+	template <typename Inside>
+	void cullInto(size_t i, vector<mat4>& out, Inside inside) const {
+		const mat4* tf = instanceData(i);
+		vec3 center;
+		float radius;
+		for (uint32_t j = 0; j < data[i].numInstances; j++) {
+			bounds(i, tf[j], center, radius);
+			if (inside(center, radius)) out.push_back(tf[j]);
+		}
+	}
+	// Culls mesh i's instances into culled[i] (or its visibility if not instanced), touches no GL state
+	void cull(size_t i, Frustum& frustum) {
+		if (!culls(i)) return;
+		auto inside = [&](vec3 center, float radius) { return frustum.inFrustum(center, radius); };
+		if (!data[i].details.instanced) {
+			vec3 center;
+			float radius;
+			bounds(i, mat4(), center, radius);
+			visible[i] = inside(center, radius);
+			return;
+		}
+		culled[i].clear();
+		cullInto(i, culled[i], inside);
+	}
+	void frustumCull(Camera& cam) {
 		Frustum frustum(cam);
-		// TODO iterate through meshes, cull, load instances
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (!culls(i)) continue;
+			cull(i, frustum);
+			if (data[i].details.instanced) meshes[i].loadInstances(culled[i]);
+		}
+	}
+	// Restores every mesh to all of its instances, e.g. after culling is turned off
+	void resetCulling() {
+		for (size_t i = 0; i < meshes.size(); i++) {
+			visible[i] = true;
+			culled[i].assign(instanceData(i), instanceData(i) + data[i].numInstances);
+			if (data[i].details.instanced) meshes[i].loadInstances(culled[i]);
+		}
+	}
+	GLsizei visibleInstances(size_t i) const { return data[i].details.instanced ? (GLsizei)culled[i].size() : (GLsizei)visible[i]; }
+	// Draws instanced meshes (or only non-instanced ones) with pass, which should already be in use
+	void render(RenderPass& pass, bool instanced = true) {
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (data[i].details.instanced != instanced || !visible[i]) continue;
+			pass.set("model", meshes[i].model);
+			if (instanced) meshes[i].renderInstanced();
+			else {
+				pass.set("transform", mat4());
+				meshes[i].render();
+			}
+		}
+	}
+	// Records culled instances (uploaded with the draw, as other lists may upload their own) or visible meshes
+	void record(CommandList& cmds, const RenderPass& pass, bool instanced = true) const {
+		GLint model = pass.location("model"), transform = pass.location("transform");
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (data[i].details.instanced != instanced || !visible[i]) continue;
+			cmds.uniform(model, meshes[i].model);
+			if (instanced) meshes[i].recordInstanced(cmds, culled[i]);
+			else {
+				cmds.uniform(transform, mat4());
+				meshes[i].record(cmds);
+			}
+		}
+	}
+	// Records shadow casters: instances passing inside(center, radius), ignoring camera culling
+	template <typename Inside>
+	void recordCasters(CommandList& cmds, const RenderPass& pass, vector<mat4>& scratch, Inside inside, bool instanced = true) const {
+		GLint model = pass.location("model"), transform = pass.location("transform");
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (data[i].details.instanced != instanced) continue;
+			bool sphere = meshes[i].collider && meshes[i].collider->type == ColliderType::Sphere;
+			if (instanced) {
+				scratch.clear();
+				if (sphere) cullInto(i, scratch, inside);
+				else scratch.assign(instanceData(i), instanceData(i) + data[i].numInstances);
+				if (scratch.empty()) continue;
+				cmds.uniform(model, meshes[i].model);
+				meshes[i].recordInstanced(cmds, scratch);
+			} else {
+				vec3 center;
+				float radius;
+				if (sphere) bounds(i, mat4(), center, radius);
+				if (sphere && !inside(center, radius)) continue;
+				cmds.uniform(model, meshes[i].model);
+				cmds.uniform(transform, mat4());
+				meshes[i].record(cmds);
+			}
+		}
+	}
+	void clear() {
+		data.clear();
+		instances.clear();
 	}
 	void cleanup() {
-
+		for (Mesh& m : meshes) m.cleanup();
+		meshes.clear();
+		culled.clear();
+		visible.clear();
+		assetObjs.clear();
+		assetImages.clear();
+		textureBytes = 0;
+		clear();
+	}
+private:
+	size_t textureBytes = 0;
+	static bool readMatrix(istringstream& in, mat4& m) {
+		for (int r = 0; r < 4; r++) {
+			if (r > 0) {
+				string sep;
+				if (!(in >> sep) || sep != "|") return false;
+			}
+			for (int c = 0; c < 4; c++)
+				if (!(in >> m[r][c])) return false;
+		}
+		return true;
+	}
+	static void writeMatrix(ofstream& out, const mat4& m) {
+		for (int r = 0; r < 4; r++) {
+			if (r > 0) out << " | ";
+			out << m.row[r].x << ' ' << m.row[r].y << ' ' << m.row[r].z << ' ' << m.row[r].w;
+		}
+		out << '\n';
 	}
 };
 
-
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,195 @@
+// dShadows.h - Cascaded shadow maps for a directional light
+
+#ifndef DSHADOWS_HDR
+#define DSHADOWS_HDR
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include "glad.h"
+#include "VecMat.h"
+#include "GeomUtils.h"
+#include "dCamera.h"
+#include "dRenderPass.h"
+#include "dCommandList.h"
+
+using std::vector;
+using std::string;
+using std::runtime_error;
+
+/* CascadedShadows splits the first shadowDistance units of the camera frustum into slices and gives
+each slice its own depth texture, so resolution goes where the camera is looking:
+ - Slices blend logarithmic and uniform splits by splitLambda
+ - Each cascade is an orthographic box around the bounding sphere of its slice (from frustumCorners()),
+   the sphere doesn't change as the camera turns and its projection is snapped to whole texels,
+   so shadow edges don't shimmer as the camera moves
+ - casts() tests a caster's bounding sphere against a cascade's box, for culling casters per cascade
+ - With cacheStatic on, static casters are drawn once into a cache per cascade and each frame the cache
+   is blitted into the cascade before dynamic casters are drawn over it. Cascades then only move in
+   steps of cacheSnap * radius (grown by a step so their slice stays covered), and a cascade's cache is
+   redrawn when it steps, the light direction changes or the static content version passed to
+   update() changes, see refresh[]
+ - Textures are separate (resolution can differ per cascade), so shaders pick the cascade's sampler
+   with an if-chain: sampling shaders should declare
+	uniform mat4 depth_vp[4];
+	uniform float cascade_far[4];
+	uniform int num_cascades;
+	uniform sampler2DShadow shadow0, shadow1, shadow2, shadow3;
+   and pick the first cascade whose cascade_far is past the fragment's view depth
+*/
+
+struct CascadedShadows {
+	static const int MAX_CASCADES = 4;
+	int count = 3;
+	int resolution[MAX_CASCADES] = { 2048, 2048, 1024, 1024 };
+	float shadowDistance = 200.0f;
+	float splitLambda = 0.75f; // 1 = logarithmic splits, 0 = uniform splits
+	float casterMargin = 100.0f; // distance towards the light past a cascade that casters are still drawn
+	vec3 lightDir = normalize(vec3(20, 30, 20)); // towards the light
+	bool cacheStatic = true;
+	float cacheSnap = 0.125f;
+	GLuint framebuffers[MAX_CASCADES] = { 0 };
+	GLuint textures[MAX_CASCADES] = { 0 };
+	GLuint cacheFramebuffers[MAX_CASCADES] = { 0 };
+	GLuint cacheTextures[MAX_CASCADES] = { 0 };
+	mat4 view[MAX_CASCADES];
+	mat4 vp[MAX_CASCADES];
+	float splitFar[MAX_CASCADES] = { 0.0f };
+	float radius[MAX_CASCADES] = { 0.0f };
+	bool refresh[MAX_CASCADES] = { false }; // cache needs static casters redrawn this frame
+	int cacheRefreshes = 0;
+	void setup() {
+		cleanup();
+		count = std::max(1, std::min(count, MAX_CASCADES));
+		for (int c = 0; c < count; c++) {
+			createTarget(resolution[c], framebuffers[c], textures[c]);
+			createTarget(resolution[c], cacheFramebuffers[c], cacheTextures[c]);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		invalidate();
+	}
+	void cleanup() {
+		for (int c = 0; c < MAX_CASCADES; c++) {
+			for (GLuint* fbo : { &framebuffers[c], &cacheFramebuffers[c] })
+				if (*fbo) glDeleteFramebuffers(1, fbo);
+			for (GLuint* tex : { &textures[c], &cacheTextures[c] })
+				if (*tex) glDeleteTextures(1, tex);
+			framebuffers[c] = textures[c] = cacheFramebuffers[c] = cacheTextures[c] = 0;
+		}
+	}
+	void invalidate() {
+		for (int c = 0; c < MAX_CASCADES; c++) cached[c] = false;
+	}
+	// Depth texture memory in bytes, cascades and their caches
+	size_t bytes() const {
+		size_t total = 0;
+		for (int c = 0; c < count; c++) total += (size_t)resolution[c] * resolution[c] * 2 * 2;
+		return total;
+	}
+	// Fits every cascade to its slice of cam's frustum, staticVersion should change whenever static casters do
+	void update(const Camera& cam, uint64_t staticVersion = 0) {
+		float aspect = (float)cam.width / (float)cam.height;
+		float zNear = cam.zNear, zFar = std::min(cam.zFar, shadowDistance);
+		float prev = zNear;
+		vec3 up = fabsf(lightDir.y) > 0.99f ? vec3(0, 0, 1) : vec3(0, 1, 0);
+		// Light space rotation, the light looks down -z
+		mat4 lightRotation = LookAt(vec3(0.0f), -lightDir, up);
+		if (memcmp(&lightDir, &cachedLightDir, sizeof(vec3)) != 0 || staticVersion != cachedVersion) invalidate();
+		cachedLightDir = lightDir;
+		cachedVersion = staticVersion;
+		for (int c = 0; c < count; c++) {
+			float p = (float)(c + 1) / count;
+			float split = splitLambda * zNear * powf(zFar / zNear, p) + (1 - splitLambda) * (zNear + (zFar - zNear) * p);
+			// Bounding sphere of the slice, radius rounded so float noise can't change it frame to frame
+			vector<vec4> corners = frustumCorners(Perspective(cam.fov, aspect, prev, split), cam.view);
+			vec3 center(0.0f);
+			for (vec4& v : corners) center += vec3(v.x, v.y, v.z) / (float)corners.size();
+			float r = 0.0f;
+			for (vec4& v : corners) r = std::max(r, length(vec3(v.x, v.y, v.z) - center));
+			r = ceilf(r * 16.0f) / 16.0f;
+			// Snap the center in light space to whole texels, or to whole cache steps
+			float texel = 2 * r / resolution[c];
+			float step = texel;
+			if (cacheStatic) {
+				step = texel * std::max(1.0f, roundf(cacheSnap * r / texel));
+				r += step;
+				texel = 2 * r / resolution[c];
+				step = texel * std::max(1.0f, roundf(step / texel));
+			}
+			vec4 lc = lightRotation * vec4(center, 1);
+			vec3 snapped(roundf(lc.x / step) * step, roundf(lc.y / step) * step, roundf(lc.z / step) * step);
+			view[c] = Translate(-(snapped + vec3(0, 0, r + casterMargin))) * lightRotation;
+			vp[c] = Orthographic(-r, r, -r, r, 0.0f, 2 * r + casterMargin) * view[c];
+			splitFar[c] = split;
+			radius[c] = r;
+			prev = split;
+			// Cache is stale once the cascade steps
+			refresh[c] = cacheStatic && (!cached[c] || memcmp(&vp[c], &cachedVp[c], sizeof(mat4)) != 0);
+			if (refresh[c]) {
+				cachedVp[c] = vp[c];
+				cached[c] = true;
+				cacheRefreshes++;
+			}
+		}
+	}
+	// Whether a caster's bounding sphere can land in cascade c
+	bool casts(int c, vec3 center, float r) const {
+		vec4 p = view[c] * vec4(center, 1);
+		float depth = -p.z;
+		return fabsf(p.x) <= radius[c] + r && fabsf(p.y) <= radius[c] + r && depth >= -r && depth <= 2 * radius[c] + casterMargin + r;
+	}
+	// Binds, sizes and clears cascade c for a depth pass, or its static cache
+	void recordTarget(CommandList& cmds, int c, bool cache = false) const {
+		cmds.bindFramebuffer(cache ? cacheFramebuffers[c] : framebuffers[c]);
+		cmds.viewport(0, 0, resolution[c], resolution[c]);
+		cmds.clear(GL_DEPTH_BUFFER_BIT);
+	}
+	// Starts cascade c's dynamic casters from its cached static depth
+	void recordCacheCopy(CommandList& cmds, int c) const {
+		cmds.blitDepth(cacheFramebuffers[c], framebuffers[c], resolution[c], resolution[c]);
+		cmds.viewport(0, 0, resolution[c], resolution[c]);
+	}
+	// Binds cascades to texture units [firstUnit, firstUnit + MAX_CASCADES) and sets pass's cascade uniforms
+	void recordSampling(CommandList& cmds, const RenderPass& pass, GLuint firstUnit = 1) const {
+		cmds.uniform(pass.location("num_cascades"), count);
+		for (int c = 0; c < MAX_CASCADES; c++) {
+			string i = std::to_string(c);
+			cmds.uniform(pass.location(("shadow" + i).c_str()), (GLint)(firstUnit + c));
+			if (c >= count) continue;
+			cmds.bindTexture(firstUnit + c, GL_TEXTURE_2D, textures[c]);
+			cmds.uniform(pass.location(("depth_vp[" + i + "]").c_str()), vp[c]);
+			cmds.uniform(pass.location(("cascade_far[" + i + "]").c_str()), splitFar[c]);
+		}
+	}
+private:
+	bool cached[MAX_CASCADES] = { false };
+	mat4 cachedVp[MAX_CASCADES];
+	vec3 cachedLightDir;
+	uint64_t cachedVersion = 0;
+	void createTarget(int size, GLuint& framebuffer, GLuint& texture) {
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			throw runtime_error("Failed to set up shadow cascade framebuffer!");
+	}
+};
+
+#endif
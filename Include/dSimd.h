@@ -0,0 +1,188 @@
+// dSimd.h - 4-wide float vectors over SSE2 / NEON, with a scalar fallback
+
+#ifndef DSIMD_HDR
+#define DSIMD_HDR
+
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DSIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DSIMD_NEON
+#include <arm_neon.h>
+#else
+#define DSIMD_SCALAR
+#endif
+
+/* float4 holds 4 floats in one register, for running kernels over structure-of-arrays data:
+ - load4() / store4() are unaligned, so arrays only need padding to a multiple of 4, not alignment
+ - Comparisons return lane masks (all bits set or clear), used with select() / bitsAnd() / moveMask()
+ - bitsXor() / storeBits4() work on the raw float bits, e.g. for building integer sort keys
+ - rsqrt4() is the hardware estimate (~12 bits), follow with a Newton step where precision matters
+ - Define DSIMD_FORCE_SCALAR to build the fallback anywhere, for checking the SIMD paths against it
+*/
+
+#ifdef DSIMD_FORCE_SCALAR
+#undef DSIMD_SSE2
+#undef DSIMD_NEON
+#define DSIMD_SCALAR
+#endif
+
+struct float4 {
+#if defined(DSIMD_SSE2)
+	__m128 v;
+	float4() { }
+	float4(__m128 v) : v(v) { }
+#elif defined(DSIMD_NEON)
+	float32x4_t v;
+	float4() { }
+	float4(float32x4_t v) : v(v) { }
+#else
+	float v[4];
+	float4() { }
+#endif
+};
+
+#if defined(DSIMD_SSE2)
+
+inline float4 splat4(float f) { return _mm_set1_ps(f); }
+inline float4 load4(const float* p) { return _mm_loadu_ps(p); }
+inline void store4(float* p, float4 a) { _mm_storeu_ps(p, a.v); }
+inline float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+inline float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline float4 operator/(float4 a, float4 b) { return _mm_div_ps(a.v, b.v); }
+inline float4 min4(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+inline float4 max4(float4 a, float4 b) { return _mm_max_ps(a.v, b.v); }
+inline float4 sqrt4(float4 a) { return _mm_sqrt_ps(a.v); }
+inline float4 rsqrt4(float4 a) { return _mm_rsqrt_ps(a.v); }
+inline float4 lessThan(float4 a, float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline float4 greaterThan(float4 a, float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline float4 equalTo(float4 a, float4 b) { return _mm_cmpeq_ps(a.v, b.v); }
+inline float4 bitsAnd(float4 a, float4 b) { return _mm_and_ps(a.v, b.v); }
+inline float4 bitsOr(float4 a, float4 b) { return _mm_or_ps(a.v, b.v); }
+inline float4 bitsXor(float4 a, float4 b) { return _mm_xor_ps(a.v, b.v); }
+// Stores the lanes' raw bits
+inline void storeBits4(uint32_t* p, float4 a) { _mm_storeu_si128((__m128i*)p, _mm_castps_si128(a.v)); }
+// mask ? a : b
+inline float4 select(float4 mask, float4 a, float4 b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+// One bit per lane from the lane's sign bit, lane 0 in bit 0
+inline int moveMask(float4 a) { return _mm_movemask_ps(a.v); }
+
+#elif defined(DSIMD_NEON)
+
+inline float4 splat4(float f) { return vdupq_n_f32(f); }
+inline float4 load4(const float* p) { return vld1q_f32(p); }
+inline void store4(float* p, float4 a) { vst1q_f32(p, a.v); }
+inline float4 operator+(float4 a, float4 b) { return vaddq_f32(a.v, b.v); }
+inline float4 operator-(float4 a, float4 b) { return vsubq_f32(a.v, b.v); }
+inline float4 operator*(float4 a, float4 b) { return vmulq_f32(a.v, b.v); }
+inline float4 min4(float4 a, float4 b) { return vminq_f32(a.v, b.v); }
+inline float4 max4(float4 a, float4 b) { return vmaxq_f32(a.v, b.v); }
+inline float4 rsqrt4(float4 a) { return vrsqrteq_f32(a.v); }
+#if defined(__aarch64__)
+inline float4 operator/(float4 a, float4 b) { return vdivq_f32(a.v, b.v); }
+inline float4 sqrt4(float4 a) { return vsqrtq_f32(a.v); }
+#else
+inline float4 operator/(float4 a, float4 b) {
+	float32x4_t r = vrecpeq_f32(b.v);
+	r = vmulq_f32(r, vrecpsq_f32(b.v, r));
+	r = vmulq_f32(r, vrecpsq_f32(b.v, r));
+	return vmulq_f32(a.v, r);
+}
+inline float4 sqrt4(float4 a) {
+	// a * rsqrt(a), with zero lanes kept at zero
+	float32x4_t r = vrsqrteq_f32(a.v);
+	r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a.v, r), r));
+	r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a.v, r), r));
+	uint32x4_t zero = vceqq_f32(a.v, vdupq_n_f32(0.0f));
+	return vbslq_f32(zero, a.v, vmulq_f32(a.v, r));
+}
+#endif
+inline float4 lessThan(float4 a, float4 b) { return vreinterpretq_f32_u32(vcltq_f32(a.v, b.v)); }
+inline float4 greaterThan(float4 a, float4 b) { return vreinterpretq_f32_u32(vcgtq_f32(a.v, b.v)); }
+inline float4 equalTo(float4 a, float4 b) { return vreinterpretq_f32_u32(vceqq_f32(a.v, b.v)); }
+inline float4 bitsAnd(float4 a, float4 b) { return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a.v), vreinterpretq_u32_f32(b.v))); }
+inline float4 bitsOr(float4 a, float4 b) { return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a.v), vreinterpretq_u32_f32(b.v))); }
+inline float4 bitsXor(float4 a, float4 b) { return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a.v), vreinterpretq_u32_f32(b.v))); }
+inline void storeBits4(uint32_t* p, float4 a) { vst1q_u32(p, vreinterpretq_u32_f32(a.v)); }
+inline float4 select(float4 mask, float4 a, float4 b) { return vbslq_f32(vreinterpretq_u32_f32(mask.v), a.v, b.v); }
+inline int moveMask(float4 a) {
+	uint32x4_t sign = vshrq_n_u32(vreinterpretq_u32_f32(a.v), 31);
+	return (int)(vgetq_lane_u32(sign, 0) | (vgetq_lane_u32(sign, 1) << 1) | (vgetq_lane_u32(sign, 2) << 2) | (vgetq_lane_u32(sign, 3) << 3));
+}
+
+#else
+
+namespace dsimd {
+	template <typename Op>
+	inline float4 lanes(float4 a, float4 b, Op op) {
+		float4 r;
+		for (int i = 0; i < 4; i++) r.v[i] = op(a.v[i], b.v[i]);
+		return r;
+	}
+	inline float maskLane(bool b) {
+		uint32_t bits = b ? 0xffffffffu : 0u;
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+	inline uint32_t laneBits(float f) {
+		uint32_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		return bits;
+	}
+}
+
+inline float4 splat4(float f) { float4 r; r.v[0] = r.v[1] = r.v[2] = r.v[3] = f; return r; }
+inline float4 load4(const float* p) { float4 r; memcpy(r.v, p, sizeof(r.v)); return r; }
+inline void store4(float* p, float4 a) { memcpy(p, a.v, sizeof(a.v)); }
+inline float4 operator+(float4 a, float4 b) { return dsimd::lanes(a, b, [](float x, float y) { return x + y; }); }
+inline float4 operator-(float4 a, float4 b) { return dsimd::lanes(a, b, [](float x, float y) { return x - y; }); }
+inline float4 operator*(float4 a, float4 b) { return dsimd::lanes(a, b, [](float x, float y) { return x * y; }); }
+inline float4 operator/(float4 a, float4 b) { return dsimd::lanes(a, b, [](float x, float y) { return x / y; }); }
+inline float4 min4(float4 a, float4 b) { return dsimd::lanes(a, b, [](float x, float y) { return y < x ? y : x; }); }
+inline float4 max4(float4 a, float4 b) { return dsimd::lanes(a, b, [](float x, float y) { return y > x ? y : x; }); }
+inline float4 sqrt4(float4 a) { return dsimd::lanes(a, a, [](float x, float) { return sqrtf(x); }); }
+inline float4 rsqrt4(float4 a) { return dsimd::lanes(a, a, [](float x, float) { return 1.0f / sqrtf(x); }); }
+inline float4 lessThan(float4 a, float4 b) { return dsimd::lanes(a, b, [](float x, float y) { return dsimd::maskLane(x < y); }); }
+inline float4 greaterThan(float4 a, float4 b) { return dsimd::lanes(a, b, [](float x, float y) { return dsimd::maskLane(x > y); }); }
+inline float4 equalTo(float4 a, float4 b) { return dsimd::lanes(a, b, [](float x, float y) { return dsimd::maskLane(x == y); }); }
+inline float4 bitsAnd(float4 a, float4 b) {
+	return dsimd::lanes(a, b, [](float x, float y) { uint32_t r = dsimd::laneBits(x) & dsimd::laneBits(y); float f; memcpy(&f, &r, 4); return f; });
+}
+inline float4 bitsOr(float4 a, float4 b) {
+	return dsimd::lanes(a, b, [](float x, float y) { uint32_t r = dsimd::laneBits(x) | dsimd::laneBits(y); float f; memcpy(&f, &r, 4); return f; });
+}
+inline float4 bitsXor(float4 a, float4 b) {
+	return dsimd::lanes(a, b, [](float x, float y) { uint32_t r = dsimd::laneBits(x) ^ dsimd::laneBits(y); float f; memcpy(&f, &r, 4); return f; });
+}
+inline void storeBits4(uint32_t* p, float4 a) { memcpy(p, a.v, sizeof(a.v)); }
+inline float4 select(float4 mask, float4 a, float4 b) {
+	float4 r;
+	for (int i = 0; i < 4; i++) r.v[i] = dsimd::laneBits(mask.v[i]) ? a.v[i] : b.v[i];
+	return r;
+}
+inline int moveMask(float4 a) {
+	int bits = 0;
+	for (int i = 0; i < 4; i++) bits |= (int)(dsimd::laneBits(a.v[i]) >> 31) << i;
+	return bits;
+}
+
+#endif
+
+// Every lane set to the given raw bits
+inline float4 splatBits4(uint32_t bits) {
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return splat4(f);
+}
+
+inline float4 operator+=(float4& a, float4 b) { return a = a + b; }
+inline float4 operator-=(float4& a, float4 b) { return a = a - b; }
+inline float4 operator*=(float4& a, float4 b) { return a = a * b; }
+
+#endif
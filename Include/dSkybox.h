@@ -127,7 +127,7 @@ struct Skybox {
 		glGenTextures(1, &texture);
 		glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
 		int w, h, c;
-		stbi_set_flip_vertically_on_load(false);
+		stbi_set_flip_vertically_on_load_thread(false);
 		for (int i = 0; i < faceTextures.size(); i++) {
 			stbi_uc* data = stbi_load(faceTextures[i].c_str(), &w, &h, &c, 0);
 			if (!data)
@@ -0,0 +1,369 @@
+// dSparseFluid.h - FluidGrid's water automaton over a sparse pool of 8^3 bricks with ghost layers
+
+#ifndef DSPARSEFLUID_HDR
+#define DSPARSEFLUID_HDR
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include "dSimd.h"
+#include "dThreadPool.h"
+#include "dFluidGrid.h"
+
+using std::vector;
+
+/* SparseFluidGrid runs the same automaton as FluidGrid (same rules, same float4 arithmetic, so the
+   same levels bit for bit) but only stores bricks that hold water or are about to:
+ - The domain is cut into 8^3 bricks. A dense top-level index (one int per brick, 32^3 for 256^3)
+   gives each brick's slot in a pool of FluidBricks, or -1. Blocks are kept apart from the levels
+   in a bitmask (a bit per cell), so solid and empty bricks cost no brick at all, and a pool brick
+   starts with its blocks already in place
+ - A FluidBrick holds both buffers of its 8^3 levels inside a ghost layer, 10^3 floats each. Before
+   each pass a brick copies the faces it needs (y for vertical flow, x and z for sideways) from its
+   neighbors' buffers, or from the bitmask for bricks not in the pool, so the passes themselves
+   only ever read the brick. Vertical pairs across a brick boundary are worked out on both sides
+   from the same values, each side keeping its own cell
+ - Before each pass, every active brick with water at a face that the pass would move across it
+   (by the pass's own thresholds) gets the brick across that face allocated. After a step, bricks
+   that are empty and haven't changed in two steps go back to the pool's free list
+ - Activity works as FluidGrid's rows but per brick: a brick runs if any brick of its 3x3x3 block
+   changed in the last two steps, and inactive bricks are skipped, their two buffers agree
+*/
+
+struct FluidBrick {
+	static const int N = 8, G = N + 2; // cells per side, with the ghost layer
+	float level[2][G * G * G];
+	int brick = -1; // index in the top-level grid, -1 while free
+	uint8_t history = 0;
+	static int cell(int x, int y, int z) { return (z * G + y) * G + x; } // ghost-layer coordinates, 0..9
+};
+
+struct SparseFluidGrid {
+	int width = 0, height = 0, depth = 0;
+	size_t bricksUpdated = 0; // bricks run in the last step
+	void resize(int w, int h, int d) {
+		width = w; height = h; depth = d;
+		bw = (w + 7) / 8; bh = (h + 7) / 8; bd = (d + 7) / 8;
+		size_t bricks = (size_t)bw * bh * bd;
+		slots.assign(bricks, -1);
+		changed.assign(bricks, ++stamp);
+		solid.assign(bricks * 8, 0);
+		solidCount.assign(bricks, 0);
+		pool.clear();
+		freeSlots.clear();
+		steps = 0;
+		// Cells past the domain inside edge bricks are blocks
+		for (int z = 0; z < bd * 8; z++)
+			for (int y = 0; y < bh * 8; y++)
+				for (int x = 0; x < bw * 8; x++)
+					if (x >= w || y >= h || z >= d) setSolidBit(x, y, z, true);
+	}
+	size_t brickCount() const { return slots.size(); }
+	int bricksX() const { return bw; }
+	int bricksY() const { return bh; }
+	int bricksZ() const { return bd; }
+	// Every step and edit takes a new stamp, and each brick keeps the stamp of its last change in
+	// levels or blocks, so a reader can find what changed since it last looked (stamps only grow,
+	// across resize() too)
+	uint64_t changeStamp() const { return stamp; }
+	uint64_t brickChanged(int bx, int by, int bz) const { return changed[brickIndex(bx, by, bz)]; }
+	// No water (not in the pool) and no blocks
+	bool brickEmpty(int bx, int by, int bz) const { int i = brickIndex(bx, by, bz); return slots[i] < 0 && !solidCount[i]; }
+	size_t allocatedBricks() const { return pool.size() - freeSlots.size(); }
+	size_t memoryBytes() const {
+		return pool.size() * sizeof(FluidBrick) + slots.size() * sizeof(int) + solid.size() * sizeof(uint64_t) + solidCount.size() * sizeof(uint16_t);
+	}
+	bool inside(int x, int y, int z) const { return x >= 0 && x < width && y >= 0 && y < height && z >= 0 && z < depth; }
+	bool block(int x, int y, int z) const { return solidBit(x, y, z); }
+	float level(int x, int y, int z) const {
+		int s = slots[brickIndex(x >> 3, y >> 3, z >> 3)];
+		if (s < 0) return 0.0f;
+		return std::max(0.0f, pool[s]->level[0][FluidBrick::cell((x & 7) + 1, (y & 7) + 1, (z & 7) + 1)]);
+	}
+	// Levels and block flags of the n^3 cells from (x0, y0, z0), x fastest, one brick lookup per 8
+	// cells of a row. Blocks and cells outside the grid have level 0, only blocks are flagged
+	void gather(int x0, int y0, int z0, int n, float* levels, uint8_t* blocks) const {
+		for (int z = z0; z < z0 + n; z++)
+			for (int y = y0; y < y0 + n; y++, levels += n, blocks += n) {
+				if (y < 0 || y >= height || z < 0 || z >= depth) {
+					std::fill(levels, levels + n, 0.0f);
+					std::fill(blocks, blocks + n, (uint8_t)0);
+					continue;
+				}
+				for (int x = x0; x < x0 + n; ) {
+					int i = x - x0;
+					if (x < 0 || x >= width) {
+						levels[i] = 0.0f;
+						blocks[i] = 0;
+						x++;
+						continue;
+					}
+					int s = slots[brickIndex(x >> 3, y >> 3, z >> 3)];
+					const float* l = s >= 0 ? pool[s]->level[0] + FluidBrick::cell(1, (y & 7) + 1, (z & 7) + 1) : nullptr;
+					for (int end = std::min(std::min(x0 + n, width), (x | 7) + 1); x < end; x++, i++) {
+						blocks[i] = solidBit(x, y, z);
+						levels[i] = l && !blocks[i] ? std::max(0.0f, l[x & 7]) : 0.0f;
+					}
+				}
+			}
+	}
+	void setBlock(int x, int y, int z, bool isSolid) {
+		if (!inside(x, y, z) || solidBit(x, y, z) == isSolid) return;
+		setSolidBit(x, y, z, isSolid);
+		// An opened cell may take water from a neighbor, so its brick joins the pool and wakes
+		int s = slots[brickIndex(x >> 3, y >> 3, z >> 3)];
+		if (s < 0 && !isSolid) s = allocate(brickIndex(x >> 3, y >> 3, z >> 3));
+		if (s >= 0) setLevel(*pool[s], x, y, z, isSolid ? FluidGrid::BLOCK : 0.0f);
+	}
+	void addWater(int x, int y, int z, float amount) {
+		if (!inside(x, y, z) || block(x, y, z)) return;
+		FluidBrick& b = *pool[allocate(brickIndex(x >> 3, y >> 3, z >> 3))];
+		setLevel(b, x, y, z, std::max(0.0f, level(x, y, z) + amount));
+	}
+	double totalWater() const {
+		double total = 0.0;
+		for (const std::unique_ptr<FluidBrick>& b : pool) {
+			if (b->brick < 0) continue;
+			for (int z = 1; z <= 8; z++)
+				for (int y = 1; y <= 8; y++)
+					for (int x = 1; x <= 8; x++) total += std::max(0.0f, b->level[0][FluidBrick::cell(x, y, z)]);
+		}
+		return total;
+	}
+	void step(ThreadPool* pool = nullptr) {
+		// Active from the last two steps, then the history moves on a step
+		activeSlots.clear();
+		for (size_t s = 0; s < this->pool.size(); s++)
+			if (this->pool[s]->brick >= 0 && nearChange(this->pool[s]->brick)) activeSlots.push_back((int)s);
+		for (std::unique_ptr<FluidBrick>& b : this->pool) b->history = (uint8_t)(b->history << 1 & 2);
+		stamp++;
+		auto run = [&](const std::function<void(FluidBrick&)>& pass) {
+			auto bricks = [&](int begin, int end, int) { for (int i = begin; i < end; i++) pass(*this->pool[activeSlots[i]]); };
+			if (pool) pool->parallelFor((int)activeSlots.size(), bricks, 16);
+			else bricks(0, (int)activeSlots.size(), 0);
+		};
+		growAroundWater(0, true);
+		run([&](FluidBrick& b) { verticalFlow(b); });
+		// Water the vertical pass brings to a side face can leave through it in this same step
+		growAroundWater(1, false);
+		run([&](FluidBrick& b) { sidewaysFlow(b); });
+		bricksUpdated = activeSlots.size();
+		for (int s : activeSlots)
+			if (this->pool[s]->history & 1) changed[this->pool[s]->brick] = stamp;
+		steps++;
+		freeQuietBricks();
+	}
+private:
+	int bw = 0, bh = 0, bd = 0; // bricks per axis
+	vector<int> slots; // pool slot of each brick, -1 if not allocated
+	vector<uint64_t> solid; // 512 bits per brick, in FluidBrick order without the ghost layer
+	vector<uint16_t> solidCount;
+	vector<std::unique_ptr<FluidBrick>> pool; // pointers, so growing the pool never moves a brick
+	vector<int> freeSlots, activeSlots;
+	vector<uint64_t> changed; // per brick, the stamp of its last change
+	uint64_t steps = 0, stamp = 0;
+	int brickIndex(int bx, int by, int bz) const { return (bz * bh + by) * bw + bx; }
+	bool solidBit(int x, int y, int z) const {
+		int bit = ((z & 7) * 8 + (y & 7)) * 8 + (x & 7);
+		return solid[(size_t)brickIndex(x >> 3, y >> 3, z >> 3) * 8 + (bit >> 6)] >> (bit & 63) & 1;
+	}
+	void setSolidBit(int x, int y, int z, bool on) {
+		int b = brickIndex(x >> 3, y >> 3, z >> 3), bit = ((z & 7) * 8 + (y & 7)) * 8 + (x & 7);
+		uint64_t& word = solid[(size_t)b * 8 + (bit >> 6)];
+		if (on) word |= 1ull << (bit & 63);
+		else word &= ~(1ull << (bit & 63));
+		solidCount[b] = (uint16_t)(solidCount[b] + (on ? 1 : -1));
+		changed[b] = ++stamp;
+	}
+	void setLevel(FluidBrick& b, int x, int y, int z, float value) {
+		int c = FluidBrick::cell((x & 7) + 1, (y & 7) + 1, (z & 7) + 1);
+		b.level[0][c] = b.level[1][c] = value;
+		b.history = 3;
+		changed[b.brick] = ++stamp;
+	}
+	// Slot of brick i, taken from the pool (blocks set, no water) if it has none
+	int allocate(int i) {
+		if (slots[i] >= 0) return slots[i];
+		int s;
+		if (!freeSlots.empty()) {
+			s = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else {
+			s = (int)pool.size();
+			pool.emplace_back(new FluidBrick());
+		}
+		FluidBrick& b = *pool[s];
+		int bx = i % bw, by = i / bw % bh, bz = i / (bw * bh);
+		for (int z = 0; z < FluidBrick::G; z++)
+			for (int y = 0; y < FluidBrick::G; y++)
+				for (int x = 0; x < FluidBrick::G; x++) {
+					bool interior = x >= 1 && x <= 8 && y >= 1 && y <= 8 && z >= 1 && z <= 8;
+					float v = interior && !solidBit(bx * 8 + x - 1, by * 8 + y - 1, bz * 8 + z - 1) ? 0.0f : FluidGrid::BLOCK;
+					b.level[0][FluidBrick::cell(x, y, z)] = b.level[1][FluidBrick::cell(x, y, z)] = v;
+				}
+		b.brick = i;
+		b.history = 3;
+		slots[i] = s;
+		return s;
+	}
+	bool nearChange(int i) const {
+		int bx = i % bw, by = i / bw % bh, bz = i / (bw * bh);
+		for (int z = std::max(0, bz - 1); z <= std::min(bd - 1, bz + 1); z++)
+			for (int y = std::max(0, by - 1); y <= std::min(bh - 1, by + 1); y++)
+				for (int x = std::max(0, bx - 1); x <= std::min(bw - 1, bx + 1); x++) {
+					int s = slots[brickIndex(x, y, z)];
+					if (s >= 0 && pool[s]->history) return true;
+				}
+		return false;
+	}
+	// Before a pass, allocates (and runs) the neighbor across any face of an active brick whose water
+	// in the buffer the pass reads would cross it: down past EPSILON or up once compressed past full
+	// for vertical flow, past MIN_FLOW for sideways
+	void growAroundWater(int buf, bool vertical) {
+		struct Face { int dx, dy, dz; float threshold; };
+		const Face verticalFaces[2] = { {0, -1, 0, FluidGrid::EPSILON}, {0, 1, 0, 1.0f} };
+		const Face sideFaces[4] = { {-1, 0, 0, FluidGrid::MIN_FLOW}, {1, 0, 0, FluidGrid::MIN_FLOW},
+			{0, 0, -1, FluidGrid::MIN_FLOW}, {0, 0, 1, FluidGrid::MIN_FLOW} };
+		size_t count = activeSlots.size(); // bricks allocated here are empty, nothing of theirs can cross
+		for (size_t i = 0; i < count; i++) {
+			FluidBrick& b = *pool[activeSlots[i]];
+			int bx = b.brick % bw, by = b.brick / bw % bh, bz = b.brick / (bw * bh);
+			const float* l = b.level[buf];
+			for (int k = 0; k < (vertical ? 2 : 4); k++) {
+				const Face& f = vertical ? verticalFaces[k] : sideFaces[k];
+				int nx = bx + f.dx, ny = by + f.dy, nz = bz + f.dz;
+				if (nx < 0 || ny < 0 || nz < 0 || nx >= bw || ny >= bh || nz >= bd) continue;
+				int n = brickIndex(nx, ny, nz);
+				if (slots[n] >= 0 || solidCount[n] == 512) continue;
+				bool flows = false;
+				for (int a = 1; a <= 8 && !flows; a++)
+					for (int c = 1; c <= 8 && !flows; c++) {
+						int x = f.dx ? (f.dx < 0 ? 1 : 8) : a, y = f.dy ? (f.dy < 0 ? 1 : 8) : (f.dx ? a : c), z = f.dz ? (f.dz < 0 ? 1 : 8) : c;
+						flows = l[FluidBrick::cell(x, y, z)] > f.threshold;
+					}
+				if (flows) activeSlots.push_back(allocate(n));
+			}
+		}
+	}
+	// Only bricks that ran can have just gone quiet, the rest were quiet and kept their water
+	void freeQuietBricks() {
+		for (int s : activeSlots) {
+			FluidBrick& b = *pool[s];
+			if (b.brick < 0 || b.history) continue;
+			bool empty = true;
+			for (int z = 1; z <= 8 && empty; z++)
+				for (int y = 1; y <= 8 && empty; y++)
+					for (int x = 1; x <= 8 && empty; x++) empty = b.level[0][FluidBrick::cell(x, y, z)] <= 0.0f;
+			if (!empty) continue;
+			slots[b.brick] = -1;
+			b.brick = -1;
+			freeSlots.push_back((int)s);
+		}
+	}
+	// Copies neighbor faces into b's buffer buf, y faces for vertical flow or x and z for sideways
+	void fillGhosts(FluidBrick& b, int buf, bool vertical) {
+		int bx = b.brick % bw, by = b.brick / bw % bh, bz = b.brick / (bw * bh);
+		float* dst = b.level[buf];
+		const int G = FluidBrick::G;
+		auto face = [&](int dx, int dy, int dz) {
+			int nx = bx + dx, ny = by + dy, nz = bz + dz;
+			// The face's axis and the two across it, by their strides in a brick
+			int axis = dx ? 1 : dy ? G : G * G, su = dx ? G : 1, sv = dz ? G : G * G;
+			bool down = dx + dy + dz < 0;
+			float* ghost = dst + (down ? 0 : 9) * axis;
+			int mirror = (down ? 8 : 1) * axis; // the neighbor's cells next to b
+			if (nx < 0 || ny < 0 || nz < 0 || nx >= bw || ny >= bh || nz >= bd) {
+				for (int v = 1; v <= 8; v++)
+					for (int u = 1; u <= 8; u++) ghost[u * su + v * sv] = FluidGrid::BLOCK;
+				return;
+			}
+			int n = brickIndex(nx, ny, nz), s = slots[n];
+			if (s >= 0) {
+				const float* src = pool[s]->level[buf] + mirror;
+				for (int v = 1; v <= 8; v++)
+					for (int u = 1; u <= 8; u++) ghost[u * su + v * sv] = src[u * su + v * sv];
+			}
+			else if (solidCount[n] == 0 || solidCount[n] == 512) {
+				float l = solidCount[n] ? FluidGrid::BLOCK : 0.0f;
+				for (int v = 1; v <= 8; v++)
+					for (int u = 1; u <= 8; u++) ghost[u * su + v * sv] = l;
+			}
+			else {
+				for (int v = 1; v <= 8; v++)
+					for (int u = 1; u <= 8; u++) {
+						int c = mirror + u * su + v * sv;
+						ghost[u * su + v * sv] = solidBit(nx * 8 + c % G - 1, ny * 8 + c / G % G - 1, nz * 8 + c / (G * G) - 1) ? FluidGrid::BLOCK : 0.0f;
+					}
+			}
+		};
+		if (vertical) {
+			face(0, -1, 0);
+			face(0, 1, 0);
+		}
+		else {
+			face(-1, 0, 0);
+			face(1, 0, 0);
+			face(0, 0, -1);
+			face(0, 0, 1);
+		}
+	}
+	// FluidGrid::verticalFlow() for the pairs touching b, each side of a boundary pair keeps its own cell
+	void verticalFlow(FluidBrick& b) {
+		int from = 0, to = 1;
+		fillGhosts(b, from, true);
+		const float4 zero = splat4(0.0f), one = splat4(1.0f), compress = splat4(FluidGrid::MAX_COMPRESS);
+		const float4 squeezed = splat4(2.0f + FluidGrid::MAX_COMPRESS), epsilon = splat4(FluidGrid::EPSILON), half = splat4(0.5f);
+		const float4 keep = splat4(1.0f / (1.0f + FluidGrid::MAX_COMPRESS)), absMask = splatBits4(0x7fffffffu);
+		// Pairs start on even cells (0-based) on even steps, odd ones on odd steps. Bricks start on even
+		// cells, so on odd steps the first and last pairs reach into the ghost rows
+		const float* in = b.level[from];
+		float* out = b.level[to];
+		float4 moved = zero;
+		for (int ly = steps & 1 ? 0 : 1; ly <= 8; ly += 2) {
+			// Pair (ly, ly + 1), where ly = 0 or ly + 1 = 9 is a ghost row
+			for (int z = 1; z <= 8; z++)
+				for (int x = 1; x <= 8; x += 4) {
+					int lc = FluidBrick::cell(x, ly, z), uc = FluidBrick::cell(x, ly + 1, z);
+					float4 lv = load4(in + lc), uv = load4(in + uc), total = lv + uv;
+					float4 open = bitsAnd(greaterThan(lv, splat4(-0.5f)), greaterThan(uv, splat4(-0.5f)));
+					float4 settled = select(greaterThan(total, squeezed), (total + compress) * half, (one + total * compress) * keep);
+					float4 lower = min4(total, select(greaterThan(total, one), settled, one));
+					float4 move = bitsAnd(open, greaterThan(bitsAnd(lower - lv, absMask), epsilon));
+					if (ly >= 1) store4(out + lc, select(move, lower, lv));
+					if (ly + 1 <= 8) store4(out + uc, select(move, total - lower, uv));
+					moved = bitsOr(moved, move);
+				}
+		}
+		if (moveMask(moved)) b.history |= 1;
+	}
+	// FluidGrid::sidewaysFlow(), neighbors in the same order so the sums round the same
+	void sidewaysFlow(FluidBrick& b) {
+		const int G = FluidBrick::G;
+		fillGhosts(b, 1, false);
+		const float4 zero = splat4(0.0f), flow = splat4(FluidGrid::FLOW), minFlow = splat4(FluidGrid::MIN_FLOW);
+		const float4 absMask = splatBits4(0x7fffffffu), solidLevel = splat4(-0.5f);
+		const float* in = b.level[1];
+		float* out = b.level[0];
+		float4 moved = zero;
+		for (int z = 1; z <= 8; z++)
+			for (int y = 1; y <= 8; y++)
+				for (int x = 1; x <= 8; x += 4) {
+					const float* c = in + FluidBrick::cell(x, y, z);
+					float4 a = load4(c), sum = zero;
+					float4 open = greaterThan(a, solidLevel);
+					for (const float* n : {c - 1, c + 1, c - G * G, c + G * G}) {
+						float4 nv = load4(n), d = nv - a;
+						float4 ok = bitsAnd(bitsAnd(open, greaterThan(nv, solidLevel)), greaterThan(bitsAnd(d, absMask), minFlow));
+						sum += select(ok, flow * d, zero);
+						moved = bitsOr(moved, ok);
+					}
+					store4(out + FluidBrick::cell(x, y, z), a + sum);
+				}
+		if (moveMask(moved)) b.history |= 1;
+	}
+};
+
+#endif
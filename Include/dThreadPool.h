@@ -0,0 +1,122 @@
+// dThreadPool.h - Fixed-size worker pool for CPU-side jobs (never touches GL)
+
+#ifndef DTHREADPOOL_HDR
+#define DTHREADPOOL_HDR
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <deque>
+#include <atomic>
+#include <algorithm>
+
+using std::vector;
+
+/* ThreadPool runs plain CPU work on a fixed set of worker threads:
+ - submit() queues a single job and returns a future for it, a pool of size 1 has no workers so
+   runs the job before returning
+ - parallelFor() splits [0, count) into chunks, the calling thread helps out until done
+ - Thread slots are numbered [0, size()), slot 0 is always the calling thread, so per-thread
+   scratch buffers can be indexed by the slot passed to parallelFor() jobs
+
+GL calls must stay on the thread that owns the context, so jobs should only produce data
+(command lists, instance buffers, simulation state) for the GL thread to consume afterwards.
+*/
+
+struct ThreadPool {
+    ThreadPool(int threads = 0) {
+        if (threads <= 0) threads = (int)std::max(1u, std::thread::hardware_concurrency());
+        // Caller counts as a thread, so spawn one less worker
+        for (int i = 1; i < threads; i++)
+            workers.emplace_back([this, i] { workerLoop(i); });
+    }
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers) t.join();
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    int size() const { return (int)workers.size() + 1; }
+    std::future<void> submit(std::function<void()> job) {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::move(job));
+        std::future<void> result = task->get_future();
+        if (workers.empty()) {
+            (*task)();
+            return result;
+        }
+        push([task](int) { (*task)(); });
+        wake.notify_one();
+        return result;
+    }
+    // Calls fn(begin, end, slot) over chunks of at most grain items, returns once every chunk is done
+    void parallelFor(int count, const std::function<void(int, int, int)>& fn, int grain = 1) {
+        if (count <= 0) return;
+        grain = std::max(1, grain);
+        int chunks = (count + grain - 1) / grain;
+        if (chunks == 1 || workers.empty()) {
+            fn(0, count, 0);
+            return;
+        }
+        // Shared so helper jobs that start after we return find no chunks left and exit
+        auto state = std::make_shared<ForState>();
+        state->fn = &fn;
+        state->count = count;
+        state->grain = grain;
+        state->chunks = chunks;
+        int helpers = std::min((int)workers.size(), chunks - 1);
+        for (int i = 0; i < helpers; i++)
+            push([state](int slot) { state->run(slot); });
+        wake.notify_all();
+        state->run(0);
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->finished.wait(lock, [&] { return state->done == state->chunks; });
+    }
+private:
+    struct ForState {
+        const std::function<void(int, int, int)>* fn = nullptr;
+        int count = 0, grain = 1, chunks = 0, done = 0;
+        std::atomic<int> next{ 0 };
+        std::mutex mutex;
+        std::condition_variable finished;
+        void run(int slot) {
+            int c;
+            while ((c = next.fetch_add(1)) < chunks) {
+                (*fn)(c * grain, std::min(count, (c + 1) * grain), slot);
+                std::lock_guard<std::mutex> lock(mutex);
+                if (++done == chunks) finished.notify_all();
+            }
+        }
+    };
+    vector<std::thread> workers;
+    std::deque<std::function<void(int)>> queue;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    void push(std::function<void(int)> job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(job));
+    }
+    void workerLoop(int slot) {
+        for (;;) {
+            std::function<void(int)> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping && queue.empty()) return;
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+            job(slot);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,253 @@
+// dWorld.h - Chunked world streaming, loads / unloads grid chunks around a moving focus
+
+#ifndef DWORLD_HDR
+#define DWORLD_HDR
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "VecMat.h"
+#include "dScene.h"
+#include "dThreadPool.h"
+
+using std::vector;
+using std::map;
+using std::shared_ptr;
+using std::function;
+
+/* World splits the XZ plane into square chunks, each a SceneGraph with its own instances and assets:
+ - update() requests every chunk within loadRadius of the focus or of where the focus will be after
+   lookahead seconds at its current velocity, nearest first
+ - Chunks load on the world's own loader threads: source() fills the chunk's scene (generated or read
+   from a .scgb file) then its obj / texture files are decoded, no GL involved
+ - Loaded chunks are uploaded on the GL thread in update(), at most maxUploadsPerFrame per call
+ - A chunk whose load threw is dropped retryDelay seconds after it failed, so the next update() in
+   range requests it again instead of leaving a hole for the rest of the session
+ - Chunks are only dropped once further than unloadRadius from both points, the gap between the two
+   radii keeps chunks on the boundary from being loaded and unloaded every other frame
+ - No new loads start while resident + in flight memory is over memoryBudget, if resident memory alone
+   is over it the farthest chunks are evicted, but never ones within loadRadius of the focus itself
+*/
+
+struct ChunkCoord {
+	int x = 0, z = 0;
+	bool operator<(const ChunkCoord& o) const { return x == o.x ? z < o.z : x < o.x; }
+	bool operator==(const ChunkCoord& o) const { return x == o.x && z == o.z; }
+};
+
+enum class ChunkState { Loading, Loaded, Resident, Failed };
+
+struct Chunk {
+	ChunkCoord coord;
+	std::atomic<ChunkState> state{ ChunkState::Loading };
+	std::atomic<bool> cancelled{ false };
+	SceneGraph scene;
+	size_t bytes = 0;
+	std::chrono::steady_clock::time_point requested, failed;
+};
+
+struct WorldStats {
+	int resident = 0, loading = 0, failed = 0;
+	int loads = 0, unloads = 0, evictions = 0, cancels = 0, retries = 0;
+	size_t residentBytes = 0;
+	float lastLoadMs = 0.0f, avgLoadMs = 0.0f, maxLoadMs = 0.0f;
+};
+
+struct World {
+	float chunkSize = 64.0f;
+	int halfChunks = 8; // chunks span [-halfChunks, halfChunks) on both axes
+	float loadRadius = 96.0f;
+	float unloadRadius = 144.0f;
+	float lookahead = 1.5f; // seconds of velocity to predict ahead
+	size_t memoryBudget = 256 << 20;
+	int maxUploadsPerFrame = 1;
+	int maxLoadsInFlight = 4;
+	float retryDelay = 2.0f; // seconds before a failed chunk is requested again
+	// Fills a chunk's scene data, called on loader threads so must not touch GL
+	function<void(ChunkCoord, SceneGraph&)> source;
+	map<ChunkCoord, shared_ptr<Chunk>> chunks;
+	WorldStats stats;
+	uint64_t version = 0; // bumped whenever the set of resident chunks changes
+	// The pool counts its caller as a thread, loads never run on it, 0 loads on the GL thread
+	World(int loaderThreads = 2) : loaders(loaderThreads + 1) { }
+	float extent() const { return halfChunks * chunkSize; }
+	ChunkCoord chunkAt(vec3 p) const { return { (int)floorf(p.x / chunkSize), (int)floorf(p.z / chunkSize) }; }
+	// Distance in XZ from p to the nearest point of a chunk
+	float distance(ChunkCoord c, vec3 p) const {
+		float dx = std::max({ c.x * chunkSize - p.x, 0.0f, p.x - (c.x + 1) * chunkSize });
+		float dz = std::max({ c.z * chunkSize - p.z, 0.0f, p.z - (c.z + 1) * chunkSize });
+		return sqrtf(dx * dx + dz * dz);
+	}
+	// velocity in units per second, call once per frame on the GL thread
+	void update(vec3 focus, vec3 velocity) {
+		vec3 predicted = focus + lookahead * velocity;
+		auto near = [&](ChunkCoord c) { return std::min(distance(c, focus), distance(c, predicted)); };
+		uploadLoaded();
+		retryFailed();
+		unloadFar(near);
+		evictOverBudget(focus);
+		requestNear(focus, predicted, near);
+		// Residency stats
+		stats.resident = stats.loading = stats.failed = 0;
+		stats.residentBytes = 0;
+		for (auto& [coord, chunk] : chunks) {
+			ChunkState state = chunk->state.load();
+			if (state == ChunkState::Resident) {
+				stats.resident++;
+				stats.residentBytes += chunk->bytes;
+			} else if (state == ChunkState::Failed) stats.failed++;
+			else stats.loading++;
+		}
+	}
+	// Resident chunk scenes, for culling and drawing
+	vector<SceneGraph*> residentScenes() {
+		vector<SceneGraph*> scenes;
+		for (auto& [coord, chunk] : chunks)
+			if (chunk->state.load() == ChunkState::Resident) scenes.push_back(&chunk->scene);
+		return scenes;
+	}
+	void cleanup() {
+		// Loads still running only touch their own chunk, let them finish and throw the results away
+		for (auto& [coord, chunk] : chunks) {
+			chunk->cancelled = true;
+			if (chunk->state.load() == ChunkState::Resident) chunk->scene.cleanup();
+		}
+		chunks.clear();
+	}
+private:
+	ThreadPool loaders;
+	// Estimate for chunks still loading
+	size_t averageChunkBytes() const {
+		return stats.resident ? stats.residentBytes / stats.resident : 0;
+	}
+	void uploadLoaded() {
+		int uploads = 0;
+		for (auto& [coord, chunk] : chunks) {
+			if (uploads >= maxUploadsPerFrame) break;
+			if (chunk->state.load(std::memory_order_acquire) != ChunkState::Loaded) continue;
+			chunk->scene.upload();
+			chunk->bytes = chunk->scene.bytes();
+			chunk->state = ChunkState::Resident;
+			version++;
+			float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - chunk->requested).count();
+			stats.loads++;
+			stats.lastLoadMs = ms;
+			stats.avgLoadMs += (ms - stats.avgLoadMs) / stats.loads;
+			stats.maxLoadMs = std::max(stats.maxLoadMs, ms);
+			uploads++;
+		}
+	}
+	void retryFailed() {
+		auto now = std::chrono::steady_clock::now();
+		for (auto it = chunks.begin(); it != chunks.end();) {
+			auto next = std::next(it);
+			const Chunk& chunk = *it->second;
+			if (chunk.state.load(std::memory_order_acquire) == ChunkState::Failed &&
+				std::chrono::duration<float>(now - chunk.failed).count() >= retryDelay) {
+				chunks.erase(it);
+				stats.retries++;
+			}
+			it = next;
+		}
+	}
+	void unload(map<ChunkCoord, shared_ptr<Chunk>>::iterator it) {
+		Chunk& chunk = *it->second;
+		ChunkState state = chunk.state.load(std::memory_order_acquire);
+		if (state == ChunkState::Resident) {
+			chunk.scene.cleanup();
+			stats.unloads++;
+			version++;
+		} else if (state == ChunkState::Loading) {
+			chunk.cancelled = true;
+			stats.cancels++;
+		}
+		chunks.erase(it);
+	}
+	template <typename Near>
+	void unloadFar(Near near) {
+		for (auto it = chunks.begin(); it != chunks.end();) {
+			auto next = std::next(it);
+			if (near(it->first) > unloadRadius) unload(it);
+			it = next;
+		}
+	}
+	void evictOverBudget(vec3 focus) {
+		size_t resident = 0;
+		for (auto& [coord, chunk] : chunks)
+			if (chunk->state.load() == ChunkState::Resident) resident += chunk->bytes;
+		while (resident > memoryBudget) {
+			auto farthest = chunks.end();
+			float farthestDist = loadRadius;
+			for (auto it = chunks.begin(); it != chunks.end(); it++) {
+				if (it->second->state.load() != ChunkState::Resident) continue;
+				float d = distance(it->first, focus);
+				if (d > farthestDist) {
+					farthestDist = d;
+					farthest = it;
+				}
+			}
+			if (farthest == chunks.end()) break;
+			resident -= farthest->second->bytes;
+			stats.evictions++;
+			unload(farthest);
+		}
+	}
+	template <typename Near>
+	void requestNear(vec3 focus, vec3 predicted, Near near) {
+		// Candidate chunks around both points, nearest first
+		vector<std::pair<float, ChunkCoord>> wanted;
+		int reach = (int)ceilf(loadRadius / chunkSize);
+		for (vec3 p : { focus, predicted }) {
+			ChunkCoord center = chunkAt(p);
+			for (int x = center.x - reach; x <= center.x + reach; x++)
+				for (int z = center.z - reach; z <= center.z + reach; z++) {
+					ChunkCoord c = { x, z };
+					if (x < -halfChunks || x >= halfChunks || z < -halfChunks || z >= halfChunks) continue;
+					float d = near(c);
+					if (d <= loadRadius && !chunks.count(c)) wanted.push_back({ d, c });
+				}
+		}
+		// Ties broken by coord so both copies of a chunk end up adjacent
+		std::sort(wanted.begin(), wanted.end());
+		wanted.erase(std::unique(wanted.begin(), wanted.end(), [](const auto& a, const auto& b) { return a.second == b.second; }), wanted.end());
+		size_t resident = 0;
+		int inFlight = 0;
+		for (auto& [coord, chunk] : chunks) {
+			ChunkState state = chunk->state.load();
+			if (state == ChunkState::Resident) resident += chunk->bytes;
+			else if (state != ChunkState::Failed) inFlight++;
+		}
+		size_t estimate = averageChunkBytes();
+		for (auto& [d, coord] : wanted) {
+			if (inFlight >= maxLoadsInFlight || resident + (inFlight + 1) * estimate > memoryBudget) break;
+			request(coord);
+			inFlight++;
+		}
+	}
+	void request(ChunkCoord coord) {
+		shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+		chunk->coord = coord;
+		chunk->requested = std::chrono::steady_clock::now();
+		chunks[coord] = chunk;
+		function<void(ChunkCoord, SceneGraph&)> fill = source;
+		loaders.submit([chunk, fill] {
+			if (chunk->cancelled) return;
+			try {
+				if (fill) fill(chunk->coord, chunk->scene);
+				chunk->scene.loadAssets();
+				chunk->state.store(ChunkState::Loaded, std::memory_order_release);
+			} catch (std::exception&) {
+				chunk->failed = std::chrono::steady_clock::now();
+				chunk->state.store(ChunkState::Failed, std::memory_order_release);
+			}
+		});
+	}
+};
+
+#endif
@@ -5,21 +5,23 @@
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 #include <time.h>
+#include <cstring>
+#include <cstdlib>
 #include <vector>
 #include "VecMat.h"
-#include "Camera.h"
-#include "Mesh.h"
-#include "Draw.h"
-#include "Misc.h"
-#include "GLXtras.h"
-#include "dMesh.h"
 #include "GeomUtils.h"
+#include "dCamera.h"
+#include "dRenderPass.h"
+#include "dMesh.h"
+#include "dMisc.h"
+#include "dBoids.h"
+#include "dThreadPool.h"
 
 using std::vector;
 
-GLuint program = 0;
-GLuint texUnit = 0;
-GLuint planeTexUnit, planeTexName;
+RenderPass scenePass;
+RenderPass meshPassInst;
+GLuint planeTexture;
 GLuint cubeBuffer, planeBuffer;
 GLuint cubeIBuffer, planeIBuffer;
 GLuint cubeVAO, planeVAO;
@@ -29,22 +31,19 @@ vector<const char*> boidTexFilenames = { "./textures/fish/fish1.png", "./texture
 vector<mat4> boidObjTransforms = { mat4(), mat4(), mat4(), mat4()};
 vector<const char*> rockObjFilenames = { "./objects/rock/rock1.obj", "./objects/rock/rock2.obj", "./objects/rock/rock3.obj" };
 vector<const char*> rockTexFilenames = { "./textures/rock/rock1.png", "./textures/rock/rock2.png", "./textures/rock/rock3.png" };
-vector<const char*> rockNormFilenames = { "./textures/rock/rock1_normal.png", "./textures/rock/rock2_normal.png", "./textures/rock/rock3_normal.png" };
 const char* sandTexFilename = "./textures/sand.png";
 
 int win_width = 800, win_height = 800;
 
-Camera camera((float) win_width / win_height, vec3(0, 0, 0), vec3(0, 0, -5));
+Camera camera(win_width, win_height, 30.0f, 0.1f, 100.0f);
+float orbitYaw = 180.0f, orbitPitch = 0.0f, orbitDistance = 5.0f;
+double dragX, dragY;
 
-vector<dMesh> boid_meshes;
-vector<dMesh> rock_meshes;
+vector<Mesh> boid_meshes;
+vector<Mesh> rock_meshes;
 vector<vec3> cube_points = { {-1, -1, 1}, {1, -1, 1}, {1, -1, -1}, {-1, -1, -1}, {-1, 1, -1}, {1, 1, -1}, {1, 1, 1}, {-1, 1, 1} }; vector<int4> cube_faces = { {0, 1, 2, 3}, {2, 3, 4, 5}, {4, 5, 6, 7}, {6, 7, 0, 1}, {0, 3, 4, 7}, {1, 2, 5, 6} };
 vector<vec3> plane_points = { {-1, -1, -1}, {1, -1, -1}, {1, -1, 1}, {-1, -1, 1} }; vector<vec2> plane_uvs = { {0, 0}, {1, 0}, {1, 1}, {0, 1} }; vector<int3> plane_tris = { {0, 1, 2}, {2, 3, 0} };
 
-vec3 lightSource = vec3(1, 1, 0);
-
-vec3 XVec(vec3 v, mat4 m) { vec4 x = m * vec4(v); return .1f * vec3(x.x, x.y, x.z); }
-
 const float BOID_SPEED = 0.005f;
 const float BOID_SIZE = 0.06f;
 const float BOID_SIZE_VARIANCE = 0.02f;
@@ -59,178 +58,65 @@ const float SEPARATION_WEIGHT = 1.0f;
 const int STARTING_BOIDS = 150;
 const int STARTING_ROCKS = 200;
 
-const bool DRAW_REF_VECTORS = false;
+const float TICK_RATE = 60.0f; // simulation steps per second, independent of the frame rate
+const int MAX_TICKS_PER_FRAME = 4; // after a stall, drop time rather than spiral
 
 bool running = true;
+float tickBlend = 0.0f; // how far between the last two steps to draw boids
 
-struct Boid;
-struct Rock;
-vector<Boid> flock;
-vector<Rock> rocks;
+ThreadPool workers;
 
-struct Boid {
-	vec3 p, v; // position and velocity vector
-	vector<int> nb, _nb; // neighbors, bucket for different meshed neighbors
-	int mesh;
-	float size = BOID_SIZE + (rand_float(-1, 1) * BOID_SIZE_VARIANCE);
-	Boid(vec3 xyz, vec3 nv) {
-		p = xyz; v = nv; mesh = rand() % boidObjFilenames.size();
-	}
-	void FindNeighbors() {
-		for (size_t i = 0; i < flock.size(); i++) {
-			float d = dist(p, flock[i].p);
-			if (&flock[i] != this && d < BOID_PERCEPTION && d > 0) {
-				if (mesh == flock[i].mesh)
-					nb.push_back(i);
-				else
-					_nb.push_back(i);
-			}
-		}
-	}
-	vec3 Alignment() {
-		vec3 cv = vec3(0.0f);
-		int nc = 0;
-		for (size_t i = 0; i < nb.size(); i++) {
-			size_t n = nb[i]; 
-			cv += flock[n].v;
-			nc++;
-		}
-		if (nc > 0) {
-			cv /= (float)nc;
-			cv = normalize(cv);
-			return cv;
-		} else {
-			return vec3(0.0f);
-		}
-	}
-	vec3 Cohesion() {
-		vec3 cv = vec3(0.0f);
-		int nc = 0;
-		for (size_t i = 0; i < nb.size(); i++) { 
-			size_t n = nb[i];
-			cv += flock[n].p;
-			nc++;
-		}
-		if (nc > 0) {
-			cv /= (float)nc;
-			cv -= p;
-			cv = normalize(cv);
-			return cv;
-		} else {
-			return vec3(0.0f);
-		}
-	}
-	vec3 Separation() {
-		// Include neighbors without same mesh
-		for (size_t i = 0; i < _nb.size(); i++)
-			nb.push_back(_nb[i]);
-		_nb.clear();
-		vec3 cv = vec3(0.0f);
-		float nc = 0; 
-		for (size_t i = 0; i < nb.size(); i++) { 
-			size_t n = nb[i];
-			vec3 iv = p - flock[n].p;
-			iv = normalize(iv);
-			iv /= dist(p, flock[n].p);
-			cv += iv;
-			nc++;
-		}
-		if (nc > 0) {
-			cv /= nc;
-			cv = normalize(cv);
-			return cv;
-		} else {
-			return vec3(0.0f);
+Flock flock;
+vector<float> boidSizes;
+vector<int> boidSlots; // each boid's instance within its mesh's buffer
+vector<int> boidsPerMesh;
+
+// Writes every boid's transform straight into its mesh's instance buffer, one instanced draw per mesh
+void DrawBoids() {
+	vector<uint8_t*> mapped(boid_meshes.size());
+	for (size_t m = 0; m < boid_meshes.size(); m++)
+		mapped[m] = boid_meshes[m].mapInstances(boidsPerMesh[m]);
+	workers.parallelFor((int)flock.boids.size(), [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			const Boid& b = flock.boids[i];
+			mat4 t = Translate(flock.interpolated(i, tickBlend)) * Scale(boidSizes[i]) * Orientation(b.v, vec3(0.0f, 1.0f, 0.0f));
+			t = Transpose(t);
+			memcpy(mapped[b.mesh] + boidSlots[i] * sizeof(mat4), &t, sizeof(mat4));
 		}
+	}, 1024);
+	for (size_t m = 0; m < boid_meshes.size(); m++) {
+		if (!mapped[m]) continue;
+		boid_meshes[m].unmapInstances();
+		meshPassInst.set("model", boid_meshes[m].model);
+		boid_meshes[m].renderInstanced();
 	}
-	vec3 Avoidance() {
-		p += v;
-		// Wrap boids around edges of screen
-		if (p.x > 1.0f)
-			p.x = -1.0f;
-		if (p.x < -1.0f)
-			p.x = 1.0f;
-		if (p.y > 1.0f)
-			p.y = -1.0f;
-		if (p.y < -1.0f)
-			p.y = 1.0f;
-		if (p.z > 1.0f)
-			p.z = -1.0f;
-		if (p.z < -1.0f)
-			p.z = 1.0f;
-		// Steer boids away from walls
-		/*
-		if (p.x < -1 + WALL_RANGE)
-			return vec3(1 / (1 - p.x), 0.0f, 0.0f); // left wall
-		if (p.x > 1 - WALL_RANGE)
-			return vec3(1 / (-1 - p.x), 0.0f, 0.0f); // right wall
-		*/
-		if (p.y > 1 - WALL_RANGE)
-			return vec3(0.0f, 1 / (-1 - p.y), 0.0f); // top wall
-		if (p.y < -1 + WALL_RANGE)
-			return vec3(0.0f, 1 / (1 - p.y), 0.0f); // bottom wall
-		/*
-		if (p.z < -1 + WALL_RANGE)
-			return vec3(0.0f, 0.0f, 1 / (1 - p.z)); // front wall
-		if (p.z > 1 - WALL_RANGE)
-			return vec3(0.0f, 0.0f, 1 / (-1 - p.z)); // back wall
-		*/
-		return vec3(0.0f);
-	}
-	void Run() {
-		FindNeighbors();
-		vec3 a_vec = Alignment() * ALIGNMENT_WEIGHT;
-		vec3 c_vec = Cohesion() * COHESION_WEIGHT;
-		vec3 s_vec = Separation() * SEPARATION_WEIGHT;
-		vec3 w_vec = Avoidance();
-		v += a_vec + c_vec + s_vec + w_vec;
-		v = normalize(v);
-		v *= BOID_SPEED;
-		// Clear neighbors
-		nb.clear(); 
-	}
-	void Draw() {
-		boid_meshes[mesh].PreDisplay();
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		glEnable(GL_DEPTH_TEST);
-		mat4 trans = Translate(p);
-		mat4 scale = Scale(size);
-		mat4 orient = Orientation(v, vec3(0.0f, 1.0f, 0.0f));
-		mat4 modelview = trans * scale * orient;
-		boid_meshes[mesh].Display(camera, &modelview);
-	}
-};
+}
 
-struct Rock {
-	vec3 p, r; // pos, rotation
-	int mesh;
-	float size;
-	Rock(vec3 pos) {
-        p = pos;
-        mesh = rand() % rockObjFilenames.size();
-        size = ROCK_SIZE + (rand_float(-1, 1) * ROCK_SIZE_VARIANCE);
-        r = rand_vec3(0, 360);
-	}
-	void Draw() {
-		rock_meshes[mesh].PreDisplay();
-		mat4 trans = Translate(p);
-		mat4 scale = Scale(size);
-		mat4 rot = RotateX(r.x) * RotateY(r.y) * RotateZ(r.z);
-		mat4 modelview = trans * scale * rot;
-		rock_meshes[mesh].Display(camera, &modelview);
+const char* vertShader = R"(
+	#version 410 core
+	layout (location = 0) in vec3 point;
+	layout (location = 1) in vec2 uv;
+	out vec2 vUv;
+	uniform mat4 model = mat4(1);
+	uniform mat4 view;
+	uniform mat4 persp;
+	void main() {
+		gl_Position = persp * view * model * vec4(point, 1);
+		vUv = uv;
 	}
-};
+)";
 
-const char* vertShader = R"(
+const char* vertShaderInstanced = R"(
 	#version 410 core
-	in vec3 point;
-	in vec2 uv;
+	layout (location = 0) in vec3 point;
+	layout (location = 1) in vec2 uv;
+	layout (location = 3) in mat4 transform;
 	out vec2 vUv;
-	uniform mat4 modelview;
+	uniform mat4 model;
+	uniform mat4 view;
 	uniform mat4 persp;
 	void main() {
-		gl_Position = persp * modelview * vec4(point, 1);
+		gl_Position = persp * view * transform * model * vec4(point, 1);
 		vUv = uv;
 	}
 )";
@@ -239,15 +125,24 @@ const char* fragShader = R"(
 	#version 410 core
 	in vec2 vUv;
 	out vec4 pColor;
-	uniform sampler2D textureUnit;
-	uniform int useTexture = 0;
+	uniform sampler2D txtr;
+	uniform int useTexture = 1;
 	void main() {
-		pColor = (useTexture == 1) ? texture(textureUnit, vUv) : vec4(1);
+		pColor = (useTexture == 1) ? texture(txtr, vUv) : vec4(1);
 	}
 )";
 
+void UpdateCamera() {
+	float yaw = orbitYaw * (float)M_PI / 180.0f, pitch = orbitPitch * (float)M_PI / 180.0f;
+	camera.loc = orbitDistance * vec3(sinf(yaw) * cosf(pitch), sinf(pitch), cosf(yaw) * cosf(pitch));
+	camera.look = vec3(0.0f);
+	camera.update();
+}
+
 void Resize(GLFWwindow* window, int width, int height) {
-	camera.Resize(win_width = width, win_height = height);
+	camera.width = win_width = width;
+	camera.height = win_height = height;
+	camera.update();
 	glViewport(0, 0, win_width, win_height);
 }
 
@@ -259,30 +154,24 @@ void Keyboard(GLFWwindow* window, int key, int scancode, int action, int mods) {
 		running = !running;
 }
 
-bool Shift(GLFWwindow* w) {
-	return glfwGetKey(w, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS ||
-		glfwGetKey(w, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS;
-}
-
 void MouseButton(GLFWwindow* w, int butn, int action, int mods) {
-	double x, y;
-	glfwGetCursorPos(w, &x, &y);
-	y = win_height - y;
 	if (action == GLFW_PRESS)
-		camera.MouseDown((int)x, (int)y);
-	if (action == GLFW_RELEASE)
-		camera.MouseUp();
+		glfwGetCursorPos(w, &dragX, &dragY);
 }
 
 void MouseMove(GLFWwindow* w, double x, double y) {
-	if (glfwGetMouseButton(w, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) { // drag
-		y = win_height - y;
-		camera.MouseDrag((int)x, (int)y, Shift(w));
+	if (glfwGetMouseButton(w, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) { // drag to orbit
+		orbitYaw -= (float)(x - dragX) * 0.3f;
+		orbitPitch = std::max(-89.0f, std::min(89.0f, orbitPitch + (float)(y - dragY) * 0.3f));
+		dragX = x;
+		dragY = y;
+		UpdateCamera();
 	}
 }
 
 void MouseWheel(GLFWwindow* w, double ignore, double spin) {
-	camera.MouseWheel(spin > 0, Shift(w));
+	orbitDistance = std::max(1.5f, std::min(20.0f, orbitDistance * (spin > 0 ? 0.9f : 1.1f)));
+	UpdateCamera();
 }
 
 void InitBuffers() {
@@ -295,7 +184,8 @@ void InitBuffers() {
 	glGenBuffers(1, &cubeIBuffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeIBuffer);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, cube_faces.size() * sizeof(int4), cube_faces.data(), GL_STATIC_DRAW);
-	VertexAttribPointer(program, "point", 3, 0, 0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
 	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
@@ -310,40 +200,45 @@ void InitBuffers() {
 	glBufferSubData(GL_ARRAY_BUFFER, plane_points.size()*sizeof(vec3), plane_uvs.size()*sizeof(vec2), plane_uvs.data());
 	glGenBuffers(1, &planeIBuffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, planeIBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, plane_tris.size()*sizeof(int3), plane_tris.data(), GL_STATIC_DRAW);	
-	glActiveTexture(GL_TEXTURE0 + planeTexUnit);
-	glBindTexture(GL_TEXTURE_2D, planeTexName);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	VertexAttribPointer(program, "point", 3, 0, 0);
-	VertexAttribPointer(program, "uv", 2, 0, (GLvoid*)(plane_points.size()*sizeof(vec3)));
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, plane_tris.size()*sizeof(int3), plane_tris.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid*)(plane_points.size()*sizeof(vec3)));
 	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
-void InitSceneObjects() {
-	for (int i = 0; i < STARTING_BOIDS; i++) {
-		vec3 p = rand_vec3();
-		vec3 v = rand_vec3();
-		v *= BOID_SPEED;
-		Boid b = Boid(p, v);
-		flock.push_back(b);
+void InitSceneObjects(uint64_t seed) {
+	pcg32 rng(seed);
+	flock.settings.speed = BOID_SPEED;
+	flock.settings.perception = BOID_PERCEPTION;
+	flock.settings.wallRange = WALL_RANGE;
+	flock.settings.alignment = ALIGNMENT_WEIGHT;
+	flock.settings.cohesion = COHESION_WEIGHT;
+	flock.settings.separation = SEPARATION_WEIGHT;
+	flock.randomize(STARTING_BOIDS, (int)boidObjFilenames.size(), rng.next());
+	// Meshes never change, so each boid keeps its instance slot for good
+	boidsPerMesh.assign(boid_meshes.size(), 0);
+	for (const Boid& b : flock.boids) {
+		boidSlots.push_back(boidsPerMesh[b.mesh]++);
+		boidSizes.push_back(BOID_SIZE + rng.range(-1.0f, 1.0f) * BOID_SIZE_VARIANCE);
 	}
+	for (size_t m = 0; m < boid_meshes.size(); m++)
+		boid_meshes[m].setupInstanceBuffer(boidsPerMesh[m]);
+	// Rocks don't move, upload them once
+	vector<vector<mat4>> rockTransforms(rock_meshes.size());
 	for (int i = 0; i < STARTING_ROCKS; i++) {
-		vec3 p = vec3(rand_float(-1, 1), -1.0f, rand_float(-1, 1));
-		Rock r = Rock(p);
-		rocks.push_back(r);
+		vec3 p = vec3(rng.range(-1.0f, 1.0f), -1.0f, rng.range(-1.0f, 1.0f));
+		vec3 r = rng.range(vec3(0.0f), vec3(360.0f));
+		float size = ROCK_SIZE + rng.range(-1.0f, 1.0f) * ROCK_SIZE_VARIANCE;
+		mat4 rot = RotateX(r.x) * RotateY(r.y) * RotateZ(r.z);
+		rockTransforms[rng.below((uint32_t)rock_meshes.size())].push_back(Translate(p) * Scale(size) * rot);
 	}
-}
-
-void DrawVectors() {
-	UseDrawShader(camera.modelview);
-	for (size_t i = 0; i < flock.size(); i++) {
-		mat4 rot = Orientation(flock[i].v, vec3(0.0f, 1.0f, 0.0f));
-		vec3 xaxis = XVec(vec3(1, 0, 0), rot), yaxis = XVec(vec3(0, 1, 0), rot), zaxis = XVec(vec3(0, 0, 1), rot);
-		ArrowV(flock[i].p, xaxis, camera.modelview, camera.persp, vec3(1, 0, 0));
-		ArrowV(flock[i].p, yaxis, camera.modelview, camera.persp, vec3(0, 1, 0));
-		ArrowV(flock[i].p, zaxis, camera.modelview, camera.persp, vec3(0, 0, 1));
+	for (size_t m = 0; m < rock_meshes.size(); m++) {
+		rock_meshes[m].setupInstanceBuffer((GLsizei)rockTransforms[m].size());
+		rock_meshes[m].loadInstances(rockTransforms[m]);
 	}
 }
 
@@ -354,48 +249,44 @@ void Display() {
 	glClearColor(0.3f, 0.3f, 0.4f, 1.0f);
 	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 	// Draw cube
+	scenePass.use();
+	scenePass.set("persp", camera.persp);
+	scenePass.set("view", camera.view);
+	scenePass.set("model", mat4());
+	scenePass.set("useTexture", 0);
 	glBindVertexArray(cubeVAO);
-	glUseProgram(program);
-	SetUniform(program, "useTexture", 0);
-	SetUniform(program, "persp", camera.persp);
-	SetUniform(program, "modelview", camera.modelview);
-	for (int i = 0; i < 6; i++) 
+	for (int i = 0; i < 6; i++)
 		glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_INT, (GLvoid*)(i * sizeof(int4)));
-	glBindVertexArray(0);
-	PrintGLErrors("Cube");
-	// Draw floor
-	glUseProgram(program);
+	// Draw floor, both sides
+	scenePass.set("useTexture", 1);
+	scenePass.set("txtr", 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, planeTexture);
 	glBindVertexArray(planeVAO);
-	SetUniform(program, "useTexture", 1);
-	SetUniform(program, "persp", camera.persp);
-	SetUniform(program, "modelview", camera.modelview);
-	SetUniform(program, "textureUnit", (int)planeTexUnit);
-	glDrawElements(GL_TRIANGLES, plane_points.size() * sizeof(vec3), GL_UNSIGNED_INT, 0);
-	// Draw other side of floor
-	mat4 modelview = camera.modelview * Translate(0, -1, 0) * RotateZ(180.0f) * Translate(0, 1, 0);
-	SetUniform(program, "modelview", modelview);
-	glDrawElements(GL_TRIANGLES, plane_points.size() * sizeof(vec3), GL_UNSIGNED_INT, 0);
+	glDrawElements(GL_TRIANGLES, (GLsizei)(plane_tris.size() * 3), GL_UNSIGNED_INT, 0);
+	scenePass.set("model", Translate(0, -1, 0) * RotateZ(180.0f) * Translate(0, 1, 0));
+	glDrawElements(GL_TRIANGLES, (GLsizei)(plane_tris.size() * 3), GL_UNSIGNED_INT, 0);
 	glBindVertexArray(0);
-	PrintGLErrors("Floor");
-	// Draw boids
-	for (size_t i = 0; i < flock.size(); i++) {
-		if (running) 
-			flock[i].Run();
-		flock[i].Draw();
+	glBindTexture(GL_TEXTURE_2D, 0);
+	// Draw boids and rocks, one instanced draw per mesh
+	meshPassInst.use();
+	meshPassInst.set("persp", camera.persp);
+	meshPassInst.set("view", camera.view);
+	meshPassInst.set("txtr", 0);
+	DrawBoids();
+	for (Mesh& m : rock_meshes) {
+		meshPassInst.set("model", m.model);
+		m.renderInstanced();
 	}
-	PrintGLErrors("Boids");
-	// Draw rocks
-	for (size_t i = 0; i < rocks.size(); i++) {
-		rocks[i].Draw();
-	}
-	PrintGLErrors("Rocks");
-	// Draw reference vectors
-	if (DRAW_REF_VECTORS) DrawVectors();
 	glFlush();
 }
 
-int main() {
-	srand((int)time(NULL));
+// boids-3d [--seed n] : the same seed gives the same rocks, fish and flocking
+int main(int argc, char** argv) {
+	uint64_t seed = (uint64_t)time(NULL);
+	for (int i = 1; i + 1 < argc; i++)
+		if (!strcmp(argv[i], "--seed")) seed = strtoull(argv[++i], nullptr, 10);
+	printf("Seed: %llu\n", (unsigned long long)seed);
 	if (!glfwInit())
 		return 1;
 	glfwWindowHint(GLFW_SAMPLES, 4);
@@ -414,26 +305,20 @@ int main() {
 	glfwSetWindowPos(window, 100, 100);
 	glfwMakeContextCurrent(window);
 	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
-	PrintGLErrors();
-	if (!(program = LinkProgramViaCode(&vertShader, &fragShader)))
-		return 1;
-	planeTexUnit = ++texUnit;
-	planeTexName = LoadTexture(sandTexFilename, planeTexUnit);
+	scenePass.loadShaders(&vertShader, &fragShader);
+	meshPassInst.loadShaders(&vertShaderInstanced, &fragShader);
+	planeTexture = loadTexture(sandTexFilename);
 	for (size_t i = 0; i < boidObjFilenames.size(); i++) {
-		boid_meshes.push_back(dMesh());
-		texUnit++;
-		boid_meshes[i].Read((char*)boidObjFilenames[i], (char*)boidTexFilenames[i], texUnit, &boidObjTransforms[i]);
-		printf("'%s' : %i vertices, %i normals, %i uvs, %i triangles\n", boidObjFilenames[i], (int)boid_meshes[i].points.size(), (int)boid_meshes[i].normals.size(), (int)boid_meshes[i].uvs.size(), (int)boid_meshes[i].triangles.size());
+		boid_meshes.push_back(Mesh(boidObjFilenames[i], boidTexFilenames[i], boidObjTransforms[i]));
+		printf("'%s' : %i vertices, %i triangles\n", boidObjFilenames[i], (int)boid_meshes[i].objData.points.size(), (int)boid_meshes[i].objData.indices.size());
 	}
 	for (size_t i = 0; i < rockObjFilenames.size(); i++) {
-		rock_meshes.push_back(dMesh());
-		texUnit++;
-		printf("  Creating and pushing back dMesh...\n");
-		rock_meshes[i].Read((char*)rockObjFilenames[i], (char*)rockTexFilenames[i], texUnit);
-		printf("'%s' : %i vertices, %i normals, %i uvs, %i triangles\n", rockObjFilenames[i], (int)rock_meshes[i].points.size(), (int)rock_meshes[i].normals.size(), (int)rock_meshes[i].uvs.size(), (int)rock_meshes[i].triangles.size());
+		rock_meshes.push_back(Mesh(rockObjFilenames[i], rockTexFilenames[i]));
+		printf("'%s' : %i vertices, %i triangles\n", rockObjFilenames[i], (int)rock_meshes[i].objData.points.size(), (int)rock_meshes[i].objData.indices.size());
 	}
-	InitSceneObjects();
+	InitSceneObjects(seed);
 	InitBuffers();
+	UpdateCamera();
 	glfwSetCursorPosCallback(window, MouseMove);
 	glfwSetMouseButtonCallback(window, MouseButton);
 	glfwSetScrollCallback(window, MouseWheel);
@@ -444,12 +329,29 @@ int main() {
 	printf("GL renderer: %s\n", glGetString(GL_RENDERER));
 	printf("GL version: %s\n", glGetString(GL_VERSION));
 	printf("GLSL version: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
+	double simTime = glfwGetTime();
 	while (!glfwWindowShouldClose(window)) {
+		// Step the flock at TICK_RATE however fast frames come, then draw between the last two steps
+		double now = glfwGetTime();
+		if (!running)
+			simTime = now;
+		else if (now - simTime > MAX_TICKS_PER_FRAME / TICK_RATE)
+			simTime = now - MAX_TICKS_PER_FRAME / TICK_RATE;
+		while (now - simTime >= 1.0 / TICK_RATE) {
+			flock.step(&workers);
+			simTime += 1.0 / TICK_RATE;
+		}
+		tickBlend = running ? (float)((now - simTime) * TICK_RATE) : 1.0f;
 		Display();
 		glfwPollEvents();
 		glfwSwapBuffers(window);
 	}
-	glDeleteVertexArrays(1, &cubeVAO);	
+	for (Mesh& m : boid_meshes) m.cleanup();
+	for (Mesh& m : rock_meshes) m.cleanup();
+	scenePass.cleanup();
+	meshPassInst.cleanup();
+	glDeleteTextures(1, &planeTexture);
+	glDeleteVertexArrays(1, &cubeVAO);
 	glDeleteBuffers(1, &cubeBuffer);
 	glDeleteBuffers(1, &cubeIBuffer);
 	glDeleteVertexArrays(1, &planeVAO);
@@ -458,5 +360,3 @@ int main() {
 	glfwDestroyWindow(window);
 	glfwTerminate();
 }
-
-
@@ -6,11 +6,21 @@
 #include <GLFW/glfw3.h>
 #include "GLXtras.h"
 #include <time.h>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
 #include <vector>
+#include <algorithm>
 #include "VecMat.h"
+#include "dBoids2D.h"
+#include "dThreadPool.h"
 
-GLuint vBuffer = 0;
+using sys_clock = std::chrono::system_clock;
+using float_ms = std::chrono::duration<float, std::milli>;
+
+GLuint vArray = 0, vBuffer = 0, instanceBuffer = 0;
 GLuint program = 0;
+int instanceCapacity = 0;
 
 const int SCREEN_WIDTH = 800;
 const int SCREEN_HEIGHT = 800;
@@ -23,167 +33,109 @@ const float ALIGNMENT_WEIGHT = 1.0f;
 const float COHESION_WEIGHT = 1.0f;
 const float SEPARATION_WEIGHT = 1.5f;
 
-int num_boids = 10;
+// --bench spreads boids over a larger world so each still sees about as many neighbors as
+// BENCH_DENSITY boids would in the window
+const int BENCH_DENSITY = 1000;
 
-float rand_float(float min = 0, float max = 1) { return min + (float)rand() / (RAND_MAX/(max-min)); }
+int starting_boids = 10;
 
-struct Boid {
-	vec2 p, r;
-	vec3 col;
-	Boid(vec2 xy, vec2 nr) {
-		p = xy, r = nr;
-		col = vec3(rand_float(0.25f, 1.0f), rand_float(0.25f, 1.0f), rand_float(0.25f, 1.0f));
-	}
-	float dist(vec2 p1, vec2 p2) {
-		return sqrt(pow(p2.x - p1.x, 2) + pow(p2.y - p1.y, 2));
-	}
-	vec2 Alignment(std::vector<Boid>* flock) {
-		vec2 cv = vec2(0.0f, 0.0f);
-		int nc = 0;
-		for (int i = 0; i < flock->size(); i++) {
-			if (&(*flock)[i] != this && dist(p, (*flock)[i].p) < BOID_PERCEPTION) {
-				cv += (*flock)[i].r;
-				nc++;
-			}
-		}
-		if (nc > 0) {
-			cv /= (float)nc;
-			cv = normalize(cv);
-			return cv;
-		} else {
-			return vec2(0.0f, 0.0f);
-		}
-	}
-	vec2 Cohesion(std::vector<Boid>* flock) {
-		vec2 cv = vec2(0.0f, 0.0f);
-		int nc = 0;
-		for (int i = 0; i < flock->size(); i++) {
-			if (&(*flock)[i] != this && dist(p, (*flock)[i].p) < BOID_PERCEPTION) {
-				cv += (*flock)[i].p;
-				nc++;
-			}
-		}
-		if (nc > 0) {
-			cv /= (float)nc;
-			cv -= p;
-			cv = normalize(cv);
-			return cv;
-		} else {
-			return vec2(0.0f, 0.0f);
-		}
-	}
-	vec2 Separation(std::vector<Boid>* flock) {
-		vec2 cv = vec2(0.0f, 0.0f);
-		int nc = 0;
-		for (int i = 0; i < flock->size(); i++) {
-			if (&(*flock)[i] != this && 
-				dist(p, (*flock)[i].p) < BOID_PERCEPTION && 
-				dist(p, (*flock)[i].p) > 0) {
-				vec2 iv = p - (*flock)[i].p;
-				iv = normalize(iv);
-				iv /= dist(p, (*flock)[i].p);
-				cv += iv;
-				nc++;
-			}
-		}
-		if (nc > 0) {
-			cv /= nc;
-			cv = normalize(cv);
-			return cv;
-		} else {
-			return vec2(0.0f, 0.0f);
-		}
-	}
-	void Move() {
-		// Get movement vector pointing upward
-		vec4 m_vec = vec4(0.0f, BOID_SPEED, 0, 1);
-		// Rotate movement vector
-		mat4 rot = RotateZ(atan2(r.y, r.x) * (180 / M_PI));
-		m_vec = rot * m_vec;
-		// Add movement vector to position vector
-		p += vec2(m_vec.x, m_vec.y);
-
-		// Wrap around screen
-		if (p.x > 400)
-			p.x = -400;
-		if (p.x < -400)
-			p.x = 400;
-		if (p.y > 400)
-			p.y = -400;
-		if (p.y < -400)
-			p.y = 400;
-	}
-	void Run(std::vector<Boid>* flock) {
-		vec2 a_vec = Alignment(flock) * ALIGNMENT_WEIGHT;
-		vec2 c_vec = Cohesion(flock) * COHESION_WEIGHT;
-		vec2 s_vec = Separation(flock) * SEPARATION_WEIGHT;
-		r += a_vec + c_vec + s_vec;
-		r = normalize(r);
-		r *= BOID_SPEED;
-		Move();
-	}
-};
+Flock2D flock;
+ThreadPool workers;
+pcg32 rng;
 
-std::vector<Boid> flock = std::vector<Boid>();
-float vertices[][2] = { 
-	{0.0f, (BOID_SIZE / 2) / SCREEN_HEIGHT}, 
-	{(BOID_SIZE / 2) / SCREEN_WIDTH, (BOID_SIZE / 2) / SCREEN_HEIGHT * -1}, 
+float vertices[][2] = {
+	{0.0f, (BOID_SIZE / 2) / SCREEN_HEIGHT},
+	{(BOID_SIZE / 2) / SCREEN_WIDTH, (BOID_SIZE / 2) / SCREEN_HEIGHT * -1},
 	{(BOID_SIZE / 2) / SCREEN_WIDTH * -1, (BOID_SIZE / 2) / SCREEN_HEIGHT * -1}
 };
-int triangles[] = { 0, 1, 2 };
 
-const char* vertexShader = R"( 
-	#version 130
-	in vec2 point;
-	uniform mat4 m;
+const char* vertexShader = R"(
+	#version 410 core
+	layout (location = 0) in vec2 point;
+	layout (location = 1) in vec4 boid; // position, heading
+	layout (location = 2) in vec4 boidColor;
+	out vec4 vColor;
+	uniform float extent;
 	void main() {
-		gl_Position = m * vec4(point, 0, 1);
+		// Turn the triangle to the heading, what RotateZ(atan2(r)) did
+		vec2 h = normalize(boid.zw);
+		vec2 p = vec2(h.x * point.x - h.y * point.y, h.y * point.x + h.x * point.y);
+		gl_Position = vec4(boid.xy / extent + p, 0, 1);
+		vColor = boidColor;
 	}
 )";
 
 const char* fragmentShader = R"(
-	#version 130
+	#version 410 core
+	in vec4 vColor;
 	out vec4 pColor;
-	uniform vec3 col;
 	void main() {
-		pColor = vec4(col, 1);
+		pColor = vec4(vColor.rgb, 1);
 	}
 )";
 
+void SetupFlock() {
+	flock.speed = BOID_SPEED;
+	flock.perception = BOID_PERCEPTION;
+	flock.alignment = ALIGNMENT_WEIGHT;
+	flock.cohesion = COHESION_WEIGHT;
+	flock.separation = SEPARATION_WEIGHT;
+}
+
 void InitVertexBuffer() {
+	glGenVertexArrays(1, &vArray);
+	glBindVertexArray(vArray);
 	glGenBuffers(1, &vBuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*6, NULL, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float)*6, vertices);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	// One Boid2DInstance per boid, streamed every frame
+	glGenBuffers(1, &instanceBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Boid2DInstance), (void*)0);
+	glVertexAttribDivisor(1, 1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Boid2DInstance), (void*)offsetof(Boid2DInstance, color));
+	glVertexAttribDivisor(2, 1);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void MouseMove(GLFWwindow* w, double x, double y) {
 	if (glfwGetMouseButton(w, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
 		vec2 m = vec2((float)x, (float)y);
 		m.x -= (SCREEN_WIDTH / 2), m.y = (m.y - (SCREEN_HEIGHT / 2)) * -1;
-		float r_ang = rand_float() * 2 * M_PI;
-		vec2 r = vec2(cos(r_ang), sin(r_ang));
-		Boid b = Boid(m, r);
-		flock.push_back(b);
-		num_boids++;
+		float r_ang = rng.range(0.0f, 2.0f * (float)M_PI);
+		uint32_t col = 0xff000000u;
+		for (int k = 0; k < 3; k++) col |= (uint32_t)(rng.range(0.25f, 1.0f) * 255.0f) << (8 * k);
+		flock.add(m, vec2(cosf(r_ang), sinf(r_ang)), col);
 	}
 }
 
 void Display() {
-	glClearColor(0.3, 0.3, 0.3, 1);
+	flock.step(&workers);
+	glClearColor(0.3f, 0.3f, 0.3f, 1);
 	glClear(GL_COLOR_BUFFER_BIT);
-	glUseProgram(program);
-	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
-	VertexAttribPointer(program, "point", 2, 0, (void*)0);
-	for (int i = 0; i < num_boids; i++) {
-		flock[i].Run(&flock);
-		mat4 rot = RotateZ(atan2(flock[i].r.y, flock[i].r.x) * (180 / M_PI));
-		mat4 trans = Translate(flock[i].p.x / (SCREEN_WIDTH / 2), flock[i].p.y / (SCREEN_HEIGHT / 2), 0.0f);
-		mat4 m = trans * rot;
-		SetUniform(program, "m", m);
-		SetUniform(program, "col", flock[i].col);
-		glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, triangles);
+	int count = flock.size();
+	if (!count) return;
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	if (count > instanceCapacity) {
+		instanceCapacity = std::max(count, 2 * instanceCapacity);
+		glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(Boid2DInstance), NULL, GL_STREAM_DRAW);
+	}
+	Boid2DInstance* mapped = (Boid2DInstance*)glMapBufferRange(GL_ARRAY_BUFFER, 0, count * sizeof(Boid2DInstance), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (mapped) {
+		workers.parallelFor(count, [&](int begin, int end, int) { flock.pack(mapped, begin, end); }, Flock2D::BLOCK);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
 	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glUseProgram(program);
+	SetUniform(program, "extent", flock.extent);
+	glBindVertexArray(vArray);
+	glDrawArraysInstanced(GL_TRIANGLES, 0, 3, count);
+	glBindVertexArray(0);
 	glFlush();
 }
 
@@ -193,10 +145,142 @@ void Keyboard(GLFWwindow* window, int key, int scancode, int action, int mods) {
 	}
 }
 
-int main() {
-	srand(time(NULL));
+// One step of f's rules from its current state, brute force over every pair in double precision,
+// indexed like f before the step. Neighbors are picked with the same float distance test
+void ReferenceStep(const Flock2D& f, vector<double>& x, vector<double>& y, vector<double>& rx, vector<double>& ry) {
+	int count = f.size();
+	x.resize(count); y.resize(count); rx.resize(count); ry.resize(count);
+	float r2 = f.perception * f.perception;
+	double extent = f.extent;
+	for (int i = 0; i < count; i++) {
+		double ax = 0, ay = 0, cx = 0, cy = 0, sepx = 0, sepy = 0;
+		int near = 0, apart = 0;
+		for (int j = 0; j < count; j++) {
+			float fdx = f.x[j] - f.x[i], fdy = f.y[j] - f.y[i];
+			if (j == i || fdx * fdx + fdy * fdy >= r2) continue;
+			double dx = (double)f.x[j] - f.x[i], dy = (double)f.y[j] - f.y[i], d2 = dx * dx + dy * dy;
+			ax += f.rx[j]; ay += f.ry[j];
+			cx += dx; cy += dy;
+			near++;
+			if (d2 > 0.0) {
+				sepx -= dx / d2; sepy -= dy / d2;
+				apart++;
+			}
+		}
+		double vx = f.rx[i], vy = f.ry[i];
+		auto steerBy = [&](double fx, double fy, double weight) {
+			double l = sqrt(fx * fx + fy * fy);
+			if (l > 0.0) { vx += fx * weight / l; vy += fy * weight / l; }
+		};
+		if (near) {
+			steerBy(ax / near, ay / near, f.alignment);
+			steerBy(cx / near, cy / near, f.cohesion);
+		}
+		if (apart) steerBy(sepx / apart, sepy / apart, f.separation);
+		double l = sqrt(vx * vx + vy * vy);
+		if (l > 0.0) { vx *= f.speed / l; vy *= f.speed / l; }
+		double mx = f.x[i] - vy, my = f.y[i] + vx;
+		if (mx > extent) mx = -extent;
+		if (mx < -extent) mx = extent;
+		if (my > extent) my = -extent;
+		if (my < -extent) my = extent;
+		x[i] = mx; y[i] = my; rx[i] = vx; ry[i] = vy;
+	}
+}
+
+// A small flock at the bench's density against ReferenceStep(), boids told apart by color since a
+// step reorders them, then the bench's flock stepped on the pool against one stepped serially.
+// Returns 0 if both match
+int BenchCheck(ThreadPool& pool, int count) {
+	int result = 0;
+	Flock2D small = flock;
+	small.x.clear(); small.y.clear(); small.rx.clear(); small.ry.clear(); small.color.clear();
+	small.extent = (SCREEN_WIDTH / 2) * sqrtf(4000.0f / BENCH_DENSITY);
+	small.randomize(4000, 2);
+	for (int i = 0; i < small.size(); i++) small.color[i] = (uint32_t)i;
+	float worstHeading = 0.0f, worstPosition = 0.0f;
+	for (int s = 0; s < 5; s++) {
+		vector<double> x, y, rx, ry;
+		ReferenceStep(small, x, y, rx, ry);
+		vector<int> before(small.size());
+		for (int i = 0; i < small.size(); i++) before[small.color[i]] = i;
+		small.step(&pool);
+		for (int k = 0; k < small.size(); k++) {
+			int i = before[small.color[k]];
+			worstHeading = std::max(worstHeading, (float)(hypot(small.rx[k] - rx[i], small.ry[k] - ry[i]) / small.speed));
+			// Wrapping turns a tiny difference at the edge into a jump across the world, measure it the short way
+			double dx = fabs(small.x[k] - x[i]), dy = fabs(small.y[k] - y[i]);
+			dx = std::min(dx, 2 * small.extent - dx);
+			dy = std::min(dy, 2 * small.extent - dy);
+			worstPosition = std::max(worstPosition, (float)hypot(dx, dy));
+		}
+	}
+	bool close = worstHeading < 1e-4f && worstPosition < 1e-3f;
+	printf("Check: %i boids, 5 steps against an O(n^2) double precision reference, max heading error %.2e of speed, max position error %.2e: %s\n",
+		small.size(), worstHeading, worstPosition, close ? "ok" : "FAILED");
+	if (!close) result = 1;
+	// Thread count mustn't change anything
+	Flock2D serial = flock, pooled = flock;
+	int n = std::min(count, 200000);
+	for (Flock2D* f : { &serial, &pooled }) {
+		f->x.clear(); f->y.clear(); f->rx.clear(); f->ry.clear(); f->color.clear();
+		f->extent = (SCREEN_WIDTH / 2) * sqrtf((float)n / BENCH_DENSITY);
+		f->randomize(n, 3);
+	}
+	for (int s = 0; s < 10; s++) {
+		serial.step();
+		pooled.step(&pool);
+	}
+	bool same = serial.x == pooled.x && serial.y == pooled.y && serial.rx == pooled.rx && serial.ry == pooled.ry && serial.color == pooled.color;
+	printf("Check: %i boids, 10 steps, 1 thread vs %i: %s\n", n, pool.size(), same ? "match" : "DIFFER");
+	if (!same) result = 1;
+	return result;
+}
+
+// boids --bench [boids] [steps] [threads] : steps and packs without opening a window
+int Bench(int count, int steps, int threads) {
+	ThreadPool pool(threads);
+	SetupFlock();
+	flock.extent = (SCREEN_WIDTH / 2) * sqrtf((float)count / BENCH_DENSITY);
+	flock.randomize(count, 1);
+	vector<Boid2DInstance> instances(count);
+	printf("%i boids in a %.0f wide world, %i steps, %i threads\n", count, 2 * flock.extent, steps, pool.size());
+	vector<float> stepMs;
+	float packMs = 0.0f;
+	size_t pairs = 0;
+	for (int s = 0; s < steps; s++) {
+		auto start = sys_clock::now();
+		flock.step(&pool);
+		auto mid = sys_clock::now();
+		pool.parallelFor(count, [&](int begin, int end, int) { flock.pack(instances.data(), begin, end); }, Flock2D::BLOCK);
+		stepMs.push_back(float_ms(mid - start).count());
+		packMs += float_ms(sys_clock::now() - mid).count();
+		pairs += flock.pairsTested;
+	}
+	std::sort(stepMs.begin(), stepMs.end());
+	float total = 0.0f;
+	for (float ms : stepMs) total += ms;
+	double checksum = 0.0;
+	for (int i = 0; i < count; i++) checksum += flock.x[i] + flock.y[i];
+	printf("Step: %.3f ms mean, %.3f best, %.3f worst, %.1f distance tests / boid\n",
+		total / steps, stepMs.front(), stepMs.back(), (double)pairs / steps / count);
+	printf("Pack: %.3f ms\n", packMs / steps);
+	printf("Checksum: %.6f\n", checksum);
+	return BenchCheck(pool, count);
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1 && !strcmp(argv[1], "--bench"))
+		return Bench(argc > 2 ? atoi(argv[2]) : 1000000, argc > 3 ? atoi(argv[3]) : 20, argc > 4 ? atoi(argv[4]) : 0);
+	rng = pcg32((uint64_t)time(NULL));
 	if (!glfwInit())
 		return 1;
+	#ifdef __APPLE__
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	#endif
 	GLFWwindow* window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Boids", NULL, NULL);
 	if (!window) {
 		glfwTerminate();
@@ -208,15 +292,8 @@ int main() {
 	PrintGLErrors();
 	if (!(program = LinkProgramViaCode(&vertexShader, &fragmentShader)))
 		return 0;
-	// Init boids
-	for (int i = 0; i < num_boids; i++) {
-		float x = (rand() % SCREEN_WIDTH), y = (rand() % SCREEN_HEIGHT);
-		float r_ang = rand_float() * 2 * M_PI;
-		vec2 p = vec2(x, y);
-		vec2 r = vec2(cos(r_ang), sin(r_ang));
-		Boid b = Boid(p, r);
-		flock.push_back(b);
-	}
+	SetupFlock();
+	flock.randomize(starting_boids, rng.next());
 	InitVertexBuffer();
 	glfwSetCursorPosCallback(window, MouseMove);
 	glfwSetKeyCallback(window, Keyboard);
@@ -226,8 +303,9 @@ int main() {
 		glfwPollEvents();
 		glfwSwapBuffers(window);
 	}
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glDeleteBuffers(1, &vBuffer);
+	glDeleteBuffers(1, &instanceBuffer);
+	glDeleteVertexArrays(1, &vArray);
 	glfwDestroyWindow(window);
 	glfwTerminate();
-}
\ No newline at end of file
+}
@@ -0,0 +1,267 @@
+// broadphase-bench.cpp : Times SweepAndPrune and TreeBroadphase updates without a window or GL, Devon McKee
+// broadphase-bench [--scene drive|space|drift|all] [--frames n] [--no-check]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include "dBroadphase.h"
+
+using sys_clock = std::chrono::system_clock;
+using float_ms = std::chrono::duration<float, std::milli>;
+
+enum Scene { DRIVE, SPACE, DRIFT };
+
+const char* sceneNames[] = { "drive", "space", "drift" };
+
+float percentile(const vector<float>& sorted, float p) {
+	return sorted[std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5f))];
+}
+
+// Bodies as the demos have them: drive's forest (16 x 16 chunks of 20-50 tree trunks, static) and
+// the car going round a loop, space's 10,000 rocks (static) and the ship flying through them, or
+// the same rocks drifting, with a few replaced by new ones every frame. A random forest or rock
+// field would hardly ever touch the car or ship, so drive plants trees along the loop and every
+// 20th rock of space lies near the ship's line, for pairs with the one dynamic proxy to come and go
+struct Body {
+	vec3 pos, vel, half;
+	bool isStatic = true;
+	Bounds bounds() const { return Bounds(pos - half, pos + half); }
+};
+
+struct Sim {
+	Scene scene;
+	vector<Body> bodies;
+	vector<int> respawned; // bodies to recreate this frame
+	float margin = 0.1f;
+	int frame = 0;
+	std::mt19937 rng{ 7 };
+	float unit() { return std::uniform_real_distribution<float>(0.0f, 1.0f)(rng); }
+	float range(float lo, float hi) { return lo + (hi - lo) * unit(); }
+	Sim(Scene s) : scene(s) {
+		if (scene == DRIVE) {
+			margin = 0.5f;
+			float chunkSize = 64.0f;
+			for (int cz = -8; cz < 8; cz++)
+				for (int cx = -8; cx < 8; cx++) {
+					int trees = 20 + (int)(unit() * 30);
+					for (int i = 0; i < trees; i++) {
+						Body tree;
+						tree.pos = vec3((cx + unit()) * chunkSize, 2.0f, (cz + unit()) * chunkSize);
+						tree.half = vec3(0.5f, 2.0f, 0.5f);
+						bodies.push_back(tree);
+					}
+				}
+			// Every 6 degrees of the loop, just off the middle of the road
+			for (int k = 0; k < 60; k++) {
+				float a = k * 6.0f * 3.14159265f / 180.0f, r = 150.0f + (k % 2 ? 1.5f : -1.5f);
+				Body tree;
+				tree.pos = vec3(r * cosf(a), 2.0f, r * sinf(a));
+				tree.half = vec3(0.5f, 2.0f, 0.5f);
+				bodies.push_back(tree);
+			}
+			Body car;
+			car.half = vec3(1.0f, 0.5f, 1.0f);
+			car.isStatic = false;
+			bodies.push_back(car);
+			return;
+		}
+		margin = scene == SPACE ? 2.0f : 0.5f;
+		for (int i = 0; i < 10000; i++) {
+			bodies.push_back(rock());
+			if (scene == SPACE && i % 20 == 0) bodies.back().pos = vec3(range(-600, 600), range(-15, 15), range(-15, 15));
+		}
+		Body ship;
+		ship.pos = vec3(-600, 0, 0);
+		ship.vel = vec3(0.8f, 0, 0);
+		ship.half = vec3(1.0f);
+		ship.isStatic = false;
+		bodies.push_back(ship);
+	}
+	Body rock() {
+		Body r;
+		r.pos = vec3(range(-600, 600), range(-600, 600), range(-600, 600));
+		r.half = vec3(range(0.5f, 8.0f));
+		r.isStatic = scene == SPACE;
+		if (!r.isStatic) r.vel = range(0.02f, 0.1f) * normalize(vec3(range(-1, 1), range(-1, 1), range(-1, 1)));
+		return r;
+	}
+	void step() {
+		frame++;
+		respawned.clear();
+		Body& mover = bodies.back();
+		if (scene == DRIVE) {
+			// 0.5 units per frame round a loop through the forest
+			float a = frame * 0.5f / 150.0f;
+			mover.pos = vec3(150.0f * cosf(a), 0.5f, 150.0f * sinf(a));
+			return;
+		}
+		mover.pos += mover.vel;
+		if (mover.pos.x > 600) mover.pos.x = -600;
+		if (scene == SPACE) return;
+		for (size_t i = 0; i + 1 < bodies.size(); i++) {
+			Body& r = bodies[i];
+			r.pos += r.vel;
+			if (fabsf(r.pos.x) > 600 || fabsf(r.pos.y) > 600 || fabsf(r.pos.z) > 600) {
+				r = rock();
+				respawned.push_back((int)i);
+			}
+		}
+		for (int k = 0; k < 5; k++) {
+			int i = (int)(unit() * (bodies.size() - 1));
+			bodies[i] = rock();
+			respawned.push_back(i);
+		}
+	}
+};
+
+template <typename Broadphase>
+void build(Broadphase& bp, vector<int>& ids, const Sim& sim) {
+	bp.margin = sim.margin;
+	ids.clear();
+	for (size_t i = 0; i < sim.bodies.size(); i++) ids.push_back(bp.create(sim.bodies[i].bounds(), (int)i, sim.bodies[i].isStatic));
+	bp.update();
+}
+
+// Applies a frame of the sim to bp, returns ms taken
+template <typename Broadphase>
+float frame(Broadphase& bp, vector<int>& ids, const Sim& sim) {
+	auto begin = sys_clock::now();
+	for (int i : sim.respawned) {
+		bp.destroy(ids[i]);
+		ids[i] = bp.create(sim.bodies[i].bounds(), i, sim.bodies[i].isStatic);
+	}
+	for (size_t i = 0; i < sim.bodies.size(); i++)
+		if (!sim.bodies[i].isStatic) bp.move(ids[i], sim.bodies[i].bounds());
+	bp.update();
+	return float_ms(sys_clock::now() - begin).count();
+}
+
+// Pairs as (user, user), comparable between broadphases
+template <typename Broadphase>
+vector<BroadphasePair> userPairs(const Broadphase& bp, const vector<BroadphasePair>& pairs) {
+	vector<BroadphasePair> users;
+	for (const BroadphasePair& p : pairs) {
+		int a = bp.proxy(p.a).user, b = bp.proxy(p.b).user;
+		users.push_back({ std::min(a, b), std::max(a, b) });
+	}
+	std::sort(users.begin(), users.end());
+	return users;
+}
+
+// Every overlapping pair of fat bounds, not both static, tested one by one
+template <typename Broadphase>
+vector<BroadphasePair> bruteForce(const Broadphase& bp) {
+	vector<BroadphasePair> pairs;
+	for (int a = 0; a < bp.capacity(); a++) {
+		const Proxy& p = bp.proxy(a);
+		if (!p.alive) continue;
+		for (int b = a + 1; b < bp.capacity(); b++) {
+			const Proxy& q = bp.proxy(b);
+			if (q.alive && !(p.isStatic && q.isStatic) && p.fat.overlaps(q.fat)) pairs.push_back({ a, b });
+		}
+	}
+	return pairs;
+}
+
+// The previous pairs, less removed, plus added, must be the new pairs
+bool consistent(const vector<BroadphasePair>& before, const ProxySet& bp) {
+	vector<BroadphasePair> kept, after;
+	std::set_difference(before.begin(), before.end(), bp.removed.begin(), bp.removed.end(), std::back_inserter(kept));
+	std::merge(kept.begin(), kept.end(), bp.added.begin(), bp.added.end(), std::back_inserter(after));
+	return after == bp.pairs;
+}
+
+struct Timing {
+	vector<float> ms;
+	double pairs = 0.0, moved = 0.0;
+	void print(const char* name, int frames, const char* extra = "") {
+		vector<float> sorted = ms;
+		std::sort(sorted.begin(), sorted.end());
+		float total = 0.0f;
+		for (float t : ms) total += t;
+		printf("  %-6s update: mean %.3f ms, p50 %.3f, p90 %.3f, max %.3f, %.1f pairs, %.1f proxies moved%s\n", name,
+			total / frames, percentile(sorted, 0.5f), percentile(sorted, 0.9f), sorted.back(), pairs / frames, moved / frames, extra);
+	}
+};
+
+int run(Scene scene, int frames, bool check) {
+	Sim sim(scene);
+	SweepAndPrune sap;
+	TreeBroadphase tree;
+	vector<int> sapIds, treeIds;
+	auto begin = sys_clock::now();
+	build(sap, sapIds, sim);
+	float sapBuild = float_ms(sys_clock::now() - begin).count();
+	begin = sys_clock::now();
+	build(tree, treeIds, sim);
+	float treeBuild = float_ms(sys_clock::now() - begin).count();
+	printf("%s: %i proxies (%i dynamic), margin %g, build: sap %.1f ms, tree %.1f ms\n", sceneNames[scene], sap.count(),
+		(int)std::count_if(sim.bodies.begin(), sim.bodies.end(), [](const Body& b) { return !b.isStatic; }), sim.margin, sapBuild, treeBuild);
+	Timing sapTime, treeTime;
+	int result = 0, mismatches = 0, inconsistent = 0, bruteChecks = 0, bruteFails = 0, changes = 0;
+	vector<BroadphasePair> sapBefore, treeBefore;
+	for (int f = 0; f < frames; f++) {
+		sim.step();
+		if (check) {
+			sapBefore = sap.pairs;
+			treeBefore = tree.pairs;
+		}
+		sapTime.ms.push_back(frame(sap, sapIds, sim));
+		treeTime.ms.push_back(frame(tree, treeIds, sim));
+		sapTime.pairs += sap.pairs.size();
+		sapTime.moved += sap.moved;
+		treeTime.pairs += tree.pairs.size();
+		treeTime.moved += tree.moved;
+		if (!check) continue;
+		changes += (int)(sap.added.size() + sap.removed.size());
+		if (userPairs(sap, sap.pairs) != userPairs(tree, tree.pairs)) mismatches++;
+		if (!consistent(sapBefore, sap) || !consistent(treeBefore, tree)) inconsistent++;
+		if (f % 100 == 0 || f == frames - 1) {
+			bruteChecks++;
+			if (bruteForce(sap) != sap.pairs) bruteFails++;
+		}
+	}
+	sapTime.print("sap", frames);
+	char height[64];
+	snprintf(height, sizeof(height), ", trees %i / %i high", tree.dynamicTree.height(), tree.staticTree.height());
+	treeTime.print("tree", frames, height);
+	if (check) {
+		bool ok = !mismatches && !inconsistent && !bruteFails;
+		printf("  Check: sap vs tree %i / %i frames differ, %i pairs added / removed, wrong on %i frames, brute force %i / %i wrong: %s\n",
+			mismatches, frames, changes, inconsistent, bruteFails, bruteChecks, ok ? "ok" : "FAILED");
+		if (!ok) result = 1;
+	}
+	return result;
+}
+
+int main(int argc, char** argv) {
+	int frames = 600, first = DRIVE, last = DRIFT;
+	bool check = true;
+	for (int i = 1; i < argc; i++) {
+		bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "--frames") && more) frames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--no-check")) check = false;
+		else if (!strcmp(argv[i], "--scene") && more) {
+			const char* s = argv[++i];
+			first = !strcmp(s, "drive") ? DRIVE : !strcmp(s, "space") ? SPACE : !strcmp(s, "drift") ? DRIFT : -1;
+			last = first;
+			if (!strcmp(s, "all")) {
+				first = DRIVE;
+				last = DRIFT;
+			}
+			if (first < 0) return 2;
+		}
+		else {
+			printf("Usage: %s [--scene drive|space|drift|all] [--frames n] [--no-check]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (frames < 1) return 2;
+	int result = 0;
+	for (int s = first; s <= last; s++)
+		result |= run((Scene)s, frames, check);
+	return result;
+}
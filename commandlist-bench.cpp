@@ -0,0 +1,197 @@
+// commandlist-bench.cpp : Times CommandList recording and replay without a window or GL, and checks replay against a logging backend, Devon McKee
+// commandlist-bench [--draws n] [--lists n] [--threads n] [--no-check]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include "dCommandList.h"
+
+using std::string;
+using sys_clock = std::chrono::system_clock;
+using float_ms = std::chrono::duration<float, std::milli>;
+
+// Backend that writes every call it gets as a line of text, payloads included
+struct CommandLog {
+	vector<string> calls;
+	void log(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+		char line[256];
+		va_list args;
+		va_start(args, format);
+		vsnprintf(line, sizeof(line), format, args);
+		va_end(args);
+		calls.push_back(line);
+	}
+	void useProgram(GLuint p) { log("useProgram %u", p); }
+	void bindVertexArray(GLuint v) { log("bindVertexArray %u", v); }
+	void bindTexture(GLuint unit, GLenum target, GLuint texture) { log("bindTexture %u %#x %u", unit, target, texture); }
+	void bindFramebuffer(GLuint fbo) { log("bindFramebuffer %u", fbo); }
+	void viewport(GLint x, GLint y, GLsizei w, GLsizei h) { log("viewport %i %i %i %i", x, y, w, h); }
+	void clear(GLbitfield mask) { log("clear %#x", mask); }
+	void cullFace(GLenum face) { log("cullFace %#x", face); }
+	void uniform(GLint loc, UniformType type, const void* v) {
+		const float* f = (const float*)v;
+		switch (type) {
+			case UniformType::Int: log("uniform %i int %i", loc, *(const GLint*)v); break;
+			case UniformType::UInt: log("uniform %i uint %u", loc, *(const GLuint*)v); break;
+			case UniformType::Float: log("uniform %i float %g", loc, f[0]); break;
+			case UniformType::Vec2: log("uniform %i vec2 %g %g", loc, f[0], f[1]); break;
+			case UniformType::Vec3: log("uniform %i vec3 %g %g %g", loc, f[0], f[1], f[2]); break;
+			case UniformType::Vec4: log("uniform %i vec4 %g %g %g %g", loc, f[0], f[1], f[2], f[3]); break;
+			case UniformType::Mat4: log("uniform %i mat4 %g %g %g %g", loc, f[0], f[3], f[12], f[15]); break;
+		}
+	}
+	void uniformBlock(GLuint binding, GLuint buffer, const void* block, size_t size) {
+		log("uniformBlock %u %u %zu %g", binding, buffer, size, *(const float*)block);
+	}
+	void bufferData(GLenum target, GLuint buffer, const void* bytes, size_t size) {
+		uint32_t sum = 0;
+		for (size_t i = 0; i < size; i++) sum = sum * 31 + ((const uint8_t*)bytes)[i];
+		log("bufferData %#x %u %zu %08x", target, buffer, size, sum);
+	}
+	void drawElements(GLenum mode, GLsizei count, size_t indexOffset) { log("drawElements %#x %i %zu", mode, count, indexOffset); }
+	void drawElementsInstanced(GLenum mode, GLsizei count, GLsizei instances, size_t indexOffset) {
+		log("drawElementsInstanced %#x %i %i %zu", mode, count, instances, indexOffset);
+	}
+	void drawArrays(GLenum mode, GLint first, GLsizei count) { log("drawArrays %#x %i %i", mode, first, count); }
+	void blitDepth(GLuint from, GLuint to, GLsizei w, GLsizei h) { log("blitDepth %u %u %i %i", from, to, w, h); }
+	void finish() { log("finish"); }
+};
+
+// What a pass records for one mesh: program, textures, per-draw uniforms, instances, draw
+void recordMesh(CommandList& cmds, int mesh, int instances) {
+	cmds.useProgram(1 + mesh % 3);
+	cmds.bindVertexArray(10 + mesh);
+	cmds.bindTexture(0, GL_TEXTURE_2D, 100 + mesh);
+	mat4 model = Translate((float)mesh, 0, 0);
+	cmds.uniform(2, model);
+	cmds.uniform(3, vec3(0.5f, (float)mesh, 1));
+	cmds.uniform(4, (GLint)mesh);
+	if (instances > 1) {
+		uint8_t* bytes = cmds.bufferData(GL_ARRAY_BUFFER, 200 + mesh, instances * sizeof(mat4));
+		for (int i = 0; i < instances; i++) {
+			mat4 m = Translate((float)i, (float)mesh, 0);
+			memcpy(bytes + i * sizeof(mat4), &m, sizeof(mat4));
+		}
+		cmds.drawElementsInstanced(GL_TRIANGLES, 36, instances);
+	}
+	else cmds.drawElements(GL_TRIANGLES, 36);
+}
+
+// Every command type once, with the calls replay() has to make for them in order
+bool checkEveryCommand() {
+	CommandList cmds;
+	cmds.bindFramebuffer(7);
+	cmds.viewport(0, 0, 640, 480);
+	cmds.clear(GL_DEPTH_BUFFER_BIT);
+	cmds.cullFace(GL_FRONT);
+	cmds.useProgram(3);
+	cmds.uniform(1, (GLint)-2);
+	cmds.uniform(2, (GLuint)9);
+	cmds.uniform(3, 0.25f);
+	cmds.uniform(4, vec2(1, 2));
+	cmds.uniform(5, vec3(1, 2, 3));
+	cmds.uniform(6, vec4(1, 2, 3, 4));
+	cmds.uniform(7, Translate(5, 6, 7));
+	cmds.uniform(-1, 1.0f); // unused uniforms are dropped when recorded
+	float block[4] = { 1.5f, 0, 0, 0 };
+	cmds.uniformBlock(0, 11, block, sizeof(block));
+	uint8_t bytes[3] = { 1, 2, 3 };
+	cmds.bufferData(GL_ARRAY_BUFFER, 12, bytes, sizeof(bytes));
+	cmds.bindVertexArray(4);
+	cmds.bindTexture(2, GL_TEXTURE_2D_ARRAY, 13);
+	cmds.drawElements(GL_TRIANGLES, 6, 24);
+	cmds.drawElementsInstanced(GL_TRIANGLES, 6, 10, 48);
+	cmds.drawArrays(GL_POINTS, 5, 100);
+	cmds.blitDepth(7, 0, 640, 480);
+	vector<string> expected = {
+		"bindFramebuffer 7", "viewport 0 0 640 480", "clear 0x100", "cullFace 0x404", "useProgram 3",
+		"uniform 1 int -2", "uniform 2 uint 9", "uniform 3 float 0.25", "uniform 4 vec2 1 2", "uniform 5 vec3 1 2 3",
+		"uniform 6 vec4 1 2 3 4", "uniform 7 mat4 1 5 0 1", "uniformBlock 0 11 16 1.5", "bufferData 0x8892 12 3 00000402",
+		"bindVertexArray 4", "bindTexture 2 0x8c1a 13", "drawElements 0x4 6 24", "drawElementsInstanced 0x4 6 10 48",
+		"drawArrays 0 5 100", "blitDepth 7 0 640 480", "finish"
+	};
+	CommandLog log;
+	replay(vector<CommandList>{ cmds }, log);
+	bool same = log.calls == expected;
+	printf("Check: every command type, %i calls: %s\n", (int)log.calls.size(), same ? "match" : "DIFFER");
+	for (size_t i = 0; !same && i < std::max(log.calls.size(), expected.size()); i++) {
+		const char* got = i < log.calls.size() ? log.calls[i].c_str() : "(none)";
+		const char* want = i < expected.size() ? expected[i].c_str() : "(none)";
+		if (strcmp(got, want)) printf("  call %i: got '%s', expected '%s'\n", (int)i, got, want);
+	}
+	return same;
+}
+
+int main(int argc, char** argv) {
+	int draws = 10000, listCount = 16, threads = (int)std::thread::hardware_concurrency();
+	bool check = true;
+	for (int i = 1; i < argc; i++) {
+		bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "--draws") && more) draws = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--lists") && more) listCount = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && more) threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--no-check")) check = false;
+		else {
+			printf("Usage: %s [--draws n] [--lists n] [--threads n] [--no-check]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (draws < 1 || listCount < 1) return 2;
+	ThreadPool pool(threads);
+	// Each list records its share of the meshes, every 4th mesh instanced
+	vector<std::function<void(CommandList&)>> recorders;
+	for (int l = 0; l < listCount; l++)
+		recorders.push_back([=](CommandList& cmds) {
+			for (int m = l * draws / listCount; m < (l + 1) * draws / listCount; m++) recordMesh(cmds, m, m % 4 ? 1 : 16);
+		});
+	vector<CommandList> lists;
+	auto begin = sys_clock::now();
+	recordParallel(pool, lists, recorders);
+	float recordMs = float_ms(sys_clock::now() - begin).count();
+	CommandStats stats;
+	begin = sys_clock::now();
+	replay(lists, stats);
+	float replayMs = float_ms(sys_clock::now() - begin).count();
+	size_t bytes = 0;
+	for (const CommandList& list : lists) bytes += list.commands.size() * sizeof(Command) + list.data.size();
+	printf("%i draws in %i lists, %i threads: record %.2f ms, replay (counting) %.2f ms, %i commands, %.1f KB\n", draws, listCount,
+		pool.size(), recordMs, replayMs, stats.commands, bytes / 1024.0f);
+	if (!check) return 0;
+	int result = checkEveryCommand() ? 0 : 1;
+	// Lists recorded in parallel replay exactly as one list recorded serially, followed by finish
+	CommandList serial;
+	for (int m = 0; m < draws; m++) recordMesh(serial, m, m % 4 ? 1 : 16);
+	CommandLog parallelLog, serialLog;
+	replay(lists, parallelLog);
+	replay(vector<CommandList>{ serial }, serialLog);
+	bool same = parallelLog.calls == serialLog.calls;
+	printf("Check: %i lists on %i threads vs 1 serial list, %i calls: %s\n", listCount, pool.size(), (int)serialLog.calls.size(), same ? "match" : "DIFFER");
+	if (!same) result = 1;
+	// Counting backend against what was recorded
+	int instanced = draws / 4 + (draws % 4 > 0);
+	CommandStats expected;
+	expected.commands = draws * 7 + instanced;
+	expected.draws = draws;
+	expected.instances = (draws - instanced) + 16 * instanced;
+	expected.stateChanges = draws * 3;
+	expected.uniforms = draws * 3;
+	expected.uploadBytes = (size_t)instanced * 16 * sizeof(mat4);
+	bool counted = stats.commands == expected.commands && stats.draws == expected.draws && stats.instances == expected.instances &&
+		stats.stateChanges == expected.stateChanges && stats.uniforms == expected.uniforms && stats.uploadBytes == expected.uploadBytes;
+	printf("Check: CommandStats %i draws, %i instances, %i state changes, %.1f KB uploaded: %s\n", stats.draws, stats.instances,
+		stats.stateChanges, stats.uploadBytes / 1024.0f, counted ? "match" : "DIFFER");
+	if (!counted) result = 1;
+	// A pool of 1 has no workers, submit() has to run the job itself rather than queue it forever
+	ThreadPool single(1);
+	int ran = 0;
+	std::future<void> job = single.submit([&] { ran++; });
+	bool done = job.wait_for(std::chrono::seconds(1)) == std::future_status::ready && ran == 1;
+	printf("Check: submit() on a pool of 1: %s\n", done ? "ran" : "NEVER RAN");
+	if (!done) result = 1;
+	return result;
+}
@@ -0,0 +1,175 @@
+// dla-bench.cpp : Times DLASim growth without a window or GL, Devon McKee
+// dla-bench [--size s] [--walkers n] [--particles n] [--seed n] [--compare n] [--runs n] [--check n]
+//           [--checkpoint file] [--every steps] [--export file.ply|file.xyz]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include "dDLA.h"
+#include "dDLACheckpoint.h"
+
+using sys_clock = std::chrono::system_clock;
+using float_ms = std::chrono::duration<float, std::milli>;
+
+int main(int argc, char** argv) {
+	float size = 0.01f;
+	int walkers = 2000, particles = 20000, compare = 2000, runs = 6, check = 300;
+	int every = 1000;
+	uint64_t seed = 1;
+	const char* checkpoint = nullptr;
+	const char* exportPath = nullptr;
+	for (int i = 1; i < argc; i++) {
+		bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "--size") && more) size = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--walkers") && more) walkers = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--particles") && more) particles = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--seed") && more) seed = strtoull(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--compare") && more) compare = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--runs") && more) runs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--check") && more) check = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--checkpoint") && more) checkpoint = argv[++i];
+		else if (!strcmp(argv[i], "--every") && more) every = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--export") && more) exportPath = argv[++i];
+		else {
+			printf("Usage: %s [--size s] [--walkers n] [--particles n] [--seed n] [--compare n] [--runs n] [--check n]\n"
+				"         [--checkpoint file] [--every steps] [--export file.ply|file.xyz]\n", argv[0]);
+			return 2;
+		}
+	}
+	auto configure = [&](DLASim& sim, uint64_t runSeed) {
+		sim.particleSize = size;
+		sim.maxWalkers = walkers;
+		sim.reset(runSeed);
+	};
+	printf("Particle size %.4f, %i walkers, seed %llu\n", size, walkers, (unsigned long long)seed);
+	struct Growth { float ms; int steps; size_t tests, jumps; };
+	auto grow = [&](DLASim& sim, int target, CheckpointWriter* writer = nullptr) {
+		Growth g = {0.0f, 0, 0, 0};
+		auto start = sys_clock::now();
+		while ((int)sim.aggregate.size() < target && !sim.finished()) {
+			sim.step();
+			g.tests += sim.stickTests;
+			g.jumps += sim.jumps;
+			g.steps++;
+			if (writer && g.steps % every == 0) writer->submit(sim, checkpoint);
+		}
+		g.ms = float_ms(sys_clock::now() - start).count();
+		return g;
+	};
+	auto printReports = [](CheckpointWriter& writer) {
+		CheckpointReport r;
+		while (writer.poll(r)) {
+			if (!r.error.empty()) printf("  checkpoint %i: %s\n", r.index, r.error.c_str());
+			else printf("  checkpoint %i: %i particles, %i walkers, %.2f MB, copy %.3f ms, write %.1f ms\n", r.index,
+				(int)r.particles, (int)r.walkers, r.bytes / 1048576.0, r.copyMs, r.writeMs);
+		}
+	};
+	// Grow to the target size (or the walls) with hashed stick tests and jumps, checkpointing every so
+	// many steps if asked
+	DLASim sim;
+	configure(sim, seed);
+	Growth g;
+	int status = 0;
+	if (checkpoint) {
+		CheckpointWriter writer;
+		g = grow(sim, particles, &writer);
+		writer.flush();
+		printReports(writer);
+		if (writer.skipped) printf("  %i checkpoints skipped, both buffers busy\n", writer.skipped);
+	}
+	else g = grow(sim, particles);
+	printf("Jumps: %i particles in %i steps, %.1f ms, %.0f stuck / s, %.3f stick tests / walker step, %.0f%% of walker steps jumped\n",
+		(int)sim.aggregate.size(), g.steps, g.ms, (sim.aggregate.size() - 1) / (g.ms / 1000.0f),
+		(double)g.tests / ((double)g.steps * walkers), 100.0 * g.jumps / ((double)g.steps * walkers));
+	if (exportPath) {
+		auto start = sys_clock::now();
+		string path = exportPath;
+		bool xyz = path.size() > 4 && path.substr(path.size() - 4) == ".xyz";
+		try {
+			if (xyz) exportXYZ(path, sim.aggregate);
+			else exportPLY(path, sim.aggregate, sim.aggregateColor);
+		}
+		catch (std::runtime_error& e) {
+			printf("%s\n", e.what());
+			return 1;
+		}
+		printf("Exported %i particles to %s in %.1f ms\n", (int)sim.aggregate.size(), exportPath, float_ms(sys_clock::now() - start).count());
+	}
+	if (checkpoint) {
+		// A run restored from a checkpoint must carry on exactly like the one that wrote it
+		DLASim original, resumed;
+		configure(original, seed);
+		for (int steps = 0; steps < every && !original.finished(); steps++) original.step();
+		int target = (int)original.aggregate.size() + std::max(check, 100);
+		DLASnapshot saved, loaded;
+		original.snapshot(saved);
+		string path = string(checkpoint) + ".resume"; // leaves the run's last checkpoint alone
+		writeCheckpoint(path, saved);
+		readCheckpoint(path, loaded);
+		std::remove(path.c_str());
+		resumed.restore(loaded);
+		grow(original, target);
+		grow(resumed, target);
+		bool same = original.aggregate.size() == resumed.aggregate.size() && original.walkers.size() == resumed.walkers.size() &&
+			!memcmp(original.aggregate.data(), resumed.aggregate.data(), original.aggregate.size() * sizeof(vec3)) &&
+			!memcmp(original.walkers.data(), resumed.walkers.data(), original.walkers.size() * sizeof(vec3));
+		printf("Resumed from step %i to %i particles: %s\n", every, (int)original.aggregate.size(), same ? "matches" : "DIFFERS");
+		if (!same) status = 1;
+	}
+	if (compare > 0 && runs > 0) {
+		// The small step walk grows different clusters from the same seed, and one cluster's
+		// dimension varies a lot, so compare averages over runs seeds
+		const char* names[] = {"jumps", "small steps"};
+		float ms[2] = {0.0f, 0.0f};
+		double dim[2] = {0.0, 0.0}, dim2[2] = {0.0, 0.0}, rg[2] = {0.0, 0.0};
+		for (int r = 0; r < runs; r++)
+			for (int k = 0; k < 2; k++) {
+				DLASim s;
+				configure(s, seed + r);
+				s.useJumps = k == 0;
+				ms[k] += grow(s, compare).ms;
+				float radius = gyrationRadius(s.aggregate), d = massDimension(s.aggregate, 4.0f * size, 0.5f * radius);
+				dim[k] += d;
+				dim2[k] += d * d;
+				rg[k] += radius;
+			}
+		double error = 0.0; // standard error of the difference in mean dimension
+		for (int k = 0; k < 2; k++) {
+			double mean = dim[k] / runs, sd = runs > 1 ? sqrt(std::max(0.0, (dim2[k] - runs * mean * mean) / (runs - 1))) : 0.0;
+			error += sd * sd / runs;
+			printf("  %s: %i runs to %i particles, %.1f ms / run, fractal dimension %.3f +- %.3f, gyration radius %.4f\n",
+				names[k], runs, compare, ms[k] / runs, mean, sd, rg[k] / runs);
+		}
+		error = sqrt(error);
+		double diff = fabs(dim[0] - dim[1]) / runs;
+		bool close = diff <= std::max(3.0 * error, 0.05);
+		printf("Speedup %.1fx, dimensions differ by %.3f (standard error %.3f), %s\n", ms[1] / ms[0], diff, error, close ? "agree" : "DIFFER");
+		if (!close) status = 1;
+	}
+	if (check <= 0) return status;
+	// Brute force from the same seed must grow exactly the same aggregate
+	DLASim hashed, brute;
+	configure(hashed, seed);
+	configure(brute, seed);
+	hashed.useJumps = brute.useJumps = false;
+	brute.useHash = false;
+	float hashMs = 0.0f, bruteMs = 0.0f;
+	while ((int)brute.aggregate.size() < check && !brute.finished()) {
+		auto begin = sys_clock::now();
+		hashed.step();
+		auto mid = sys_clock::now();
+		brute.step();
+		hashMs += float_ms(mid - begin).count();
+		bruteMs += float_ms(sys_clock::now() - mid).count();
+	}
+	bool same = hashed.aggregate.size() == brute.aggregate.size() && hashed.walkers.size() == brute.walkers.size() &&
+		!memcmp(hashed.aggregate.data(), brute.aggregate.data(), hashed.aggregate.size() * sizeof(vec3)) &&
+		!memcmp(hashed.walkers.data(), brute.walkers.data(), hashed.walkers.size() * sizeof(vec3));
+	printf("First %i particles: hashed %.1f ms, brute force %.1f ms, %s\n",
+		(int)brute.aggregate.size(), hashMs, bruteMs, same ? "matches" : "DIFFERS");
+	return same ? status : 1;
+}
@@ -0,0 +1,68 @@
+// dla-lattice.cpp : Grows an on-lattice DLA aggregate without a window or GL, Devon McKee
+// dla-lattice [--side n] [--particles n] [--threads n] [--walkers n] [--seed n] [--out file]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <stdexcept>
+#include "dLatticeDLA.h"
+
+using sys_clock = std::chrono::system_clock;
+using float_ms = std::chrono::duration<float, std::milli>;
+
+int main(int argc, char** argv) {
+	int side = 1024, particles = 500000, threads = 0, walkers = 1;
+	uint64_t seed = 1;
+	const char* out = nullptr;
+	for (int i = 1; i < argc; i++) {
+		bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "--side") && more) side = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--particles") && more) particles = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && more) threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--walkers") && more) walkers = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--seed") && more) seed = strtoull(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--out") && more) out = argv[++i];
+		else {
+			printf("Usage: %s [--side n] [--particles n] [--threads n] [--walkers n] [--seed n] [--out file]\n", argv[0]);
+			return 2;
+		}
+	}
+	ThreadPool pool(threads);
+	LatticeDLA sim;
+	sim.walkersPerThread = walkers;
+	try {
+		sim.reset(side, seed);
+	}
+	catch (std::runtime_error& e) {
+		printf("%s\n", e.what());
+		return 2;
+	}
+	double bytes = (double)side * side * side / 8;
+	printf("%i^3 lattice (%.1f %s), %i threads x %i walkers, seed %llu\n", side, bytes < (1 << 20) ? bytes / 1024 : bytes / (1 << 20),
+		bytes < (1 << 20) ? "KB" : "MB", pool.size(), walkers, (unsigned long long)seed);
+	// Grow in tenths so the rate can be watched as the aggregate gets larger
+	float total = 0.0f;
+	for (int tenth = 1; tenth <= 10 && sim.stuck() < particles && !sim.full(); tenth++) {
+		int before = sim.stuck();
+		auto start = sys_clock::now();
+		sim.grow(std::max(before + 1, (int)((long long)particles * tenth / 10)), &pool);
+		float ms = float_ms(sys_clock::now() - start).count();
+		total += ms;
+		printf("%9i stuck, radius %4i: %.0f stuck / s\n", sim.stuck(), sim.radius(), (sim.stuck() - before) / (ms / 1000.0f));
+	}
+	printf("%i particles in %.1f ms, %.0f stuck / s%s\n", sim.stuck(), total, (sim.stuck() - 1) / (total / 1000.0f),
+		sim.full() ? " (lattice full)" : "");
+	if (out) {
+		auto start = sys_clock::now();
+		try {
+			sim.writePoints(out);
+		}
+		catch (std::runtime_error& e) {
+			printf("%s\n", e.what());
+			return 1;
+		}
+		printf("Wrote %i points to %s in %.1f ms\n", sim.stuck(), out, float_ms(sys_clock::now() - start).count());
+	}
+	return 0;
+}
@@ -6,7 +6,12 @@
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 #include <time.h>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <string>
 #include <vector>
+#include <algorithm>
 #include "Camera.h"
 #include "GLXtras.h"
 #include "Mesh.h"
@@ -15,20 +20,39 @@
 #include "CameraControls.h"
 #include "dCube.h"
 #include "GeomUtils.h"
+#include "dDLA.h"
+#include "dDLACheckpoint.h"
 
 using std::vector;
 
-GLuint vArray = 0;
 GLuint vBuffer = 0;
 GLuint iBuffer = 0;
-GLuint program = 0;
+GLuint program = 0, spriteProgram = 0;
+
+// Stuck particles only ever get appended, so the aggregate's instances are uploaded once, in a
+// batch per frame. Walkers all move every frame and go in a small buffer streamed each frame
+struct ParticleInstance {
+	vec3 p;
+	uint32_t color; // RGBA8
+};
+struct InstanceBuffer {
+	GLuint buffer = 0, meshArray = 0, spriteArray = 0;
+	int capacity = 0, count = 0;
+};
+InstanceBuffer aggregateInstances, walkerInstances;
+vector<ParticleInstance> walkerScratch;
+
+// Spheres up to SPRITE_THRESHOLD stuck particles, shaded point sprites past it ('P' cycles modes)
+enum class DrawMode { Auto, Spheres, Sprites };
+DrawMode drawMode = DrawMode::Auto;
+const int SPRITE_THRESHOLD = 20000;
 
 int win_width = 800;
 int win_height = 800;
 
 Camera camera((float)win_width / win_height, vec3(0, 0, 0), vec3(0, 0, -5));
 vec3 lightSource = vec3(1, 1, 0);
-time_t start;
+std::chrono::steady_clock::time_point start;
 
 dCube cube;
 
@@ -40,76 +64,37 @@ vector<int3> meshTris;
 const char* particleObjFile = "objects/sphere.obj"; mat4 particleMeshTransform = mat4();
 
 const float PARTICLE_SIZE = 0.05f;
-const float PARTICLE_RANGE = 1.5 * PARTICLE_SIZE;
 const float PARTICLE_SPEED = 0.01f;
-const float PARTICLE_SPEED_STEPS = 5;
+const int PARTICLE_SPEED_STEPS = 5;
 const int MAX_PARTICLES = 200;
 
-bool simulation = true;
-time_t simFinish = 0;
-int particleBuffer = MAX_PARTICLES;
-int particleDeaths = 0;
-
-vec3 getCol(float n);
+float simFinish = 0.0f;
 
-struct Particle;
-vector<Particle> particlesAlive;
-vector<Particle> particlesDead;
+DLASim sim;
 
-struct Particle {
-	vec3 p, v, c; // position, color
-	bool alive = true;
-	Particle(vec3 xyz) {
-        p = xyz; v = vec3(1, 0, 0); c = vec3(1);
-	}
-	void WrapWalls() {
-		if (p.x < -1.0f) p.x = 1.0f;
-		if (p.x > 1.0f) p.x = -1.0f;
-		if (p.y < -1.0f) p.y = 1.0f;
-		if (p.y > 1.0f) p.y = -1.0f;
-		if (p.z < -1.0f) p.z = 1.0f;
-		if (p.z > 1.0f) p.z = -1.0f;
-	}
-	void Run() {
-		if (!alive) return;
-		v = rand_dir();
-		v *= PARTICLE_SPEED;
-		for (int s = 0; s < PARTICLE_SPEED_STEPS; s++) {
-			p += v;
-			WrapWalls();
-			for (size_t i = 0; i < particlesDead.size(); i++) {
-				if (dist(particlesDead[i].p, p) <= PARTICLE_RANGE) {
-					alive = false;
-					break;
-				}
-			}
-			if (!alive) {
-				particleBuffer++;
-				particleDeaths++;
-				c = getCol((float)particleDeaths / 1000.0f);
-				break;
-			}
-		}
-	}
-	mat4 GetModelview() {
-		mat4 trans = Translate(p);
-		mat4 scale = Scale(PARTICLE_SIZE);
-		mat4 orient = Orientation(v, vec3(0.0f, 1.0f, 0.0f));
-		return trans * scale * orient;
-	}
-};
+// dla-fractal [--resume file] [--checkpoint file] [--every seconds] [--export file.ply|file.xyz]
+CheckpointWriter checkpoints;
+const char* checkpointPath = nullptr;
+const char* exportPath = nullptr;
+float checkpointEvery = 60.0f, lastCheckpoint = 0.0f;
+bool checkpointedFinish = false;
 
 const char* vertShader = R"(
 	#version 410 core
-	in vec3 point;
-	in vec3 normal;
+	layout (location = 0) in vec3 point;
+	layout (location = 1) in vec3 normal;
+	layout (location = 2) in vec3 center; // per instance
+	layout (location = 3) in vec4 instanceColor;
 	out vec3 vPoint;
 	out vec3 vNormal;
+	out vec3 vColor;
 	uniform mat4 modelview;
 	uniform mat4 persp;
+	uniform float size;
 	void main() {
-		vPoint = (modelview * vec4(point, 1)).xyz;
+		vPoint = (modelview * vec4(center + size * point, 1)).xyz;
 		vNormal = (modelview * vec4(normal, 0)).xyz;
+		vColor = instanceColor.rgb;
 		gl_Position = persp*vec4(vPoint, 1);
 	}
 )";
@@ -118,9 +103,9 @@ const char* fragShader = R"(
 	#version 410 core
 	in vec3 vPoint;
 	in vec3 vNormal;
+	in vec3 vColor;
 	out vec4 pColor;
 	uniform vec3 light;
-	uniform vec3 color;
 	void main() {
 		vec3 N = normalize(vNormal);       // surface normal
         vec3 L = normalize(light-vPoint);  // light vector
@@ -129,70 +114,138 @@ const char* fragShader = R"(
         float d = abs(dot(N, L));          // two-sided diffuse
         float s = abs(dot(R, E));          // two-sided specular
         float intensity = clamp(d+pow(s, 50), 0, 1);
-		pColor = vec4(intensity*color, 1);
+		pColor = vec4(intensity*vColor, 1);
 	}
 )";
 
-vec3 getCol(float n) {
-	n *= (2 * M_PI);
-	vec3 c;
-	c.x = 0.5 * sin(n) + 0.5;
-	c.y = 0.5 * sin(n - (2.0f * M_PI / 3.0f)) + 0.5;
-	c.z = 0.5 * sin(n - (4.0f * M_PI / 3.0f)) + 0.5;
-	return c;
-}
+// Impostors: one point per particle, sized to the sphere and shaded (and depth written) as one
+const char* spriteVertShader = R"(
+	#version 410 core
+	layout (location = 2) in vec3 center;
+	layout (location = 3) in vec4 instanceColor;
+	out vec3 vCenter;
+	out vec3 vColor;
+	uniform mat4 modelview;
+	uniform mat4 persp;
+	uniform float size;
+	uniform float pixelScale; // persp[1][1] * viewport height
+	void main() {
+		vCenter = (modelview * vec4(center, 1)).xyz;
+		vColor = instanceColor.rgb;
+		gl_Position = persp * vec4(vCenter, 1);
+		gl_PointSize = max(1.0, size * pixelScale / -vCenter.z);
+	}
+)";
 
-void CreateParticles() {
-	if (particleBuffer > 0) {
-		Particle p = Particle(rand_vec3());
-		particlesAlive.push_back(p);
-		particleBuffer--;;
+const char* spriteFragShader = R"(
+	#version 410 core
+	in vec3 vCenter;
+	in vec3 vColor;
+	out vec4 pColor;
+	uniform mat4 persp;
+	uniform vec3 light;
+	uniform float size;
+	void main() {
+		vec2 c = 2.0 * gl_PointCoord - 1.0;
+		float r2 = dot(c, c);
+		if (r2 > 1.0) discard;
+		vec3 N = vec3(c.x, -c.y, sqrt(1.0 - r2));
+		vec3 vPoint = vCenter + size * N;
+		vec4 clip = persp * vec4(vPoint, 1);
+		gl_FragDepth = 0.5 * clip.z / clip.w + 0.5;
+		vec3 L = normalize(light-vPoint);
+		vec3 E = normalize(vPoint);
+		vec3 R = reflect(L, N);
+		float d = abs(dot(N, L));
+		float s = abs(dot(R, E));
+		float intensity = clamp(d+pow(s, 50.0), 0.0, 1.0);
+		pColor = vec4(intensity*vColor, 1);
 	}
+)";
+
+uint32_t PackColor(vec3 c) {
+	auto channel = [](float v) { return (uint32_t)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f); };
+	return channel(c.x) | channel(c.y) << 8 | channel(c.z) << 16 | 0xff000000u;
+}
+
+// Wall time since the sim started, clock() would count CPU time across every thread instead
+float SimSeconds() {
+	return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
 }
 
 void CheckSimRunning() {
-	if (simulation) {
-		for (size_t i = 0; i < particlesDead.size(); i++) {
-			if (particlesDead[i].p.x > 1 - PARTICLE_RANGE ||
-				particlesDead[i].p.x < -1 + PARTICLE_RANGE ||
-				particlesDead[i].p.y > 1 - PARTICLE_RANGE ||
-				particlesDead[i].p.y < -1 + PARTICLE_RANGE ||
-				particlesDead[i].p.z > 1 - PARTICLE_RANGE ||
-				particlesDead[i].p.z < -1 + PARTICLE_RANGE) {
-				simulation = false;
-			}
-		}
-	} else if (simFinish == 0.0f && particlesAlive.size() == 0) {
-		simFinish = (clock() - start) / CLOCKS_PER_SEC;
+	if (simFinish == 0.0f && sim.finished())
+		simFinish = SimSeconds();
+}
+
+// A status line a second, and a line per finished checkpoint
+void PrintSimInfo(float& lastSec) {
+	CheckpointReport r;
+	while (checkpoints.poll(r)) {
+		if (!r.error.empty()) printf("Checkpoint %i failed: %s\n", r.index, r.error.c_str());
+		else printf("Checkpoint %i: %i particles, %i walkers, %.2f MB to %s, copy %.3f ms, write %.1f ms\n",
+			r.index, (int)r.particles, (int)r.walkers, r.bytes / 1048576.0, checkpointPath, r.copyMs, r.writeMs);
 	}
+	float elapsed = SimSeconds();
+	if (elapsed < lastSec + 1.0f) return;
+	lastSec = elapsed;
+	const char* state = sim.spawning ? "running" : !sim.walkers.empty() ? "finishing" : "completed";
+	printf("%i s: %i of %i walkers alive, %i particles stuck, %s", (int)elapsed, (int)sim.walkers.size(),
+		sim.maxWalkers, (int)sim.aggregate.size(), state);
+	if (sim.finished()) printf(" after %i s", (int)simFinish);
+	printf("\n");
 }
 
-void PrintSimInfo(float sec) {
-	float elapsed = (clock() - start) / CLOCKS_PER_SEC;
-	if (elapsed > (sec + 1.0f)) {
-		sec = elapsed;
-		for (int i = 0; i < 5; i++)
-			printf("\033[1A\033[2K");
-		printf("-- SIMULATION INFO --\n");
-		printf("%i seconds elapsed\n", (int)elapsed);
-		printf("%i of %i particles alive\n", MAX_PARTICLES - particleBuffer, MAX_PARTICLES);
-		printf("%i particles alive, %i particles dead\n", (int)particlesAlive.size(), (int)particlesDead.size());
-		if (simulation) {
-			printf("Simulation running...\n");
-		} else {
-			if (particlesAlive.size() > 0)
-				printf("Simulation finishing...\n");
-			else
-				printf("Simulation completed after: %i seconds\n", (int)simFinish);
-		}
+// Hands the sim to the checkpoint writer every checkpointEvery seconds, the copy is all it costs here
+void CheckpointSim() {
+	if (!checkpointPath) return;
+	float elapsed = SimSeconds();
+	if (elapsed < lastCheckpoint + checkpointEvery && !(sim.finished() && !checkpointedFinish)) return;
+	lastCheckpoint = elapsed;
+	checkpointedFinish = sim.finished();
+	checkpoints.submit(sim, checkpointPath);
+}
+
+// Points the instance attributes of b's vertex arrays at b.buffer, per instance for the sphere mesh
+// and per vertex for sprites
+void AttachInstances(InstanceBuffer& b) {
+	for (GLuint array : {b.meshArray, b.spriteArray}) {
+		GLuint divisor = array == b.meshArray ? 1 : 0;
+		glBindVertexArray(array);
+		glBindBuffer(GL_ARRAY_BUFFER, b.buffer);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), (void*)0);
+		glVertexAttribDivisor(2, divisor);
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ParticleInstance), (void*)offsetof(ParticleInstance, color));
+		glVertexAttribDivisor(3, divisor);
 	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
+void InitInstances(InstanceBuffer& b, int capacity, GLenum usage) {
+	glGenVertexArrays(1, &b.meshArray);
+	glGenVertexArrays(1, &b.spriteArray);
+	// The sphere's own vertices and triangles, shared by both mesh arrays
+	glBindVertexArray(b.meshArray);
+	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffer);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(meshPts.size() * sizeof(vec3)));
+	glBindVertexArray(0);
+	glGenBuffers(1, &b.buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, b.buffer);
+	glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(ParticleInstance), NULL, usage);
+	b.capacity = capacity;
+	b.count = 0;
+	AttachInstances(b);
 }
 
 void InitVertexBuffers() {
 	cube.loadBuffer();
-	glGenVertexArrays(1, &vArray);
-	glBindVertexArray(vArray);
 	glGenBuffers(1, &vBuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
 	size_t sizePts = meshPts.size() * sizeof(vec3);
@@ -204,15 +257,84 @@ void InitVertexBuffers() {
 	glGenBuffers(1, &iBuffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffer);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshTris.size()*sizeof(int3), meshTris.data(), GL_STATIC_DRAW);
-	VertexAttribPointer(program, "point", 3, 0, (void*)0);
-	VertexAttribPointer(program, "normal", 3, 0, (void*)(meshPts.size() * sizeof(vec3)));
-	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	InitInstances(aggregateInstances, 4096, GL_DYNAMIC_DRAW);
+	InitInstances(walkerInstances, MAX_PARTICLES, GL_STREAM_DRAW);
+}
+
+void DelInstances(InstanceBuffer& b) {
+	glDeleteBuffers(1, &b.buffer);
+	glDeleteVertexArrays(1, &b.meshArray);
+	glDeleteVertexArrays(1, &b.spriteArray);
 }
 
 void DelVertexBuffers() {
 	cube.unloadBuffer();
+	DelInstances(aggregateInstances);
+	DelInstances(walkerInstances);
+	glDeleteBuffers(1, &vBuffer);
+	glDeleteBuffers(1, &iBuffer);
+}
+
+// Appends particles stuck since the last frame, one glBufferSubData for all of them. Outgrowing the
+// buffer doubles it, copying what's there on the GPU rather than uploading it again
+void UploadAggregate() {
+	InstanceBuffer& b = aggregateInstances;
+	int count = (int)sim.aggregate.size();
+	if (count == b.count) return;
+	if (count > b.capacity) {
+		int capacity = std::max(count, 2 * b.capacity);
+		GLuint grown = 0;
+		glGenBuffers(1, &grown);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+		glBufferData(GL_COPY_WRITE_BUFFER, capacity * sizeof(ParticleInstance), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, b.buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, b.count * sizeof(ParticleInstance));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &b.buffer);
+		b.buffer = grown;
+		b.capacity = capacity;
+		AttachInstances(b);
+	}
+	vector<ParticleInstance> batch(count - b.count);
+	for (int i = b.count; i < count; i++)
+		batch[i - b.count] = { sim.aggregate[i], PackColor(sim.aggregateColor[i]) };
+	glBindBuffer(GL_ARRAY_BUFFER, b.buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, b.count * sizeof(ParticleInstance), batch.size() * sizeof(ParticleInstance), batch.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	b.count = count;
+}
+
+// Orphans and refills the walker buffer
+void UploadWalkers() {
+	InstanceBuffer& b = walkerInstances;
+	b.count = (int)sim.walkers.size();
+	walkerScratch.resize(b.count);
+	for (int i = 0; i < b.count; i++)
+		walkerScratch[i] = { sim.walkers[i], 0xffffffffu };
+	glBindBuffer(GL_ARRAY_BUFFER, b.buffer);
+	if (b.count > b.capacity) b.capacity = b.count;
+	glBufferData(GL_ARRAY_BUFFER, b.capacity * sizeof(ParticleInstance), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, b.count * sizeof(ParticleInstance), walkerScratch.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+bool UseSprites() {
+	return drawMode == DrawMode::Sprites || (drawMode == DrawMode::Auto && (int)sim.aggregate.size() > SPRITE_THRESHOLD);
+}
+
+void DrawInstances(const InstanceBuffer& b, bool sprites) {
+	if (!b.count) return;
+	if (sprites) {
+		glBindVertexArray(b.spriteArray);
+		glDrawArrays(GL_POINTS, 0, b.count);
+	}
+	else {
+		glBindVertexArray(b.meshArray);
+		glDrawElementsInstanced(GL_TRIANGLES, 3 * meshTris.size(), GL_UNSIGNED_INT, 0, b.count);
+	}
 }
 
 void Display() {
@@ -220,38 +342,60 @@ void Display() {
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 	cube.display(camera);
-	glUseProgram(program);
-	glBindVertexArray(vArray);
+	sim.step();
+	UploadAggregate();
+	UploadWalkers();
+	bool sprites = UseSprites();
+	GLuint p = sprites ? spriteProgram : program;
+	glUseProgram(p);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glEnable(GL_DEPTH_TEST);
-	SetUniform(program, "light", lightSource);
-	SetUniform(program, "persp", camera.persp);
-	for (size_t i = 0; i < particlesAlive.size(); i++) {
-		particlesAlive[i].Run();
-		if (particlesAlive[i].alive) {
-			mat4 m = particlesAlive[i].GetModelview();
-			SetUniform(program, "modelview", camera.modelview * m);
-			SetUniform(program, "color", particlesAlive[i].c);
-			glDrawElements(GL_TRIANGLES, 3 * meshTris.size(), GL_UNSIGNED_INT, 0);
-		} else {
-			particlesDead.push_back(particlesAlive[i]);
-			particlesAlive.erase(particlesAlive.begin() + i);
-			i--;
-		}
-	}
-	for (size_t i = 0; i < particlesDead.size(); i++) {
-		mat4 m = particlesDead[i].GetModelview();
-		SetUniform(program, "modelview", camera.modelview * m);
-		SetUniform(program, "color", particlesDead[i].c);
-		glDrawElements(GL_TRIANGLES, 3 * meshTris.size(), GL_UNSIGNED_INT, 0);	
-	}
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	SetUniform(p, "light", lightSource);
+	SetUniform(p, "persp", camera.persp);
+	SetUniform(p, "modelview", camera.modelview);
+	SetUniform(p, "size", sim.particleSize); // a resumed run keeps its own
+	if (sprites) SetUniform(p, "pixelScale", camera.persp.row[1].y * win_height);
+	DrawInstances(walkerInstances, sprites);
+	DrawInstances(aggregateInstances, sprites);
 	glBindVertexArray(0);
 	glFlush();
 }
 
-int main() {
-	srand((int)time(NULL));
+void DLAKeyboard(GLFWwindow* window, int key, int scancode, int action, int mods) {
+	Keyboard(window, key, scancode, action, mods);
+	if (key == GLFW_KEY_P && action == GLFW_PRESS)
+		drawMode = drawMode == DrawMode::Auto ? DrawMode::Spheres : drawMode == DrawMode::Spheres ? DrawMode::Sprites : DrawMode::Auto;
+}
+
+bool Export() {
+	try {
+		string path = exportPath;
+		if (path.size() > 4 && path.substr(path.size() - 4) == ".xyz") exportXYZ(path, sim.aggregate);
+		else exportPLY(path, sim.aggregate, sim.aggregateColor);
+	}
+	catch (std::runtime_error& e) {
+		fprintf(stderr, "err: %s\n", e.what());
+		return false;
+	}
+	printf("Exported %i particles to %s\n", (int)sim.aggregate.size(), exportPath);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	const char* resumePath = nullptr;
+	for (int i = 1; i < argc; i++) {
+		bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "--resume") && more) resumePath = argv[++i];
+		else if (!strcmp(argv[i], "--checkpoint") && more) checkpointPath = argv[++i];
+		else if (!strcmp(argv[i], "--every") && more) checkpointEvery = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--export") && more) exportPath = argv[++i];
+		else {
+			printf("Usage: %s [--resume file] [--checkpoint file] [--every seconds] [--export file.ply|file.xyz]\n", argv[0]);
+			return 2;
+		}
+	}
 	if (!glfwInit())
 		return 1;
 	#ifdef __APPLE__
@@ -269,7 +413,8 @@ int main() {
 	glfwMakeContextCurrent(window);
 	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
 	PrintGLErrors();
-	if (!(program = LinkProgramViaCode(&vertShader, &fragShader)))
+	if (!(program = LinkProgramViaCode(&vertShader, &fragShader)) ||
+		!(spriteProgram = LinkProgramViaCode(&spriteVertShader, &spriteFragShader)))
 		return 1;
 	if (!ReadAsciiObj(particleObjFile, meshPts, meshTris, &meshNorms, &meshUvs)) {
 		fprintf(stderr, "err: Failed to read obj '%s'\n", particleObjFile);
@@ -278,23 +423,44 @@ int main() {
 	printf("'%s' : %i vertices, %i normals, %i triangles\n", particleObjFile, (int)meshPts.size(), (int)meshNorms.size(), (int)meshTris.size());
 	InitVertexBuffers();
 	InitializeCallbacks(window);
+	glfwSetKeyCallback(window, DLAKeyboard);
 	glfwSwapInterval(1);
-	// Create "seed" particle
-	Particle p = Particle(vec3(0, 0, 0));
-	p.alive = false;
-	p.c = getCol(particleDeaths / MAX_PARTICLES);
-	particlesDead.push_back(p);
-	start = clock();
+	// Starts from the "seed" particle at the origin
+	sim.particleSize = PARTICLE_SIZE;
+	sim.speed = PARTICLE_SPEED;
+	sim.speedSteps = PARTICLE_SPEED_STEPS;
+	sim.maxWalkers = MAX_PARTICLES;
+	sim.reset((uint64_t)time(NULL));
+	if (resumePath) {
+		// Carries on with the checkpoint's own settings and random state
+		try {
+			DLASnapshot saved;
+			readCheckpoint(resumePath, saved);
+			sim.restore(saved);
+		}
+		catch (std::runtime_error& e) {
+			fprintf(stderr, "err: %s\n", e.what());
+			return 1;
+		}
+		printf("Resumed %i particles, %i walkers from %s\n", (int)sim.aggregate.size(), (int)sim.walkers.size(), resumePath);
+	}
+	start = std::chrono::steady_clock::now();
 	float lastSec = 0;
 	while (!glfwWindowShouldClose(window)) {
-		if (simulation) CreateParticles();
 		Display();
 		glfwPollEvents();
 		glfwSwapBuffers(window);
 		CheckSimRunning();
+		CheckpointSim();
 		PrintSimInfo(lastSec);
 		//frame++;
 	}
+	// Whatever ran since the last checkpoint is saved too
+	checkpoints.flush();
+	if (checkpointPath) checkpoints.submit(sim, checkpointPath);
+	checkpoints.flush();
+	PrintSimInfo(lastSec);
+	if (exportPath) Export();
 	DelVertexBuffers();
 	glfwDestroyWindow(window);
 	glfwTerminate();
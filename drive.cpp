@@ -8,19 +8,27 @@
 #include <GLFW/glfw3.h>
 #pragma clang diagnostic pop
 #include <chrono>
+#include <random>
 #include <vector>
 #include <string>
 #include <stdexcept>
 #include "VecMat.h"
 #include "GeomUtils.h"
 #include "dCollisions.h"
+#include "dBroadphase.h"
 #include "dCamera.h"
 #include "dRenderPass.h"
 #include "dMesh.h"
+#include "dScene.h"
+#include "dWorld.h"
+#include "dShadows.h"
+#include "dProfiler.h"
 #include "dMisc.h"
 #include "dSkybox.h"
 #include "dParticles.h"
 #include "dTextureDebug.h"
+#include "dThreadPool.h"
+#include "dCommandList.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include "imgui/imgui.h"
@@ -48,15 +56,19 @@ bool showShadowMap = false;
 float dt;
 GLenum polygonMode = GL_FILL;
 
-const int SHADOW_DIM = 16384;
 RenderPass mainPass;
 RenderPass mainPassInst;
 RenderPass shadowPass;
 RenderPass shadowPassInst;
 RenderPass phongPass;
 RenderPass phongPassInst;
-GLuint shadowFramebuffer = 0;
-GLuint shadowTexture = 0;
+CascadedShadows shadows;
+GPUProfiler profiler;
+
+ThreadPool workers;
+vector<SceneGraph*> visibleScenes;
+vector<CommandList> passCommands;
+CommandStats frameStats;
 
 float lightColor[3] = { 1.0f, 1.0f, 1.0f };
 float init_time;
@@ -99,16 +111,18 @@ const char* mainVert = R"(
 	layout(location = 0) in vec3 point;
 	layout(location = 1) in vec2 uv;
 	out vec2 vUv;
-	out vec4 shadowCoord;
+	out vec4 worldPoint;
+	out float viewDepth;
     uniform mat4 model;
 	uniform mat4 transform;
 	uniform mat4 view;
 	uniform mat4 persp;
-	uniform mat4 depth_vp;
 	void main() {
-		shadowCoord = depth_vp * transform * model * vec4(point, 1);
+		worldPoint = transform * model * vec4(point, 1);
+		vec4 viewPoint = view * worldPoint;
+		viewDepth = -viewPoint.z;
 		vUv = uv;
-		gl_Position = persp * view * transform * model * vec4(point, 1);
+		gl_Position = persp * viewPoint;
 	}
 )";
 
@@ -118,25 +132,31 @@ const char* mainVertInstanced = R"(
     layout (location = 1) in vec2 uv;
     layout (location = 3) in mat4 transform;
     out vec2 vUv;
-    out vec4 shadowCoord;
+    out vec4 worldPoint;
+    out float viewDepth;
     uniform mat4 model;
     uniform mat4 view;
     uniform mat4 persp;
-    uniform mat4 depth_vp;
     void main() {
-        shadowCoord = depth_vp * transform * model * vec4(point, 1);
+        worldPoint = transform * model * vec4(point, 1);
+        vec4 viewPoint = view * worldPoint;
+        viewDepth = -viewPoint.z;
         vUv = uv;
-        gl_Position = persp * view * transform * model * vec4(point, 1);
+        gl_Position = persp * viewPoint;
     }
 )";
 
 const char* mainFrag = R"(
 	#version 410 core
 	in vec2 vUv;
-	in vec4 shadowCoord;
+	in vec4 worldPoint;
+	in float viewDepth;
 	out vec4 pColor;
 	uniform sampler2D txtr;
-	uniform sampler2DShadow shadow;
+	uniform mat4 depth_vp[4];
+	uniform float cascade_far[4];
+	uniform int num_cascades;
+	uniform sampler2DShadow shadow0, shadow1, shadow2, shadow3;
 	uniform vec4 ambient = vec4(vec3(0.1), 1);
 	uniform vec3 lightColor;
 	vec2 uniformSamples[16] = vec2[](vec2(-0.16696604, -0.09312990), vec2(0.53086904, 0.58433708), vec2(0.78145449, -0.86848999), vec2(0.74769790, 0.07194131), vec2(-0.09741326, 0.74185956), vec2(0.32706693, -0.03813042), vec2(0.73635845, 0.86372260), vec2(-0.27280913, 0.54069966), vec2(0.01584532, 0.26754421), vec2(-0.68606618, 0.53619244), vec2(-0.33333386, 0.35455430), vec2(-0.43123940, -0.60522600), vec2(0.03626988, -0.22807865), vec2(-0.53173498, 0.54256439), vec2(-0.65302623, 0.75253209), vec2(0.07282969, 0.19763551));
@@ -144,18 +164,32 @@ const char* mainFrag = R"(
 		float dot_product = dot(seed, vec4(12.9898,78.233,45.164,94.673));
 		return fract(sin(dot_product) * 43758.5453);
 	}
-    float calcShadow(vec4 shadow_coord) {
+	// Samplers can't be indexed per fragment, so cascades are picked with an if-chain
+	float lit(int c, vec3 coord) {
+		float v = c == 0 ? texture(shadow0, coord) : c == 1 ? texture(shadow1, coord) : c == 2 ? texture(shadow2, coord) : texture(shadow3, coord);
+		return v == 0.0f ? 0.4f : 1.0f;
+	}
+	vec2 texelSize(int c) {
+		ivec2 size = c == 0 ? textureSize(shadow0, 0) : c == 1 ? textureSize(shadow1, 0) : c == 2 ? textureSize(shadow2, 0) : textureSize(shadow3, 0);
+		return 1.0 / vec2(size);
+	}
+    float calcShadow() {
+        // First cascade reaching past this fragment, unshadowed beyond the last
+        int c = 0;
+        while (c < num_cascades && viewDepth > cascade_far[c]) c++;
+        if (c >= num_cascades) return 1.0f;
         // Perspective division and transforming shadow coord from [-1, 1] to [0, 1]
+        vec4 shadow_coord = depth_vp[c] * worldPoint;
         vec3 coord = shadow_coord.xyz / shadow_coord.w;
         coord = coord * 0.5 + 0.5;
         // Calculating total texel size and value at shadow
-		vec2 texelSize = 1.0 / textureSize(shadow, 0);
-        float shadowVal = texture(shadow, vec3(coord.xy, coord.z)) == 0.0f ? 0.4f : 1.0f;
+		vec2 texel = texelSize(c);
+        float shadowVal = lit(c, coord);
         // Early bailing on extra sampling if nearby values are the same (not on shadow edge)
         bool different = false;
         for (int x = -1; x <= 1; x += 2) {
             for (int y = -1; y <= 1; y += 2) {
-                float diffVal = texture(shadow, vec3(coord.xy + vec2(x, y) * texelSize, coord.z)) == 0.0f ? 0.4f : 1.0f;
+                float diffVal = lit(c, vec3(coord.xy + vec2(x, y) * texel, coord.z));
                 if (diffVal != shadowVal) different = true;
             }
         }
@@ -163,12 +197,12 @@ const char* mainFrag = R"(
         // If on shadow edge, sample using nearby precalculated uniform random coordinates
 		for (int i = 0; i < 16; i++) {
 			int ind = int(float(16)*random(vec4(gl_FragCoord.xyy, i))) % 16;
-			shadowVal += texture(shadow, vec3(coord.xy + uniformSamples[ind] * texelSize, coord.z)) == 0.0f ? 0.4f : 1.0f;
+			shadowVal += lit(c, vec3(coord.xy + uniformSamples[ind] * texel, coord.z));
 		}
         return shadowVal / 21.0f;
     }
 	void main() {
-        pColor = ambient + texture(txtr, vUv) * vec4(lightColor, 1) * calcShadow(shadowCoord);
+        pColor = ambient + texture(txtr, vUv) * vec4(lightColor, 1) * calcShadow();
 	}
 )";
 
@@ -264,350 +298,69 @@ vector<vec3> floor_normals = { {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0} };
 vector<vec2> floor_uvs = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
 vector<int3> floor_triangles = { {2, 1, 0}, {0, 3, 2} };
 
-Mesh large_tree_mesh;
-vector<vec3> large_tree_instance_positions {
-	{49, 0, 37}, {50, 0, 32}, {29, 0, 15}, {50, 0, 10},
-	{-10, 0, 32}, {-34, 0, 7}, {15, 0, -13}, {6, 0, -15},
-	{-0.75f, 0, 0.3f}, {-9.11f, 0, -8.64f}, {-16.16f, 0, -12.58f}, {-27.02f, 0, -15.88f}, 
-	{-32.39f, 0, -7.18f}, {-22.69f, 0, -24.82f}, {-15.40f, 0, -31.95f}, {-8.23f, 0, -33.90f}, 
-	{-7.48f, 0, -48.32f}, {7.70f, 0, -34.07f}, {49.83f, 0, -22.92f}, {54.68f, 0, -30.48f}, 
-	{52.80f, 0, -38.50f}, {46.54f, 0, -49.25f}, {36.14f, 0, -50.60f}, {26.13f, 0, -51.73f}, 
-	{10.83f, 0, -51.97f}, {-13.78f, 0, -33.34f}, {-25.02f, 0, -24.78f}, {-31.62f, 0, -16.71f}, 
-	{-29.06f, 0, -6.59f}, {7.55f, 0, 10.67f}, {25.84f, 0, 21.15f}, {23.49f, 0, 34.07f}, 
-	{7.52f, 0, 46.78f}, {-2.10f, 0, 54.42f}, {-12.51f, 0, 54.03f}, {-21.23f, 0, 54.79f}, 
-	{-32.39f, 0, 54.86f}, {-37.58f, 0, 46.49f}, {-36.75f, 0, 35.87f}, {-41.17f, 0, 30.20f}, 
-	{-52.15f, 0, 31.90f}, {-57.76f, 0, 14.15f}, {-58.13f, 0, 3.82f}, {-58.32f, 0, -4.81f}, 
-	{-58.50f, 0, -15.75f}, {-58.31f, 0, -26.44f}, {-58.05f, 0, -38.86f}, {-57.40f, 0, -49.04f},
-	{-34.08f, 0, -27.36f}, {-35.94f, 0, -16.43f}, {-31.61f, 0, -12.72f}, {-22.11f, 0, -10.64f}, 
-	{-11.82f, 0, -11.64f}, {-10.84f, 0, -21.56f}, {-17.93f, 0, -28.87f}, {-25.40f, 0, -33.24f}, 
-	{-34.90f, 0, -30.52f}, {-8.35f, 0, 9.46f}, {-7.34f, 0, 21.43f}, {-7.45f, 0, 35.74f}, 
-	{-16.61f, 0, 39.66f}, {7.60f, 0, 16.11f}, {12.85f, 0, 11.31f}, {23.16f, 0, 8.94f}, 
-	{23.09f, 0, 17.21f}, {33.01f, 0, 7.78f}, {31.65f, 0, 19.08f}, {30.85f, 0, 25.40f}, 
-	{35.05f, 0, 33.10f}, {29.93f, 0, 34.80f}, {22.32f, 0, 41.41f}, {6.87f, 0, 36.39f}, 
-	{6.92f, 0, 55.30f}, {12.63f, 0, 57.65f}, {22.51f, 0, 57.53f}, {29.38f, 0, 54.41f}, 
-	{41.66f, 0, 56.19f}, {51.12f, 0, 53.26f}, {55.26f, 0, 46.08f}, {50.39f, 0, 42.98f}, 
-	{53.33f, 0, 37.18f}, {56.60f, 0, 29.23f}, {50.68f, 0, 23.18f}, {47.43f, 0, 17.28f}, 
-	{53.80f, 0, 13.17f}, {57.79f, 0, 2.03f}, {53.03f, 0, -7.96f}, {54.85f, 0, -20.03f}, 
-	{53.67f, 0, -44.20f}, {35.25f, 0, -35.85f}, {25.01f, 0, 17.04f}, {27.80f, 0, 18.07f}, 
-	{30.01f, 0, 21.32f}, {27.01f, 0, 24.33f}, {-7.86f, 0, -15.65f}, {-14.89f, 0, -17.18f}, 
-	{-24.90f, 0, -20.11f}, {-31.91f, 0, -20.91f}, {-57.89f, 0, 9.50f}, {-59.31f, 0, 19.05f},
-	{-58.51f, 0, 25.29f}, {-56.70f, 0, 35.26f}, {-50.98f, 0, 38.97f}, {-46.18f, 0, 33.34f}, 
-	{-38.07f, 0, 26.96f}, {-34.56f, 0, 31.28f}, {-34.16f, 0, 37.87f}, {-36.81f, 0, 42.84f}, 
-	{-41.31f, 0, 42.38f}, {-32.40f, 0, 49.67f}, {-23.46f, 0, 57.46f}, {-14.06f, 0, 56.53f}, 
-	{-2.28f, 0, 53.18f}, {6.61f, 0, 50.97f}, {14.48f, 0, 53.34f}, {19.61f, 0, 54.60f}, 
-	{27.19f, 0, 56.32f}, {45.39f, 0, 57.37f}, {51.48f, 0, 48.51f}, {53.57f, 0, 42.74f}, 
-	{55.55f, 0, 36.85f}, {54.38f, 0, 26.52f}, {55.33f, 0, 19.61f}, {54.74f, 0, 6.12f}, 
-	{49.12f, 0, -5.46f}, {46.48f, 0, -14.67f}, {56.58f, 0, -27.82f}, {54.64f, 0, -40.71f}, 
-	{49.18f, 0, -45.38f}, {40.86f, 0, -49.48f}, {25.39f, 0, -49.89f}, {13.77f, 0, -49.16f}, 
-	{-2.02f, 0, -51.96f}, {11.01f, 0, 7.26f}, {13.33f, 0, 8.87f}, {16.48f, 0, 10.46f},
-    {19.92f, 0, 11.65f}, {26.48f, 0, 12.77f}, {32.18f, 0, 10.76f}, {35.11f, 0, 6.94f},
-    {31.87f, 0, 16.33f}, {7.90f, 0, 38.96f}, {8.29f, 0, 42.33f}, {2.28f, 0, 51.69f},
-    {-6.42f, 0, 56.59f}, {-28.42f, 0, 53.62f}, {-38.48f, 0, 52.90f}, {-41.16f, 0, 52.04f},
-    {-45.38f, 0, 48.90f}, {-46.25f, 0, 45.71f}, {-45.19f, 0, 42.25f}, {-43.87f, 0, 36.51f},
-    {-44.07f, 0, 31.30f}, {-47.49f, 0, 27.07f}, {-51.11f, 0, 27.18f}, {-54.14f, 0, 31.55f},
-    {-53.87f, 0, 37.11f}, {-53.30f, 0, 41.10f}, {-57.40f, 0, 18.26f}, {-56.87f, 0, 11.89f},
-    {-57.14f, 0, 7.42f}, {-56.71f, 0, 0.37f}, {-57.52f, 0, -19.77f}, {-57.82f, 0, -30.18f},
-    {-57.25f, 0, -42.02f}, {-42.21f, 0, -58.22f}, {-31.70f, 0, -57.72f}, {-13.13f, 0, -57.26f},
-    {-5.69f, 0, -57.26f}, {4.19f, 0, -57.32f}, {12.61f, 0, -57.31f}, {20.29f, 0, -56.96f},
-    {25.05f, 0, -56.66f}, {30.72f, 0, -56.69f}, {34.94f, 0, -56.89f}, {39.91f, 0, -56.25f},
-    {42.73f, 0, -54.73f}, {45.96f, 0, -52.28f}, {49.24f, 0, -50.56f}, {52.45f, 0, -50.05f},
-    {52.41f, 0, -56.66f}, {46.12f, 0, -53.55f}, {42.78f, 0, -52.05f}, {34.30f, 0, -51.96f},
-    {29.32f, 0, -46.49f}, {47.28f, 0, -39.51f}, {49.31f, 0, -35.55f}, {50.26f, 0, -31.58f},
-    {51.32f, 0, -27.77f}, {52.52f, 0, -22.80f}, {53.24f, 0, -17.62f}, {55.14f, 0, -11.74f},
-    {56.41f, 0, -6.88f}, {51.25f, 0, 12.24f}, {49.11f, 0, 19.59f}, {48.08f, 0, 24.16f},
-    {49.38f, 0, 29.80f}, {53.92f, 0, 33.04f}, {57.16f, 0, 36.24f}, {56.22f, 0, 48.83f},
-    {47.80f, 0, 53.40f}, {37.92f, 0, 54.39f}, {20.33f, 0, 55.91f}, {10.11f, 0, 54.36f},
-    {-26.37f, 0, 54.01f}, {34.43f, 0, 54.40f}, {31.47f, 0, 57.06f}, {53.41f, 0, 54.71f},
-    {55.33f, 0, 41.25f}, {50.85f, 0, 35.64f}, {49.49f, 0, 25.79f}, {51.63f, 0, 18.89f},
-    {53.68f, 0, 1.17f}, {54.13f, 0, -3.98f}, {57.81f, 0, -15.81f}, {58.67f, 0, -19.96f},
-    {55.51f, 0, -35.65f}, {48.99f, 0, -40.59f}, {46.78f, 0, -44.15f}, {43.45f, 0, -47.26f},
-    {34.74f, 0, -48.75f}, {30.60f, 0, -49.21f}, {22.94f, 0, -48.71f}, {18.03f, 0, -49.42f},
-    {11.44f, 0, -53.66f}, {7.85f, 0, -54.97f}, {2.40f, 0, -54.92f}, {-4.58f, 0, -54.76f},
-    {-18.88f, 0, -57.27f}, {-24.03f, 0, -58.32f}, {-36.24f, 0, -58.71f}, {-46.70f, 0, -57.97f},
-    {-53.89f, 0, -57.15f}, {-58.09f, 0, -45.90f}, {-56.46f, 0, -36.90f}, {-56.69f, 0, -26.61f},
-    {-56.60f, 0, -14.89f}, {-56.29f, 0, 22.82f}, {-51.58f, 0, 45.38f}, {-43.59f, 0, 53.44f},
-    {-38.02f, 0, 56.29f}, {-18.65f, 0, 55.90f}, {-1.49f, 0, 57.18f}, {5.27f, 0, 58.12f},
-    {32.96f, 0, 56.77f}, {46.31f, 0, 51.64f}, {47.90f, 0, 41.29f}, {35.89f, 0, 38.23f},
-    {30.27f, 0, 39.04f}, {26.93f, 0, 38.70f}, {23.19f, 0, 31.18f}, {27.90f, 0, 28.60f},
-    {32.41f, 0, 27.79f}, {33.90f, 0, 14.39f}, {27.47f, 0, 9.37f}, {8.09f, 0, -6.20f},
-    {8.81f, 0, -13.83f}, {6.51f, 0, -22.14f}, {6.91f, 0, -24.57f}, {7.72f, 0, -27.59f},
-    {16.58f, 0, -5.08f}, {27.26f, 0, -5.23f},
-};
-vector<mat4> large_tree_instance_transforms;
-int num_culled_large_trees = 0;
+// Trees and grass, generated in scenes/drive.scg and converted with scene-convert
+SceneGraph scene;
+
+// Streamed forest around the arena, chunks are generated from their coordinates
+World world;
+Mesh ground_mesh;
+
+void generate_chunk(ChunkCoord c, SceneGraph& chunk) {
+	// Arena chunks are covered by the static scene
+	if (c.x >= -1 && c.x <= 0 && c.z >= -1 && c.z <= 0) return;
+	std::mt19937 rng((uint32_t)(c.x * 73856093) ^ (uint32_t)(c.z * 19349663));
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	auto scatter = [&](int count) {
+		vector<mat4> instances;
+		for (int i = 0; i < count; i++) {
+			vec3 pos((c.x + unit(rng)) * world.chunkSize, 0, (c.z + unit(rng)) * world.chunkSize);
+			instances.push_back(Translate(pos) * RotateY(unit(rng) * 360.0f - 180.0f));
+		}
+		return instances;
+	};
+	chunk.addMesh("objects/largetree.obj", "textures/largetree.png", Scale(2.0f), scatter(20 + (int)(unit(rng) * 30)), 'S', 'F');
+	chunk.addMesh("objects/grass.obj", "textures/grass.png", mat4(), scatter(60 + (int)(unit(rng) * 120)), 'S', 'F');
+}
 
-Mesh grass_mesh;
-vector<vec3> grass_instance_positions {
-	{7.79f, 0, -5.38f}, {5.27f, 0, -8.41f}, {-6.32f, 0, -8.58f}, {-9.40f, 0, -5.62f}, 
-	{-9.49f, 0, 5.47f}, {-6.46f, 0, 8.56f}, {4.59f, 0, 9.61f}, {7.51f, 0, 6.12f},
-	{12.07f, 0, 5.49f}, {15.67f, 0, 5.87f}, {20.84f, 0, 5.78f}, {23.66f, 0, 10.43f},
-	{16.71f, 0, 11.87f}, {-7.01f, 0, 17.79f}, {-7.03f, 0, 27.66f}, {-7.15f, 0, 37.66f},
-	{-18.52f, 0, 41.08f}, {-21.48f, 0, 34.07f}, {-20.76f, 0, 22.88f}, {-30.34f, 0, 15.04f},
-	{-36.73f, 0, 14.27f}, {-43.83f, 0, 14.90f}, {-44.92f, 0, 9.24f}, {-35.86f, 0, -6.22f},
-	{-25.08f, 0, -8.68f}, {-14.91f, 0, -15.59f}, {-10.73f, 0, -23.47f}, {-11.57f, 0, -30.97f},
-	{-20.33f, 0, -33.76f}, {-31.8f, 0, -28.42f}, {13.06f, 0, -5.47f}, {20.72f, 0, -5.45f}, 
-	{31.65f, 0, -4.70f}, {35.97f, 0, -33.82f}, {25.40f, 0, -36.43f}, {9.04f, 0, 8.93f},
-	{7.82f, 0, -36.36f}, {5.39f, 0, -23.72f}, {-9.14f, 0, -11.88f}, {-20.57f, 0, -12.46f}, 
-	{-32.20f, 0, -20.17f}, {-20.66f, 0, -26.84f}, {4.43f, 0, -47.64f}, {3.93f, 0, -53.39f}, 
-	{0.33f, 0, -57.04f}, {-7.27f, 0, -51.45f}, {-10.98f, 0, -48.05f}, {16.12f, 0, -50.30f}, 
-	{30.95f, 0, -49.04f}, {45.22f, 0, -46.89f}, {49.36f, 0, -38.55f}, {50.14f, 0, -25.47f}, 
-	{51.44f, 0, -17.93f}, {48.32f, 0, -10.58f}, {52.20f, 0, -5.34f}, {55.19f, 0, 2.71f}, 
-	{53.23f, 0, 10.13f}, {48.65f, 0, 19.89f}, {53.20f, 0, 29.25f}, {52.94f, 0, 39.64f}, 
-	{40.97f, 0, 53.80f}, {33.35f, 0, 55.97f}, {22.45f, 0, 55.02f}, {12.37f, 0, 52.92f}, 
-	{4.89f, 0, 51.58f}, {7.12f, 0, 44.37f}, {8.70f, 0, 35.15f}, {8.79f, 0, 15.86f}, 
-	{8.65f, 0, -8.66f}, {5.71f, 0, -19.49f}, {-7.94f, 0, -18.39f}, {-12.41f, 0, -13.37f}, 
-	{-18.98f, 0, -6.11f}, {-23.53f, 0, -13.22f}, {-18.43f, 0, -21.01f}, {-12.61f, 0, -26.95f}, 
-	{-20.56f, 0, -31.51f}, {-25.20f, 0, -27.63f}, {-26.66f, 0, -18.66f}, {-28.89f, 0, -11.67f}, 
-	{-35.18f, 0, -10.46f}, {-35.20f, 0, -24.29f}, {-42.69f, 0, 6.82f}, {-33.15f, 0, 27.00f}, 
-	{-33.92f, 0, 33.73f}, {-33.91f, 0, 43.06f}, {-33.89f, 0, 49.01f}, {-37.87f, 0, 51.80f}, 
-	{-41.86f, 0, 46.81f}, {-39.06f, 0, 37.08f}, {-37.24f, 0, 30.39f}, {-45.18f, 0, 26.06f}, 
-	{-52.10f, 0, 28.20f}, {-51.13f, 0, 35.53f}, {-48.92f, 0, 42.02f}, {-44.19f, 0, 49.47f}, 
-	{-48.15f, 0, 51.39f}, {-52.47f, 0, 45.00f}, {-19.89f, 0, 37.80f}, {-8.92f, 0, 40.31f}, 
-	{6.92f, 0, 40.09f}, {21.51f, 0, 40.12f}, {31.11f, 0, 42.29f}, {34.82f, 0, 36.45f}, 
-	{35.20f, 0, 30.16f}, {34.46f, 0, 21.91f}, {33.01f, 0, 14.88f}, {31.73f, 0, 7.26f}, 
-	{18.89f, 0, 8.64f}, {11.94f, 0, 10.72f}, {6.14f, 0, 13.45f}, {19.11f, 0, 15.25f}, 
-	{25.39f, 0, 18.05f}, {27.88f, 0, 24.53f}, {24.49f, 0, 30.18f}, {-15.33f, 0, -9.27f}, 
-	{-17.74f, 0, -15.42f}, {-21.91f, 0, -19.81f}, {-28.09f, 0, -25.55f}, {-35.06f, 0, -18.19f}, 
-	{-31.77f, 0, -11.53f}, {-17.96f, 0, -8.67f}, {-7.88f, 0, -29.60f}, {-14.56f, 0, -29.49f}, 
-	{-16.12f, 0, -34.21f}, {-21.71f, 0, 28.06f}, {6.18f, 0, 37.26f}, {7.01f, 0, 49.03f}, 
-	{10.97f, 0, 55.62f}, {17.51f, 0, 56.45f}, {49.75f, 0, 49.19f}, {53.50f, 0, 33.92f}, 
-	{49.00f, 0, 25.35f}, {53.92f, 0, 22.33f}, {49.92f, 0, 17.05f}, {53.79f, 0, 16.88f}, 
-	{56.55f, 0, 13.86f}, {56.15f, 0, 8.20f}, {50.05f, 0, 6.49f}, {33.86f, 0, 10.72f}, 
-	{26.73f, 0, 12.74f}, {23.75f, 0, 14.55f}, {29.74f, 0, 18.33f}, {28.37f, 0, 7.24f}, 
-	{34.98f, 0, -7.36f}, {26.29f, 0, -5.06f}, {48.05f, 0, -21.12f}, {52.87f, 0, -23.11f},
-	{54.21f, 0, -27.11f}, {49.96f, 0, -33.09f}, {49.25f, 0, -43.09f}, {49.27f, 0, -49.34f}, 
-	{43.54f, 0, -53.94f}, {34.86f, 0, -55.65f}, {31.18f, 0, -54.53f}, {23.49f, 0, -47.76f}, 
-	{19.93f, 0, -52.79f}, {16.68f, 0, -57.96f}, {11.80f, 0, -57.26f}, {9.42f, 0, -53.46f},
-	{10.55f, 0, -47.26f}, {16.66f, 0, -47.86f}, {7.30f, 0, -56.81f}, {0.79f, 0, -55.33f}, 
-	{-6.02f, 0, -54.50f}, {-11.82f, 0, -57.15f}, {-22.68f, 0, -58.74f}, {-30.38f, 0, -57.70f},
-	{-40.51f, 0, -57.49f}, {-53.80f, 0, -57.32f}, {-57.84f, 0, -53.29f}, {-58.09f, 0, -44.97f}, 
-	{-58.10f, 0, -32.31f}, {-57.77f, 0, -20.81f}, {-57.48f, 0, -11.24f}, {-57.76f, 0, -0.54f}, 
-	{-58.23f, 0, 8.00f}, {-57.65f, 0, 20.25f}, {-56.34f, 0, 27.91f}, {-12.13f, 0, -7.25f}, 
-	{-10.14f, 0, -17.27f}, {-13.09f, 0, -21.82f}, {-17.47f, 0, -25.97f}, {-23.17f, 0, -31.02f}, 
-	{-31.75f, 0, -32.83f}, {-31.41f, 0, -24.12f}, {-25.43f, 0, -21.01f}, {-19.74f, 0, -23.85f}, 
-	{-16.54f, 0, -25.51f}, {-7.47f, 0, -25.94f}, {-9.09f, 0, -20.63f}, {-20.19f, 0, -17.30f},
-	{-30.55f, 0, -8.13f}, {-24.77f, 0, -6.63f}, {-13.41f, 0, -7.41f}, {12.13f, 0, -7.70f}, 
-	{48.80f, 0, -29.86f}, {54.54f, 0, -13.45f}, {55.77f, 0, -6.18f}, {57.66f, 0, -15.36f}, 
-	{54.96f, 0, -34.84f}, {52.84f, 0, -46.37f}, {50.84f, 0, -54.69f}, {37.50f, 0, -53.79f}, 
-	{30.17f, 0, -50.93f}, {25.60f, 0, -55.13f}, {20.31f, 0, -56.20f}, {15.10f, 0, -53.24f}, 
-	{10.99f, 0, -50.25f}, {-0.23f, 0, -53.39f}, {-4.14f, 0, -56.11f}, {-11.35f, 0, -52.83f}, 
-	{-33.86f, 0, -35.34f}, {-36.90f, 0, -22.12f}, {-37.35f, 0, -10.74f}, {-21.66f, 0, 24.40f}, 
-	{-21.72f, 0, 39.58f}, {-31.84f, 0, 51.97f}, {-36.49f, 0, 54.49f}, {-34.69f, 0, 56.44f}, 
-	{-27.99f, 0, 54.64f}, {-20.92f, 0, 53.10f}, {-16.84f, 0, 56.33f}, {-12.06f, 0, 57.21f}, 
-	{-9.39f, 0, 53.56f}, {-4.92f, 0, 54.34f}, {2.20f, 0, 56.54f}, {8.00f, 0, 52.92f}, 
-	{9.49f, 0, 57.30f}, {15.74f, 0, 54.92f}, {24.05f, 0, 41.10f}, {25.94f, 0, 36.21f}, 
-	{27.32f, 0, 32.39f}, {29.15f, 0, 27.36f}, {32.31f, 0, 21.46f}, {35.16f, 0, 24.48f}, 
-	{32.21f, 0, 32.18f}, {32.75f, 0, 36.64f}, {30.44f, 0, 40.23f}, {23.81f, 0, 41.49f}, 
-	{19.42f, 0, 37.20f}, {-33.55f, 0, 14.57f}, {-27.67f, 0, 14.98f}, {-29.79f, 0, 14.04f}, 
-	{-32.18f, 0, 13.55f}, {-35.26f, 0, 13.33f}, {-38.98f, 0, 13.40f}, {-44.59f, 0, 12.91f}, 
-	{-46.66f, 0, 7.57f}, {-44.61f, 0, 5.95f}, {-40.08f, 0, 5.57f}, {-27.39f, 0, -5.66f}, 
-	{-26.85f, 0, -9.52f}, {-26.07f, 0, -12.88f}, {-24.40, 0, -16.34f}, {-23.27f, 0, -20.96f}, 
-	{-27.79f, 0, -23.86f}, {-29.43f, 0, -21.98f}, {-30.33f, 0, -18.65f}, {-30.18f, 0, -15.58f}, 
-	{-31.41f, 0, -13.76f}, {-34.75f, 0, -12.85f}, {-36.49f, 0, -14.15f}, {-36.92f, 0, -18.37f}, 
-	{-36.22f, 0, -20.76f}, {-34.27f, 0, -22.29f}, {-32.51f, 0, -24.84f}, {-31.13f, 0, -26.86f}, 
-	{-29.61f, 0, -29.13f}, {-28.76f, 0, -32.15f}, {-28.27f, 0, -34.72f}, {-26.58f, 0, -36.07f}, 
-	{-22.98f, 0, -35.24f}, {-22.26f, 0, -33.07f}, {-21.23f, 0, -29.38f}, {-18.45f, 0, -26.65f}, 
-	{-13.72f, 0, -25.51f}, {-10.28f, 0, -25.43f}, {-5.84f, 0, -27.94f}, {-6.24f, 0, -32.47f}, 
-	{-6.26f, 0, -35.59f}, {-10.39f, 0, -36.67f}, {-14.25f, 0, -36.43f}, {-17.40f, 0, -36.38f}, 
-	{-22.20f, 0, -36.52f}, {-27.87f, 0, -36.81f}, {-36.01f, 0, -36.67f}, {-17.48f, 0, -18.48f}, 
-	{-21.01f, 0, -21.98f}, {-25.72f, 0, -23.66f}, {-28.87f, 0, -19.30f}, {-28.49f, 0, -13.54f}, 
-	{-26.28f, 0, -10.59f}, {-22.39f, 0, -8.57f}, {-16.60f, 0, -5.67f}, {-13.35f, 0, -4.84f}, 
-	{-7.64f, 0, -6.07f}, {-6.41f, 0, -11.05f}, {-9.05f, 0, -14.32f}, {-12.80f, 0, -16.71f}, 
-	{-15.39f, 0, -19.39f}, {-16.52f, 0, -22.11f}, {-15.72f, 0, -27.53f}, {-18.79f, 0, -34.71f}, 
-	{-16.88f, 0, -23.59f}, {-14.52f, 0, -20.90f}, {-12.08f, 0, -16.92f}, {-7.35f, 0, -12.63f}, 
-	{-5.75f, 0, -17.78f}, {-5.84f, 0, -21.74f}, {6.76f, 0, -47.18f}, {7.78f, 0, -50.94f}, 
-	{4.30f, 0, -54.88f}, {-0.90f, 0, -56.83f}, {-6.28f, 0, -58.10f}, {-10.86f, 0, -54.56f}, 
-	{-8.83f, 0, -50.10f}, {-19.19f, 0, -56.78f}, {-16.15f, 0, -58.57f}, {-12.47f, 0, -49.55f}, 
-	{4.79f, 0, -12.65f}, {9.41f, 0, -10.75f}, {10.83f, 0, -6.25f}, {4.76f, 0, -11.12f}, 
-	{3.96f, 0, -20.00f}, {4.69f, 0, -27.87f}, {5.04f, 0, -33.21f}, {10.44f, 0, -36.83f}, 
-	{27.54f, 0, -35.99f}, {36.46f, 0, -21.07f}, {36.40f, 0, -17.21f}, {35.67f, 0, -11.70f}, 
-	{35.96f, 0, -4.80f}, {29.95f, 0, -6.10f}, {24.39f, 0, -5.66f}, {18.90f, 0, -5.31f}, 
-	{11.17f, 0, -5.14f}, {-7.37f, 0, 12.00f}, {-6.71f, 0, 15.04f}, {-5.78f, 0, 19.91f}, 
-	{-5.51f, 0, 24.88f}, {-5.64f, 0, 30.31f}, {-5.64f, 0, 35.28f}, {-5.81f, 0, 39.78f}, 
-	{-10.05f, 0, 42.11f}, {-13.67f, 0, 41.83f}, {-20.10f, 0, 42.18f}, {-22.22f, 0, 37.72f}, 
-	{-20.33f, 0, 34.77f}, {-21.37f, 0, 31.31f}, {-20.09f, 0, 26.05f}, {-20.46f, 0, 20.12f}, 
-	{-39.62f, 0, 15.22f}, {-42.69f, 0, 12.81f}, {-42.90f, 0, 9.50f}, {-56.69f, 0, 21.79f}, 
-	{-56.43f, 0, 24.90f}, {-52.67f, 0, 26.47f}, {-48.11f, 0, 26.70f}, {-44.68f, 0, 28.87f}, 
-	{-41.58f, 0, 26.45f}, {-38.73f, 0, 24.67f}, {-34.97f, 0, 29.57f}, {-34.64f, 0, 37.02f}, 
-	{-33.14f, 0, 46.21f}, {-25.28f, 0, 56.25f}, {-9.07f, 0, 56.45f}, {-2.69f, 0, 57.27f}, 
-	{3.69f, 0, 58.65f}, {16.90f, 0, 58.91f}, {27.23f, 0, 58.25f}, {36.18f, 0, 56.12f}, 
-	{43.06f, 0, 52.91f}, {48.84f, 0, 48.37f}, {52.10f, 0, 44.23f}, {55.49f, 0, 39.55f}, 
-	{56.85f, 0, 34.40f}, {54.39f, 0, 28.08f}, {52.06f, 0, 21.57f}, {51.39f, 0, 15.64f}, 
-	{52.38f, 0, 6.39f}, {53.44f, 0, 0.50f}, {55.45f, 0, -9.32f}, {56.91f, 0, -18.42f}, 
-	{57.29f, 0, -25.93f}, {54.85f, 0, -37.79f}, {51.45f, 0, -44.24f}, {43.59f, 0, -49.36f}, 
-	{36.16f, 0, -52.86f}, {28.66f, 0, -56.44f}, {22.47f, 0, -57.88f}, {17.48f, 0, -56.27f}, 
-	{18.20f, 0, -48.93f}, {26.47f, 0, -47.31f}, {34.46f, 0, -47.86f}, {42.41f, 0, -51.44f}, 
-	{49.29f, 0, -36.01f}, {47.09f, 0, -27.21f}, {49.26f, 0, -18.03f}, {56.10f, 0, -4.74f}, 
-	{56.14f, 0, -4.00f}, {53.54f, 0, 1.52f}, {47.41f, 0, 7.95f}, {46.24f, 0, 21.65f},
-    {38.94f, 0, -47.43f}, {33.79f, 0, -49.83f}, {30.55f, 0, -52.44f}, {27.22f, 0, -54.78f},
-    {22.52f, 0, -55.69f}, {17.95f, 0, -55.24f}, {13.81f, 0, -55.44f}, {9.36f, 0, -56.34f},
-    {2.66f, 0, -56.98f}, {-2.99f, 0, -57.04f}, {-9.30f, 0, -57.38f}, {-15.63f, 0, -57.94f},
-    {-20.38f, 0, -58.25f}, {-25.96f, 0, -58.29f}, {-34.27f, 0, -58.04f}, {-39.78f, 0, -58.01f},
-    {-45.41f, 0, -58.31f}, {-52.74f, 0, -57.31f}, {-56.38f, 0, -55.73f}, {-58.71f, 0, -46.41f},
-    {-56.91f, 0, -40.70f}, {-56.34f, 0, -35.57f}, {-56.91f, 0, -26.94f}, {-56.76f, 0, -23.05f},
-    {-56.58f, 0, -16.76f}, {-56.61f, 0, -12.46f}, {-56.59f, 0, -6.18f}, {-56.64f, 0, -1.49f},
-    {-56.39f, 0, 8.65f}, {-56.33f, 0, 12.85f}, {-56.32f, 0, 17.78f}, {-54.17f, 0, 28.98f},
-    {-48.91f, 0, 29.00f}, {-45.86f, 0, 27.89f}, {-34.40f, 0, 26.29f}, {-36.32f, 0, 28.00f},
-    {-39.20f, 0, 31.56f}, {-41.69f, 0, 34.52f}, {-44.07f, 0, 37.33f}, {-45.98f, 0, 40.27f},
-    {-47.25f, 0, 43.02f}, {-47.96f, 0, 46.18f}, {-47.64f, 0, 48.80f}, {-45.17f, 0, 51.62f},
-    {-42.54f, 0, 52.05f}, {-38.97f, 0, 50.31f}, {-36.42f, 0, 47.81f}, {-34.10f, 0, 40.85f},
-    {-30.29f, 0, 57.02f}, {-20.73f, 0, 56.91f}, {-7.47f, 0, 57.99f}, {-4.24f, 0, 57.32f},
-    {1.91f, 0, 54.61f}, {13.65f, 0, 54.87f}, {30.86f, 0, 57.23f}, {37.79f, 0, 54.56f},
-    {46.25f, 0, 52.50f}, {51.37f, 0, 50.67f}, {56.74f, 0, 35.82f}, {53.26f, 0, 31.24f},
-    {50.68f, 0, 28.23f}, {47.81f, 0, 22.54f}, {50.64f, 0, 13.15f}, {51.93f, 0, 9.73f},
-    {54.83f, 0, -1.94f}, {55.71f, 0, -13.07f}, {56.62f, 0, -21.19f}, {52.35f, 0, -30.55f},
-    {48.46f, 0, -40.50f}, {53.61f, 0, -48.78f}, {5.09f, 0, 16.62f}, {9.34f, 0, 12.47f},
-    {12.81f, 0, 13.42f}, {15.58f, 0, 14.36f}, {19.47f, 0, 14.14f}, {22.79f, 0, 13.22f},
-    {28.75f, 0, 11.69f}, {33.18f, 0, 12.77f}, {33.85f, 0, 17.45f}, {33.40f, 0, 24.04f},
-    {32.91f, 0, 27.34f}, {32.58f, 0, 34.53f}, {32.69f, 0, 39.06f}, {34.38f, 0, 41.43f},
-    {35.74f, 0, 39.22f}, {35.91f, 0, 37.12f}, {36.90f, 0, 32.56f}, {37.51f, 0, 29.22f},
-    {32.64f, 0, 26.35f}, {27.75f, 0, 34.76f}, {27.28f, 0, 36.89f}, {26.97f, 0, 38.37f},
-    {24.39f, 0, 38.93f}, {22.82f, 0, 36.59f}, {21.97f, 0, 34.31f}, {22.24f, 0, 30.07f},
-    {23.61f, 0, 25.81f}, {23.95f, 0, 22.37f}, {16.42f, 0, 15.65f}, {14.28f, 0, 15.42f},
-    {12.38f, 0, 15.56f}, {6.59f, 0, 19.50f}, {4.14f, 0, 23.44f}, {4.71f, 0, 31.14f},
-    {5.15f, 0, 34.47f}, {5.30f, 0, 38.29f}, {5.30f, 0, 41.84f}, {5.20f, 0, 45.10f},
-    {4.66f, 0, 48.77f}, {-0.55f, 0, 55.32f}, {-9.01f, 0, 57.66f}, {-17.88f, 0, 56.68f},
-    {-24.87f, 0, 52.94f}, {-27.82f, 0, 51.87f}, {-34.80f, 0, 51.60f}, {-41.61f, 0, 51.37f},
-    {-50.01f, 0, 46.54f}, {-49.57f, 0, 43.92f}, {-48.88f, 0, 38.37f}, {-48.94f, 0, 35.12f},
-    {-49.97f, 0, 31.50f}, {-51.18f, 0, 29.02f}, {-55.23f, 0, 24.71f}, {-46.65f, 0, 14.44f},
-    {-45.64f, 0, 10.87f}, {-45.77f, 0, 9.32f}, {-46.22f, 0, 4.41f}, {-35.55f, 0, -9.57f},
-    {-32.86f, 0, -9.59f}, {-29.92f, 0, -10.06f}, {-23.26f, 0, -14.88f}, {-22.00f, 0, -17.16f},
-    {-19.81f, 0, -21.49f}, {-19.55f, 0, -29.35f}, {-20.39f, 0, -35.36f}, {-17.33f, 0, -32.07f},
-    {-15.32f, 0, -28.43f}, {-11.14f, 0, -25.83f}, {5.46f, 0, -29.87f}, {7.75f, 0, -30.83f},
-    {23.47f, 0, -36.36f}, {47.78f, 0, -28.33f}, {50.18f, 0, -27.19f}, {52.96f, 0, -25.91f},
-    {57.32f, 0, -23.95f}, {56.58f, 0, -31.89f}, {54.45f, 0, -33.92f}, {52.47f, 0, -36.03f},
-    {50.95f, 0, -38.36f}, {51.49f, 0, -46.06f}, {52.44f, 0, -48.50f}, {53.00f, 0, -51.11f},
-    {52.91f, 0, -53.58f}, {50.07f, 0, -57.54f}, {45.45f, 0, -57.41f}, {43.36f, 0, -56.52f},
-    {40.55f, 0, -55.41f}, {37.62f, 0, -54.58f}, {34.99f, 0, -54.38f}, {32.68f, 0, -54.87f},
-    {25.77f, 0, -58.26f}, {19.76f, 0, -58.25f}, {13.74f, 0, -56.77f}, {5.09f, 0, -56.43f},
-    {-7.84f, 0, -56.52f}, {-18.55f, 0, -57.89f}, {-27.67f, 0, -57.99f}, {-36.49f, 0, -58.12f},
-    {-41.07f, 0, -58.32f}, { 21.57f, 0, 38.42f }, { 26.00f, 0, 41.18f }, { 28.12f, 0, 41.85f }, 
-	{ 33.05f, 0, 40.88f }, { 33.18f, 0, 36.80f }, { 30.38f, 0, 31.58f }, { 31.19f, 0, 30.01f }, 
-	{ 36.97f, 0, 27.68f }, { 34.90f, 0, 26.15f }, { 31.79f, 0, 23.68f }, { 27.49f, 0, 22.34f }, 
-	{ 24.90f, 0, 23.55f }, { 23.57f, 0, 19.80f }, { 21.60f, 0, 17.56f }, { 21.48f, 0, 15.50f }, 
-	{ 21.68f, 0, 11.71f }, { 21.55f, 0, 9.13f }, { 18.56f, 0, 5.81f }, { 15.87f, 0, 8.03f }, 
-	{ -5.63f, 0, 22.07f }, { -6.87f, 0, 23.27f }, { -7.47f, 0, 25.76f }, { -6.12f, 0, 31.83f }, 
-	{ -6.99f, 0, 40.06f }, { -15.49f, 0, 42.69f }, { -22.04f, 0, 20.43f }, { -36.08f, 0, 25.88f }, 
-	{ -38.62f, 0, 32.12f }, { -39.92f, 0, 35.25f }, { -41.74f, 0, 38.26f }, { -46.64f, 0, 41.17f }, 
-	{ -53.02f, 0, 35.14f }, { -53.89f, 0, 33.56f }, { -56.80f, 0, 31.98f }, { -54.82f, 0, 27.13f }, 
-	{ -44.25f, 0, 45.49f }, { -41.47f, 0, 45.26f }, { -38.61f, 0, 44.70f }, { -35.11f, 0, 44.46f }, 
-	{ -23.97f, 0, 54.63f }, { -0.30f, 0, 58.74f }, { 9.11f, 0, 59.28f }, { 36.81f, 0, 57.64f }, 
-	{ 50.27f, 0, 55.22f }, { 46.93f, 0, 55.28f }, { 44.07f, 0, 54.52f }, { 47.36f, 0, 45.87f }, 
-	{ 54.86f, 0, 43.48f }, { 49.55f, 0, 38.87f }, { 47.18f, 0, 35.37f }, { 50.34f, 0, 33.63f }, 
-	{ 56.19f, 0, 27.30f }, { 58.14f, 0, 22.87f }, { 58.18f, 0, 17.00f }, { 56.67f, 0, 11.44f }, 
-	{ 56.97f, 0, -1.50f }, { 56.09f, 0, 0.20f }, { 46.54f, 0, 10.94f }, { 47.81f, 0, 13.39f }, 
-	{ 58.06f, 0, -11.35f }, { 55.72f, 0, -22.92f }, { 52.50f, 0, -32.51f }, { 51.65f, 0, -38.87f }, 
-	{ 41.64f, 0, -57.81f }, { 33.92f, 0, -58.19f }, { 30.10f, 0, -58.24f }, { 9.47f, 0, -58.33f }, 
-	{ 1.21f, 0, -58.92f }, { -3.25f, 0, -58.90f }, { -10.07f, 0, -59.04f }, { -48.94f, 0, -57.36f }, 
-	{ -57.86f, 0, -57.26f }, { -57.49f, 0, -55.68f }, { -36.20f, 0, -34.43f }, { -33.50f, 0, -32.37f }, 
-	{ -30.82f, 0, -30.75f }, { -27.72f, 0, -29.72f }, { -25.40f, 0, -29.57f }, { -12.61f, 0, -28.41f }, 
-	{ -9.25f, 0, -28.02f }, { -6.21f, 0, -20.05f }, { -10.26f, 0, -19.39f }, { -19.01f, 0, -19.78f }, 
-	{ -23.80f, 0, -18.77f }, { -24.60f, 0, -9.96f }, { 24.10f, 0, 5.98f }, { 24.52f, 0, 9.41f }, 
-	{ 27.50f, 0, 16.84f }, { 29.73f, 0, 17.18f }, { 34.77f, 0, 19.41f }, { 48.27f, 0, 27.44f }, 
-	{ 53.14f, 0, 25.60f }, { 54.67f, 0, 24.06f }, { 57.14f, 0, 21.41f }, { 58.43f, 0, 11.90f }, 
-	{ 57.19f, 0, 6.75f }, { 58.28f, 0, -8.24f }, { 53.38f, 0, -10.45f }, { 50.74f, 0, -11.99f }, 
-	{ 48.67f, 0, -14.99f }, { 47.27f, 0, -18.25f }, { 46.71f, 0, -23.69f }, { 6.69f, 0, -53.31f }, 
-	{ 9.37f, 0, -49.49f }, { 13.61f, 0, -46.99f }, { 19.53f, 0, -47.11f }, { 22.56f, 0, -47.09f }, 
-	{ 27.84f, 0, -49.37f }, { 28.49f, 0, -52.33f }, { -0.60f, 0, -59.11f }, { -6.40f, 0, -59.06f }, 
-	{ -9.50f, 0, -55.26f }, { -9.50f, 0, -52.49f }, { -8.71f, 0, -47.28f }, { -6.71f, 0, -46.99f }, 
-	{ -5.70f, 0, -50.21f }, { -11.83f, 0, -55.45f }, { -12.20f, 0, -36.02f }, { -12.06f, 0, -34.09f }, 
-	{ -9.92f, 0, -31.57f }, { -6.29f, 0, -30.69f }, { -9.29f, 0, -30.05f }, { -10.89f, 0, -28.22f }, 
-	{ -13.06f, 0, -24.90f }, { -13.96f, 0, -23.61f }, { -16.30f, 0, -21.04f }, { -19.99f, 0, -15.99f },
-	{ -21.62f, 0, -13.29f }, { -24.45f, 0, -11.49f }, { -27.34f, 0, -14.43f }, { -28.68f, 0, -16.38f }, 
-	{ -29.51f, 0, -24.00f }, { -29.50f, 0, -26.34f }, { -27.76f, 0, -28.10f }, { -23.80f, 0, -27.57f }, 
-	{ -22.84f, 0, -28.34f }, { -23.85f, 0, -32.58f }, { -29.74f, 0, -36.28f }, { -32.49f, 0, -36.44f }, 
-	{ -33.06f, 0, -34.40f }, { -30.85f, 0, -34.00f }, { -29.69f, 0, -33.01f }, { -31.37f, 0, -30.65f }, 
-	{ -35.18f, 0, -28.76f }, { -36.59f, 0, -26.76f }, { -34.22f, 0, -25.66f }, { -36.51f, 0, -24.10f }, 
-	{ -34.78f, 0, -20.10f }, { -33.92f, 0, -18.53f }, { -33.30f, 0, -17.01f }, { -34.29f, 0, -15.94f }, 
-	{ -33.61f, 0, -14.39f }, { -32.67f, 0, -12.39f }, { -33.86f, 0, -9.07f }, { -32.61f, 0, -5.10f }, 
-	{ -30.48f, 0, -5.47f }, { -25.51f, 0, -5.15f }, { -23.80f, 0, -5.28f }, { -21.11f, 0, -7.14f }, 
-	{ -19.89f, 0, -9.21f }, { -18.85f, 0, -11.52f }, { -19.68f, 0, -14.33f }, { -21.05f, 0, -14.46f }, 
-	{ -20.85f, 0, -15.22f }, { -13.94f, 0, -18.57f }, { -12.40f, 0, -19.74f }, { -8.43f, 0, -19.82f }, 
-	{ -6.78f, 0, -22.18f }, { -8.36f, 0, -23.42f }, { -6.57f, 0, -25.14f }, { -5.74f, 0, -14.35f }, 
-	{ -8.87f, 0, 7.16f }, { -6.19f, 0, 10.64f }, { -5.92f, 0, 16.25f }, { -6.00f, 0, 26.85f }, 
-	{ -7.51f, 0, 33.26f }, { -10.92f, 0, 40.87f }, { -15.60f, 0, 41.41f }, { -19.17f, 0, 39.74f }, 
-	{ -21.22f, 0, 37.41f }, { -40.43f, 0, 14.08f }, { -42.77f, 0, 14.27f }, { -44.33f, 0, 10.97f }, 
-	{ -44.04f, 0, 8.85f }, { -56.59f, 0, 2.85f }, { -56.82f, 0, 5.58f }, { -58.84f, 0, 11.99f }, 
-	{ -58.89f, 0, 15.95f }, { -47.66f, 0, 30.59f }, { -48.46f, 0, 32.53f }, { -50.73f, 0, 33.47f }, 
-	{ -54.97f, 0, 35.88f }, { -56.08f, 0, 37.66f }, { -54.80f, 0, 40.04f }, { -51.64f, 0, 40.17f }, 
-	{ -47.68f, 0, 40.67f }, { -46.91f, 0, 38.58f }, { -45.76f, 0, 36.36f }, { -44.51f, 0, 34.22f }, 
-	{ -40.92f, 0, 32.01f }, { -38.09f, 0, 36.33f }, { -36.86f, 0, 38.44f }, { -35.50f, 0, 40.80f }, 
-	{ -34.54f, 0, 46.37f }, { -35.31f, 0, 49.37f }, { -36.30f, 0, 52.49f }, { -32.52f, 0, 56.78f }, 
-	{ -36.33f, 0, 55.96f }, { -38.11f, 0, 54.97f }, { -41.63f, 0, 52.96f }, { -47.01f, 0, 50.07f }, 
-	{ -41.92f, 0, 56.68f }, { -15.52f, 0, 55.47f }, { -16.90f, 0, 54.07f }, { -18.84f, 0, 52.81f }, 
-	{ -16.76f, 0, 52.59f }, { -13.06f, 0, 52.57f }, { -7.97f, 0, 52.48f }, { -1.40f, 0, 52.19f }, 
-	{ 0.91f, 0, 55.66f }, { -8.65f, 0, 41.74f }, { -7.01f, 0, 41.51f }, { -5.86f, 0, 37.95f }, 
-	{ -5.91f, 0, 28.07f }, { -21.75f, 0, 21.93f }, { -21.93f, 0, 26.61f }, { -21.62f, 0, 29.60f }, 
-	{ -20.77f, 0, 32.44f }, { -20.33f, 0, 39.84f }, { -17.11f, 0, 41.30f }, { 5.03f, 0, 33.06f }, 
-	{ 7.35f, 0, 33.21f }, { 4.93f, 0, 28.86f }, { 4.49f, 0, 26.60f }, { 4.60f, 0, 21.51f }, 
-	{ 4.76f, 0, 19.99f }, { 4.75f, 0, 12.98f }, { 5.34f, 0, 11.78f }, { 7.05f, 0, 8.93f }, 
-	{ 9.13f, 0, 5.75f }, { 13.54f, 0, 6.54f }, { 18.43f, 0, 10.55f }, { 17.59f, 0, 13.44f },
-	{ 20.31f, 0, 16.43f }, { 24.22f, 0, 12.55f }, { 25.11f, 0, 11.31f }, { 26.04f, 0, 8.61f }, 
-	{ 23.95f, 0, 5.56f }, { 25.10f, 0, 5.50f }, { 26.88f, 0, 5.97f }, { 29.38f, 0, 6.16f }, 
-	{ 30.16f, 0, 8.09f }, { 29.41f, 0, 9.73f }, { 30.19f, 0, 11.18f }, { 30.21f, 0, 13.47f }, 
-	{ 30.34f, 0, 15.44f }, { 28.39f, 0, 20.34f }, { 26.62f, 0, 19.77f }, { 29.97f, 0, 26.10f }, 
-	{ 31.98f, 0, 28.70f }, { 34.17f, 0, 28.84f }, { 36.90f, 0, 25.82f }, { 36.84f, 0, 22.56f }, 
-	{ 35.70f, 0, 18.73f }, { 35.54f, 0, 15.63f }, { 35.85f, 0, 12.77f }, { 36.23f, 0, 5.75f }, 
-	{ 34.19f, 0, 28.17f }, { 33.70f, 0, 30.17f }, { 33.91f, 0, 34.17f }, { 36.54f, 0, 35.31f }, 
-	{ 31.01f, 0, 38.03f }, { 29.56f, 0, 36.46f }, { 28.66f, 0, 39.02f }, { 19.72f, 0, 34.29f }, 
-	{ 19.93f, 0, 35.84f }, { 19.82f, 0, 38.98f }, { 19.91f, 0, 42.03f }, { 24.99f, 0, 52.75f }, 
-	{ 24.88f, 0, 55.82f }, { 29.94f, 0, 53.25f }, { 31.96f, 0, 53.60f }, { 39.10f, 0, 56.54f }, 
-	{ 41.77f, 0, 55.14f }, { 55.22f, 0, 53.93f }, { 54.72f, 0, 51.76f }, { 53.76f, 0, 48.69f }, 
-	{ 50.74f, 0, 45.52f }, { 47.75f, 0, 47.66f }, { 47.29f, 0, 50.14f }, { 51.25f, 0, 46.04f }, 
-	{ 52.20f, 0, 41.81f }, { 51.48f, 0, 38.85f }, { 51.70f, 0, 36.46f }, { 55.17f, 0, 33.59f }, 
-	{ 57.15f, 0, 31.54f }, { 57.56f, 0, 25.08f }, { 53.03f, 0, 24.36f }, { 52.28f, 0, 26.02f }, 
-	{ 52.07f, 0, 23.54f }, { 53.11f, 0, 19.77f }, { 54.47f, 0, 17.86f }, { 57.95f, 0, 14.91f }, 
-	{ 52.79f, 0, 14.50f }, { 49.39f, 0, 14.72f }, { 46.92f, 0, 15.40f }, { 46.08f, 0, 13.51f }, 
-	{ 47.86f, 0, 9.79f }, { 49.19f, 0, 8.19f }, { 53.99f, 0, 7.96f }, { 56.56f, 0, 6.32f }, 
-	{ 55.41f, 0, 4.19f }, { 52.98f, 0, 3.31f }, { 51.72f, 0, -0.48f }, { 52.44f, 0, -2.27f }, 
-	{ 51.55f, 0, -4.91f }, { 50.24f, 0, -7.82f }, { 46.91f, 0, -4.91f }, { 47.36f, 0, -6.17f }, 
-	{ 48.62f, 0, -7.71f }, { 50.16f, 0, -8.61f }, { 52.26f, 0, -10.21f }, { 52.02f, 0, -13.28f }, 
-	{ 49.74f, 0, -12.87f }, { 47.97f, 0, -12.54f }, { 48.53f, 0, -14.84f }, { 51.40f, 0, -15.51f }, 
-	{ 56.80f, 0, -13.79f }, { 51.05f, 0, -19.37f }, { 48.85f, 0, -19.29f }, { 47.44f, 0, -24.19f }, 
-	{ 51.56f, 0, -24.81f }, { 54.78f, 0, -24.72f }, { 56.16f, 0, -26.48f }, { 54.13f, 0, -28.42f }, 
-	{ 47.71f, 0, -31.59f }, { 46.88f, 0, -33.94f }, { 52.13f, 0, -40.43f }, { 53.54f, 0, -41.79f }, 
-	{ 51.50f, 0, -47.52f }, { 48.87f, 0, -47.76f }, { 44.77f, 0, -49.47f }, { 44.47f, 0, -51.67f }, 
-	{ 39.40f, 0, -57.76f }, { 37.63f, 0, -57.13f }, { 38.38f, 0, -51.33f }, { 39.79f, 0, -48.78f }, 
-	{ 37.03f, 0, -47.33f }, { 32.75f, 0, -47.12f }, { 32.36f, 0, -49.75f }, { 32.36f, 0, -51.72f }, 
-	{ 29.59f, 0, -53.98f }, { 26.03f, 0, -53.59f }, { 23.92f, 0, -53.44f }, { 21.65f, 0, -53.80f }, 
-	{ 17.41f, 0, -52.93f }, { 20.82f, 0, -48.53f }, { 19.81f, 0, -47.62f }, { 15.23f, 0, -47.65f }, 
-	{ 8.99f, 0, -48.89f }, { 6.32f, 0, -50.02f }, { 3.40f, 0, -51.99f }, { 0.38f, 0, -54.51f }, 
-	{ -3.05f, 0, -54.93f }, { -5.65f, 0, -49.58f }, { -8.72f, 0, -51.62f }, { -17.70f, 0, -58.69f },
-	{ -28.50f, 0, -59.50f }, { -38.44f, 0, -57.30f }, { -36.20f, 0, -57.10f }, { -29.49f, 0, -56.79f }, 
-	{ -25.90f, 0, -56.94f }, { -10.58f, 0, -50.28f }, { -5.12f, 0, -52.24f }, { 6.50f, 0, -58.81f }, 
-	{ 12.25f, 0, -54.32f }, { 13.39f, 0, -52.25f }, { 21.76f, 0, -50.69f }, { 38.94f, 0, -52.72f }, 
-	{ 40.29f, 0, -52.28f }, { 47.24f, 0, -46.72f }, { 50.45f, 0, -48.56f }, { 52.32f, 0, -34.34f }, 
-	{ 52.76f, 0, -28.48f }, { 49.01f, 0, -26.49f }, { 46.48f, 0, -21.59f }, { 48.39f, 0, -17.15f }, 
-	{ 50.04f, 0, -14.48f }, { 51.22f, 0, -8.46f }, { 51.86f, 0, 1.80f }, { 50.82f, 0, 7.50f }, 
-	{ 48.13f, 0, 11.58f }, { 50.76f, 0, 19.59f }, { 54.93f, 0, 24.79f }, { 57.12f, 0, 38.98f }, 
-	{ 56.23f, 0, 42.44f }, { 56.68f, 0, 44.42f }, { 55.11f, 0, 48.04f }, { 53.98f, 0, 50.57f }, 
-	{ 51.54f, 0, 54.29f }, { 41.96f, 0, 57.94f }, { 29.96f, 0, 55.75f }, { 26.19f, 0, 55.08f }, 
-	{ 14.04f, 0, 56.66f }, { 15.12f, 0, 57.98f }, { 17.89f, 0, 54.18f }, { 10.50f, 0, 51.90f }, 
-	{ 9.12f, 0, 51.09f }, { 5.33f, 0, 40.32f }, { 7.32f, 0, 37.91f }, { 6.15f, 0, 31.37f }, 
-	{ 6.93f, 0, 14.92f }, { 9.36f, 0, 14.49f }, { 10.78f, 0, 14.57f }, { 13.41f, 0, 13.83f }, 
-	{ 19.98f, 0, 10.25f }, { 22.57f, 0, 7.55f }, { 19.59f, 0, 6.85f }, { 17.74f, 0, 7.23f }, 
-	{ 23.52f, 0, -5.53f }, { 22.39f, 0, -6.01f }, { 18.95f, 0, -6.49f }, { 15.78f, 0, -6.89f }, 
-	{ 11.36f, 0, -9.35f }, { 7.91f, 0, -11.52f }, { 6.14f, 0, -9.82f }, { 8.23f, 0, -7.11f },
-	{ 31.15f, 0, -7.49f }, { 33.75f, 0, -5.98f }, { 34.57f, 0, 8.31f }, { 29.83f, 0, 29.31f }, 
-	{ 27.75f, 0, 29.61f }, { 25.29f, 0, 31.32f }, { 25.19f, 0, 33.15f }, { 24.76f, 0, 35.16f }, 
-	{ 21.09f, 0, 52.20f }, { 9.03f, 0, 56.11f }, { 1.79f, 0, 58.45f }, { -6.74f, 0, 54.05f }, 
-	{ -10.44f, 0, 54.99f }, { -27.07f, 0, 56.72f }, { -41.20f, 0, 55.51f }, { -43.14f, 0, 48.33f }, 
-	{ -43.73f, 0, 43.56f }, { -43.53f, 0, 41.66f }, { -45.00f, 0, 38.08f }, { -47.48f, 0, 36.47f }, 
-	{ -57.45f, 0, 30.35f }, { -57.81f, 0, 23.64f }, { -57.70f, 0, 15.34f }, { -58.16f, 0, -2.38f }, 
-	{ -57.30f, 0, -7.40f }, { -57.05f, 0, -9.18f }, { -58.11f, 0, -13.11f }, { -58.43f, 0, -18.31f }, 
-	{ -57.89f, 0, -22.26f }, { -57.42f, 0, -24.69f }, { -57.31f, 0, -33.43f }, { -57.55f, 0, -35.70f }, 
-	{ -56.67f, 0, -43.26f }, { -56.50f, 0, -46.19f }, { -56.47f, 0, -50.34f }, { -56.05f, 0, -57.30f }, 
-	{ -50.94f, 0, -58.01f }, { -43.34f, 0, -57.15f }, { -34.19f, 0, -56.94f }, { -29.01f, 0, -57.93f }, 
-	{ -13.11f, 0, -58.57f }, { -8.10f, 0, -54.39f }, { -15.78f, 0, -36.10f }, { -17.96f, 0, -33.51f }, 
-	{ -25.76f, 0, -31.07f }, { -28.83f, 0, -27.96f }, { -28.04f, 0, -22.31f }, { -27.38f, 0, -21.02f }, 
-	{ -25.56f, 0, -17.26f }, { -25.44f, 0, -15.38f }, { -17.95f, 0, -11.92f }, { -14.27f, 0, -11.04f }, 
-	{ -11.70f, 0, -15.28f }, { -8.10f, 0, -13.89f }, { -8.11f, 0, -10.88f }, { -10.42f, 0, -10.11f }, 
-	{ -13.10f, 0, -9.87f }, { -32.87f, 0, -15.44f }, { -31.98f, 0, -18.43f }, { -26.25f, 0, -24.69f }, 
-	{ -24.35f, 0, -29.04f }, { -18.31f, 0, -30.59f }, { -15.05f, 0, -30.33f }, { -8.05f, 0, -26.74f }, 
-	{ -35.61f, 0, -7.96f }, { -42.00f, 0, 5.40f },
-};
-vector<mat4> grass_instance_transforms;
-int num_culled_grass = 0;
+// Tree trunks of the arena scene and of resident chunks are static proxies, added and removed as
+// chunks come and go, the car is the one dynamic proxy: its pairs are the trunks it may hit
+enum BodyType { CAR, TRUNK };
+const float CAR_RADIUS = 0.6f, TRUNK_RADIUS = 0.4f, TRUNK_HEIGHT = 4.0f;
+TreeBroadphase collisions;
+int carProxy = -1;
+vector<int> arenaTrunks;
+map<ChunkCoord, vector<int>> chunkTrunks;
+uint64_t trunksVersion = ~0ull;
+
+void addTrunks(const SceneGraph& s, vector<int>& ids) {
+	for (size_t i = 0; i < s.size(); i++) {
+		if (s.data[i].obj.find("largetree") == string::npos) continue;
+		// A single instance is baked into the model matrix
+		uint32_t n = max(s.data[i].numInstances, 1u);
+		for (uint32_t j = 0; j < n; j++) {
+			mat4 m = s.data[i].numInstances ? s.instanceData(i)[j] * s.data[i].model : s.data[i].model;
+			vec3 base(m * vec4(0, 0, 0, 1));
+			vec3 half(TRUNK_RADIUS, TRUNK_HEIGHT, TRUNK_RADIUS);
+			ids.push_back(collisions.create(Bounds(base - half, base + half), TRUNK, true));
+		}
+	}
+}
+
+void syncTrunks() {
+	if (world.version == trunksVersion) return;
+	trunksVersion = world.version;
+	for (auto it = chunkTrunks.begin(); it != chunkTrunks.end();) {
+		auto chunk = world.chunks.find(it->first);
+		if (chunk != world.chunks.end() && chunk->second->state.load() == ChunkState::Resident) {
+			it++;
+			continue;
+		}
+		for (int id : it->second) collisions.destroy(id);
+		it = chunkTrunks.erase(it);
+	}
+	for (auto& [coord, chunk] : world.chunks)
+		if (chunk->state.load() == ChunkState::Resident && !chunkTrunks.count(coord)) addTrunks(chunk->scene, chunkTrunks[coord]);
+}
 
 Mesh cloud_mesh;
 vector<mat4> cloud_instance_transforms;
@@ -637,15 +390,27 @@ struct Car {
 	}
 	void collide() {
 		if (pos.y < 0) pos.y = 0;
-		if (pos.x > 59.5) { pos.x = 59.5; }
-		else if (pos.x < -59.5) { pos.x = -59.5; }
-		else if (pos.z > 59.5) { pos.z = 59.5; }
-		else if (pos.z < -59.5) { pos.z = -59.5; }
-		/*for (vec3 tree_pos : large_tree_positions) {
-			float d = dist(pos, tree_pos);
-			if (d < 1.5) vel *= 0.5;
-			//if (d < 1.0) vel = (pos - tree_pos); hard collision with tree
-		}*/
+		float bound = world.extent() - 0.5f;
+		if (pos.x > bound) { pos.x = bound; }
+		else if (pos.x < -bound) { pos.x = -bound; }
+		else if (pos.z > bound) { pos.z = bound; }
+		else if (pos.z < -bound) { pos.z = -bound; }
+		collisions.move(carProxy, Bounds::sphere(pos, CAR_RADIUS));
+		collisions.update();
+		for (const BroadphasePair& pair : collisions.pairs) {
+			if (pair.a != carProxy && pair.b != carProxy) continue;
+			const Bounds& trunk = collisions.proxy(pair.a == carProxy ? pair.b : pair.a).bounds;
+			// Pushed out of the trunk, losing the speed into it and half the rest
+			vec3 away = pos - 0.5f * (trunk.lo + trunk.hi);
+			away.y = 0;
+			float d = length(away), reach = CAR_RADIUS + TRUNK_RADIUS;
+			if (d >= reach || d < 1e-4f) continue;
+			away = away / d;
+			pos += (reach - d) * away;
+			float into = dot(vel, away);
+			if (into < 0) vel -= into * away;
+			vel *= 0.5f;
+		}
 	}
 	void update(float dt) {
 		// Weight update by time delta for consistent effect of updates
@@ -740,12 +505,7 @@ void Keyboard(GLFWwindow* window, int key, int scancode, int action, int mods) {
 	if (key == GLFW_KEY_F && action == GLFW_PRESS) {
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS) {
             frustumCulling = !frustumCulling;
-            if (!frustumCulling) {
-                large_tree_mesh.loadInstances(large_tree_instance_transforms);
-                num_culled_large_trees = (int)large_tree_instance_transforms.size();
-                grass_mesh.loadInstances(grass_instance_transforms);
-                num_culled_grass = (int)grass_instance_transforms.size();
-            }
+            if (!frustumCulling) scene.resetCulling();
         } else {
             if (fullscreen) {
                 win_width = windowed_width;
@@ -821,8 +581,16 @@ void show_performance_window() {
 		ImGui::Text("FPS: %.0f fps", io.Framerate);
 		ImVec2 displaySize = io.DisplaySize;
 		ImGui::Text("Display Size: %.0f x %.0f", displaySize.x, displaySize.y);
-		ImGui::Text("Trees in view: %d / %d", num_culled_large_trees, (int)large_tree_instance_transforms.size());
-		ImGui::Text("Grass in view: %d / %d", num_culled_grass, (int)grass_instance_transforms.size());
+		for (size_t i = 0; i < scene.size(); i++)
+			ImGui::Text("%s in view: %d / %d", scene.data[i].obj.c_str(), scene.visibleInstances(i), (int)max(scene.data[i].numInstances, 1u));
+		ImGui::Text("Chunks: %d resident, %d loading (%.1f / %.0f MB)", world.stats.resident, world.stats.loading, world.stats.residentBytes / 1048576.0f, world.memoryBudget / 1048576.0f);
+		ImGui::Text("Broadphase: %d proxies, %d pairs", collisions.count(), (int)collisions.pairs.size());
+		ImGui::Text("Chunk load: %.1f ms avg, %.1f ms max (%d loads, %d unloads, %d evictions)", world.stats.avgLoadMs, world.stats.maxLoadMs, world.stats.loads, world.stats.unloads, world.stats.evictions);
+		ImGui::Text("Shadow maps: %d cascades, %.1f MB, %d cache redraws", shadows.count, shadows.bytes() / 1048576.0f, shadows.cacheRefreshes);
+		ImGui::Text("GPU shadow pass: %.2f ms, main pass: %.2f ms", profiler.avgMs("Shadows"), profiler.avgMs("Main"));
+		ImGui::Text("Draw calls: %d (%d state changes, %.1f KB uploaded)", frameStats.draws, frameStats.stateChanges, frameStats.uploadBytes / 1024.0f);
+		ImGui::Text("Particles: %d / %d (%d stolen, %d dropped)", particleSystem.drawn, particleSystem.max_particles, particleSystem.stolen, particleSystem.dropped);
+		ImGui::Text("Particle CPU: sim %.2f ms, depth sort %.2f ms, pack %.2f ms", particleSystem.simMs, particleSystem.sortMs, particleSystem.packMs);
         ImGui::Separator();
         static ImPlotFlags plot_flags = ImPlotFlags_NoBoxSelect | ImPlotFlags_NoMouseText;
         ImPlot::PushStyleColor(ImPlotCol_FrameBg, {0.0f, 0.0f, 0.0f, 0.3f});
@@ -869,12 +637,14 @@ void render_imgui() {
 			ImGui::EndCombo();
 		}
 		if (ImGui::MenuItem("Frustum Culling", "CTRL + F", frustumCulling)) {
-			large_tree_mesh.loadInstances(large_tree_instance_transforms);
-			num_culled_large_trees = (int)large_tree_instance_transforms.size();
-			grass_mesh.loadInstances(grass_instance_transforms);
-			num_culled_grass = (int)grass_instance_transforms.size();
+			frustumCulling = !frustumCulling;
+			if (!frustumCulling) scene.resetCulling();
 		}
 		if (ImGui::MenuItem("Shadow Map Display", "CTRL + M", showShadowMap)) showShadowMap = !showShadowMap;
+		if (ImGui::MenuItem("Static Shadow Caching", NULL, shadows.cacheStatic)) {
+			shadows.cacheStatic = !shadows.cacheStatic;
+			shadows.invalidate();
+		}
 		ImGui::EndMenu();
 	}
     if (ImGui::BeginMenu("Settings")) {
@@ -911,25 +681,8 @@ void setup() {
 	shadowPassInst.loadShaders(&shadowVertInstanced, &shadowFrag);
 	phongPass.loadShaders(&phongVert, &phongFrag);
 	phongPassInst.loadShaders(&phongVertInstanced, &phongFrag);
-    // Set up shadowmap resources
-    glGenFramebuffers(1, &shadowFramebuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowFramebuffer);
-    glGenTextures(1, &shadowTexture);
-    glBindTexture(GL_TEXTURE_2D, shadowTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, SHADOW_DIM, SHADOW_DIM, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowTexture, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        throw runtime_error("Failed to set up shadow framebuffer!");
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // Set up shadow cascades
+    shadows.setup();
 	// Setup meshes
 	mat4 car_transform = Scale(0.75f) * RotateY(-90);
 	Mesh car_mesh = Mesh("objects/car.obj", "textures/car.png", car_transform);
@@ -937,21 +690,18 @@ void setup() {
 	car = Car(car_mesh, 500.0, 3, 10.0, 10.0);
 	car.pos = vec3(2, 0, 0);
 	floor_mesh = Mesh(floor_points, floor_uvs, floor_normals, floor_triangles, "textures/racetrack.png");
-    mat4 large_tree_transform = Scale(2.0);
-	large_tree_mesh = Mesh("objects/largetree.obj", "textures/largetree.png", large_tree_transform);
-	grass_mesh = Mesh("objects/grass.obj", "textures/grass.png", mat4());
 	cloud_mesh = Mesh("objects/cloud.obj", "textures/cloud.png", Scale(4.0f));
 	campfire_mesh = Mesh("objects/campfire.obj", "textures/campfire.png", Scale(0.5f));
 	sleeping_bag_mesh = Mesh("objects/sleeping_bag.obj", "textures/sleeping_bag.png", Translate(0.0f, 0.05f, 0.0f));
     // Setup instance render buffers
-	for (vec3 pos : large_tree_instance_positions)
-		large_tree_instance_transforms.push_back(Translate(pos) * RotateY(rand_float(-180.0f, 180.0f)));
-	large_tree_mesh.setupInstanceBuffer((GLsizei)large_tree_instance_transforms.size());
-	large_tree_mesh.loadInstances(large_tree_instance_transforms); 
-	for (vec3 pos : grass_instance_positions)
-		grass_instance_transforms.push_back(Translate(pos) * RotateY(rand_float(-180.0f, 180.0f)));
-	grass_mesh.setupInstanceBuffer((GLsizei)grass_instance_transforms.size());
-	grass_mesh.loadInstances(grass_instance_transforms); 
+	scene = SceneGraph("scenes/drive.scgb");
+	collisions.margin = 0.5f;
+	addTrunks(scene, arenaTrunks);
+	carProxy = collisions.create(Bounds::sphere(car.pos, CAR_RADIUS), CAR);
+	world.source = generate_chunk;
+	// Ground under the streamed world, texture repeats every 8 units
+	float ground_uv = world.extent() / 4.0f;
+	ground_mesh = Mesh(floor_points, { {0.0f, 0.0f}, {ground_uv, 0.0f}, {ground_uv, ground_uv}, {0.0f, ground_uv} }, floor_normals, floor_triangles, "textures/sand.png");
 	for (int i = 0; i < 500; i++) {
 		mat4 m;
 		m = Scale(rand_float(3, 6)) * m;
@@ -961,9 +711,6 @@ void setup() {
 	}
 	cloud_mesh.setupInstanceBuffer((GLsizei)cloud_instance_transforms.size());
 	cloud_mesh.loadInstances(cloud_instance_transforms);
-	// Setup colliders
-	large_tree_mesh.createCollider<Sphere>();
-	grass_mesh.createCollider<Sphere>();
 	// Setup skyboxes
 	for (string path : skyboxPaths) {
 		Skybox skybox;
@@ -985,8 +732,9 @@ void cleanup() {
 	// Cleanup meshes
 	car.mesh.cleanup();
 	floor_mesh.cleanup();
-	large_tree_mesh.cleanup();
-	grass_mesh.cleanup();
+	scene.cleanup();
+	world.cleanup();
+	ground_mesh.cleanup();
 	campfire_mesh.cleanup();
 	sleeping_bag_mesh.cleanup();
 	cloud_mesh.cleanup();
@@ -995,8 +743,8 @@ void cleanup() {
 		skybox.cleanup();
     particleSystem.cleanup();
     // Cleanup shadow map resources
-	glDeleteFramebuffers(1, &shadowFramebuffer);
-	glDeleteTextures(1, &shadowTexture);
+	shadows.cleanup();
+	profiler.cleanup();
 	// Cleanup render passes
 	mainPass.cleanup();
 	mainPassInst.cleanup();
@@ -1006,6 +754,100 @@ void cleanup() {
 	phongPassInst.cleanup();
 }
 
+// Replays recorded commands with GL, counting them for the performance window
+void submit(const CommandList& list) {
+	GLBackend gl;
+	replay(list, gl);
+	gl.finish();
+	replay(list, frameStats);
+}
+
+void record_static_meshes(CommandList& cmds, RenderPass& pass) {
+	GLint model = pass.location("model"), transform = pass.location("transform");
+	cmds.uniform(model, floor_mesh.model);
+	cmds.uniform(transform, Scale(60));
+	floor_mesh.record(cmds);
+	cmds.uniform(model, ground_mesh.model);
+	cmds.uniform(transform, Translate(0, -0.01f, 0) * Scale(world.extent()));
+	ground_mesh.record(cmds);
+	cmds.uniform(model, campfire_mesh.model);
+	cmds.uniform(transform, Translate(-16.62f, 0, 11.89f));
+	campfire_mesh.record(cmds);
+	cmds.uniform(model, sleeping_bag_mesh.model);
+	cmds.uniform(transform, Translate(-17.86f, 0, 10.67f) * RotateY(-40.0f));
+	sleeping_bag_mesh.record(cmds);
+	cmds.uniform(transform, Translate(-15.92f, 0, 10.98f) * RotateY(45.0f));
+	sleeping_bag_mesh.record(cmds);
+}
+
+void record_dynamic_meshes(CommandList& cmds, RenderPass& pass) {
+	cmds.uniform(pass.location("model"), car.mesh.model);
+	cmds.uniform(pass.location("transform"), car.transform());
+	car.mesh.record(cmds);
+}
+
+void record_static_casters(CommandList& cmds, int c) {
+	cmds.useProgram(shadowPass.program);
+	cmds.uniform(shadowPass.location("depth_vp"), shadows.vp[c]);
+	record_static_meshes(cmds, shadowPass);
+	// Instanced rendering shadow map, culled to the cascade
+	cmds.useProgram(shadowPassInst.program);
+	cmds.uniform(shadowPassInst.location("depth_vp"), shadows.vp[c]);
+	vector<mat4> scratch;
+	auto inCascade = [c](vec3 center, float radius) { return shadows.casts(c, center, radius); };
+	for (SceneGraph* s : visibleScenes) s->recordCasters(cmds, shadowPassInst, scratch, inCascade);
+}
+
+void record_shadow_cascade(CommandList& cmds, int c) {
+	cmds.cullFace(GL_FRONT);
+	if (shadows.cacheStatic) {
+		// Static casters only when the cache went stale, then start from the cache
+		if (shadows.refresh[c]) {
+			shadows.recordTarget(cmds, c, true);
+			record_static_casters(cmds, c);
+		}
+		shadows.recordCacheCopy(cmds, c);
+	} else {
+		shadows.recordTarget(cmds, c);
+		record_static_casters(cmds, c);
+	}
+	// Dynamic casters over the top
+	cmds.useProgram(shadowPass.program);
+	cmds.uniform(shadowPass.location("depth_vp"), shadows.vp[c]);
+	record_dynamic_meshes(cmds, shadowPass);
+}
+
+void record_main_pass(CommandList& cmds) {
+	cmds.bindFramebuffer(0);
+	cmds.viewport(0, 0, win_width, win_height);
+	cmds.clear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+	cmds.cullFace(GL_BACK);
+	cmds.useProgram(mainPass.program);
+	shadows.recordSampling(cmds, mainPass);
+	cmds.uniform(mainPass.location("txtr"), 0);
+	cmds.uniform(mainPass.location("lightColor"), vec3(lightColor[0], lightColor[1], lightColor[2]));
+	cmds.uniform(mainPass.location("persp"), camera.persp);
+	cmds.uniform(mainPass.location("view"), camera.view);
+	record_static_meshes(cmds, mainPass);
+	record_dynamic_meshes(cmds, mainPass);
+}
+
+void record_main_pass_instanced(CommandList& cmds) {
+	cmds.useProgram(mainPassInst.program);
+	shadows.recordSampling(cmds, mainPassInst);
+	cmds.uniform(mainPassInst.location("txtr"), 0);
+	cmds.uniform(mainPassInst.location("lightColor"), vec3(lightColor[0], lightColor[1], lightColor[2]));
+	cmds.uniform(mainPassInst.location("persp"), camera.persp);
+	cmds.uniform(mainPassInst.location("view"), camera.view);
+	for (SceneGraph* s : visibleScenes) s->record(cmds, mainPassInst);
+	cmds.useProgram(phongPassInst.program);
+	cmds.uniform(phongPassInst.location("persp"), camera.persp);
+	cmds.uniform(phongPassInst.location("view"), camera.view);
+	cmds.uniform(phongPassInst.location("model"), cloud_mesh.model);
+	cmds.uniform(phongPassInst.location("txtr"), 0);
+	cloud_mesh.recordInstanced(cmds);
+}
+
 void draw() {
 	// Update camera
 	if (camera_type == 1) { // Third person chase camera
@@ -1026,97 +868,40 @@ void draw() {
 		camera.fov = 60;
 	}
 	camera.update();
+	shadows.update(camera, world.version);
+	visibleScenes = world.residentScenes();
+	visibleScenes.push_back(&scene);
+	// Cull instances out of frustum on worker threads
 	if (frustumCulling) {
-		// Cull instances out of frustum, update instances
-        Frustum frustum(camera);
-        vector<mat4> culled_large_trees = cull_instances_sphere(frustum, large_tree_mesh.collider, large_tree_instance_transforms);
-		large_tree_mesh.loadInstances(culled_large_trees);
-		num_culled_large_trees = (int)culled_large_trees.size();
-        vector<mat4> culled_grass = cull_instances_sphere(frustum, grass_mesh.collider, grass_instance_transforms);
-		grass_mesh.loadInstances(culled_grass);
-		num_culled_grass = (int)culled_grass.size();
+		Frustum frustum(camera);
+		vector<std::pair<SceneGraph*, size_t>> meshes;
+		for (SceneGraph* s : visibleScenes)
+			for (size_t i = 0; i < s->size(); i++) meshes.push_back({ s, i });
+		workers.parallelFor((int)meshes.size(), [&](int begin, int end, int) {
+			for (int m = begin; m < end; m++) meshes[m].first->cull(meshes[m].second, frustum);
+		});
 	}
-	// Draw scene to depth buffer
-	glBindFramebuffer(GL_FRAMEBUFFER, shadowFramebuffer);
-	glViewport(0, 0, SHADOW_DIM, SHADOW_DIM);
-	glClear(GL_DEPTH_BUFFER_BIT);
-	glCullFace(GL_FRONT);
-	// Rendering shadow map
-	shadowPass.use();
-	mat4 depthProj = Orthographic(-80, 80, -80, 80, -20, 100);
-	mat4 depthView = LookAt(vec3(20, 30, 20), vec3(0, 0, 0), vec3(0, 1, 0));
-	mat4 depthVP = depthProj * depthView;
-	shadowPass.set("depth_vp", depthVP);
-	shadowPass.set("model", floor_mesh.model);
-	shadowPass.set("transform", Scale(60));
-	floor_mesh.render();
-	shadowPass.set("model", campfire_mesh.model);
-	shadowPass.set("transform", Translate(-16.62f, 0, 11.89f));
-	campfire_mesh.render();
-	shadowPass.set("model", sleeping_bag_mesh.model);
-	shadowPass.set("transform", Translate(-17.86f, 0, 10.67f) * RotateY(-40.0f));
-	sleeping_bag_mesh.render();
-	shadowPass.set("transform", Translate(-15.92f, 0, 10.98f) * RotateY(45.0f));
-	sleeping_bag_mesh.render();
-	shadowPass.set("model", car.mesh.model);
-	shadowPass.set("transform", car.transform());
-	car.mesh.render();
-	// Instanced rendering shadow map
-	shadowPassInst.use();
-	shadowPassInst.set("depth_vp", depthVP);
-	shadowPassInst.set("model", large_tree_mesh.model);
-	large_tree_mesh.renderInstanced();
-	shadowPassInst.set("model", grass_mesh.model);
-	grass_mesh.renderInstanced();
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0, 0, win_width, win_height);
-	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-	glCullFace(GL_BACK);
-	// Rendering main pass
-	mainPass.use();
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, shadowTexture);
-	mainPass.set("txtr", 0);
-	mainPass.set("shadow", 1);
-	mainPass.set("lightColor", vec3(lightColor[0], lightColor[1], lightColor[2]));
-	mainPass.set("depth_vp", depthVP);
-	mainPass.set("persp", camera.persp);
-	mainPass.set("view", camera.view);
-	mainPass.set("model", floor_mesh.model);
-	mainPass.set("transform", Scale(60));
-	floor_mesh.render();
-	mainPass.set("model", campfire_mesh.model);
-	mainPass.set("transform", Translate(-16.62f, 0, 11.89f));
-	campfire_mesh.render();
-	mainPass.set("model", sleeping_bag_mesh.model);
-	mainPass.set("transform", Translate(-17.86f, 0, 10.67f) * RotateY(-40.0f));
-	sleeping_bag_mesh.render();
-	mainPass.set("transform", Translate(-15.92f, 0, 10.98f) * RotateY(45.0f));
-	sleeping_bag_mesh.render();
-	mainPass.set("model", car.mesh.model);
-	mainPass.set("transform", car.transform());
-	car.mesh.render();
-    particleSystem.draw(dt, camera.persp * camera.view, floor_mesh.texture, 60);
+	// Record cascades and main passes in parallel now that instances are culled
+	vector<std::function<void(CommandList&)>> recorders;
+	for (int c = 0; c < shadows.count; c++)
+		recorders.push_back([c](CommandList& cmds) { record_shadow_cascade(cmds, c); });
+	recorders.push_back(record_main_pass);
+	recorders.push_back(record_main_pass_instanced);
+	recordParallel(workers, passCommands, recorders);
+	// Replay on GL thread in pass order
+	frameStats = CommandStats();
+	profiler.begin("Shadows");
+	for (int c = 0; c < shadows.count; c++) submit(passCommands[c]);
+	profiler.end();
+	profiler.begin("Main");
+	submit(passCommands[shadows.count]);
+	particleSystem.draw(camera.persp * camera.view, floor_mesh.texture, 60);
 	skyboxes[cur_skybox].draw(camera.look - camera.loc, camera.up, camera.persp);
-    // Rendering instanced main pass
-	mainPassInst.use();
-	mainPassInst.set("txtr", 0);
-	mainPassInst.set("shadow", 1);
-	mainPassInst.set("lightColor", vec3(lightColor[0], lightColor[1], lightColor[2]));
-	mainPassInst.set("depth_vp", depthVP);
-	mainPassInst.set("persp", camera.persp);
-	mainPassInst.set("view", camera.view);
-	mainPassInst.set("model", large_tree_mesh.model);
-	large_tree_mesh.renderInstanced();
-	mainPassInst.set("model", grass_mesh.model);
-    grass_mesh.renderInstanced();
-	phongPassInst.use();
-	phongPassInst.set("persp", camera.persp);
-	phongPassInst.set("view", camera.view);
-	phongPassInst.set("model", cloud_mesh.model);
-	phongPassInst.set("txtr", 0);
-	cloud_mesh.renderInstanced();
-	if (showShadowMap) TextureDebug::show(shadowTexture, 0, 0, 512, 512);
+	submit(passCommands[shadows.count + 1]);
+	profiler.end();
+	profiler.nextFrame();
+	if (showShadowMap)
+		for (int c = 0; c < shadows.count; c++) TextureDebug::show(shadows.textures[c], c * 256, 0, 256, 256);
 	render_imgui();
 	glFlush();
 }
@@ -1172,7 +957,12 @@ int main() {
 		update_title(cur);
         collect_perf(cur);
 		car.update(dt);
+		syncTrunks();
 		car.collide();
+		particleSystem.eye = camera.loc;
+		particleSystem.updateAsync(workers, dt);
+		// Car velocity is per 1/60 s
+		world.update(car.pos, 60.0f * car.vel);
 		draw();
 		glfwPollEvents();
 		glfwSwapBuffers(window);
@@ -0,0 +1,112 @@
+// flock-bench.cpp : Times Flock steps without a window or GL, Devon McKee
+// flock-bench [--boids n] [--perception r] [--threads n] [--seed n] [--steps n] [--no-check]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include "dBoids.h"
+
+using sys_clock = std::chrono::system_clock;
+using float_ms = std::chrono::duration<float, std::milli>;
+
+float percentile(const vector<float>& sorted, float p) {
+	return sorted[std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5f))];
+}
+
+int main(int argc, char** argv) {
+	int count = 100000, steps = 50, threads = (int)std::thread::hardware_concurrency();
+	// boids-3d's 0.3 with 150 boids sees a couple of neighbors, 100k boids at 0.05 see a few dozen
+	float perception = 0.05f;
+	uint64_t seed = 1;
+	bool check = true, usage = false;
+	for (int i = 1; i < argc && !usage; i++) {
+		bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "--boids") && more) count = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--perception") && more) perception = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && more) threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--seed") && more) seed = strtoull(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--steps") && more) steps = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--no-check")) check = false;
+		else usage = true;
+	}
+	if (usage || count < 1 || steps < 1) {
+		printf("Usage: %s [--boids n] [--perception r] [--threads n] [--seed n] [--steps n] [--no-check]\n", argv[0]);
+		return 2;
+	}
+	ThreadPool pool(threads);
+	Flock flock;
+	flock.settings.perception = perception;
+	flock.randomize(count, 4, seed);
+	Flock start = flock;
+	printf("%i boids, perception %.3f, seed %llu, %i steps, %i threads\n", count, perception, (unsigned long long)seed, steps, pool.size());
+	vector<float> stepMs;
+	size_t pairs = 0;
+	for (int s = 0; s < steps; s++) {
+		auto begin = sys_clock::now();
+		flock.step(&pool);
+		stepMs.push_back(float_ms(sys_clock::now() - begin).count());
+		pairs += flock.pairsTested;
+	}
+	vector<float> sorted = stepMs;
+	std::sort(sorted.begin(), sorted.end());
+	float total = 0.0f;
+	for (float ms : stepMs) total += ms;
+	printf("Step (%i^3 cells): mean %.3f ms, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+		flock.grid.n, total / steps, percentile(sorted, 0.5f), percentile(sorted, 0.9f), percentile(sorted, 0.99f), sorted.back());
+	printf("Distance tests / boid: %.1f\n", (double)pairs / steps / count);
+	printf("Checksum: %016llx\n", (unsigned long long)flock.checksum());
+	if (!check) return 0;
+	// Same flock on one thread, which must end in exactly the same state
+	Flock serial = start;
+	for (int s = 0; s < steps; s++) serial.step();
+	bool matches = serial.checksum() == flock.checksum();
+	printf("One thread: %s\n", matches ? "matches" : "DIFFERS");
+	// Kernels alone from the same state: the scalar reference against the fused SIMD pass
+	Flock scalar, simd; // the first step of each
+	float scalarMs = 0.0f, simdMs = 0.0f;
+	int kernelSteps = std::min(steps, 10);
+	for (int s = 0; s < kernelSteps; s++) {
+		Flock a = start, b = start;
+		a.useSimd = false;
+		auto begin = sys_clock::now();
+		a.step();
+		auto mid = sys_clock::now();
+		b.step();
+		scalarMs += float_ms(mid - begin).count();
+		simdMs += float_ms(sys_clock::now() - mid).count();
+		if (s == 0) {
+			scalar = a;
+			simd = b;
+		}
+	}
+	float maxError = 0.0f;
+	for (int i = 0; i < count; i++)
+		maxError = std::max(maxError, length(simd.boids[i].v - scalar.boids[i].v) / flock.settings.speed);
+	bool accurate = maxError < 1e-3f;
+	printf("One step, one thread: scalar %.3f ms, SIMD %.3f ms (%.2fx), max velocity error %.2e of speed%s\n",
+		scalarMs / kernelSteps, simdMs / kernelSteps, scalarMs / simdMs, maxError, accurate ? "" : " TOO HIGH");
+	// Brute force on a small flock, which the scalar grid must match exactly
+	int small = std::min(count, 4000);
+	Flock grid, brute;
+	grid.settings.perception = brute.settings.perception = perception;
+	grid.randomize(small, 4, seed + 1);
+	brute.randomize(small, 4, seed + 1);
+	brute.useGrid = false;
+	grid.useSimd = false;
+	float gridMs = 0.0f, bruteMs = 0.0f;
+	for (int s = 0; s < kernelSteps; s++) {
+		auto begin = sys_clock::now();
+		grid.step();
+		auto mid = sys_clock::now();
+		brute.step();
+		gridMs += float_ms(mid - begin).count();
+		bruteMs += float_ms(sys_clock::now() - mid).count();
+	}
+	bool same = grid.checksum() == brute.checksum();
+	printf("%i boids: grid %.3f ms / step, brute force %.3f ms / step, %s\n",
+		small, gridMs / kernelSteps, bruteMs / kernelSteps, same ? "matches" : "DIFFERS");
+	return same && matches && accurate ? 0 : 1;
+}
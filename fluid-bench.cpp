@@ -0,0 +1,276 @@
+// fluid-bench.cpp : Times FluidGrid and SparseFluidGrid steps without a window or GL, Devon McKee
+// fluid-bench [--size n] [--steps n] [--threads n] [--scene dam|lake|drop] [--grid dense|sparse|both] [--mesh] [--no-check]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <map>
+#include <array>
+#include "dFluidGrid.h"
+#include "dSparseFluid.h"
+#include "dFluidMesh.h"
+
+using sys_clock = std::chrono::system_clock;
+using float_ms = std::chrono::duration<float, std::milli>;
+
+enum Scene { DAM, LAKE, DROP };
+
+const char* sceneNames[] = { "dam break", "lake", "drop" };
+
+float percentile(const vector<float>& sorted, float p) {
+	return sorted[std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5f))];
+}
+
+// An n^3 box with a floor and a low wall across it, then either a dam break (a quarter of the box
+// full of water on one side of the wall), a lake (a level layer of water already at rest) or a
+// drop (a ball of water falling into the empty box, little of the domain ever wet)
+template <typename Grid>
+void buildScene(Grid& grid, int n, Scene scene) {
+	grid.resize(n, n, n);
+	for (int z = 0; z < n; z++)
+		for (int x = 0; x < n; x++) grid.setBlock(x, 0, z, true);
+	for (int y = 1; y < n / 4; y++)
+		for (int z = 0; z < n * 3 / 4; z++)
+			for (int x = n / 3; x < n / 3 + 2; x++) grid.setBlock(x, y, z, true);
+	if (scene == DROP) {
+		int r = n / 8, cx = n * 2 / 3, cy = n * 3 / 4, cz = n / 2;
+		for (int z = cz - r; z <= cz + r; z++)
+			for (int y = cy - r; y <= cy + r; y++)
+				for (int x = cx - r; x <= cx + r; x++)
+					if ((x - cx) * (x - cx) + (y - cy) * (y - cy) + (z - cz) * (z - cz) <= r * r) grid.addWater(x, y, z, 1.0f);
+		return;
+	}
+	bool dam = scene == DAM;
+	for (int z = 0; z < n; z++)
+		for (int y = 1; y < (dam ? n * 3 / 4 : n / 8); y++)
+			for (int x = 0; x < (dam ? n / 3 : n); x++) grid.addWater(x, y, z, 1.0f);
+}
+
+template <typename Grid>
+uint64_t checksum(const Grid& grid) {
+	uint64_t h = 14695981039346656037ull;
+	for (int z = 0; z < grid.depth; z++)
+		for (int y = 0; y < grid.height; y++)
+			for (int x = 0; x < grid.width; x++) {
+				float l = grid.level(x, y, z);
+				uint32_t bits;
+				memcpy(&bits, &l, 4);
+				h = (h ^ bits) * 1099511628211ull;
+			}
+	return h;
+}
+
+size_t updatedUnits(const FluidGrid& g) { return g.rowsUpdated; }
+size_t updatedUnits(const SparseFluidGrid& g) { return g.bricksUpdated; }
+size_t unitCount(const FluidGrid& g) { return g.rowCount(); }
+size_t unitCount(const SparseFluidGrid& g) { return g.brickCount(); }
+
+// Steps grid, printing step times and, per quarter of the run, memory and (for the sparse grid) how
+// many bricks are allocated. Returns the mean step in ms
+template <typename Grid>
+float timeSteps(Grid& grid, const char* name, const char* units, int steps, ThreadPool& pool, bool sparse) {
+	double water = grid.totalWater();
+	vector<float> stepMs;
+	size_t run = 0;
+	for (int s = 0; s < steps; s++) {
+		auto begin = sys_clock::now();
+		grid.step(&pool);
+		stepMs.push_back(float_ms(sys_clock::now() - begin).count());
+		run += updatedUnits(grid);
+		if ((s + 1) % std::max(1, steps / 4) == 0 || s + 1 == steps) {
+			float recent = 0.0f;
+			int count = std::min(s + 1, std::max(1, steps / 4));
+			for (int i = s + 1 - count; i <= s; i++) recent += stepMs[i];
+			printf("  %-6s step %4i: %7.1f MB", name, s + 1, grid.memoryBytes() / 1048576.0);
+			if (sparse) {
+				const SparseFluidGrid& g = (const SparseFluidGrid&)grid;
+				printf(", %6zu of %zu bricks (%.1f%%)", g.allocatedBricks(), g.brickCount(), 100.0 * g.allocatedBricks() / g.brickCount());
+			}
+			printf(", %.3f ms / step\n", recent / count);
+		}
+	}
+	vector<float> sorted = stepMs;
+	std::sort(sorted.begin(), sorted.end());
+	float total = 0.0f;
+	for (float ms : stepMs) total += ms;
+	printf("%s: mean %.3f ms (%.1f steps / s), p50 %.3f, p90 %.3f, max %.3f, %.1f%% of %s active\n", name,
+		total / steps, 1000.0f * steps / total, percentile(sorted, 0.5f), percentile(sorted, 0.9f), sorted.back(),
+		100.0 * run / steps / unitCount(grid), units);
+	printf("%s: water %.0f cells, drift %.2e, checksum %016llx\n", name, water, grid.totalWater() / water - 1.0,
+		(unsigned long long)checksum(grid));
+	return total / steps;
+}
+
+// Every directed edge of the water triangles must be matched by the same edge the other way round, by
+// exact positions, for the surface to be closed across cubes and chunks. Returns unmatched edges
+size_t openEdges(const FluidMesher& mesher, const SparseFluidGrid& grid, double& volume) {
+	std::map<std::array<float, 6>, int> edges;
+	volume = 0.0;
+	for (int z = 0; z < grid.bricksZ(); z++)
+		for (int y = 0; y < grid.bricksY(); y++)
+			for (int x = 0; x < grid.bricksX(); x++) {
+				const vector<MeshVertex>& w = mesher.chunk(x, y, z).water;
+				for (size_t t = 0; t < w.size(); t += 3) {
+					volume += dot(w[t].point, cross(w[t + 1].point, w[t + 2].point)) / 6.0;
+					for (int k = 0; k < 3; k++) {
+						vec3 a = w[t + k].point, b = w[t + (k + 1) % 3].point;
+						if (a.x == b.x && a.y == b.y && a.z == b.z) continue;
+						edges[{ a.x, a.y, a.z, b.x, b.y, b.z }]++;
+						edges[{ b.x, b.y, b.z, a.x, a.y, a.z }]--;
+					}
+				}
+			}
+	size_t open = 0;
+	for (const auto& e : edges) open += e.second != 0;
+	return open;
+}
+
+bool sameMeshes(const FluidMesher& a, const FluidMesher& b, const SparseFluidGrid& grid) {
+	auto same = [](const vector<MeshVertex>& u, const vector<MeshVertex>& v) {
+		return u.size() == v.size() && (u.empty() || !memcmp(u.data(), v.data(), u.size() * sizeof(MeshVertex)));
+	};
+	for (int z = 0; z < grid.bricksZ(); z++)
+		for (int y = 0; y < grid.bricksY(); y++)
+			for (int x = 0; x < grid.bricksX(); x++)
+				if (!same(a.chunk(x, y, z).blocks, b.chunk(x, y, z).blocks) || !same(a.chunk(x, y, z).water, b.chunk(x, y, z).water)) return false;
+	return true;
+}
+
+// Steps a sparse grid with a FluidMesher keeping up after every step, as fluid.cpp does per frame.
+// The incremental meshes must end as a full remesh would make them, and the water surface closed
+int timeMeshing(int size, Scene scene, int steps, ThreadPool& pool) {
+	SparseFluidGrid grid;
+	buildScene(grid, size, scene);
+	FluidMesher mesher;
+	auto begin = sys_clock::now();
+	mesher.update(grid, &pool);
+	float firstMs = float_ms(sys_clock::now() - begin).count();
+	size_t firstBricks = mesher.bricksMeshed, remeshed = 0;
+	vector<float> meshMs;
+	for (int s = 0; s < steps; s++) {
+		grid.step(&pool);
+		begin = sys_clock::now();
+		mesher.update(grid, &pool);
+		meshMs.push_back(float_ms(sys_clock::now() - begin).count());
+		remeshed += mesher.bricksMeshed;
+	}
+	vector<float> sorted = meshMs;
+	std::sort(sorted.begin(), sorted.end());
+	float total = 0.0f;
+	for (float ms : meshMs) total += ms;
+	size_t blockTris = 0, waterTris = 0;
+	for (int z = 0; z < grid.bricksZ(); z++)
+		for (int y = 0; y < grid.bricksY(); y++)
+			for (int x = 0; x < grid.bricksX(); x++) {
+				blockTris += mesher.chunk(x, y, z).blocks.size() / 3;
+				waterTris += mesher.chunk(x, y, z).water.size() / 3;
+			}
+	printf("Mesh: first %.1f ms (%zu bricks), then mean %.3f ms, p90 %.3f, max %.3f, %.0f of %zu bricks remeshed per step\n",
+		firstMs, firstBricks, total / steps, percentile(sorted, 0.9f), sorted.back(), (double)remeshed / steps, grid.brickCount());
+	double volume;
+	size_t open = openEdges(mesher, grid, volume);
+	FluidMesher full;
+	full.update(grid);
+	bool same = sameMeshes(mesher, full, grid);
+	printf("Mesh: %zu block, %zu water triangles, surface encloses %.0f cells (water %.0f), %zu open edges, incremental vs full remesh %s\n",
+		blockTris, waterTris, volume, grid.totalWater(), open, same ? "match" : "DIFFER");
+	return open == 0 && same ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+	int size = 256, steps = 120, threads = (int)std::thread::hardware_concurrency();
+	Scene scene = DAM;
+	bool dense = true, sparse = true, mesh = false, check = true;
+	for (int i = 1; i < argc; i++) {
+		bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "--size") && more) size = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--steps") && more) steps = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && more) threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--scene") && more) {
+			i++;
+			scene = !strcmp(argv[i], "lake") ? LAKE : !strcmp(argv[i], "drop") ? DROP : DAM;
+		}
+		else if (!strcmp(argv[i], "--grid") && more) {
+			i++;
+			dense = strcmp(argv[i], "sparse") != 0;
+			sparse = strcmp(argv[i], "dense") != 0;
+		}
+		else if (!strcmp(argv[i], "--mesh")) mesh = true;
+		else if (!strcmp(argv[i], "--no-check")) check = false;
+		else {
+			printf("Usage: %s [--size n] [--steps n] [--threads n] [--scene dam|lake|drop] [--grid dense|sparse|both] [--mesh] [--no-check]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (size < 8 || steps < 1) return 2;
+	ThreadPool pool(threads);
+	printf("%i^3 %s, %i steps, %i threads\n", size, sceneNames[scene], steps, pool.size());
+	uint64_t denseSum = 0, sparseSum = 0;
+	float denseMs = 0.0f, sparseMs = 0.0f;
+	size_t denseBytes = 0, sparseBytes = 0;
+	if (dense) {
+		FluidGrid grid;
+		auto setup = sys_clock::now();
+		buildScene(grid, size, scene);
+		printf("Dense setup %.0f ms\n", float_ms(sys_clock::now() - setup).count());
+		denseMs = timeSteps(grid, "Dense", "rows", steps, pool, false);
+		denseSum = checksum(grid);
+		denseBytes = grid.memoryBytes();
+	}
+	if (sparse) {
+		SparseFluidGrid grid;
+		auto setup = sys_clock::now();
+		buildScene(grid, size, scene);
+		printf("Sparse setup %.0f ms\n", float_ms(sys_clock::now() - setup).count());
+		sparseMs = timeSteps(grid, "Sparse", "bricks", steps, pool, true);
+		sparseSum = checksum(grid);
+		sparseBytes = grid.memoryBytes();
+	}
+	int result = 0;
+	if (dense && sparse) {
+		printf("Sparse vs dense: %.2fx the memory, %.2fx the step time, levels %s\n", (double)sparseBytes / denseBytes,
+			sparseMs / denseMs, sparseSum == denseSum ? "match" : "DIFFER");
+		if (sparseSum != denseSum) result = 1;
+	}
+	if (mesh && timeMeshing(size, scene, steps, pool)) result = 1;
+	if (!check) return result;
+	// Skipping settled rows and bricks and splitting work over threads must all leave every level as it was
+	int n = std::min(size, 48), checkSteps = 400;
+	FluidGrid active, all, threaded;
+	SparseFluidGrid bricks, bricksThreaded;
+	for (FluidGrid* g : {&active, &all, &threaded}) buildScene(*g, n, scene);
+	for (SparseFluidGrid* g : {&bricks, &bricksThreaded}) buildScene(*g, n, scene);
+	all.useActive = false;
+	for (int s = 0; s < checkSteps; s++) {
+		active.step();
+		all.step();
+		threaded.step(&pool);
+		bricks.step();
+		bricksThreaded.step(&pool);
+	}
+	uint64_t sum = checksum(active);
+	bool same = sum == checksum(all) && sum == checksum(threaded) && sum == checksum(bricks) && sum == checksum(bricksThreaded);
+	printf("Check %i^3, %i steps: active rows vs every row vs threads vs sparse bricks %s\n", n, checkSteps, same ? "match" : "DIFFER");
+	if (!same) result = 1;
+	// Settled water costs nothing: an empty box and a full 1 deep pool on its floor both go quiet
+	int quiet[2] = { -1, -1 };
+	for (int full = 0; full < 2; full++) {
+		FluidGrid pool32;
+		pool32.resize(32, 32, 32);
+		for (int z = 0; z < 32; z++)
+			for (int x = 0; x < 32; x++) {
+				pool32.setBlock(x, 0, z, true);
+				if (full) pool32.addWater(x, 1, z, 1.0f);
+			}
+		for (int s = 0; s < 10 && quiet[full] < 0; s++) {
+			pool32.step();
+			if (pool32.rowsUpdated == 0) quiet[full] = s + 1;
+		}
+	}
+	bool settled = quiet[0] > 0 && quiet[1] > 0;
+	printf("Check 32^3 empty / 1 deep pool: 0 active rows after %i / %i steps, %s\n", quiet[0], quiet[1], settled ? "ok" : "NEVER SETTLED");
+	return settled ? result : 1;
+}
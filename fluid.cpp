@@ -5,84 +5,155 @@
 #include "GLXtras.h"
 #include <time.h>
 #include <vector>
+#include <algorithm>
 #include "VecMat.h"
 #include "Camera.h"
+#include "dSparseFluid.h"
+#include "dFluidMesh.h"
+#include "dSPH.h"
 
 GLuint vBuffer = 0;
 GLuint program = 0;
+GLuint meshProgram = 0;
+GLuint spriteProgram = 0;
 
 int win_width = 800;
 int win_height = 800;
 
 Camera camera((float)win_width / win_height, vec3(0, 0, 0), vec3(0, 0, -5));
+vec3 lightSource = vec3(1, 1, 0);
 
 float cube_points[][3] = { {-1, -1, 1}, {1, -1, 1}, {1, -1, -1}, {-1, -1, -1}, {-1, 1, -1}, {1, 1, -1}, {1, 1, 1}, {-1, 1, 1} };
 int cube_faces[][4] = { {0, 1, 2, 3}, {2, 3, 4, 5}, {4, 5, 6, 7}, {6, 7, 0, 1}, {0, 3, 4, 7}, {1, 2, 5, 6} };
 
-const int GRID_NUM = 4;
+const int GRID_NUM = 16;
+const float SPOUT_RATE = 0.5f; // water added per step at the top of the box
 
-enum CELL { AIR, BLOCK, WATER };
+ThreadPool workers;
 
-struct Cell {
-	CELL type = AIR;
-	float level = 0;
+// Steps the SparseFluidGrid and draws its surface: after each step the FluidMesher remeshes the
+// bricks around what changed (on the workers), and each region it lists is streamed again into that
+// region's vertex buffer, blocks then water. A frame draws two ranges per non-empty region
+struct RegionBuffer {
+	GLuint vBuffer = 0;
+	int blockVertices = 0, waterVertices = 0;
 };
 
 struct Grid {
-	std::vector<std::vector<std::vector<Cell>>> grid;
-	Grid() {
-		// Initialize grid
-		for (int i = 0; i < GRID_NUM; i++) {
-			grid.push_back(std::vector<std::vector<Cell>>());
-			for (int j = 0; j < GRID_NUM; j++) {
-				grid[i].push_back(std::vector<Cell>());
-				for (int k = 0; k < GRID_NUM; k++) {
-					grid[i][j].push_back(Cell());
-					grid[i][j][k].type = BLOCK;
-				}
-			}
+	SparseFluidGrid fluid; // stores only the bricks around water
+	FluidMesher mesher;
+	vector<RegionBuffer> regions;
+	vector<MeshVertex> blocks, water; // a region's mesh, while uploading
+	Grid() { Reset(); }
+	// A floor, a low wall across the box and a column of water behind it
+	void Reset() {
+		fluid.resize(GRID_NUM, GRID_NUM, GRID_NUM);
+		for (int i = 0; i < GRID_NUM; i++)
+			for (int k = 0; k < GRID_NUM; k++) fluid.setBlock(i, 0, k, true);
+		for (int j = 1; j < GRID_NUM / 4; j++)
+			for (int k = 0; k < GRID_NUM * 3 / 4; k++) fluid.setBlock(GRID_NUM / 2, j, k, true);
+		for (int i = 0; i < GRID_NUM / 4; i++)
+			for (int j = 1; j < GRID_NUM * 3 / 4; j++)
+				for (int k = 0; k < GRID_NUM / 4; k++) fluid.addWater(i, j, k, 1.0f);
+		mesher.offset = vec3(-1, -1, -1);
+		mesher.scale = 2.0f / GRID_NUM;
+	}
+	void Simulate() {
+		fluid.addWater(GRID_NUM * 3 / 4, GRID_NUM - 1, GRID_NUM / 2, SPOUT_RATE);
+		fluid.step(&workers);
+		const vector<int>& changed = mesher.update(fluid, &workers);
+		regions.resize(mesher.regionCount());
+		for (int r : changed) Upload(r);
+	}
+	// Orphans the region's buffer and writes its blocks then its water
+	void Upload(int r) {
+		RegionBuffer& b = regions[r];
+		mesher.regionMesh(r, blocks, water);
+		b.blockVertices = (int)blocks.size();
+		b.waterVertices = (int)water.size();
+		if (!b.vBuffer) glGenBuffers(1, &b.vBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, b.vBuffer);
+		glBufferData(GL_ARRAY_BUFFER, (blocks.size() + water.size()) * sizeof(MeshVertex), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, blocks.size() * sizeof(MeshVertex), blocks.data());
+		glBufferSubData(GL_ARRAY_BUFFER, blocks.size() * sizeof(MeshVertex), water.size() * sizeof(MeshVertex), water.data());
+	}
+	void Render() {
+		glUseProgram(meshProgram);
+		SetUniform(meshProgram, "persp", camera.persp);
+		SetUniform(meshProgram, "modelview", camera.modelview);
+		SetUniform(meshProgram, "light", lightSource);
+		for (RegionBuffer& b : regions) {
+			if (!b.blockVertices && !b.waterVertices)
+				continue;
+			glBindBuffer(GL_ARRAY_BUFFER, b.vBuffer);
+			VertexAttribPointer(meshProgram, "point", 3, sizeof(MeshVertex), (void*)0);
+			VertexAttribPointer(meshProgram, "normal", 3, sizeof(MeshVertex), (void*)sizeof(vec3));
+			SetUniform(meshProgram, "color", vec4(0.2f, 0.2f, 0.2f, 1));
+			glDrawArrays(GL_TRIANGLES, 0, b.blockVertices);
+			SetUniform(meshProgram, "color", vec4(0.1f, 0.3f, 0.9f, 1));
+			glDrawArrays(GL_TRIANGLES, b.blockVertices, b.waterVertices);
 		}
 	}
-	void DownwardFlow() {
-
+	void Release() {
+		for (RegionBuffer& b : regions)
+			if (b.vBuffer) glDeleteBuffers(1, &b.vBuffer);
+		regions.clear();
 	}
-	void SidewaysFlow() {
+};
 
-	}
-	void UpwardsFlow() {
+Grid grid;
 
+// The SPH fluid fills the same container, a column of water against one wall. A frame advances it by
+// a 60th of a second (at most SPH_SUBSTEPS substeps, slow motion beyond that) and streams each
+// particle's position and speed into one buffer, drawn as point sprites
+const float SPH_SPACING = 0.05f;
+const int SPH_SUBSTEPS = 16;
+
+struct Particles {
+	SPHFluid fluid;
+	GLuint vBuffer = 0;
+	vector<float> points; // x, y, z, speed per particle
+	Particles() { Reset(); }
+	void Reset() {
+		fluid.spacing = SPH_SPACING;
+		fluid.maxSubsteps = SPH_SUBSTEPS;
+		fluid.reset();
+		fluid.addBlock(vec3(-1, -1, -1), vec3(-0.5f, 0, 1));
+		fluid.setSoundSpeed(1.0f);
 	}
 	void Simulate() {
-
+		fluid.advance(1.0f / 60.0f, &workers);
 	}
 	void Render() {
-		SetUniform(program, "persp", camera.persp);
-		for (int i = 0; i < GRID_NUM; i++) {
-			for (int j = 0; j < GRID_NUM; j++) {
-				for (int k = 0; k < GRID_NUM; k++) {
-					float interval = 2.0 / GRID_NUM;
-					mat4 modelview = camera.modelview * Translate(interval * i - 1.0, interval * j - 1.0, interval * k - 1.0) * Scale(vec3(1 / GRID_NUM));
-					SetUniform(program, "modelview", modelview);
-					switch (grid[i][j][k].type) {
-						case BLOCK:
-							SetUniform(program, "color", vec4(0, 0, 0, 1));
-							break;
-						case WATER:
-							SetUniform(program, "color", vec4(0, 0, 1, 1));
-							break;
-					}
-					if (grid[i][j][k].type != AIR) {
-						for (int f = 0; f < 6; f++) {
-							glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_INT, cube_faces[f]);
-						}
-					}
-				}
-			}
+		int n = fluid.count();
+		points.resize(4 * n);
+		for (int i = 0; i < n; i++) {
+			float* p = &points[4 * i];
+			p[0] = fluid.px[i]; p[1] = fluid.py[i]; p[2] = fluid.pz[i];
+			p[3] = sqrtf(fluid.vx[i] * fluid.vx[i] + fluid.vy[i] * fluid.vy[i] + fluid.vz[i] * fluid.vz[i]);
 		}
+		if (!vBuffer) glGenBuffers(1, &vBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
+		glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(float), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, points.size() * sizeof(float), points.data());
+		glUseProgram(spriteProgram);
+		glEnable(GL_PROGRAM_POINT_SIZE);
+		SetUniform(spriteProgram, "persp", camera.persp);
+		SetUniform(spriteProgram, "modelview", camera.modelview);
+		SetUniform(spriteProgram, "light", lightSource);
+		SetUniform(spriteProgram, "size", 0.6f * SPH_SPACING);
+		SetUniform(spriteProgram, "pixelScale", camera.persp.row[1].y * win_height);
+		VertexAttribPointer(spriteProgram, "particle", 4, 0, (void*)0);
+		glDrawArrays(GL_POINTS, 0, n);
+	}
+	void Release() {
+		if (vBuffer) glDeleteBuffers(1, &vBuffer);
+		vBuffer = 0;
 	}
 };
 
-Grid grid;
+Particles particles;
+bool showParticles = false; // 'S' switches between the grid automaton and SPH
 
 const char* vertexShader = R"(
 	#version 130
@@ -103,6 +174,85 @@ const char* fragmentShader = R"(
 	}
 )";
 
+const char* meshVertexShader = R"(
+	#version 130
+	in vec3 point;
+	in vec3 normal;
+	out vec3 vPoint;
+	out vec3 vNormal;
+	uniform mat4 persp;
+	uniform mat4 modelview;
+	void main() {
+		vPoint = (modelview * vec4(point, 1)).xyz;
+		vNormal = (modelview * vec4(normal, 0)).xyz;
+		gl_Position = persp * vec4(vPoint, 1);
+	}
+)";
+
+const char* meshFragmentShader = R"(
+	#version 130
+	in vec3 vPoint;
+	in vec3 vNormal;
+	out vec4 pColor;
+	uniform vec4 color;
+	uniform vec3 light;
+	void main() {
+		vec3 N = normalize(vNormal);
+		vec3 L = normalize(light-vPoint);
+		vec3 E = normalize(vPoint);
+		vec3 R = reflect(L, N);
+		float d = abs(dot(N, L));
+		float s = abs(dot(R, E));
+		float intensity = clamp(0.2+0.8*d+pow(s, 50.0), 0.0, 1.0);
+		pColor = vec4(intensity*color.rgb, color.a);
+	}
+)";
+
+// Point impostors, as dlaFractal's sprites: a shaded sphere per particle, depth written per pixel
+const char* spriteVertexShader = R"(
+	#version 130
+	in vec4 particle;
+	out vec3 vCenter;
+	out float vSpeed;
+	uniform mat4 persp;
+	uniform mat4 modelview;
+	uniform float size;
+	uniform float pixelScale; // persp[1][1] * viewport height
+	void main() {
+		vCenter = (modelview * vec4(particle.xyz, 1)).xyz;
+		vSpeed = particle.w;
+		gl_Position = persp * vec4(vCenter, 1);
+		gl_PointSize = max(1.0, size * pixelScale / -vCenter.z);
+	}
+)";
+
+const char* spriteFragmentShader = R"(
+	#version 130
+	in vec3 vCenter;
+	in float vSpeed;
+	out vec4 pColor;
+	uniform mat4 persp;
+	uniform vec3 light;
+	uniform float size;
+	void main() {
+		vec2 c = 2.0 * gl_PointCoord - 1.0;
+		float r2 = dot(c, c);
+		if (r2 > 1.0) discard;
+		vec3 N = vec3(c.x, -c.y, sqrt(1.0 - r2));
+		vec3 vPoint = vCenter + size * N;
+		vec4 clip = persp * vec4(vPoint, 1);
+		gl_FragDepth = 0.5 * clip.z / clip.w + 0.5;
+		vec3 L = normalize(light-vPoint);
+		vec3 E = normalize(vPoint);
+		vec3 R = reflect(L, N);
+		float d = abs(dot(N, L));
+		float s = abs(dot(R, E));
+		float intensity = clamp(0.2+0.8*d+pow(s, 50.0), 0.0, 1.0);
+		vec3 color = mix(vec3(0.1, 0.3, 0.9), vec3(0.9, 0.95, 1.0), clamp(vSpeed / 3.0, 0.0, 1.0));
+		pColor = vec4(intensity*color, 1);
+	}
+)";
+
 void InitVertexBuffer() {
 	glGenBuffers(1, &vBuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
@@ -118,6 +268,12 @@ void Keyboard(GLFWwindow* window, int key, int scancode, int action, int mods) {
 	if (key == GLFW_KEY_ESCAPE || key == GLFW_KEY_Q) {
 		glfwSetWindowShouldClose(window, GLFW_TRUE);
 	}
+	if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+		if (showParticles) particles.Reset();
+		else grid.Reset();
+	}
+	if (key == GLFW_KEY_S && action == GLFW_PRESS)
+		showParticles = !showParticles;
 }
 
 bool Shift(GLFWwindow* w) {
@@ -150,7 +306,8 @@ void Display() {
 	glUseProgram(program);
 	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
 	glClearColor(0.6, 0.6, 0.6, 1);
-	glClear(GL_COLOR_BUFFER_BIT);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
 	VertexAttribPointer(program, "point", 3, 0, (void*)0);
 	// Draw enclosing cube
 	SetUniform(program, "persp", camera.persp);
@@ -159,8 +316,14 @@ void Display() {
 	for (int f = 0; f < 6; f++) {
 		glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_INT, cube_faces[f]);
 	}
-	grid.Simulate();
-	grid.Render();
+	if (showParticles) {
+		particles.Simulate();
+		particles.Render();
+	}
+	else {
+		grid.Simulate();
+		grid.Render();
+	}
 	glFlush();
 }
 
@@ -179,6 +342,10 @@ int main() {
 	PrintGLErrors();
 	if (!(program = LinkProgramViaCode(&vertexShader, &fragmentShader)))
 		return 0;
+	if (!(meshProgram = LinkProgramViaCode(&meshVertexShader, &meshFragmentShader)))
+		return 0;
+	if (!(spriteProgram = LinkProgramViaCode(&spriteVertexShader, &spriteFragmentShader)))
+		return 0;
 	InitVertexBuffer();
 	glfwSetCursorPosCallback(window, MouseMove);
 	glfwSetMouseButtonCallback(window, MouseButton);
@@ -193,6 +360,8 @@ int main() {
 	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glDeleteBuffers(1, &vBuffer);
+	grid.Release();
+	particles.Release();
 	glfwDestroyWindow(window);
 	glfwTerminate();
 }
\ No newline at end of file
@@ -0,0 +1,183 @@
+// particle-bench.cpp : Times ParticleSim updates without a window or GL, Devon McKee
+// particle-bench [--particles n] [--steps n]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include "dParticleSim.h"
+#include "dRadixSort.h"
+
+using sys_clock = std::chrono::system_clock;
+using float_ms = std::chrono::duration<float, std::milli>;
+
+// The old dParticles layout, one struct per particle, for comparison
+struct AoSParticle {
+	vec3 pos, vel;
+	vec4 color;
+	float life = 0.0f;
+};
+
+float rand_range(float min, float max) { return min + (max - min) * (float)rand() / (float)RAND_MAX; }
+
+vec3 rand_velocity() { return vec3(rand_range(-0.03f, 0.03f), rand_range(0.05f, 0.1f), rand_range(-0.03f, 0.03f)); }
+
+int main(int argc, char** argv) {
+	int count = 1000000, steps = 200;
+	bool usage = false;
+	for (int i = 1; i < argc && !usage; i++) {
+		bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "--particles") && more) count = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--steps") && more) steps = atoi(argv[++i]);
+		else usage = true;
+	}
+	if (usage || count < 1 || steps < 1) {
+		printf("Usage: %s [--particles n] [--steps n]\n", argv[0]);
+		return 2;
+	}
+	srand(1);
+	ParticleSim sim;
+	sim.life_dt = 0.01f;
+	sim.resize(count);
+	for (int i = 0; i < count; i++)
+		sim.spawn(vec3(rand_range(-60, 60), 0, rand_range(-60, 60)), rand_velocity(), vec4(1, 0.1f, 0.1f, 1));
+	vector<ParticleInstance> instances(sim.capacity());
+	float update_ms = 0.0f, pack_ms = 0.0f, spawn_ms = 0.0f;
+	int spawned = 0;
+	for (int s = 0; s < steps; s++) {
+		auto start = sys_clock::now();
+		sim.update(1.0f);
+		auto updated = sys_clock::now();
+		sim.pack(instances.data(), 0.015f);
+		auto packed = sys_clock::now();
+		// Keep the system full, as a steady emitter would
+		for (int i = sim.live; i < count; i++, spawned++)
+			sim.spawn(vec3(rand_range(-60, 60), 0, rand_range(-60, 60)), rand_velocity(), vec4(1, 0.1f, 0.1f, 1));
+		update_ms += float_ms(updated - start).count();
+		pack_ms += float_ms(packed - updated).count();
+		spawn_ms += float_ms(sys_clock::now() - packed).count();
+	}
+	printf("%d particles, %d steps (%d respawned)\n", count, steps, spawned);
+	// Spawning into a full pool, each policy
+	const char* policies[] = { "drop", "steal oldest", "grow" };
+	for (int p = 0; p < 3; p++) {
+		ParticleSim full;
+		full.overflow = (ParticleOverflow)p;
+		full.resize(count);
+		auto start = sys_clock::now();
+		for (int i = 0; i < 2 * count; i++)
+			full.spawn(vec3(0.0f), rand_velocity(), vec4(1.0f));
+		float ms = float_ms(sys_clock::now() - start).count();
+		printf("Overflow (%s): %.1f ns/spawn, %d dropped, %d stolen, %d grown, capacity %d\n", policies[p],
+			ms * 1e6f / (2 * count), full.dropped, full.stolen, full.grown, full.capacity());
+	}
+	// Block jobs over several emitters, every thread count must give the serial result
+	const int emitters = 4;
+	auto run_emitters = [&](ThreadPool* pool, float& ms) {
+		vector<ParticleSim> sims(emitters);
+		vector<ParticleSim*> ptrs;
+		for (int e = 0; e < emitters; e++) {
+			sims[e].life_dt = 0.01f;
+			sims[e].emitter = e;
+			sims[e].resize(count / emitters);
+			ptrs.push_back(&sims[e]);
+		}
+		ms = 0.0f;
+		for (int s = 0; s < steps; s++) {
+			// Refill whatever died last step
+			for (ParticleSim& sim : sims)
+				for (int i = sim.live; i < sim.capacity(); i++)
+					sim.emit(vec3((float)(i % 120 - 60), 0, (float)(i / 120 % 120 - 60)), vec4(1, 0.1f, 0.1f, 1));
+			auto start = sys_clock::now();
+			if (pool) updateParticles(*pool, ptrs, 1.0f);
+			else for (ParticleSim& sim : sims) sim.update(1.0f);
+			ms += float_ms(sys_clock::now() - start).count();
+		}
+		double sum = 0.0;
+		for (ParticleSim& sim : sims)
+			for (int i = 0; i < sim.live; i++) sum += sim.px[i] + 3.0 * sim.py[i] + 7.0 * sim.vz[i] + sim.life[i];
+		return sum;
+	};
+	float serial_ms;
+	double serial_sum = run_emitters(nullptr, serial_ms);
+	printf("%d emitters, serial: %.3f ms/step (%u hardware threads)\n", emitters, serial_ms / steps, std::thread::hardware_concurrency());
+	for (int threads : { 1, 2, 4, 8, 16 }) {
+		ThreadPool pool(threads);
+		float ms;
+		double sum = run_emitters(&pool, ms);
+		printf("  %2d threads: %.3f ms/step (%.2fx), %s\n", threads, ms / steps, serial_ms / ms,
+			sum == serial_sum ? "matches serial" : "DIFFERS from serial");
+	}
+	// Back to front depth sort of the first system, keys + radix sort vs std::sort
+	{
+		vec3 eye(10.0f, 5.0f, -30.0f);
+		int n = sim.live;
+		RadixSort sorter;
+		sorter.keys.resize(n);
+		sorter.values.resize(n);
+		float key_ms = 0.0f, radix_ms = 0.0f, pooled_ms = 0.0f, std_ms = 0.0f;
+		ThreadPool pool;
+		const int runs = 10;
+		for (int r = 0; r < runs; r++) {
+			auto start = sys_clock::now();
+			sim.depthKeys(eye, sorter.keys.data(), sorter.values.data(), 0, n);
+			auto keyed = sys_clock::now();
+			sorter.sort(n);
+			auto sorted = sys_clock::now();
+			key_ms += float_ms(keyed - start).count();
+			radix_ms += float_ms(sorted - keyed).count();
+			sim.depthKeys(eye, sorter.keys.data(), sorter.values.data(), 0, n);
+			vector<std::pair<uint32_t, uint32_t>> pairs(n);
+			for (int i = 0; i < n; i++) pairs[i] = { sorter.keys[i], sorter.values[i] };
+			start = sys_clock::now();
+			sorter.sort(n, &pool);
+			pooled_ms += float_ms(sys_clock::now() - start).count();
+			start = sys_clock::now();
+			std::sort(pairs.begin(), pairs.end());
+			std_ms += float_ms(sys_clock::now() - start).count();
+		}
+		bool ordered = true;
+		for (int i = 1; i < n; i++) ordered = ordered && sorter.keys[i - 1] <= sorter.keys[i];
+		printf("Depth sort of %d: keys %.3f ms, radix %.3f ms (%d passes), radix on %d threads %.3f ms, std::sort %.3f ms, %s\n",
+			n, key_ms / runs, radix_ms / runs, sorter.passes, pool.size(), pooled_ms / runs, std_ms / runs, ordered ? "ordered" : "NOT ORDERED");
+	}
+	// Same integration, scalar over an array of structs
+	vector<AoSParticle> aos(count);
+	for (AoSParticle& p : aos) {
+		p.pos = vec3(rand_range(-60, 60), 0, rand_range(-60, 60));
+		p.vel = rand_velocity();
+		p.life = 1.0f;
+	}
+	vec3 gravity = sim.gravity;
+	float aos_ms = 0.0f;
+	for (int s = 0; s < steps; s++) {
+		auto start = sys_clock::now();
+		for (AoSParticle& p : aos) {
+			if (p.life <= 0.0f) continue;
+			p.life -= sim.life_dt;
+			p.pos += p.vel;
+			p.vel += gravity;
+			if (p.pos.y < 0.0f) p.pos.y = 0.0f;
+		}
+		aos_ms += float_ms(sys_clock::now() - start).count();
+		// Respawn the dead, as the SoA loop does, so every step updates all of them
+		for (AoSParticle& p : aos)
+			if (p.life <= 0.0f) {
+				p.pos = vec3(rand_range(-60, 60), 0, rand_range(-60, 60));
+				p.vel = rand_velocity();
+				p.color = vec4(1, 0.1f, 0.1f, 1);
+				p.life = 1.0f;
+			}
+	}
+	float checksum = 0.0f;
+	for (int i = 0; i < sim.live; i++) checksum += sim.px[i] + sim.life[i];
+	printf("SoA update: %.3f ms/step (%.0f M particles/s)\n", update_ms / steps, count / (update_ms / steps) / 1000.0f);
+	printf("Instance pack: %.3f ms/step, respawn: %.3f ms/step\n", pack_ms / steps, spawn_ms / steps);
+	printf("AoS scalar update: %.3f ms/step (SoA is %.2fx %s)\n", aos_ms / steps,
+		aos_ms >= update_ms ? aos_ms / update_ms : update_ms / aos_ms, aos_ms >= update_ms ? "faster" : "SLOWER");
+	printf("Checksum: %f\n", checksum);
+	return 0;
+}
@@ -6,11 +6,13 @@
 #include <GLFW/glfw3.h>
 #include "GLXtras.h"
 #include <time.h>
+#include <math.h>
 #include <vector>
 #include "VecMat.h"
 #include "Camera.h"
 #include "Mesh.h"
 #include "Misc.h"
+#include "dParticleSim.h"
 
 GLuint vBuffer = 0;
 GLuint program = 0;
@@ -33,38 +35,37 @@ Camera camera((float)win_width / win_height, vec3(0, 0, 0), vec3(0, 0, -5));
 
 vec3 lightSource = vec3(1, 1, 0);
 
-float rand_float(float min = 0, float max = 1) { return min + (float)rand() / (RAND_MAX / (max - min)); }
-vec3 rand_vec3(float min = -1, float max = 1) { return vec3(min + (float)rand() / (RAND_MAX / (max - min)), min + (float)rand() / (RAND_MAX / (max - min)), min + (float)rand() / (RAND_MAX / (max - min))); }
+int num_particles = 1000;
+ParticleSim particles;
+ThreadPool workers;
 
-struct Particle {
-	vec3 pos, vel;
-	vec4 col;
-	float life;
-	Particle() {
-		pos = vec3(0.0f), vel = vec3(0.0f), col = vec4(1.0f), life = 0.0f;
-	}
-	void Revive(vec3 new_pos = vec3(0.0f)) {
-		life = 1.0f;
-		pos = new_pos;
-		vel = vec3(
-			rand_float(H_RANGE.x, H_RANGE.y),
-			rand_float(V_RANGE.x, V_RANGE.y),
-			rand_float(H_RANGE.x, H_RANGE.y)
-		);
-	}
-	void Run() {
-		if (life > 0.0f) {
-			life -= LIFE_DT;
-			pos += vel;
-			vel += GRAVITY;
-			col = vec4(1.0f, 1 - life, 0.0f, 0.0f);
-		}
-	}
-};
+// The sim steps on the pool while the frame draws: a step copies live positions into the back buffer,
+// Display() draws the front one (the last finished step) and then joins the step in flight before
+// starting the next, so the draw never waits on the update (a frame of latency)
+vector<vec3> stepped[2];
+int front = 0;
+std::future<void> stepping;
 
-int num_particles = 1000;
-std::vector<Particle> particles = std::vector<Particle>();
-int lastUsedParticle = 0;
+void StepParticles() {
+	updateParticles(workers, particles, 1.0f);
+	// Live particles are packed at the front, no need to skip dead ones
+	vector<vec3>& out = stepped[1 - front];
+	out.resize(particles.live);
+	for (int i = 0; i < particles.live; i++) out[i] = vec3(particles.px[i], particles.py[i], particles.pz[i]);
+}
+
+void JoinStep() {
+	if (!stepping.valid()) return;
+	stepping.get();
+	front = 1 - front;
+}
+
+// Emits this frame's particles and starts the next step, after joining the last one
+void StartStep() {
+	JoinStep();
+	particles.emit(vec3(0.0f), vec4(1.0f));
+	stepping = workers.submit(StepParticles);
+}
 
 float cube_points[][3] = {
 	{-1, -1, 1}, {1, -1, 1}, {1, 1, 1}, {-1, 1, 1}, // front (0, 1, 2, 3)
@@ -179,26 +180,6 @@ void MouseWheel(GLFWwindow* w, double ignore, double spin) {
 	camera.MouseWheel(spin > 0, Shift(w));
 }
 
-int FindNextParticle() {
-	// Search for dead particle from last used particle
-	for (int i = lastUsedParticle; i < num_particles; i++) {
-		if (particles[i].life <= 0.0f) {
-			lastUsedParticle = i;
-			return i;
-		}
-	}
-	// Search linearly through rest of particles
-	for (int i = 0; i < lastUsedParticle; i++) {
-		if (particles[i].life <= 0.0f) {
-			lastUsedParticle = i;
-			return i;
-		}
-	}
-	// If no dead particles exist, simply take the first particle
-	lastUsedParticle = 0;
-	return 0;
-}
-
 void InitVertexBuffer() {
 	glGenBuffers(1, &vBuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
@@ -224,21 +205,18 @@ void Display() {
 	glActiveTexture(GL_TEXTURE0 + texUnit);
 	glBindTexture(GL_TEXTURE_2D, texName);
 	SetUniform(program, "texImage", (int)texUnit);
-	for (int i = 0; i < num_particles; i++) {
-		if (particles[i].life > 0.0f) {
-			particles[i].Run();
-			mat4 scale = Scale(PARTICLE_SIZE);
-			mat4 trans = Translate(particles[i].pos);
-			mat4 modelview = camera.modelview * trans * scale;
-			SetUniform(program, "modelview", modelview);
-			glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, cube_triangles);
-		}
+	for (const vec3& p : stepped[front]) {
+		mat4 scale = Scale(PARTICLE_SIZE);
+		mat4 trans = Translate(p);
+		mat4 modelview = camera.modelview * trans * scale;
+		SetUniform(program, "modelview", modelview);
+		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, cube_triangles);
 	}
 	glFlush();
+	StartStep();
 }
 
 int main() {
-	srand((int)time(NULL));
 	if (!glfwInit())
 		return 1;
 	GLFWwindow* window = glfwCreateWindow(win_width, win_height, "Particles 3D", NULL, NULL);
@@ -254,9 +232,14 @@ int main() {
 		return 1;
 	InitVertexBuffer();
 	texName = LoadTexture(texture, texUnit);
-	for (int i = 0; i < num_particles; i++) {
-		particles.push_back(Particle());
-	}
+	particles.gravity = GRAVITY;
+	particles.life_dt = LIFE_DT;
+	particles.floorY = -INFINITY;
+	particles.overflow = ParticleOverflow::StealOldest;
+	particles.velMin = vec3(H_RANGE.x, V_RANGE.x, H_RANGE.x);
+	particles.velMax = vec3(H_RANGE.y, V_RANGE.y, H_RANGE.y);
+	particles.seed = (uint64_t)time(NULL);
+	particles.resize(num_particles);
 	glfwSetCursorPosCallback(window, MouseMove);
 	glfwSetMouseButtonCallback(window, MouseButton);
 	glfwSetScrollCallback(window, MouseWheel);
@@ -264,11 +247,11 @@ int main() {
 	glfwSetWindowSizeCallback(window, Resize);
 	glfwSwapInterval(1);
 	while (!glfwWindowShouldClose(window)) {
-		particles[FindNextParticle()].Revive();
 		Display();
 		glfwPollEvents();
 		glfwSwapBuffers(window);
 	}
+	JoinStep();
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glDeleteBuffers(1, &vBuffer);
 	glDeleteBuffers(1, &texName);
@@ -6,8 +6,10 @@
 #include <GLFW/glfw3.h>
 #include "GLXtras.h"
 #include <time.h>
+#include <math.h>
 #include <vector>
 #include "VecMat.h"
+#include "dParticleSim.h"
 
 GLuint vBuffer = 0;
 GLuint program = 0;
@@ -21,33 +23,8 @@ const float PARTICLE_SIZE = 3.0f;
 const float H_VARIANCE = 0.01f;
 const int NUM_PARTICLES_SPAWNED = 10;
 
-float rand_float(float min = 0, float max = 1) { return min + (float)rand() / (RAND_MAX / (max - min)); }
-
-struct Particle {
-	vec2 pos, vel;
-	vec4 col;
-	float life;
-	Particle() {
-		pos = vec2(0.0f), vel = vec2(0.0f), col = vec4(1.0f), life = 0.0f;
-	}
-	void Revive(vec2 new_pos = vec2(0.0f, 0.0f)) {
-		life = 1.0f;
-		pos = new_pos;
-		vel = vec2(rand_float(-1 * H_VARIANCE, H_VARIANCE), rand_float(0.025f, 0.05f));
-	}
-	void Run() {
-		if (life > 0.0f) {
-			life -= LIFE_DT;
-			pos += vel;
-			vel += GRAVITY;
-			col = vec4(1.0f, 1 - life, 0.0f, 0.0f);
-		}
-	}
-};
-
 int num_particles = 1000;
-std::vector<Particle> particles = std::vector<Particle>();
-int lastUsedParticle = 0;
+ParticleSim particles;
 bool mouseDown = false;
 
 float vertices[][2] = { {-1.0f, -1.0f}, {-1.0f, 1.0f}, {1.0f, -1.0f}, {1.0f, 1.0f} };
@@ -78,26 +55,6 @@ void InitVertexBuffer() {
 	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
 }
 
-int FindNextParticle() {
-	// Search for dead particle from last used particle
-	for (int i = lastUsedParticle; i < num_particles; i++) {
-		if (particles[i].life <= 0.0f) {
-			lastUsedParticle = i;
-			return i;
-		}
-	}
-	// Search linearly through rest of particles
-	for (int i = 0; i < lastUsedParticle; i++) {
-		if (particles[i].life <= 0.0f) {
-			lastUsedParticle = i;
-			return i;
-		}
-	}
-	// If no dead particles exist, simply take the first particle
-	lastUsedParticle = 0;
-	return 0;
-}
-
 void Display() {
 	glClearColor(0, 0, 0, 1);
 	glClear(GL_COLOR_BUFFER_BIT);
@@ -105,16 +62,15 @@ void Display() {
 	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
 	VertexAttribPointer(program, "point", 2, 0, (void*)0);
-	for (int i = 0; i < num_particles; i++) {
-		if (particles[i].life > 0.0f) {
-			particles[i].Run();
-			mat4 scale = Scale(PARTICLE_SIZE / SCREEN_WIDTH, PARTICLE_SIZE / SCREEN_HEIGHT, 0.0f);
-			mat4 trans = Translate(vec3(particles[i].pos, 0.0f));
-			mat4 m = trans * scale;
-			SetUniform(program, "m", m);
-			SetUniform(program, "col", particles[i].col);
-			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, triangles);
-		}
+	// Live particles are packed at the front, no need to skip dead ones
+	particles.update(1.0f);
+	for (int i = 0; i < particles.live; i++) {
+		mat4 scale = Scale(PARTICLE_SIZE / SCREEN_WIDTH, PARTICLE_SIZE / SCREEN_HEIGHT, 0.0f);
+		mat4 trans = Translate(vec3(particles.px[i], particles.py[i], 0.0f));
+		mat4 m = trans * scale;
+		SetUniform(program, "m", m);
+		SetUniform(program, "col", vec4(1.0f, 1 - particles.life[i], 0.0f, 0.0f));
+		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, triangles);
 	}
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glFlush();
@@ -143,14 +99,11 @@ void SpawnParticle(GLFWwindow* w) {
 	vec2 m = vec2((float)x, (float)y);
 	m.x = (m.x - (SCREEN_WIDTH / 2)) / (SCREEN_WIDTH / 2);
 	m.y = ((m.y - (SCREEN_HEIGHT / 2)) * -1) / (SCREEN_HEIGHT / 2);
-	for (int i = 0; i < NUM_PARTICLES_SPAWNED; i++) {
-		int p = FindNextParticle();
-		particles[p].Revive(m);
-	}
+	for (int i = 0; i < NUM_PARTICLES_SPAWNED; i++)
+		particles.emit(vec3(m.x, m.y, 0.0f), vec4(1.0f));
 }
 
 int main() {
-	srand(time(NULL));
 	if (!glfwInit())
 		return 1;
 	GLFWwindow* window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Particles", NULL, NULL);
@@ -165,9 +118,14 @@ int main() {
 	if (!(program = LinkProgramViaCode(&vertexShader, &fragmentShader)))
 		return 0;
 	InitVertexBuffer();
-	for (int i = 0; i < num_particles; i++) {
-		particles.push_back(Particle());
-	}
+	particles.gravity = vec3(GRAVITY.x, GRAVITY.y, 0.0f);
+	particles.life_dt = LIFE_DT;
+	particles.floorY = -INFINITY;
+	particles.overflow = ParticleOverflow::StealOldest;
+	particles.velMin = vec3(-1 * H_VARIANCE, 0.025f, 0.0f);
+	particles.velMax = vec3(H_VARIANCE, 0.05f, 0.0f);
+	particles.seed = (uint64_t)time(NULL);
+	particles.resize(num_particles);
 	glfwSetMouseButtonCallback(window, MouseButton);
 	glfwSetKeyCallback(window, Keyboard);
 	glfwSwapInterval(1);
@@ -0,0 +1,41 @@
+// scene-convert.cpp : Converts scene graphs between text (.scg) and binary (.scgb), Devon McKee
+
+#include <glad.h>
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+#include <cstdio>
+#include <chrono>
+#include "dScene.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using sys_clock = std::chrono::system_clock;
+using float_ms = std::chrono::duration<float, std::milli>;
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <in.scg|in.scgb> <out.scg|out.scgb>\n", argv[0]);
+		return 1;
+	}
+	try {
+		// Only scene data is touched, no GL context needed
+		SceneGraph scene;
+		auto start = sys_clock::now();
+		scene.deserialize(argv[1]);
+		float load_ms = float_ms(sys_clock::now() - start).count();
+		scene.serialize(argv[2]);
+		// Time the output back in, that's what loading the converted scene will cost
+		SceneGraph check;
+		start = sys_clock::now();
+		check.deserialize(argv[2]);
+		float reload_ms = float_ms(sys_clock::now() - start).count();
+		if (check.size() != scene.size() || check.instances.size() != scene.instances.size())
+			throw std::runtime_error("Converted scene doesn't match input!");
+		printf("%d meshes, %d instances\n", (int)scene.size(), (int)scene.instances.size());
+		printf("Loaded '%s' in %.2f ms, '%s' in %.2f ms\n", argv[1], load_ms, argv[2], reload_ms);
+	} catch (std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
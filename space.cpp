@@ -15,6 +15,7 @@
 #include "GeomUtils.h"
 #include "dRenderPass.h"
 #include "dMesh.h"
+#include "dBroadphase.h"
 #include "dMisc.h"
 #include "dSkybox.h"
 #define STB_IMAGE_IMPLEMENTATION
@@ -117,6 +118,11 @@ Camera camera(win_width, win_height, 60, 0.5, 1200.0f);
 Mesh rock_mesh;
 vector<mat4> rock_transforms;
 
+// Rocks are static proxies (their bounding spheres), the ship is the one dynamic proxy
+const float SHIP_RADIUS = 1.0f;
+TreeBroadphase collisions;
+int shipProxy = -1;
+
 struct Ship {
 	Mesh mesh;
 	vec3 pos = vec3(0, 0, 0);
@@ -160,6 +166,21 @@ struct Ship {
 		vel += dt * acc;
 		pos += dt * vel;
 	}
+	// Bounces off rocks the broadphase pairs with the ship, at half the speed it hit them
+	void collide() {
+		collisions.move(shipProxy, Bounds::sphere(pos, SHIP_RADIUS));
+		collisions.update();
+		for (const BroadphasePair& pair : collisions.pairs) {
+			const Bounds& rock = collisions.proxy(pair.a == shipProxy ? pair.b : pair.a).bounds;
+			vec3 center = 0.5f * (rock.lo + rock.hi), away = pos - center;
+			float d = length(away), reach = 0.5f * (rock.hi.x - rock.lo.x) + SHIP_RADIUS;
+			if (d >= reach || d < 1e-4f) continue;
+			away = away / d;
+			pos = center + reach * away;
+			float into = dot(vel, away);
+			if (into < 0) vel -= 1.5f * into * away;
+		}
+	}
 } ship;
 
 void WindowResized(GLFWwindow* window, int _width, int _height) {
@@ -215,6 +236,13 @@ void setup() {
 		m = Translate(rand_float(-600, 600), rand_float(-600, 600), rand_float(-600, 600)) * m;
 		rock_transforms.push_back(m);
 	}
+	collisions.margin = 2.0f;
+	for (const mat4& m : rock_transforms) {
+		mat4 t = m * rock_mesh.model;
+		float scale = max({ length(vec3(t[0][0], t[1][0], t[2][0])), length(vec3(t[0][1], t[1][1], t[2][1])), length(vec3(t[0][2], t[1][2], t[2][2])) });
+		collisions.create(Bounds::sphere(vec3(t * vec4(0, 0, 0, 1)), scale), 0, true);
+	}
+	shipProxy = collisions.create(Bounds::sphere(ship.pos, SHIP_RADIUS));
 	rock_mesh.setupInstanceBuffer((GLsizei)rock_transforms.size());
 	rock_mesh.loadInstances(rock_transforms);
 	// Setup skyboxes
@@ -299,6 +327,7 @@ int main() {
 		dt = 1 / (1000.0f / since.count() / 60.0f);
 		lastSim = cur;
 		ship.update(dt);
+		ship.collide();
 		draw();
 		glfwPollEvents();
 		glfwSwapBuffers(window);
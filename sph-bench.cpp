@@ -0,0 +1,123 @@
+// sph-bench.cpp : Times SPHFluid substeps without a window or GL, and checks a dam break against experiment, Devon McKee
+// sph-bench [--spacing s] [--substeps n] [--threads n] [--no-check]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include "dSPH.h"
+
+using sys_clock = std::chrono::system_clock;
+using float_ms = std::chrono::duration<float, std::milli>;
+
+float percentile(const vector<float>& sorted, float p) {
+	return sorted[std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5f))];
+}
+
+// Surge front of a collapsing water column (width a, height 2a) measured by Martin & Moyce (1952), as
+// Z = front / a against T = t sqrt(2 g / a)
+const float surgeT[] = { 0.0f, 0.84f, 1.19f, 1.43f, 1.63f, 1.83f, 1.98f, 2.20f, 2.32f, 2.51f, 2.65f, 2.83f, 2.98f, 3.11f };
+const float surgeZ[] = { 1.0f, 1.22f, 1.44f, 1.67f, 1.89f, 2.11f, 2.33f, 2.56f, 2.78f, 3.00f, 3.22f, 3.44f, 3.67f, 3.89f };
+
+float measuredSurge(float t) {
+	int n = sizeof(surgeT) / sizeof(surgeT[0]), i = 1;
+	while (i < n - 1 && surgeT[i] < t) i++;
+	float s = (t - surgeT[i - 1]) / (surgeT[i] - surgeT[i - 1]);
+	return surgeZ[i - 1] + s * (surgeZ[i] - surgeZ[i - 1]);
+}
+
+// The column against the -x wall of a box 4a long and 3a high, thin in z (a slice, the z walls slip)
+void damBreak(SPHFluid& fluid, float a, float spacing, float depth) {
+	fluid.boxMin = vec3(0, 0, 0);
+	fluid.boxMax = vec3(4 * a, 3 * a, depth);
+	fluid.spacing = spacing;
+	fluid.reset();
+	fluid.addBlock(vec3(0, 0, 0), vec3(a, 2 * a, depth));
+	fluid.setSoundSpeed(2 * a);
+}
+
+int main(int argc, char** argv) {
+	float spacing = 0.02f;
+	int substeps = 40, threads = (int)std::thread::hardware_concurrency();
+	bool check = true;
+	for (int i = 1; i < argc; i++) {
+		bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "--spacing") && more) spacing = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--substeps") && more) substeps = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && more) threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--no-check")) check = false;
+		else {
+			printf("Usage: %s [--spacing s] [--substeps n] [--threads n] [--no-check]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (spacing < 0.005f || substeps < 1) return 2;
+	ThreadPool pool(threads);
+	// fluid.cpp's container, a quarter of it filled as a column against one wall (125k at 0.02)
+	SPHFluid fluid;
+	auto setup = sys_clock::now();
+	fluid.spacing = spacing;
+	fluid.reset();
+	fluid.addBlock(vec3(-1, -1, -1), vec3(-0.5f, 0, 1));
+	fluid.setSoundSpeed(1.0f);
+	printf("%i particles, spacing %g, h %g, dt %.3g ms, %i threads, setup %.0f ms\n", fluid.count(), spacing,
+		fluid.smoothing(), 1000.0f * fluid.timestep(), pool.size(), float_ms(sys_clock::now() - setup).count());
+	vector<float> stepMs;
+	for (int s = 0; s < substeps; s++) {
+		auto begin = sys_clock::now();
+		fluid.substep(&pool);
+		stepMs.push_back(float_ms(sys_clock::now() - begin).count());
+	}
+	vector<float> sorted = stepMs;
+	std::sort(sorted.begin(), sorted.end());
+	float total = 0.0f;
+	for (float ms : stepMs) total += ms;
+	printf("Substep: mean %.2f ms, p50 %.2f, p90 %.2f, max %.2f, %.2fM particle substeps / s, %.3f simulated s / s\n",
+		total / substeps, percentile(sorted, 0.5f), percentile(sorted, 0.9f), sorted.back(),
+		fluid.count() * (double)substeps / total / 1000.0, fluid.timestep() * substeps / (total / 1000.0f));
+	if (!check) return 0;
+	int result = 0;
+	// Thread count mustn't change anything
+	{
+		SPHFluid serial, threaded;
+		damBreak(serial, 0.1f, 0.01f, 0.04f);
+		damBreak(threaded, 0.1f, 0.01f, 0.04f);
+		for (int s = 0; s < 200; s++) {
+			serial.substep();
+			threaded.substep(&pool);
+		}
+		bool same = !memcmp(serial.px.data(), threaded.px.data(), serial.count() * sizeof(float)) &&
+			!memcmp(serial.vy.data(), threaded.vy.data(), serial.count() * sizeof(float));
+		printf("Check: 1 thread vs %i, 200 substeps: %s\n", pool.size(), same ? "match" : "DIFFER");
+		if (!same) result = 1;
+	}
+	// Dam break, against Martin & Moyce's surge front, density within a few % of rest, nothing escaping
+	float a = 0.2f, s = a / 16;
+	SPHFluid dam;
+	damBreak(dam, a, s, 6 * s);
+	printf("Dam break: a %g, %i particles, %i substeps to T = 3\n", a, dam.count(), (int)ceilf(3.0f / sqrtf(2.0f * 9.81f / a) / dam.timestep()));
+	float scaleT = sqrtf(2.0f * 9.81f / a), nextT = 1.0f, worst = 0.0f, densest = 0.0f;
+	auto begin = sys_clock::now();
+	while (nextT <= 3.0f) {
+		dam.substep(&pool);
+		for (int i = 0; i < dam.count(); i++) densest = std::max(densest, dam.density[i]);
+		float T = dam.time * scaleT;
+		if (T < nextT) continue;
+		float front = 0.0f;
+		for (int i = 0; i < dam.count(); i++) front = std::max(front, dam.px[i]);
+		float Z = front / a, expected = measuredSurge(T), error = fabsf(Z - expected) / expected;
+		worst = std::max(worst, error);
+		printf("  T %.2f: front %.2f a, measured %.2f a (%+.1f%%)\n", T, Z, expected, 100.0f * (Z - expected) / expected);
+		nextT += 0.5f;
+	}
+	int outside = 0;
+	for (int i = 0; i < dam.count(); i++)
+		outside += dam.px[i] < dam.boxMin.x || dam.px[i] > dam.boxMax.x || dam.py[i] < dam.boxMin.y || dam.py[i] > dam.boxMax.y ||
+			dam.pz[i] < dam.boxMin.z || dam.pz[i] > dam.boxMax.z;
+	bool ok = worst < 0.1f && densest < 1.05f * dam.restDensity && outside == 0;
+	printf("Dam break: %.0f ms, surge front within %.1f%%, peak density %.1f%% over rest, %i outside: %s\n",
+		float_ms(sys_clock::now() - begin).count(), 100.0f * worst, 100.0f * (densest / dam.restDensity - 1.0f), outside, ok ? "ok" : "FAILED");
+	return ok ? result : 1;
+}